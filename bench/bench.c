@@ -0,0 +1,586 @@
+/*
+    Copyright (C) 2024-2026 Sergey B Kirpichev
+
+    This file is part of the ZZ Library.
+
+    The ZZ Library is free software: you can redistribute it and/or modify it
+    under the terms of the GNU Lesser General Public License (LGPL) as
+    published by the Free Software Foundation; either version 3 of the License,
+    or (at your option) any later version.  See
+    <https://www.gnu.org/licenses/>.
+*/
+
+/* Throughput benchmarks for the ZZ Library.
+
+   For every operation and every operand size (in digits, from 1 up to
+   the per-operation limit below) the same operands are timed with zz_*
+   functions and with raw mpz_* functions.  Reported are nanoseconds per
+   call, the number of calls to the memory allocation functions per call
+   and the peak resident set size of the process so far.  The "ratio"
+   column is the zz time over the mpz time, i.e. the wrapper's overhead
+   (or gain, if it's below 1).
+
+   With the -s option, zz_* functions use the scratch context for
+   temporary allocations.
+
+   Usage: zzbench [-s] [-m MAXSIZE] [-t SECONDS] [OPERATION...] */
+
+#include "config.h"
+
+#include <gmp.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#  include <sys/resource.h>
+#endif
+#include <time.h>
+
+#include "zz.h"
+
+/* Operands of a single benchmark point, both as zz_t's and mpz_t's. */
+typedef struct {
+    size_t size;
+    zz_digit_t *buf;
+    char *str;
+    zz_t u, v, m, w, r, s, t;
+    mpz_t mu, mv, mm, mw, mr, ms, mt;
+    zz_mod_ctx ctx;
+} bench_args;
+
+typedef struct {
+    const char *name;
+    /* Largest operand size (in digits) for the default sweep. */
+    size_t maxsize;
+    /* Digits of the first and second operands, relative to the size. */
+    int usize, vsize;
+    bool negative;
+    zz_err (*zz_func)(bench_args *);
+    void (*mpz_func)(bench_args *);
+} bench_op;
+
+static zz_err
+zz_add_bench(bench_args *a)
+{
+    return zz_add(&a->u, &a->v, &a->w);
+}
+
+static void
+mpz_add_bench(bench_args *a)
+{
+    mpz_add(a->mw, a->mu, a->mv);
+}
+
+static zz_err
+zz_mul_bench(bench_args *a)
+{
+    return zz_mul(&a->u, &a->v, &a->w);
+}
+
+static void
+mpz_mul_bench(bench_args *a)
+{
+    mpz_mul(a->mw, a->mu, a->mv);
+}
+
+static zz_err
+zz_div_bench(bench_args *a)
+{
+    return zz_div(&a->u, &a->v, &a->w, &a->r);
+}
+
+static void
+mpz_div_bench(bench_args *a)
+{
+    mpz_fdiv_qr(a->mw, a->mr, a->mu, a->mv);
+}
+
+static zz_err
+zz_powm_bench(bench_args *a)
+{
+    return zz_powm(&a->u, &a->v, &a->m, &a->w);
+}
+
+static void
+mpz_powm_bench(bench_args *a)
+{
+    mpz_powm(a->mw, a->mu, a->mv, a->mm);
+}
+
+/* Side-channel silent functions, the modulus is set in a context. */
+static zz_err
+zz_powm_sec_bench(bench_args *a)
+{
+    return zz_powm_sec(&a->u, &a->v, &a->ctx, &a->w);
+}
+
+static void
+mpz_powm_sec_bench(bench_args *a)
+{
+    mpz_powm_sec(a->mw, a->mu, a->mv, a->mm);
+}
+
+/* GMP has no side-channel silent inversion for mpz_t's: the u is compared
+   with the variable-time mpz_invert(). */
+static zz_err
+zz_inverse_sec_bench(bench_args *a)
+{
+    return zz_inverse_sec(&a->u, &a->ctx, &a->w);
+}
+
+static void
+mpz_inverse_sec_bench(bench_args *a)
+{
+    (void)mpz_invert(a->mw, a->mu, a->mm);
+}
+
+static zz_err
+zz_gcdext_bench(bench_args *a)
+{
+    return zz_gcdext(&a->u, &a->v, &a->w, &a->s, &a->t);
+}
+
+static void
+mpz_gcdext_bench(bench_args *a)
+{
+    mpz_gcdext(a->mw, a->ms, a->mt, a->mu, a->mv);
+}
+
+static zz_err
+zz_get_str_bench(bench_args *a)
+{
+    return zz_get_str(&a->u, 10, a->str);
+}
+
+static void
+mpz_get_str_bench(bench_args *a)
+{
+    (void)mpz_get_str(a->str, 10, a->mu);
+}
+
+static zz_err
+zz_set_str_bench(bench_args *a)
+{
+    return zz_set_str(a->str, 10, &a->w);
+}
+
+static void
+mpz_set_str_bench(bench_args *a)
+{
+    (void)mpz_set_str(a->mw, a->str, 10);
+}
+
+static zz_err
+zz_import_bench(bench_args *a)
+{
+    return zz_import(a->size, a->buf, *zz_get_layout(), &a->w);
+}
+
+static void
+mpz_import_bench(bench_args *a)
+{
+    mpz_import(a->mw, a->size, -1, sizeof(zz_digit_t), 0, 0, a->buf);
+}
+
+static zz_err
+zz_export_bench(bench_args *a)
+{
+    return zz_export(&a->u, *zz_get_layout(), a->size, a->buf);
+}
+
+static void
+mpz_export_bench(bench_args *a)
+{
+    (void)mpz_export(a->buf, NULL, -1, sizeof(zz_digit_t), 0, 0, a->mu);
+}
+
+static zz_err
+zz_and_bench(bench_args *a)
+{
+    return zz_and(&a->u, &a->v, &a->w);
+}
+
+static void
+mpz_and_bench(bench_args *a)
+{
+    mpz_and(a->mw, a->mu, a->mv);
+}
+
+static zz_err
+zz_or_bench(bench_args *a)
+{
+    return zz_or(&a->u, &a->v, &a->w);
+}
+
+static void
+mpz_or_bench(bench_args *a)
+{
+    mpz_ior(a->mw, a->mu, a->mv);
+}
+
+static zz_err
+zz_xor_bench(bench_args *a)
+{
+    return zz_xor(&a->u, &a->v, &a->w);
+}
+
+static void
+mpz_xor_bench(bench_args *a)
+{
+    mpz_xor(a->mw, a->mu, a->mv);
+}
+
+/* Limits are chosen to keep the default run within minutes. */
+static const bench_op ops[] = {
+    {"add", 10000000, 1, 1, false, zz_add_bench, mpz_add_bench},
+    {"mul", 10000000, 1, 1, false, zz_mul_bench, mpz_mul_bench},
+    {"div", 10000000, 2, 1, false, zz_div_bench, mpz_div_bench},
+    {"powm", 300, 1, 1, false, zz_powm_bench, mpz_powm_bench},
+    {"powm_sec", 300, 1, 1, false, zz_powm_sec_bench, mpz_powm_sec_bench},
+    {"inverse_sec", 1000, 1, 1, false, zz_inverse_sec_bench,
+     mpz_inverse_sec_bench},
+    {"gcdext", 100000, 1, 1, false, zz_gcdext_bench, mpz_gcdext_bench},
+    {"get_str", 1000000, 1, 0, false, zz_get_str_bench, mpz_get_str_bench},
+    {"set_str", 1000000, 1, 0, false, zz_set_str_bench, mpz_set_str_bench},
+    {"import", 10000000, 1, 0, false, zz_import_bench, mpz_import_bench},
+    {"export", 10000000, 1, 0, false, zz_export_bench, mpz_export_bench},
+    {"and", 10000000, 1, 1, true, zz_and_bench, mpz_and_bench},
+    {"or", 10000000, 1, 1, true, zz_or_bench, mpz_or_bench},
+    {"xor", 10000000, 1, 1, true, zz_xor_bench, mpz_xor_bench},
+};
+
+/* Allocation functions, counting calls.  Same functions are used for
+   both libraries, so allocation counts and timings are comparable. */
+
+static size_t nallocs;
+
+static void *
+count_malloc(size_t size)
+{
+    nallocs++;
+    return malloc(size);
+}
+
+static void *
+count_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+    (void)old_size;
+    nallocs++;
+    return realloc(ptr, new_size);
+}
+
+static void
+count_free(void *ptr, size_t size)
+{
+    (void)size;
+    free(ptr);
+}
+
+/* The ZZ Library installs its own GMP memory functions in zz_setup().
+   They are switched to the counting functions while working with mpz_t's
+   and restored back for zz_t's. */
+
+static void *(*zz_gmp_malloc)(size_t);
+static void *(*zz_gmp_realloc)(void *, size_t, size_t);
+static void (*zz_gmp_free)(void *, size_t);
+
+static void
+mpz_mode(void)
+{
+    mp_set_memory_functions(count_malloc, count_realloc, count_free);
+}
+
+static void
+zz_mode(void)
+{
+    mp_set_memory_functions(zz_gmp_malloc, zz_gmp_realloc, zz_gmp_free);
+}
+
+static uint64_t state = 0x9e3779b97f4a7c15;
+
+static zz_digit_t
+next_digit(void)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (zz_digit_t)state;
+}
+
+/* Fill buf with a random number of exactly size digits. */
+static void
+fill_digits(size_t size, zz_digit_t *buf, bool odd)
+{
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = next_digit();
+    }
+    buf[size - 1] |= (zz_digit_t)1 << (sizeof(zz_digit_t)*8 - 1);
+    if (odd) {
+        buf[0] |= 1;
+    }
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    (void)timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec*1e9 + (double)ts.tv_nsec;
+}
+
+static long
+peak_rss(void)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+    struct rusage usage;
+
+    if (!getrusage(RUSAGE_SELF, &usage)) {
+        return usage.ru_maxrss;
+    }
+#endif
+    return -1;
+}
+
+static void
+fail(const char *op, size_t size)
+{
+    fprintf(stderr, "zzbench: %s failed for size %zu\n", op, size);
+    exit(1);
+}
+
+static zz_err
+bench_call(const bench_op *op, bench_args *a, bool use_zz)
+{
+    if (use_zz) {
+        return op->zz_func(a);
+    }
+    op->mpz_func(a);
+    return ZZ_OK;
+}
+
+/* Run func at least once and until mintime (in ns) elapsed, return
+   the time per call.  Allocations per call are stored to *allocs. */
+static double
+bench_loop(const bench_op *op, bench_args *a, bool use_zz, double mintime,
+           double *allocs)
+{
+    size_t reps = 1, total = 0, counted = 0;
+    double elapsed = 0;
+
+    /* warm up caches */
+    if (bench_call(op, a, use_zz)) {
+        fail(op->name, a->size);
+    }
+    while (elapsed < mintime) {
+        size_t before = nallocs;
+        double start = now();
+
+        for (size_t i = 0; i < reps; i++) {
+            if (bench_call(op, a, use_zz)) {
+                fail(op->name, a->size);
+            }
+        }
+        elapsed += now() - start;
+        counted += nallocs - before;
+        total += reps;
+        reps *= 2;
+    }
+    *allocs = (double)counted/(double)total;
+    return elapsed/(double)total;
+}
+
+static void
+bench_point(const bench_op *op, size_t size, double mintime)
+{
+    size_t usize = size*(size_t)op->usize;
+    size_t vsize = size*(size_t)op->vsize;
+    size_t bufsize = usize > vsize ? usize : vsize;
+    bench_args a = {.size = size};
+    double zz_ns, mpz_ns, zz_allocs, mpz_allocs;
+    zz_digit_t *ubuf = malloc(usize*sizeof(zz_digit_t));
+    zz_digit_t *vbuf = malloc((vsize ? vsize : 1)*sizeof(zz_digit_t));
+    zz_t *z[] = {&a.u, &a.v, &a.m, &a.w, &a.r, &a.s, &a.t};
+    const size_t n = sizeof(z)/sizeof(z[0]);
+    bool ctx = (op->zz_func == zz_powm_sec_bench
+                || op->zz_func == zz_inverse_sec_bench);
+    bool invertible = op->zz_func == zz_inverse_sec_bench;
+
+    a.buf = malloc(bufsize*sizeof(zz_digit_t));
+    if (!ubuf || !vbuf || !a.buf) {
+        fail(op->name, size);
+    }
+    fill_digits(usize, ubuf, false);
+    if (vsize) {
+        fill_digits(vsize, vbuf, true);
+    }
+    memcpy(a.buf, ubuf, usize*sizeof(zz_digit_t));
+
+    /* zz_t operands */
+    zz_mode();
+    for (size_t i = 0; i < n; i++) {
+        if (zz_init(z[i])) {
+            fail(op->name, size);
+        }
+    }
+    if (zz_import(usize, ubuf, *zz_get_layout(), &a.u)
+        || (vsize && zz_import(vsize, vbuf, *zz_get_layout(), &a.v))
+        || (op->negative && zz_neg(&a.u, &a.u))
+        || zz_pos(&a.v, &a.m))
+    {
+        fail(op->name, size);
+    }
+    /* The u is made invertible: reduced and incremented, until it's
+       coprime with the modulus.  Same is done below for mpz_t's. */
+    if (invertible && zz_div(&a.u, &a.m, NULL, &a.u)) {
+        fail(op->name, size);
+    }
+    while (invertible) {
+        if (zz_gcdext(&a.u, &a.m, &a.w, NULL, NULL)) {
+            fail(op->name, size);
+        }
+        if (zz_cmp(&a.w, 1) == ZZ_EQ) {
+            break;
+        }
+        if (zz_add(&a.u, 1, &a.u)) {
+            fail(op->name, size);
+        }
+    }
+    if (ctx && zz_mod_ctx_init(&a.m, &a.ctx)) {
+        fail(op->name, size);
+    }
+    if (op->zz_func == zz_get_str_bench || op->zz_func == zz_set_str_bench) {
+        size_t len;
+
+        if (zz_get_str_size(&a.u, 10, &len)
+            || !(a.str = malloc(len))
+            || zz_get_str(&a.u, 10, a.str))
+        {
+            fail(op->name, size);
+        }
+    }
+    nallocs = 0;
+    zz_ns = bench_loop(op, &a, true, mintime, &zz_allocs);
+    if (ctx) {
+        zz_mod_ctx_clear(&a.ctx);
+    }
+    for (size_t i = 0; i < n; i++) {
+        zz_clear(z[i]);
+    }
+
+    /* mpz_t operands */
+    mpz_mode();
+    mpz_inits(a.mu, a.mv, a.mm, a.mw, a.mr, a.ms, a.mt, NULL);
+    mpz_import(a.mu, usize, -1, sizeof(zz_digit_t), 0, 0, ubuf);
+    if (vsize) {
+        mpz_import(a.mv, vsize, -1, sizeof(zz_digit_t), 0, 0, vbuf);
+    }
+    if (op->negative) {
+        mpz_neg(a.mu, a.mu);
+    }
+    mpz_set(a.mm, a.mv);
+    if (invertible) {
+        mpz_mod(a.mu, a.mu, a.mm);
+        for (mpz_gcd(a.mw, a.mu, a.mm); mpz_cmp_ui(a.mw, 1);
+             mpz_gcd(a.mw, a.mu, a.mm))
+        {
+            mpz_add_ui(a.mu, a.mu, 1);
+        }
+    }
+    nallocs = 0;
+    mpz_ns = bench_loop(op, &a, false, mintime, &mpz_allocs);
+    mpz_clears(a.mu, a.mv, a.mm, a.mw, a.mr, a.ms, a.mt, NULL);
+    zz_mode();
+
+    printf("%-11s %9zu %14.1f %14.1f %7.3f %8.2f %8.2f %10ld\n", op->name,
+           size, zz_ns, mpz_ns, zz_ns/mpz_ns, zz_allocs, mpz_allocs,
+           peak_rss());
+    fflush(stdout);
+    free(a.str);
+    free(a.buf);
+    free(ubuf);
+    free(vbuf);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: zzbench [-s] [-m MAXSIZE] [-t SECONDS]"
+            " [OPERATION...]\n"
+            "operations:");
+    for (size_t i = 0; i < sizeof(ops)/sizeof(ops[0]); i++) {
+        fprintf(stderr, " %s", ops[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t maxsize = SIZE_MAX;
+    double mintime = 0.1;
+    bool selected[sizeof(ops)/sizeof(ops[0])] = {false}, all = true;
+    bool scratch = false;
+    zz_scratch s;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+            maxsize = strtoull(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            mintime = strtod(argv[++i], NULL);
+        }
+        else if (!strcmp(argv[i], "-s")) {
+            scratch = true;
+        }
+        else {
+            size_t j = 0;
+
+            while (j < sizeof(ops)/sizeof(ops[0])
+                   && strcmp(argv[i], ops[j].name))
+            {
+                j++;
+            }
+            if (j == sizeof(ops)/sizeof(ops[0])) {
+                usage();
+            }
+            selected[j] = true;
+            all = false;
+        }
+    }
+    if (zz_setup()) {
+        return 1;
+    }
+    mp_get_memory_functions(&zz_gmp_malloc, &zz_gmp_realloc, &zz_gmp_free);
+    zz_set_memory_funcs(count_malloc, count_realloc, count_free);
+    if (scratch) {
+        if (zz_scratch_init(0, &s)) {
+            return 1;
+        }
+        zz_set_scratch(&s);
+    }
+    printf("%-11s %9s %14s %14s %7s %8s %8s %10s\n", "op", "digits",
+           "zz ns/op", "mpz ns/op", "ratio", "zz allocs", "mpz allocs",
+           "peak KB");
+    for (size_t i = 0; i < sizeof(ops)/sizeof(ops[0]); i++) {
+        if (!all && !selected[i]) {
+            continue;
+        }
+        /* Sizes 1, 3, 10, 30, 100, ... */
+        for (size_t size = 1, k = 0; size <= ops[i].maxsize && size <= maxsize;
+             size = k++ % 2 ? size*10/3 : size*3)
+        {
+            bench_point(&ops[i], size, mintime*1e9);
+        }
+    }
+    if (scratch) {
+        zz_set_scratch(NULL);
+        zz_scratch_clear(&s);
+    }
+    zz_finish();
+    return 0;
+}
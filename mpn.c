@@ -10,7 +10,11 @@
     <https://www.gnu.org/licenses/>.
 */
 
+#include "config.h"
+
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
 
 #if defined(__MINGW32__) && defined(__GNUC__)
 #  pragma GCC diagnostic push
@@ -28,6 +32,8 @@
 #  pragma GCC diagnostic pop
 #endif
 
+#include "mpn.h"
+
 #define CNST_LIMB(C) ((mp_limb_t) C##LL)
 
 #if HAVE_LIMB_BIG_ENDIAN
@@ -144,6 +150,90 @@ static const mp_limb_t  endian_test = (CNST_LIMB(1) << (GMP_LIMB_BITS-7)) - 1;
 #  pragma GCC diagnostic ignored "-Wsign-conversion"
 #endif
 
+/* Load or store one word of 1, 2, 4 or 8 bytes, optionally swapping
+   its bytes.  Used for whole-word processing of digits with nails,
+   that's much faster than assembling them byte by byte. */
+static inline mp_limb_t
+load_word(const unsigned char *p, size_t size, int swap)
+{
+    uint8_t b;
+    uint16_t h;
+    uint32_t w;
+    mp_limb_t limb;
+
+    switch (size) {
+    case 1:
+        memcpy(&b, p, 1);
+        return b;
+    case 2:
+        memcpy(&h, p, 2);
+        return swap ? (uint16_t)(h << 8 | h >> 8) : h;
+    case 4:
+        memcpy(&w, p, 4);
+        if (swap) {
+            w = ((w << 24) | ((w & 0xFF00) << 8) | ((w >> 8) & 0xFF00)
+                 | (w >> 24));
+        }
+        return w;
+    default:
+        memcpy(&limb, p, 8);
+        if (swap) {
+            BSWAP_LIMB (limb, limb);
+        }
+        return limb;
+    }
+}
+
+static inline void
+store_word(unsigned char *p, size_t size, int swap, mp_limb_t limb)
+{
+    uint8_t b;
+    uint16_t h;
+    uint32_t w;
+
+    switch (size) {
+    case 1:
+        b = (uint8_t)limb;
+        memcpy(p, &b, 1);
+        break;
+    case 2:
+        h = (uint16_t)limb;
+        h = swap ? (uint16_t)(h << 8 | h >> 8) : h;
+        memcpy(p, &h, 2);
+        break;
+    case 4:
+        w = (uint32_t)limb;
+        if (swap) {
+            w = ((w << 24) | ((w & 0xFF00) << 8) | ((w >> 8) & 0xFF00)
+                 | (w >> 24));
+        }
+        memcpy(p, &w, 4);
+        break;
+    default:
+        if (swap) {
+            BSWAP_LIMB (limb, limb);
+        }
+        memcpy(p, &limb, 8);
+    }
+}
+
+/* Whole-word loops can be used for these digits. */
+#define WORD_DIGITS_P(size, numb)                                   \
+    (((size) == 1 || (size) == 2 || (size) == 4 || (size) == 8) \
+     && (numb) > 0 && (numb) < GMP_NUMB_BITS)
+
+/* Specialize the loop for a constant size, so the compiler could
+   inline load/store_word() and vectorize it. */
+#define WORD_DIGITS_LOOP(size, LOOP) \
+    do {                             \
+        switch (size) {              \
+        case 1: LOOP(1); break;      \
+        case 2: LOOP(2); break;      \
+        case 4: LOOP(4); break;      \
+        default: LOOP(8); break;     \
+        }                            \
+    } while (0)
+
 void *
 mpn_export(void *data, size_t *countp, int order,
            size_t size, int endian, size_t nail, mp_srcptr z, mp_size_t zsize)
@@ -191,6 +281,50 @@ mpn_export(void *data, size_t *countp, int order,
                 return data;
             }
         }
+        if (size == sizeof (mp_limb_t)) {
+            /* Unaligned data: same as above, but a word at a time. */
+            unsigned char *dp = (unsigned char *) data;
+
+            for (size_t i = 0; i < count; i++) {
+                mp_limb_t limb = zp[order == -1 ? i : count - 1 - i];
+
+                if (endian != HOST_ENDIAN) {
+                    BSWAP_LIMB (limb, limb);
+                }
+                memcpy (dp + i*sizeof (mp_limb_t), &limb, sizeof (mp_limb_t));
+            }
+            return data;
+        }
+    }
+    if (WORD_DIGITS_P(size, numb)) {
+        unsigned char *dp = (unsigned char *) data;
+        mp_srcptr zend = zp + zsize;
+        mp_limb_t limb = 0, mask = (CNST_LIMB(1) << numb) - 1;
+        int swap = endian != HOST_ENDIAN;
+        size_t lbits = 0;
+
+#define EXPORT_LOOP(SIZE)                                                \
+        for (size_t i = 0; i < count; i++) {                             \
+            mp_limb_t digit;                                             \
+                                                                         \
+            if (lbits >= (size_t)numb) {                                 \
+                digit = limb & mask;                                     \
+                limb >>= numb;                                           \
+                lbits -= (size_t)numb;                                   \
+            }                                                            \
+            else {                                                       \
+                mp_limb_t newlimb = (zp == zend ? 0 : *zp++);            \
+                                                                         \
+                digit = (limb | (newlimb << lbits)) & mask;              \
+                limb = newlimb >> ((size_t)numb - lbits);                \
+                lbits += GMP_NUMB_BITS - (size_t)numb;                   \
+            }                                                            \
+            store_word(dp + (order == -1 ? i : count - 1 - i)*(SIZE),    \
+                       (SIZE), swap, digit);                             \
+        }
+        WORD_DIGITS_LOOP(size, EXPORT_LOOP);
+#undef EXPORT_LOOP
+        return data;
     }
     {
         mp_limb_t limb, wbitsmask;
@@ -294,6 +428,46 @@ mpn_import (mp_ptr zp, mp_size_t *zsize, size_t count, int order,
             }
         }
     }
+    else if (nail == 0 && GMP_NAIL_BITS == 0 && size == sizeof (mp_limb_t)) {
+        /* Unaligned data: same as above, but a word at a time. */
+        const unsigned char *dp = (const unsigned char *) data;
+
+        for (size_t i = 0; i < count; i++) {
+            mp_limb_t limb;
+
+            memcpy (&limb, dp + i*sizeof (mp_limb_t), sizeof (mp_limb_t));
+            if (endian != HOST_ENDIAN) {
+                BSWAP_LIMB (limb, limb);
+            }
+            zp[order == -1 ? i : count - 1 - i] = limb;
+        }
+    }
+    else if (WORD_DIGITS_P(size, 8*size - nail)) {
+        const unsigned char *dp = (const unsigned char *) data;
+        size_t numb = 8*size - nail, lbits = 0;
+        mp_limb_t limb = 0, mask = (CNST_LIMB(1) << numb) - 1;
+        int swap = endian != HOST_ENDIAN;
+
+#define IMPORT_LOOP(SIZE)                                                 \
+        for (size_t i = 0; i < count; i++) {                              \
+            size_t k = order == -1 ? i : count - 1 - i;                   \
+            mp_limb_t digit = load_word(dp + k*(SIZE), (SIZE), swap) & mask; \
+                                                                          \
+            limb |= digit << lbits;                                       \
+            lbits += numb;                                                \
+            if (lbits >= GMP_NUMB_BITS) {                                 \
+                *zp++ = limb;                                             \
+                lbits -= GMP_NUMB_BITS;                                   \
+                limb = lbits ? digit >> (numb - lbits) : 0;               \
+            }                                                             \
+        }
+        WORD_DIGITS_LOOP(size, IMPORT_LOOP);
+#undef IMPORT_LOOP
+        if (lbits) {
+            *zp++ = limb;
+        }
+        ASSERT (zp == z + *zsize);
+    }
     else {
         mp_limb_t limb, byte, wbitsmask;
         size_t i, j, numb, wbytes;
@@ -370,8 +544,46 @@ extern void __gmpn_powlo(mp_limb_t *rp, const mp_limb_t *bp,
                          mp_limb_t *tp);
 extern void __gmpn_binvert(mp_limb_t *rp, const mp_limb_t *up, mp_size_t n,
                            mp_limb_t *scratch);
+extern void __gmpn_mul_basecase(mp_limb_t *rp, const mp_limb_t *up,
+                                mp_size_t un, const mp_limb_t *vp,
+                                mp_size_t vn);
 extern void __gmpn_mullo_n(mp_limb_t *rp, const mp_limb_t *xp,
                            const mp_limb_t *yp, mp_size_t n);
+extern mp_limb_t __gmpn_redc_1(mp_limb_t *rp, mp_limb_t *up,
+                               const mp_limb_t *mp, mp_size_t n,
+                               mp_limb_t invm);
+extern mp_limb_t __gmpn_redc_n(mp_limb_t *rp, mp_limb_t *up,
+                               const mp_limb_t *mp, mp_size_t n,
+                               const mp_limb_t *ip);
+
+extern mp_limb_t __gmpn_mod_34lsub1(const mp_limb_t *up, mp_size_t n);
+extern mp_size_t __gmpn_rootrem(mp_limb_t *rp, mp_limb_t *remp,
+                                const mp_limb_t *up, mp_size_t un,
+                                mp_limb_t k);
+
+#if HAVE_MPN_DIV_PI1
+extern mp_limb_t __gmpn_preinv_divrem_1(mp_limb_t *qp, mp_size_t xn,
+                                        const mp_limb_t *ap, mp_size_t n,
+                                        mp_limb_t d, mp_limb_t dinv,
+                                        int shift);
+extern void __gmpn_mod_1_1p_cps(mp_limb_t cps[4], mp_limb_t b);
+extern mp_limb_t __gmpn_mod_1_1p(const mp_limb_t *ap, mp_size_t n,
+                                 mp_limb_t b, const mp_limb_t cps[4]);
+extern void __gmpn_mod_1s_4p_cps(mp_limb_t cps[7], mp_limb_t b);
+extern mp_limb_t __gmpn_mod_1s_4p(const mp_limb_t *ap, mp_size_t n,
+                                  mp_limb_t b, const mp_limb_t cps[7]);
+extern mp_limb_t __gmpn_div_qr_2n_pi1(mp_limb_t *qp, mp_limb_t *rp,
+                                      const mp_limb_t *np, mp_size_t nn,
+                                      mp_limb_t d1, mp_limb_t d0,
+                                      mp_limb_t dinv);
+extern mp_limb_t __gmpn_div_qr_2u_pi1(mp_limb_t *qp, mp_limb_t *rp,
+                                      const mp_limb_t *np, mp_size_t nn,
+                                      mp_limb_t d1, mp_limb_t d0, int shift,
+                                      mp_limb_t dinv);
+extern mp_limb_t __gmpn_sbpi1_div_qr(mp_limb_t *qp, mp_limb_t *np,
+                                     mp_size_t nn, const mp_limb_t *dp,
+                                     mp_size_t dn, mp_limb_t dinv);
+#endif /* HAVE_MPN_DIV_PI1 */
 
 void mpn_powm(mp_limb_t *rp, const mp_limb_t *bp, mp_size_t bn,
               const mp_limb_t *ep, mp_size_t en, const mp_limb_t *mp,
@@ -398,12 +610,130 @@ void mpn_binvert(mp_limb_t *rp, const mp_limb_t *up, mp_size_t n,
     __gmpn_binvert(rp, up, n, scratch);
 }
 
+void mpn_mul_basecase(mp_limb_t *rp, const mp_limb_t *up, mp_size_t un,
+                      const mp_limb_t *vp, mp_size_t vn)
+{
+    __gmpn_mul_basecase(rp, up, un, vp, vn);
+}
+
 void mpn_mullo_n(mp_limb_t *rp, const mp_limb_t *xp,
                  const mp_limb_t *yp, mp_size_t n)
 {
     __gmpn_mullo_n(rp, xp, yp, n);
 }
 
+mp_limb_t mpn_mod_34lsub1(const mp_limb_t *up, mp_size_t n)
+{
+    return __gmpn_mod_34lsub1(up, n);
+}
+
+mp_size_t mpn_rootrem(mp_limb_t *rp, mp_limb_t *remp, const mp_limb_t *up,
+                      mp_size_t un, mp_limb_t k)
+{
+    return __gmpn_rootrem(rp, remp, up, un, k);
+}
+
+mp_limb_t mpn_redc_1(mp_limb_t *rp, mp_limb_t *up, const mp_limb_t *mp,
+                     mp_size_t n, mp_limb_t invm)
+{
+    return __gmpn_redc_1(rp, up, mp, n, invm);
+}
+
+mp_limb_t mpn_redc_n(mp_limb_t *rp, mp_limb_t *up, const mp_limb_t *mp,
+                     mp_size_t n, const mp_limb_t *ip)
+{
+    return __gmpn_redc_n(rp, up, mp, n, ip);
+}
+
+/* Port of the invert_limb() macro of the GMP: the quotient of {~0, ~d} by d.
+   The mpn_invert_limb() is exported only by some assembly builds. */
+mp_limb_t mpn_invert_limb(mp_limb_t d)
+{
+    mp_limb_t np[2] = {~(mp_limb_t)0, ~d}, qp[2];
+
+    assert(d >> (GMP_NUMB_BITS - 1));
+    (void)mpn_divrem_1(qp, 0, np, 2, d);
+    assert(!qp[1]);
+    return qp[0];
+}
+
+/* Port of the invert_pi1() macro of the GMP. */
+mp_limb_t mpn_invert_pi1(mp_limb_t d1, mp_limb_t d0)
+{
+    mp_limb_t v = mpn_invert_limb(d1), p = d1*v, t0, t1;
+
+    p += d0;
+    if (p < d0) {
+        v--;
+        if (p >= d1) {
+            v--;
+            p -= d1;
+        }
+        p -= d1;
+    }
+    t1 = mpn_mul_1(&t0, &d0, 1, v);
+    p += t1;
+    if (p < t1) {
+        v--;
+        if (p >= d1 && (p > d1 || t0 >= d0)) {
+            v--;
+        }
+    }
+    return v;
+}
+
+#if HAVE_MPN_DIV_PI1
+mp_limb_t mpn_preinv_divrem_1(mp_limb_t *qp, const mp_limb_t *ap,
+                              mp_size_t n, mp_limb_t d, mp_limb_t dinv,
+                              int shift)
+{
+    return __gmpn_preinv_divrem_1(qp, 0, ap, n, d, dinv, shift);
+}
+
+void mpn_mod_1_1p_cps(mp_limb_t cps[4], mp_limb_t b)
+{
+    __gmpn_mod_1_1p_cps(cps, b);
+}
+
+mp_limb_t mpn_mod_1_1p(const mp_limb_t *ap, mp_size_t n, mp_limb_t b,
+                       const mp_limb_t cps[4])
+{
+    return __gmpn_mod_1_1p(ap, n, b, cps);
+}
+
+void mpn_mod_1s_4p_cps(mp_limb_t cps[7], mp_limb_t b)
+{
+    __gmpn_mod_1s_4p_cps(cps, b);
+}
+
+mp_limb_t mpn_mod_1s_4p(const mp_limb_t *ap, mp_size_t n, mp_limb_t b,
+                        const mp_limb_t cps[7])
+{
+    return __gmpn_mod_1s_4p(ap, n, b, cps);
+}
+
+mp_limb_t mpn_div_qr_2n_pi1(mp_limb_t *qp, mp_limb_t *rp,
+                            const mp_limb_t *np, mp_size_t nn, mp_limb_t d1,
+                            mp_limb_t d0, mp_limb_t dinv)
+{
+    return __gmpn_div_qr_2n_pi1(qp, rp, np, nn, d1, d0, dinv);
+}
+
+mp_limb_t mpn_div_qr_2u_pi1(mp_limb_t *qp, mp_limb_t *rp,
+                            const mp_limb_t *np, mp_size_t nn, mp_limb_t d1,
+                            mp_limb_t d0, int shift, mp_limb_t dinv)
+{
+    return __gmpn_div_qr_2u_pi1(qp, rp, np, nn, d1, d0, shift, dinv);
+}
+
+mp_limb_t mpn_sbpi1_div_qr(mp_limb_t *qp, mp_limb_t *np, mp_size_t nn,
+                           const mp_limb_t *dp, mp_size_t dn,
+                           mp_limb_t dinv)
+{
+    return __gmpn_sbpi1_div_qr(qp, np, nn, dp, dn, dinv);
+}
+#endif /* HAVE_MPN_DIV_PI1 */
+
 #ifdef __GNUC__
 #  pragma GCC diagnostic pop
 #endif
@@ -40,8 +40,88 @@ void mpn_powlo(mp_limb_t *rp, const mp_limb_t *bp,
 void mpn_binvert(mp_limb_t *rp, const mp_limb_t *up, mp_size_t n,
                  mp_limb_t *scratch);
 
+/* Set {rp, un + vn} to the product of {up, un} and {vp, vn} by the
+   schoolbook method, un >= vn >= 1.  Output must not overlap with inputs.
+   Does no memory allocation. */
+void mpn_mul_basecase(mp_limb_t *rp, const mp_limb_t *up, mp_size_t un,
+                      const mp_limb_t *vp, mp_size_t vn);
+
 /* Multiply two n-limb numbers and return the low n limbs of their products. */
 void mpn_mullo_n(mp_limb_t *rp, const mp_limb_t *xp,
                  const mp_limb_t *yp, mp_size_t n);
 
+/* Montgomery reduction: set {rp, n} to {up, 2n} / B^n mod m and return the
+   carry (if it's nonzero, m should be subtracted from rp).  Requires odd m,
+   {up, 2n} is clobbered.  The mpn_redc_1() takes invm = -1/m mod B, while
+   mpn_redc_n() takes {ip, n} = 1/m mod B^n. */
+mp_limb_t mpn_redc_1(mp_limb_t *rp, mp_limb_t *up, const mp_limb_t *mp,
+                     mp_size_t n, mp_limb_t invm);
+mp_limb_t mpn_redc_n(mp_limb_t *rp, mp_limb_t *up, const mp_limb_t *mp,
+                     mp_size_t n, const mp_limb_t *ip);
+
+/* Return a value, congruent to {up, n} modulo 2^48 - 1 (for 64-bit limbs),
+   but not necessarily less than the modulus, n >= 1. */
+mp_limb_t mpn_mod_34lsub1(const mp_limb_t *up, mp_size_t n);
+
+/* Set {rp, ceil(un/k)} to the truncated k-th root of {up, un} and {remp, un}
+   to the remainder, k >= 2, up[un - 1] != 0.  Return the size of the
+   remainder.  If remp is NULL, return nonzero iff the root is not exact. */
+mp_size_t mpn_rootrem(mp_limb_t *rp, mp_limb_t *remp, const mp_limb_t *up,
+                      mp_size_t un, mp_limb_t k);
+
+/* Return floor((B^2 - 1)/d) - B for normalized d (the most significant bit
+   is set), the reciprocal in the Moller-Granlund division. */
+mp_limb_t mpn_invert_limb(mp_limb_t d);
+/* Return floor((B^3 - 1)/(d1*B + d0)) - B for normalized d1, the reciprocal
+   for division by two limbs. */
+mp_limb_t mpn_invert_pi1(mp_limb_t d1, mp_limb_t d0);
+
+/* Internal division functions of the GMP are used only if all are
+   exported by the library, see configure.ac. */
+#if (HAVE___GMPN_PREINV_DIVREM_1 && HAVE___GMPN_MOD_1_1P_CPS \
+     && HAVE___GMPN_MOD_1_1P && HAVE___GMPN_MOD_1S_4P_CPS \
+     && HAVE___GMPN_MOD_1S_4P && HAVE___GMPN_DIV_QR_2N_PI1 \
+     && HAVE___GMPN_DIV_QR_2U_PI1 && HAVE___GMPN_SBPI1_DIV_QR)
+#  define HAVE_MPN_DIV_PI1 1
+#else
+#  define HAVE_MPN_DIV_PI1 0
+#endif
+
+#if HAVE_MPN_DIV_PI1
+/* Division by one limb d with precomputed dinv = mpn_invert_limb(d << shift).
+   Set {qp, n} to the quotient of {ap, n} and return the remainder. */
+mp_limb_t mpn_preinv_divrem_1(mp_limb_t *qp, const mp_limb_t *ap,
+                              mp_size_t n, mp_limb_t d, mp_limb_t dinv,
+                              int shift);
+/* Return {ap, n} mod b, n >= 2, given cps for b, computed by the respective
+   mpn_mod_1*_cps() function.  These take b as is, while mpn_mod_1_1p() and
+   mpn_mod_1s_4p() take b << cps[1].  The mpn_mod_1s_4p() requires
+   b < B/4. */
+void mpn_mod_1_1p_cps(mp_limb_t cps[4], mp_limb_t b);
+mp_limb_t mpn_mod_1_1p(const mp_limb_t *ap, mp_size_t n, mp_limb_t b,
+                       const mp_limb_t cps[4]);
+void mpn_mod_1s_4p_cps(mp_limb_t cps[7], mp_limb_t b);
+mp_limb_t mpn_mod_1s_4p(const mp_limb_t *ap, mp_size_t n, mp_limb_t b,
+                        const mp_limb_t cps[7]);
+
+/* Division of {np, nn} by normalized {d0, d1} with dinv from
+   mpn_invert_pi1() (for mpn_div_qr_2u_pi1() np is shifted internally by
+   shift bits).  Set {qp, nn - 2} to the quotient, {rp, 2} to the remainder
+   and return the most significant limb of the quotient. */
+mp_limb_t mpn_div_qr_2n_pi1(mp_limb_t *qp, mp_limb_t *rp,
+                            const mp_limb_t *np, mp_size_t nn, mp_limb_t d1,
+                            mp_limb_t d0, mp_limb_t dinv);
+mp_limb_t mpn_div_qr_2u_pi1(mp_limb_t *qp, mp_limb_t *rp,
+                            const mp_limb_t *np, mp_size_t nn, mp_limb_t d1,
+                            mp_limb_t d0, int shift, mp_limb_t dinv);
+
+/* Schoolbook division of {np, nn} by normalized {dp, dn}, dn > 2, with
+   dinv from mpn_invert_pi1() for two most significant limbs of the divisor.
+   Set {qp, nn - dn} to the quotient, {np, dn} to the remainder and return
+   the most significant limb of the quotient. */
+mp_limb_t mpn_sbpi1_div_qr(mp_limb_t *qp, mp_limb_t *np, mp_size_t nn,
+                           const mp_limb_t *dp, mp_size_t dn,
+                           mp_limb_t dinv);
+#endif /* HAVE_MPN_DIV_PI1 */
+
 #endif /* MPN_H */
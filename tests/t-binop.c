@@ -208,6 +208,32 @@ zz_gcd(const zz_t *u, const zz_t *v, zz_t *w)
 ZZ_BINOP_REF(gcd)
 ZZ_BINOP_REF(lcm)
 
+zz_err
+zz_ref_addmul(const zz_t *u, const zz_t *v, const zz_t *w, bool sub,
+              zz_t *r)
+{
+    mpz_t z;
+    TMP_MPZ(mu, u);
+    TMP_MPZ(mv, v);
+    TMP_MPZ(mw, w);
+    if (TMP_OVERFLOW) {
+        return ZZ_MEM;
+    }
+    mpz_init_set(z, mw);
+    if (sub) {
+        mpz_submul(z, mu, mv);
+    }
+    else {
+        mpz_addmul(z, mu, mv);
+    }
+    if (zz_set_mpz_t(z, r)) {
+        mpz_clear(z);
+        return ZZ_MEM;
+    }
+    mpz_clear(z);
+    return ZZ_OK;
+}
+
 zz_err
 zz_ref_mul_2exp(const zz_t *u, zz_bitcnt_t v, zz_t *w)
 {
@@ -404,6 +430,428 @@ check_binop_examples(void)
     zz_clear(&v);
 }
 
+void
+check_addmul_bulk(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_t u, v, w, r, t;
+
+        if (zz_init(&u) || zz_init(&v) || zz_init(&w) || zz_init(&r)
+            || zz_init(&t) || zz_random((zz_bitcnt_t)rand() % 300, true, &u)
+            || zz_random((zz_bitcnt_t)rand() % 300, true, &w)
+            || zz_random(i % 2 ? 64 : 300, true, &v))
+        {
+            abort();
+        }
+        for (int sub = 0; sub < 2; sub++) {
+            zz_err (*op)(const zz_t *, const zz_t *,
+                         zz_t *) = sub ? zz_submul : zz_addmul;
+
+            /* w +/- u*v, with all possible aliasings. */
+            if (zz_ref_addmul(&u, &v, &w, sub, &r) || zz_pos(&w, &t)
+                || op(&u, &v, &t) || zz_cmp(&t, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+            if (zz_ref_addmul(&w, &v, &w, sub, &r) || zz_pos(&w, &t)
+                || op(&t, &v, &t) || zz_cmp(&t, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+            if (zz_ref_addmul(&u, &w, &w, sub, &r) || zz_pos(&w, &t)
+                || op(&u, &t, &t) || zz_cmp(&t, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+            if (zz_ref_addmul(&w, &w, &w, sub, &r) || zz_pos(&w, &t)
+                || op(&t, &t, &t) || zz_cmp(&t, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+
+            int64_t sv;
+            uint64_t uv;
+
+            if (zz_get(&v, &sv) == ZZ_OK
+                && (zz_ref_addmul(&u, &v, &w, sub, &r) || zz_pos(&w, &t)
+                    || (sub ? zz_submul(&u, sv, &t) : zz_addmul(&u, sv, &t))
+                    || zz_cmp(&t, &r) != ZZ_EQ))
+            {
+                abort();
+            }
+            if (zz_abs(&v, &v)) {
+                abort();
+            }
+            if (zz_get(&v, &uv) == ZZ_OK
+                && (zz_ref_addmul(&u, &v, &w, sub, &r) || zz_pos(&w, &t)
+                    || (sub ? zz_submul(&u, uv, &t) : zz_addmul(&u, uv, &t))
+                    || zz_cmp(&t, &r) != ZZ_EQ
+                    || zz_ref_addmul(&w, &v, &w, sub, &r) || zz_pos(&w, &t)
+                    || (sub ? zz_submul(&t, uv, &t) : zz_addmul(&t, uv, &t))
+                    || zz_cmp(&t, &r) != ZZ_EQ))
+            {
+                abort();
+            }
+        }
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&w);
+        zz_clear(&r);
+        zz_clear(&t);
+    }
+}
+
+/* Operands with many zero low digits, so borrows and carry propagate far,
+   and in-place operations, that must not reallocate if the result fits. */
+void
+check_bitwise_borrow(void)
+{
+    zz_err (*ops[])(const zz_t *, const zz_t *, zz_t *) = {zz_and, zz_or,
+                                                            zz_xor};
+    zz_err (*refs[])(const zz_t *, const zz_t *, zz_t *) = {zz_ref_and,
+                                                             zz_ref_ior,
+                                                             zz_ref_xor};
+
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_t u, v, w, r;
+
+        if (zz_init(&u) || zz_init(&v) || zz_init(&w) || zz_init(&r)) {
+            abort();
+        }
+        if (zz_random(256, true, &u) || zz_random(256, true, &v)
+            || zz_mul_2exp(&u, (zz_bitcnt_t)(rand() % 512), &u)
+            || zz_mul_2exp(&v, (zz_bitcnt_t)(rand() % 512), &v))
+        {
+            abort();
+        }
+        if (rand() % 2 && zz_sub(&u, 1, &u)) {
+            abort();
+        }
+        for (size_t k = 0; k < 3; k++) {
+            if (ops[k](&u, &v, &w) || refs[k](&u, &v, &r)
+                || zz_cmp(&w, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+            if (zz_pos(&u, &w)) {
+                abort();
+            }
+
+            zz_digit_t *digits = w.digits;
+            zz_size_t alloc = w.alloc;
+
+            if (ops[k](&w, &v, &w) || zz_cmp(&w, &r) != ZZ_EQ) {
+                abort();
+            }
+            if (alloc > MAX(u.size, v.size) && w.digits != digits) {
+                abort();
+            }
+        }
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&w);
+        zz_clear(&r);
+    }
+}
+
+/* Inline fast paths of zz.h must agree with out-of-line functions (called
+   with parenthesized names) around the overflow boundaries. */
+void
+check_inline_fast(void)
+{
+    const int64_t vals[] = {0, 1, -1, 2, -3, INT32_MAX, INT32_MIN,
+                            INT64_MAX/2, INT64_MAX - 1, INT64_MAX,
+                            INT64_MIN + 1, INT64_MIN};
+    const size_t n = sizeof(vals)/sizeof(vals[0]);
+    zz_t u, w, r;
+
+    if (zz_init(&u) || zz_init(&w) || zz_init(&r)) {
+        abort();
+    }
+    for (size_t i = 0; i < n + 4; i++) {
+        if (i < n ? zz_set(vals[i], &u)
+            : zz_set(i % 2 ? UINT64_MAX : (uint64_t)INT64_MAX + 1, &u))
+        {
+            abort();
+        }
+        if (i >= n + 2 && zz_mul(&u, -3, &u)) {
+            abort();
+        }
+        if (zz_iszero(&u) != (zz_iszero)(&u)
+            || zz_isneg(&u) != (zz_isneg)(&u)
+            || zz_isodd(&u) != (zz_isodd)(&u))
+        {
+            abort();
+        }
+        for (size_t j = 0; j < n; j++) {
+            int64_t v = vals[j];
+
+            if (zz_cmp(&u, v) != (zz_cmp_i64)(&u, v)
+                || zz_add(&u, v, &w) || (zz_add_i64)(&u, v, &r)
+                || zz_cmp(&w, &r) != ZZ_EQ
+                || zz_sub(&u, v, &w) || (zz_sub_i64)(&u, v, &r)
+                || zz_cmp(&w, &r) != ZZ_EQ
+                || zz_mul(&u, v, &w) || (zz_mul_i64)(&u, v, &r)
+                || zz_cmp(&w, &r) != ZZ_EQ
+                || zz_mul(&u, (uint64_t)v, &w)
+                || (zz_mul_u64)(&u, (uint64_t)v, &r)
+                || zz_cmp(&w, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+    }
+
+    /* views as outputs take the out-of-line path */
+    zz_digit_t buf[1] = {5};
+
+    if (zz_view(1, buf, &w) || zz_add(&w, 1, &w) || zz_cmp(&w, 6) != ZZ_EQ
+        || buf[0] != 5 || zz_view(1, buf, &w) || zz_mul(&w, 7u, &w)
+        || zz_cmp(&w, 35) != ZZ_EQ || buf[0] != 5)
+    {
+        abort();
+    }
+    zz_clear(&u);
+    zz_clear(&w);
+    zz_clear(&r);
+}
+
+void
+check_batch(void)
+{
+    size_t n = 1000;
+    zz_t *u = malloc(n*sizeof(zz_t)), *v = malloc(n*sizeof(zz_t));
+    zz_t *w = malloc(n*sizeof(zz_t)), *r = malloc(n*sizeof(zz_t));
+    zz_ord *o = malloc(n*sizeof(zz_ord));
+
+    if (!u || !v || !w || !r || !o) {
+        abort();
+    }
+    for (size_t i = 0; i < n; i++) {
+        zz_bitcnt_t bs = i % 10 ? 64 : 300;
+
+        if (zz_init(u + i) || zz_init(v + i) || zz_init(w + i)
+            || zz_init(r + i) || zz_random(bs, true, u + i)
+            || zz_random(i % 7 ? 64 : bs, true, v + i))
+        {
+            abort();
+        }
+        if (i % 5 == 0 && zz_set(i % 3 ? UINT64_MAX : 0, v + i)) {
+            abort();
+        }
+        if (i % 11 == 0 && zz_pos(u + i, v + i)) {
+            abort();
+        }
+        if (i % 13 == 0 && zz_neg(u + i, v + i)) {
+            abort();
+        }
+        if (i % 17 == 0
+            && (zz_set(1, w + i) || zz_mul_2exp(w + i, 1000, w + i)))
+        {
+            abort();
+        }
+    }
+    if (zz_add_batch(n, u, v, w)) {
+        abort();
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (zz_add(u + i, v + i, r + i) || zz_cmp(w + i, r + i) != ZZ_EQ) {
+            abort();
+        }
+    }
+    if (zz_mul_batch(n, u, v, w)) {
+        abort();
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (zz_mul(u + i, v + i, r + i) || zz_cmp(w + i, r + i) != ZZ_EQ) {
+            abort();
+        }
+    }
+    zz_cmp_batch(n, u, v, o);
+    for (size_t i = 0; i < n; i++) {
+        if (o[i] != zz_cmp(u + i, v + i)) {
+            abort();
+        }
+    }
+    /* Outputs may be inputs. */
+    if (zz_mul_batch(n, u, v, r) || zz_mul_batch(n, u, v, u)
+        || zz_add_batch(n, v, v, v))
+    {
+        abort();
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (zz_cmp(u + i, r + i) != ZZ_EQ) {
+            abort();
+        }
+    }
+    /* The output with storage for one digit only. */
+    for (int k = 0; k < 2; k++) {
+        zz_digit_t *p = malloc(sizeof(zz_digit_t));
+
+        if (!p || zz_set(UINT64_MAX, u) || zz_set(UINT64_MAX - 1 + (uint64_t)k, v)
+            || zz_adopt(0, 1, p, w)
+            || (k ? zz_mul_batch(1, u, v, w) : zz_add_batch(1, u, v, w))
+            || (k ? zz_mul(u, v, r) : zz_add(u, v, r))
+            || zz_cmp(w, r) != ZZ_EQ)
+        {
+            abort();
+        }
+        zz_clear(w);
+        if (zz_init(w)) {
+            abort();
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        zz_clear(u + i);
+        zz_clear(v + i);
+        zz_clear(w + i);
+        zz_clear(r + i);
+    }
+    free(u);
+    free(v);
+    free(w);
+    free(r);
+    free(o);
+}
+
+void
+check_div_pre(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs;
+
+        switch (i % 8) {
+        case 0: case 1: case 2:
+            bs = (zz_bitcnt_t)(1 + rand() % 64);
+            break;
+        case 3: case 4:
+            bs = (zz_bitcnt_t)(65 + rand() % 64);
+            break;
+        case 5: case 6:
+            bs = (zz_bitcnt_t)(129 + rand() % 4000);
+            break;
+        default:
+            bs = (zz_bitcnt_t)(1 + rand() % (i % 64 ? 8000 : 80000));
+        }
+
+        zz_t u, d, q, r, rq, rr;
+        zz_divisor dv;
+
+        if (zz_init(&u) || zz_init(&d) || zz_init(&q) || zz_init(&r)
+            || zz_init(&rq) || zz_init(&rr))
+        {
+            abort();
+        }
+        if (zz_random(bs, true, &d) || zz_iszero(&d)
+            || zz_random(bs + (zz_bitcnt_t)(rand() % 6400), true, &u))
+        {
+            if (zz_iszero(&d)) {
+                if (zz_divisor_init(&d, &dv) != ZZ_VAL) {
+                    abort();
+                }
+                zz_divisor_clear(&dv);
+                goto clear;
+            }
+            abort();
+        }
+        if (zz_divisor_init(&d, &dv) || zz_div(&u, &d, &rq, &rr)) {
+            abort();
+        }
+        if (zz_div_pre(&u, &dv, &q, &r) || zz_cmp(&q, &rq) != ZZ_EQ
+            || zz_cmp(&r, &rr) != ZZ_EQ)
+        {
+            abort();
+        }
+        if (zz_set(0, &q) || zz_div_pre(&u, &dv, NULL, &r)
+            || zz_cmp(&r, &rr) != ZZ_EQ || zz_div_pre(&u, &dv, &q, NULL)
+            || zz_cmp(&q, &rq) != ZZ_EQ
+            || zz_div_pre(&u, &dv, NULL, NULL))
+        {
+            abort();
+        }
+        if (zz_pos(&u, &q) || zz_div_pre(&q, &dv, &q, &r)
+            || zz_cmp(&q, &rq) != ZZ_EQ || zz_cmp(&r, &rr) != ZZ_EQ
+            || zz_pos(&u, &r) || zz_div_pre(&r, &dv, NULL, &r)
+            || zz_cmp(&r, &rr) != ZZ_EQ)
+        {
+            abort();
+        }
+        if (d.size == 1 && !zz_isneg(&d)) {
+            uint64_t v = d.digits[0], w;
+
+            if (zz_mod_u64(&u, v, &w) || zz_set(w, &q)
+                || zz_cmp(&rr, &q) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+        zz_divisor_clear(&dv);
+clear:
+        zz_clear(&u);
+        zz_clear(&d);
+        zz_clear(&q);
+        zz_clear(&r);
+        zz_clear(&rq);
+        zz_clear(&rr);
+    }
+
+    size_t n = 100;
+    zz_t u[100], q[100], r[100], d, t;
+    zz_divisor dv;
+    uint64_t w;
+
+    if (zz_init(&d) || zz_init(&t) || zz_set(-12345, &d)
+        || zz_divisor_init(&d, &dv))
+    {
+        abort();
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (zz_init(&u[i]) || zz_init(&q[i]) || zz_init(&r[i])
+            || zz_random(i % 10 ? 64 : 640, true, &u[i]))
+        {
+            abort();
+        }
+    }
+    if (zz_div_batch(n, u, &dv, q, r) || zz_div_batch(n, u, &dv, NULL, NULL))
+    {
+        abort();
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (zz_div(&u[i], &d, &d, &t) || zz_cmp(&q[i], &d) != ZZ_EQ
+            || zz_cmp(&r[i], &t) != ZZ_EQ || zz_set(-12345, &d))
+        {
+            abort();
+        }
+    }
+    if (zz_div_batch(n, u, &dv, NULL, r)) {
+        abort();
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (zz_div(&u[i], &d, NULL, &t) || zz_cmp(&r[i], &t) != ZZ_EQ) {
+            abort();
+        }
+        zz_clear(&u[i]);
+        zz_clear(&q[i]);
+        zz_clear(&r[i]);
+    }
+    zz_divisor_clear(&dv);
+    if (zz_mod_u64(&d, 0, &w) != ZZ_VAL || zz_mod_u64(&t, 7, &w)
+        || zz_set(0, &t) || zz_mod_u64(&t, 7, &w) || w
+        || zz_set(-1, &t) || zz_mod_u64(&t, UINT64_MAX, &w)
+        || w != UINT64_MAX - 1)
+    {
+        abort();
+    }
+    /* quotient overwrites the dividend */
+    if (zz_set(-100, &t) || zz_div(&t, 7, &t, &d) || zz_cmp(&t, -15) != ZZ_EQ
+        || zz_cmp(&d, 5) != ZZ_EQ)
+    {
+        abort();
+    }
+    zz_clear(&d);
+    zz_clear(&t);
+}
+
 void
 check_lshift_bulk(void)
 {
@@ -550,6 +998,20 @@ check_shift_examples(void)
         abort();
     }
 #endif
+    if (zz_set(-1, &u) || zz_mul_2exp(&u, 128, &u) || zz_add(&u, 1, &u)
+        || zz_neg(&u, &u))
+    {
+        abort();
+    }
+
+    zz_digit_t *digits = u.digits;
+
+    if (zz_quo_2exp(&u, 1, &u) || zz_quo_2exp(&u, 64, &u)
+        || u.digits != digits || zz_mul_2exp(&u, 65, &u)
+        || u.digits != digits || zz_bitlen(&u) != 128)
+    {
+        abort();
+    }
     zz_clear(&u);
     zz_clear(&v);
 }
@@ -617,6 +1079,53 @@ check_square_outofmem_pthread(void)
 }
 #endif /* HAVE_PTHREAD_H */
 
+#if HAVE_PTHREAD_H
+void
+check_mul_threads(void)
+{
+    if (zz_set_mul_threads(0, 100) != ZZ_VAL
+        || zz_set_mul_threads(2, 1) != ZZ_VAL || zz_set_mul_threads(4, 8))
+    {
+        abort();
+    }
+    for (size_t i = 0; i < nsamples/10; i++) {
+        zz_bitcnt_t bs = (zz_bitcnt_t)rand() % 40000;
+        zz_t u, v, w, r;
+
+        if (zz_init(&u) || zz_init(&v) || zz_init(&w) || zz_init(&r)
+            || zz_random(bs, true, &u)
+            || zz_random(i % 3 ? bs : (zz_bitcnt_t)rand() % 40000, true, &v))
+        {
+            abort();
+        }
+        if (zz_mul(&u, &v, &w) || zz_ref_mul(&u, &v, &r)
+            || zz_cmp(&w, &r) != ZZ_EQ || zz_mul(&u, &u, &w)
+            || zz_ref_mul(&u, &u, &r) || zz_cmp(&w, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+
+        uint64_t e = (uint64_t)rand() % 5000;
+
+        if (zz_abs(&u, &u) || zz_quo_2exp(&u, bs/2, &v) || zz_pow(&v, e, &w)
+            || zz_set_mul_threads(1, 8) || zz_pow(&v, e, &r)
+            || zz_cmp(&w, &r) != ZZ_EQ || zz_set_mul_threads(4, 8))
+        {
+            abort();
+        }
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&w);
+        zz_clear(&r);
+    }
+    /* Workers of the test can't allocate memory (see my_malloc()). */
+    check_square_outofmem();
+    if (zz_set_mul_threads(1, 8192)) {
+        abort();
+    }
+}
+#endif /* HAVE_PTHREAD_H */
+
 int
 main(void)
 {
@@ -634,12 +1143,18 @@ main(void)
     check_gcd_bulk();
     check_lcm_bulk();
     check_binop_examples();
+    check_bitwise_borrow();
+    check_inline_fast();
+    check_addmul_bulk();
+    check_batch();
+    check_div_pre();
     check_lshift_bulk();
     check_rshift_bulk();
     check_shift_examples();
     check_square_outofmem();
 #if HAVE_PTHREAD_H
     check_square_outofmem_pthread();
+    check_mul_threads();
 #endif
     zz_finish();
     zz_testclear();
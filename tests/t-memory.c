@@ -101,6 +101,41 @@ check_square_outofmem_pthread(void)
     free(d);
     free(tid);
 }
+
+/* Memory failures of the prime factorization, used with threads. */
+void
+check_comb_outofmem(void)
+{
+    if (zz_set_mul_threads(2, 8192)) {
+        abort();
+    }
+    for (size_t i = 0; i < 4; i++) {
+        uint64_t x = 65536 + (uint64_t)(rand() % 12173);
+        zz_t mx;
+
+        if (zz_init(&mx)) {
+            abort();
+        }
+        while (1) {
+            zz_err r = i%2 ? zz_primorial(x, &mx) : zz_fac(x, &mx);
+
+            if (r != ZZ_OK) {
+                if (r == ZZ_MEM) {
+                    break;
+                }
+                abort();
+            }
+            x *= 2;
+        }
+        zz_clear(&mx);
+        if (zz_get_alloc_state()) {
+            abort();
+        }
+    }
+    if (zz_set_mul_threads(1, 8192)) {
+        abort();
+    }
+}
 #endif /* HAVE_PTHREAD_H */
 
 int
@@ -143,6 +178,9 @@ main(void)
         return 1;
     }
     check_fac_outofmem();
+#  if HAVE_PTHREAD_H
+    check_comb_outofmem();
+#  endif
     zz_finish();
     return 0;
 #else
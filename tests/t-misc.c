@@ -128,6 +128,136 @@ check_bitcnt_examples(void)
     zz_clear(&u);
 }
 
+void
+check_bitlen_bulk(void)
+{
+    zz_bitcnt_t bs = 512;
+
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_t u;
+
+        if (zz_init(&u) || zz_random(bs, true, &u)) {
+            abort();
+        }
+
+        TMP_MPZ(mu, &u);
+        if (zz_bitlen(&u) != (u.size ? mpz_sizeinbase(mu, 2) : 0)) {
+            abort();
+        }
+        zz_clear(&u);
+    }
+}
+
+void
+check_tstbit_bulk(void)
+{
+    zz_bitcnt_t bs = 512;
+
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_t u;
+
+        if (zz_init(&u) || zz_random(bs, true, &u)) {
+            abort();
+        }
+
+        zz_bitcnt_t idx = (zz_bitcnt_t)(rand() % 600);
+        TMP_MPZ(mu, &u);
+
+        if (zz_tstbit(&u, idx) != mpz_tstbit(mu, idx)
+            || (zz_tstbit)(&u, idx) != mpz_tstbit(mu, idx))
+        {
+            abort();
+        }
+        zz_clear(&u);
+    }
+}
+
+#define TEST_CHBIT(op)                                              \
+    do {                                                            \
+        zz_t u, r;                                                  \
+        mpz_t z;                                                    \
+                                                                    \
+        if (zz_init(&u) || zz_init(&r)                              \
+            || zz_random(bs, true, &u))                             \
+        {                                                           \
+            abort();                                                \
+        }                                                           \
+                                                                    \
+        zz_bitcnt_t idx = (zz_bitcnt_t)(rand() % 600);              \
+        TMP_MPZ(mu, &u);                                            \
+                                                                    \
+        mpz_init_set(z, mu);                                        \
+        mpz_##op(z, idx);                                           \
+        if (zz_set_mpz_t(z, &r) || zz_##op(&u, idx)                 \
+            || zz_cmp(&u, &r) != ZZ_EQ)                             \
+        {                                                           \
+            abort();                                                \
+        }                                                           \
+        mpz_clear(z);                                               \
+        zz_clear(&u);                                               \
+        zz_clear(&r);                                               \
+    } while (0)
+
+void
+check_chbit_bulk(void)
+{
+    zz_bitcnt_t bs = 512;
+
+    for (size_t i = 0; i < nsamples; i++) {
+        TEST_CHBIT(setbit);
+        TEST_CHBIT(clrbit);
+        TEST_CHBIT(combit);
+    }
+}
+
+void
+check_chbit_examples(void)
+{
+    zz_t u;
+
+    if (zz_init(&u) || zz_setbit(&u, 200) || zz_bitlen(&u) != 201
+        || !zz_tstbit(&u, 200) || zz_tstbit(&u, 201)
+        || zz_clrbit(&u, 200) || !zz_iszero(&u))
+    {
+        abort();
+    }
+    if (zz_set(-1, &u) || zz_setbit(&u, 1000) || zz_cmp(&u, -1) != ZZ_EQ
+        || zz_combit(&u, 0) || zz_cmp(&u, -2) != ZZ_EQ
+        || zz_clrbit(&u, 64) || zz_bitlen(&u) != 65
+        || zz_combit(&u, 0) || zz_setbit(&u, 64) || zz_cmp(&u, -1) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_clrbit(&u, ZZ_BITS_MAX) != ZZ_BUF || zz_cmp(&u, -1) != ZZ_EQ
+        || zz_setbit(&u, ZZ_BITS_MAX) || zz_cmp(&u, -1) != ZZ_EQ
+        || !zz_tstbit(&u, ZZ_BITS_MAX))
+    {
+        abort();
+    }
+    if (zz_set(1, &u) || zz_setbit(&u, ZZ_BITS_MAX) != ZZ_BUF
+        || zz_clrbit(&u, ZZ_BITS_MAX) || zz_cmp(&u, 1) != ZZ_EQ)
+    {
+        abort();
+    }
+    zz_clear(&u);
+
+    const zz_digit_t d[2] = {0, 5};
+
+    if (zz_view(2, d, &u) || zz_combit(&u, 64) || zz_cmp(&u, 4) == ZZ_EQ
+        || d[1] != 5 || zz_quo_2exp(&u, 64, &u) || zz_cmp(&u, 4) != ZZ_EQ)
+    {
+        abort();
+    }
+    zz_clear(&u);
+    if (zz_view(2, d, &u) || zz_neg(&u, &u) || zz_clrbit(&u, 64)
+        || d[1] != 5 || zz_neg(&u, &u) || zz_quo_2exp(&u, 64, &u)
+        || zz_cmp(&u, 6) != ZZ_EQ)
+    {
+        abort();
+    }
+    zz_clear(&u);
+}
+
 zz_err
 zz_ref_sqrtrem(const zz_t *u, zz_t *v, zz_t *w)
 {
@@ -216,6 +346,154 @@ check_sqrtrem_examples(void)
     zz_clear(&v);
 }
 
+void
+check_rootrem_bulk(void)
+{
+    zz_bitcnt_t bs = 512;
+
+    for (size_t i = 0; i < nsamples; i++) {
+        uint64_t k = 1 + (uint64_t)(rand() % 20);
+        bool neg = k % 2 && rand() % 2;
+        zz_t u, v, w;
+        mpz_t z, r;
+
+        if (zz_init(&u) || zz_random(bs, neg, &u) || zz_init(&v)
+            || zz_init(&w))
+        {
+            abort();
+        }
+
+        TMP_MPZ(mu, &u);
+        if (TMP_OVERFLOW) {
+            abort();
+        }
+        mpz_init(z);
+        mpz_init(r);
+        mpz_rootrem(z, r, mu, (unsigned long)k);
+        if (zz_rootrem(&u, k, &v, &w)) {
+            abort();
+        }
+
+        TMP_MPZ(mv, &v);
+        TMP_MPZ(mw, &w);
+        if (mpz_cmp(mv, z) || mpz_cmp(mw, r)) {
+            abort();
+        }
+        if (zz_rootrem(&u, k, &u, NULL) || mpz_cmp(mv, z)) {
+            abort();
+        }
+        mpz_clear(z);
+        mpz_clear(r);
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&w);
+    }
+}
+
+void
+check_is_square_bulk(void)
+{
+    zz_bitcnt_t bs = 512;
+
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_t u;
+
+        if (zz_init(&u) || zz_random(bs, true, &u)) {
+            abort();
+        }
+        if (i % 2 && (zz_abs(&u, &u) || zz_mul(&u, &u, &u)
+                      || zz_add(&u, rand() % 3 - 1, &u)))
+        {
+            abort();
+        }
+
+        bool sq, pp;
+        TMP_MPZ(mu, &u);
+        if (zz_is_square(&u, &sq) || zz_is_perfect_power(&u, &pp)
+            || sq != (mpz_perfect_square_p(mu) != 0)
+            || pp != (mpz_perfect_power_p(mu) != 0))
+        {
+            abort();
+        }
+        zz_clear(&u);
+    }
+}
+
+void
+check_perfect_power_bulk(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        uint64_t k = 2 + (uint64_t)(rand() % 9);
+        zz_t u;
+
+        if (zz_init(&u) || zz_random(64, k % 2, &u) || zz_pow(&u, k, &u)
+            || zz_add(&u, rand() % 3 - 1, &u))
+        {
+            abort();
+        }
+
+        bool pp;
+        TMP_MPZ(mu, &u);
+        if (zz_is_perfect_power(&u, &pp)
+            || pp != (mpz_perfect_power_p(mu) != 0))
+        {
+            abort();
+        }
+        zz_clear(&u);
+    }
+}
+
+void
+check_rootrem_examples(void)
+{
+    zz_t u, v, w;
+    bool res;
+
+    if (zz_init(&u) || zz_init(&v) || zz_init(&w) || zz_set(-30, &u)) {
+        abort();
+    }
+    if (zz_rootrem(&u, 3, &v, &w) || zz_cmp(&v, -3) != ZZ_EQ
+        || zz_cmp(&w, -3) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_rootrem(&u, 1, &v, &w) || zz_cmp(&v, -30) != ZZ_EQ
+        || zz_cmp(&w, 0) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_rootrem(&u, 4, &v, &w) != ZZ_VAL
+        || zz_rootrem(&u, 0, &v, NULL) != ZZ_VAL)
+    {
+        abort();
+    }
+    if (zz_set(1000, &u) || zz_rootrem(&u, 100, &v, &u)
+        || zz_cmp(&v, 1) != ZZ_EQ || zz_cmp(&u, 999) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_is_square(&u, &res) || res || zz_set(0, &u)
+        || zz_is_square(&u, &res) || !res
+        || zz_is_perfect_power(&u, &res) || !res)
+    {
+        abort();
+    }
+    if (zz_set(-1, &u) || zz_is_square(&u, &res) || res
+        || zz_is_perfect_power(&u, &res) || !res)
+    {
+        abort();
+    }
+    if (zz_set(-32, &u) || zz_is_perfect_power(&u, &res) || !res
+        || zz_set(-64, &u) || zz_is_perfect_power(&u, &res) || !res
+        || zz_set(-16, &u) || zz_is_perfect_power(&u, &res) || res)
+    {
+        abort();
+    }
+    zz_clear(&u);
+    zz_clear(&v);
+    zz_clear(&w);
+}
+
 void
 check_bin(void)
 {
@@ -224,7 +502,127 @@ check_bin(void)
     if (zz_init(&u) || zz_bin(13, 5, &u) || zz_cmp(&u, 1287) != ZZ_EQ) {
         abort();
     }
+
+    zz_t v;
+
+    /* Big results take digits of the mpz_t as is, they are not
+       tracked as temporaries. */
+    if (zz_init(&v) || zz_bin(3000, 1000, &u) || zz_fac(3000, &v)
+        || zz_get_alloc_state() || GETALLOC(&u) < u.size
+        || GETALLOC(&v) < v.size)
+    {
+        abort();
+    }
+    if (zz_bin(3000, 2000, &v) || zz_cmp(&u, &v) != ZZ_EQ) {
+        abort();
+    }
+    if (zz_fac(3000, &v)) {
+        abort();
+    }
+    for (int64_t k = 3000; k > 1; k--) {
+        if (zz_div(&v, k, &v, NULL)) {
+            abort();
+        }
+    }
+    if (zz_cmp(&v, 1) != ZZ_EQ) {
+        abort();
+    }
+    zz_clear(&u);
+    zz_clear(&v);
+}
+
+zz_err
+zz_ref_comb(int kind, uint64_t n, uint64_t k, zz_t *w)
+{
+    mpz_t z;
+    if (TMP_OVERFLOW) {
+        return ZZ_MEM;
+    }
+    mpz_init(z);
+    switch (kind) {
+    case 0:
+        mpz_fac_ui(z, (unsigned long)n);
+        break;
+    case 1:
+        mpz_2fac_ui(z, (unsigned long)n);
+        break;
+    case 2:
+        mpz_bin_uiui(z, (unsigned long)n, (unsigned long)k);
+        break;
+    default:
+        mpz_primorial_ui(z, (unsigned long)n);
+    }
+    if (zz_set_mpz_t(z, w)) {
+        mpz_clear(z);
+        return ZZ_MEM;
+    }
+    mpz_clear(z);
+    return ZZ_OK;
+}
+
+zz_err
+zz_comb(int kind, uint64_t n, uint64_t k, zz_t *w)
+{
+    switch (kind) {
+    case 0:
+        return zz_fac(n, w);
+    case 1:
+        return zz_fac2(n, w);
+    case 2:
+        return zz_bin(n, k, w);
+    default:
+        return zz_primorial(n, w);
+    }
+}
+
+void
+check_comb(void)
+{
+    zz_t u, r;
+
+    if (zz_init(&u) || zz_init(&r)) {
+        abort();
+    }
+    /* Clustered arguments, to reuse cached results for nearby ones. */
+    if (zz_set_comb_cache(65) != ZZ_VAL || zz_set_comb_cache(4)) {
+        abort();
+    }
+    for (size_t i = 0; i < nsamples; i++) {
+        int kind = rand() % 4;
+        uint64_t n = (i/50)*37 + (uint64_t)(rand() % 40);
+        uint64_t k = (rand() % 4 ? n/3 + (uint64_t)(rand() % 8)
+                      : (uint64_t)rand() % (n + 2));
+
+        if (zz_comb(kind, n, k, &u) || zz_ref_comb(kind, n, k, &r)
+            || zz_cmp(&u, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+    }
+    zz_comb_cache_clear();
+    /* Results from the prime factorization. */
+    if (zz_set_comb_threshold(0) != ZZ_VAL || zz_set_comb_threshold(65536)
+        || zz_set_comb_cache(0) || zz_set_mul_threads(4, 8))
+    {
+        abort();
+    }
+    for (size_t i = 0; i < 4; i++) {
+        uint64_t n = 65536 + (uint64_t)(rand() % 3000);
+        uint64_t k = n/4 + (uint64_t)(rand() % 100);
+
+        for (int kind = 0; kind < 4; kind++) {
+            if (zz_comb(kind, n, k, &u) || zz_ref_comb(kind, n, k, &r)
+                || zz_cmp(&u, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+    }
+    if (zz_set_mul_threads(1, 8192) || zz_set_comb_threshold(UINT64_MAX)) {
+        abort();
+    }
     zz_clear(&u);
+    zz_clear(&r);
 }
 
 void
@@ -418,6 +816,14 @@ check_gcdext_examples(void)
     if (zz_gcdext(&u, &v, NULL, NULL, NULL) != ZZ_OK) {
         abort();
     }
+    /* Same sizes, but the second is bigger without the common power
+       of two. */
+    if (zz_set(1, &u) || zz_mul_2exp(&u, 64, &u) || zz_add(&u, 2, &u)
+        || zz_set(1, &v) || zz_mul_2exp(&v, 127, &v) || zz_add(&v, 2, &v)
+        || zz_gcdext(&u, &v, &a, NULL, NULL) || zz_cmp(&a, 2) != ZZ_EQ)
+    {
+        abort();
+    }
     zz_clear(&u);
     zz_clear(&v);
     zz_clear(&a);
@@ -511,26 +917,189 @@ check_invert_euclidext_bulk(void)
     }
 }
 
+/* Worker threads of product trees don't use the pool of the caller:
+   their integers are released through the heap. */
 void
-check_fromto_double(void)
+check_prodtree_pool(void)
 {
-    zz_t u;
-    double d;
+    size_t n = 4096;
+    zz_t *m = malloc(n*sizeof(zz_t)), *r = malloc(n*sizeof(zz_t)), u, w;
+    zz_prodtree tree;
+    zz_pool p;
 
-    if (zz_init(&u) || zz_set(INFINITY, &u) != ZZ_BUF) {
+    if (!m || !r || zz_pool_init(&p) || zz_set_mul_threads(4, 16)) {
         abort();
     }
-    if (zz_init(&u) || zz_set(NAN, &u) != ZZ_VAL) {
+    zz_set_pool(&p);
+    if (zz_init(&u) || zz_init(&w)
+        || zz_random((zz_bitcnt_t)n*9*64, false, &u))
+    {
         abort();
     }
-    if (zz_set(1092.2666666666667, &u) || zz_cmp(&u, 1092) != ZZ_EQ) {
-        abort();
+    for (size_t j = 0; j < n; j++) {
+        /* outputs have storage in the pool */
+        if (zz_init(&m[j]) || zz_random(9*64, false, &m[j])
+            || zz_setbit(&m[j], 0) || zz_init(&r[j]) || zz_set(1, &r[j])
+            || zz_mul_2exp(&r[j], 150, &r[j]))
+        {
+            abort();
+        }
     }
-    if (zz_set(1, &u) || zz_mul_2exp(&u, 2000, &u)) {
+    if (zz_prodtree_init(n, m, &tree) || zz_remtree(&u, &tree, r)) {
         abort();
     }
-    if (zz_get(&u, &d) != ZZ_BUF) {
-        abort();
+    for (size_t j = 0; j < n; j++) {
+        if (zz_div(&u, &m[j], NULL, &w) || zz_cmp(&w, &r[j]) != ZZ_EQ) {
+            abort();
+        }
+    }
+    zz_prodtree_clear(&tree);
+    for (size_t j = 0; j < n; j++) {
+        zz_clear(&m[j]);
+        zz_clear(&r[j]);
+    }
+    zz_clear(&u);
+    zz_clear(&w);
+    zz_set_pool(NULL);
+    zz_pool_clear(&p);
+    if (zz_set_mul_threads(1, 8192)) {
+        abort();
+    }
+    free(m);
+    free(r);
+}
+
+void
+check_prodtree_bulk(void)
+{
+    for (size_t i = 0; i < nsamples/10; i++) {
+        bool big = i % 10 == 0;
+        size_t n = (size_t)(1 + rand() % (big ? 64 : 20));
+        zz_bitcnt_t bs = (zz_bitcnt_t)(1 + rand() % (big ? 8192 : 300));
+        zz_t m[64], r[64], u, w, p;
+        zz_prodtree tree;
+
+        if (big && zz_set_mul_threads(4, 8)) {
+            abort();
+        }
+        if (zz_init(&u) || zz_init(&w) || zz_init(&p)
+            || zz_set_i64(1, &p))
+        {
+            abort();
+        }
+        for (size_t j = 0; j < n; j++) {
+            if (zz_init(&m[j]) || zz_init(&r[j])) {
+                abort();
+            }
+            /* make moduli coprime */
+            do {
+                if (zz_random(bs, false, &m[j]) || zz_add(&m[j], 1, &m[j])
+                    || zz_gcdext(&m[j], &p, &w, NULL, NULL))
+                {
+                    abort();
+                }
+            } while (zz_cmp(&w, 1) != ZZ_EQ);
+            if (zz_mul(&p, &m[j], &p)) {
+                abort();
+            }
+        }
+        if (zz_prod(n, m, &w) || zz_cmp(&w, &p) != ZZ_EQ) {
+            abort();
+        }
+        if (zz_prodtree_init(n, m, &tree)) {
+            abort();
+        }
+        if (zz_random(bs*(zz_bitcnt_t)n + 100, true, &u)
+            || zz_remtree(&u, &tree, r))
+        {
+            abort();
+        }
+        for (size_t j = 0; j < n; j++) {
+            if (zz_div(&u, &m[j], NULL, &w) || zz_cmp(&w, &r[j]) != ZZ_EQ) {
+                abort();
+            }
+        }
+        if (zz_div(&u, &p, NULL, &u) || zz_crt(r, &tree, &w)
+            || zz_cmp(&w, &u) != ZZ_EQ)
+        {
+            abort();
+        }
+        /* unreduced residues */
+        if (zz_sub(&r[0], &m[0], &r[0]) || zz_mul(&m[n - 1], 3, &w)
+            || zz_add(&r[n - 1], &w, &r[n - 1]) || zz_crt(r, &tree, &r[0])
+            || zz_cmp(&r[0], &u) != ZZ_EQ)
+        {
+            abort();
+        }
+        /* in-place */
+        if (zz_remtree(&r[0], &tree, r) || zz_div(&u, &m[0], NULL, &w)
+            || zz_cmp(&r[0], &w) != ZZ_EQ)
+        {
+            abort();
+        }
+        zz_prodtree_clear(&tree);
+        if (n > 1 && zz_cmp(&m[0], 1) == ZZ_GT) {
+            /* not coprime */
+            if (zz_mul(&m[n - 1], &m[0], &m[n - 1])
+                || zz_prodtree_init(n, m, &tree)
+                || zz_crt(r, &tree, &w) != ZZ_VAL
+                || zz_crt(r, &tree, &w) != ZZ_VAL)
+            {
+                abort();
+            }
+            zz_prodtree_clear(&tree);
+        }
+        if (zz_prod(n, m, &m[0]) || zz_prod(0, m, &w)
+            || zz_cmp(&w, 1) != ZZ_EQ)
+        {
+            abort();
+        }
+        for (size_t j = 0; j < n; j++) {
+            zz_clear(&m[j]);
+            zz_clear(&r[j]);
+        }
+        zz_clear(&u);
+        zz_clear(&w);
+        zz_clear(&p);
+        if (big && zz_set_mul_threads(1, 8192)) {
+            abort();
+        }
+    }
+
+    zz_t m[2];
+    zz_prodtree tree;
+
+    if (zz_init(&m[0]) || zz_init(&m[1]) || zz_set_i64(3, &m[0])
+        || zz_prodtree_init(0, m, &tree) != ZZ_VAL
+        || zz_prodtree_init(2, m, &tree) != ZZ_VAL
+        || zz_set_i64(-5, &m[1]) || zz_prodtree_init(2, m, &tree) != ZZ_VAL)
+    {
+        abort();
+    }
+    zz_clear(&m[0]);
+    zz_clear(&m[1]);
+}
+
+void
+check_fromto_double(void)
+{
+    zz_t u;
+    double d;
+
+    if (zz_init(&u) || zz_set(INFINITY, &u) != ZZ_BUF) {
+        abort();
+    }
+    if (zz_init(&u) || zz_set(NAN, &u) != ZZ_VAL) {
+        abort();
+    }
+    if (zz_set(1092.2666666666667, &u) || zz_cmp(&u, 1092) != ZZ_EQ) {
+        abort();
+    }
+    if (zz_set(1, &u) || zz_mul_2exp(&u, 2000, &u)) {
+        abort();
+    }
+    if (zz_get(&u, &d) != ZZ_BUF) {
+        abort();
     }
     if (zz_set(9007199254740993, &u) || zz_get(&u, &d)
         || d != 9007199254740992.0)
@@ -858,17 +1427,749 @@ check_fac_outofmem(void)
     zz_set_memory_funcs(NULL, NULL, NULL);
 }
 
+void
+check_arena(void)
+{
+    zz_t u, v, r1, r2;
+    zz_arena a;
+
+    if (zz_init(&r1) || zz_fac(3000, &r1) || zz_init(&r2)
+        || zz_mul(&r1, &r1, &r2) || zz_sub_i64(&r2, 1, &r2))
+    {
+        abort();
+    }
+    if (zz_arena_init(4096, &a)) {
+        abort();
+    }
+    for (size_t i = 0; i < 3; i++) {
+        zz_set_arena(&a);
+        if (zz_init(&u) || zz_init(&v) || zz_fac(3000, &u)
+            || zz_mul(&u, &u, &v) || zz_sub_i64(&v, 1, &v))
+        {
+            abort();
+        }
+        for (int64_t j = 1; j < 100; j++) {
+            if (zz_add_i64(&u, j, &u) || zz_sub_i64(&u, j, &u)) {
+                abort();
+            }
+        }
+
+        size_t len;
+
+        if (zz_sizeinbase(&v, 10, &len)) {
+            abort();
+        }
+
+        char *buf = malloc(len + 2);
+
+        if (!buf || zz_get_str(&v, 10, buf) || zz_set_str(buf, 10, &v)) {
+            abort();
+        }
+        free(buf);
+        zz_clear(&u);
+        zz_set_arena(NULL);
+        if (zz_cmp(&v, &r2) != ZZ_EQ) {
+            abort();
+        }
+        zz_arena_reset(&a);
+    }
+    zz_arena_clear(&a);
+    zz_clear(&r1);
+    zz_clear(&r2);
+}
+
+void
+check_pool(void)
+{
+    zz_t u, v, r;
+    zz_pool p;
+
+    if (zz_init(&r) || zz_fac(10000, &r) || zz_pow(&r, 3, &r)) {
+        abort();
+    }
+    if (zz_pool_init(&p)) {
+        abort();
+    }
+    zz_set_pool(&p);
+    if (zz_init(&u) || zz_init(&v)) {
+        abort();
+    }
+    for (uint64_t i = 1; i < 500; i++) {
+        if (zz_set(i, &v) || zz_pow(&v, i, &v) || zz_add(&u, &v, &u)) {
+            abort();
+        }
+    }
+    zz_clear(&v);
+    if (zz_fac(10000, &u) || zz_pow(&u, 3, &u)) {
+        abort();
+    }
+    zz_set_pool(NULL);
+    if (zz_cmp(&u, &r) != ZZ_EQ) {
+        abort();
+    }
+    zz_pool_clear(&p);
+    zz_clear(&r);
+}
+
+/* Integers are resized and released by their allocator, when they are
+   passed across zz_set_pool() and zz_set_arena() calls. */
+void
+check_alloc_owner(void)
+{
+    zz_t u, v, w, x, y, r;
+    zz_pool p;
+    zz_arena a;
+
+    total_size = 0;
+    max_size = SIZE_MAX;
+    zz_set_memory_funcs(my_malloc, my_realloc, my_free);
+    if (zz_pool_init(&p) || zz_arena_init(4096, &a)) {
+        abort();
+    }
+    /* The u is on the heap, v and w - in the pool, x - in the arena and
+       y has an adopted buffer. */
+    if (zz_init(&u) || zz_set(1, &u) || zz_mul_2exp(&u, 1000, &u)) {
+        abort();
+    }
+
+    zz_digit_t *d = my_malloc(4*sizeof(zz_digit_t));
+
+    if (!d) {
+        abort();
+    }
+    d[0] = d[1] = d[2] = 0;
+    d[3] = 1;
+    if (zz_init(&y) || zz_adopt(4, 4, d, &y)) {
+        abort();
+    }
+    zz_set_pool(&p);
+    if (zz_mul_2exp(&y, 100000, &y) || zz_mul_2exp(&y, 100000, &y)
+        || zz_quo_2exp(&y, 200000, &y) || zz_mul_2exp(&y, 1000, &y))
+    {
+        abort();
+    }
+    if (zz_mul_2exp(&u, 100000, &u) || zz_init(&v) || zz_set(3, &v)
+        || zz_mul_2exp(&v, 500, &v) || zz_init(&w)
+        || zz_mul_2exp(&u, 100000, &w))
+    {
+        abort();
+    }
+    zz_set_arena(&a);
+    if (zz_mul_2exp(&v, 5000, &v) || zz_init(&x) || zz_add(&u, &v, &x)
+        || zz_mul_2exp(&w, 1000, &w))
+    {
+        abort();
+    }
+    zz_set_pool(NULL);
+    if (zz_mul_2exp(&x, 100000, &x) || zz_init(&r) || zz_set(1, &r)
+        || zz_mul_2exp(&r, 101000, &r) || zz_cmp(&u, &r) != ZZ_EQ
+        || zz_mul_2exp(&r, 101000, &r) || zz_cmp(&w, &r) != ZZ_EQ
+        || zz_set(3, &r) || zz_mul_2exp(&r, 5500, &r)
+        || zz_cmp(&v, &r) != ZZ_EQ || zz_add(&u, &v, &r)
+        || zz_mul_2exp(&r, 100000, &r) || zz_cmp(&x, &r) != ZZ_EQ
+        || zz_set(1, &r) || zz_mul_2exp(&r, 3*64 + 1000, &r)
+        || zz_cmp(&y, &r) != ZZ_EQ)
+    {
+        abort();
+    }
+    zz_clear(&u);
+    zz_clear(&y);
+    zz_set_arena(&a);
+    zz_clear(&v);
+    zz_set_pool(&p);
+    zz_clear(&w);
+    zz_clear(&x);
+    zz_set_pool(NULL);
+    zz_clear(&r);
+    zz_pool_clear(&p);
+    zz_arena_clear(&a);
+    if (total_size || zz_get_alloc_state()) {
+        abort();
+    }
+    zz_set_memory_funcs(NULL, NULL, NULL);
+}
+
+/* Results with the scratch set (too small at first) are same. */
+void
+check_scratch(void)
+{
+    zz_t u, v, m, r[8], q[8];
+    zz_scratch s;
+
+    if (zz_init(&u) || zz_init(&v) || zz_init(&m)
+        || zz_set(3, &u) || zz_pow(&u, 2000, &u) || zz_sub(&u, 1, &u)
+        || zz_set(7, &v) || zz_pow(&v, 1500, &v) || zz_add(&v, 2, &v)
+        || zz_fac(200, &m) || zz_add(&m, 1, &m))
+    {
+        abort();
+    }
+    for (size_t i = 0; i < 8; i++) {
+        if (zz_init(&r[i]) || zz_init(&q[i])) {
+            abort();
+        }
+    }
+    if (zz_scratch_init(64, &s)) {
+        abort();
+    }
+    for (size_t k = 0; k < 3; k++) {
+        zz_t *w = k ? q : r;
+
+        zz_set_scratch(k ? &s : NULL);
+        if (zz_mul(&u, &v, &w[0]) || zz_powm(&u, &v, &m, &w[1])
+            || zz_gcdext(&u, &v, &w[2], &w[3], &w[4])
+            || zz_gcdext(&u, &m, &w[5], NULL, NULL) || zz_pow(&v, 5, &w[6])
+            || zz_bin(1000, 300, &w[7]))
+        {
+            abort();
+        }
+        zz_set_scratch(NULL);
+        if (zz_get_alloc_state()) {
+            abort();
+        }
+        for (size_t i = 0; k && i < 8; i++) {
+            if (zz_cmp(&r[i], &q[i]) != ZZ_EQ) {
+                abort();
+            }
+        }
+        if (k && (s.size <= 64 || s.used)) {
+            abort();
+        }
+    }
+    zz_scratch_clear(&s);
+    zz_clear(&u);
+    zz_clear(&v);
+    zz_clear(&m);
+    for (size_t i = 0; i < 8; i++) {
+        zz_clear(&r[i]);
+        zz_clear(&q[i]);
+    }
+}
+
+void
+check_tracker(void)
+{
+    size_t n = 1000;
+    mpz_t *z = malloc(n * sizeof(mpz_t));
+
+    if (!z || TMP_OVERFLOW) {
+        abort();
+    }
+    for (size_t i = 0; i < n; i++) {
+        mpz_init2(z[i], 64 + (mp_bitcnt_t)(rand() % 1000));
+        mpz_set_ui(z[i], i);
+    }
+    if (zz_get_alloc_state() != n) {
+        abort();
+    }
+    for (size_t i = 0; i < n; i += 2) {
+        mpz_mul_2exp(z[i], z[i], 10000);
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t j = (i*7919) % n;
+
+        if (j % 2 ? mpz_cmp_ui(z[j], j) : mpz_scan1(z[j], 0) < 10000) {
+            abort();
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        mpz_clear(z[(i*7919) % n]);
+    }
+    if (zz_get_alloc_state()) {
+        abort();
+    }
+    free(z);
+}
+
+static size_t big_allocs;
+
+static void *
+count_malloc(size_t size)
+{
+    big_allocs += size >= 1024;
+    return malloc(size);
+}
+
+static void *
+count_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+    (void)old_size;
+    big_allocs += new_size >= 1024;
+    return realloc(ptr, new_size);
+}
+
+static void
+count_free(void *ptr, size_t size)
+{
+    (void)size;
+    free(ptr);
+}
+
+void
+check_tracker_reuse(void)
+{
+    size_t n = 1000;
+    mpz_t *z = malloc(n * sizeof(mpz_t));
+
+    if (!z || TMP_OVERFLOW) {
+        abort();
+    }
+    zz_set_memory_funcs(count_malloc, count_realloc, count_free);
+    for (int k = 0; k < 2; k++) {
+        big_allocs = 0;
+        for (size_t i = 0; i < n; i++) {
+            mpz_init2(z[i], 64);
+        }
+        for (size_t i = 0; i < n; i++) {
+            mpz_clear(z[i]);
+        }
+        /* The array of the tracker is kept between calls. */
+        if (k && big_allocs) {
+            abort();
+        }
+    }
+    /* Slots of released allocations are reused, not only from the top. */
+    mpz_init2(z[0], 64);
+    for (size_t i = 0; i < 100*n; i++) {
+        mpz_init2(z[(i + 1) % 2], 64);
+        mpz_clear(z[i % 2]);
+    }
+    mpz_clear(z[(100*n) % 2]);
+    if (big_allocs || zz_get_alloc_state()) {
+        abort();
+    }
+    zz_set_memory_funcs(NULL, NULL, NULL);
+    free(z);
+}
+
 void
 check_sizeof(void)
 {
     zz_t u;
 
-    if (zz_init(&u) || zz_set(1, &u)
-        || zz_sizeof(&u) < sizeof(zz_t) + sizeof(zz_digit_t))
+    if (zz_init(&u) || zz_set(1, &u) || zz_sizeof(&u) != sizeof(zz_t)) {
+        abort();
+    }
+    if (zz_mul_2exp(&u, 3*ZZ_DIGIT_T_BITS, &u)
+        || zz_sizeof(&u) < sizeof(zz_t) + 4*sizeof(zz_digit_t))
+    {
+        abort();
+    }
+    zz_clear(&u);
+}
+
+void
+check_reserve(void)
+{
+    zz_t u;
+
+    if (zz_init(&u) || zz_set(123, &u) || zz_reserve(&u, 10)
+        || zz_sizeof(&u) < sizeof(zz_t) + 10*sizeof(zz_digit_t)
+        || zz_cmp(&u, 123) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_reserve(&u, 5) || zz_shrink_to_fit(&u)
+        || zz_sizeof(&u) != sizeof(zz_t) || zz_cmp(&u, 123) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_mul_2exp(&u, 3*ZZ_DIGIT_T_BITS, &u) || zz_reserve(&u, 10)
+        || zz_shrink_to_fit(&u)
+        || zz_sizeof(&u) != sizeof(zz_t) + 4*sizeof(zz_digit_t)
+        || zz_quo_2exp(&u, 3*ZZ_DIGIT_T_BITS, &u)
+        || zz_cmp(&u, 123) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_reserve(&u, ZZ_DIGITS_MAX + 1) != ZZ_BUF) {
+        abort();
+    }
+    zz_clear(&u);
+}
+
+/* Memory-backed stream, that reads in pieces of random size and can
+   fail on the write after fail_after calls. */
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t pos;
+    int fail_after;
+} mem_stream;
+
+static zz_err
+mem_write(void *ctx, const void *data, size_t len)
+{
+    mem_stream *s = ctx;
+
+    if (!s->fail_after--) {
+        return ZZ_BUF;
+    }
+    s->data = realloc(s->data, s->len + len);
+    if (!s->data) {
+        abort();
+    }
+    memcpy(s->data + s->len, data, len);
+    s->len += len;
+    return ZZ_OK;
+}
+
+static zz_err
+mem_read(void *ctx, void *data, size_t *len)
+{
+    mem_stream *s = ctx;
+    size_t n = MIN(*len, s->len - s->pos);
+
+    if (n > 1) {
+        n = 1 + (size_t)rand() % n;
+    }
+    if (n) {
+        memcpy(data, s->data + s->pos, n);
+    }
+    s->pos += n;
+    *len = n;
+    return ZZ_OK;
+}
+
+void
+check_exportimport_layouts(void)
+{
+    const zz_layout layouts[] = {{1, 1, 1, 0}, {7, 1, -1, 1}, {8, 1, -1, 0},
+                                 {15, 2, -1, 0}, {16, 2, 1, 1},
+                                 {9, 2, 1, -1}, {30, 4, -1, 0},
+                                 {31, 4, 1, 1}, {32, 4, 1, -1},
+                                 {63, 8, -1, 1}, {33, 8, 1, 0}};
+
+    for (size_t j = 0; j < sizeof(layouts)/sizeof(layouts[0]); j++) {
+        zz_layout lay = layouts[j];
+
+        for (int i = 0; i < nsamples/10; i++) {
+            zz_bitcnt_t bc = (zz_bitcnt_t)rand() % 2000;
+            zz_t u, v;
+
+            if (zz_init(&u) || zz_init(&v) || zz_random(bc, false, &u)) {
+                abort();
+            }
+
+            size_t len = (zz_bitlen(&u) + lay.bits_per_digit
+                          - 1)/lay.bits_per_digit, count;
+            unsigned char *ref = malloc(len*lay.digit_size + 1);
+            unsigned char *buf = malloc(len*lay.digit_size + 1);
+            TMP_MPZ(mu, &u);
+
+            if (!ref || !buf) {
+                abort();
+            }
+            mpz_export(ref, &count, lay.digits_order, lay.digit_size,
+                       lay.digit_endianness,
+                       (size_t)(8*lay.digit_size - lay.bits_per_digit), mu);
+            if (count != len || zz_export(&u, lay, len, buf + 1)
+                || (len && memcmp(ref, buf + 1, len*lay.digit_size))
+                || zz_import(len, buf + 1, lay, &v)
+                || zz_cmp(&u, &v) != ZZ_EQ)
+            {
+                abort();
+            }
+            /* Nail bits must be ignored on input. */
+            if (lay.bits_per_digit % 8) {
+                int endian = lay.digit_endianness;
+                size_t hi;
+
+                if (!endian) {
+                    const uint16_t one = 1;
+
+                    endian = *(const unsigned char *)&one ? -1 : 1;
+                }
+                hi = endian == 1 ? 0 : lay.digit_size - 1;
+                for (size_t k = 0; k < len; k++) {
+                    buf[1 + k*lay.digit_size + hi] |= 0x80;
+                }
+                if (zz_import(len, buf + 1, lay, &v)
+                    || zz_cmp(&u, &v) != ZZ_EQ)
+                {
+                    abort();
+                }
+            }
+            free(ref);
+            free(buf);
+            zz_clear(&u);
+            zz_clear(&v);
+        }
+    }
+}
+
+void
+check_stream(void)
+{
+    const zz_bitcnt_t bits[] = {0, 7, 1000, 1500000};
+    const zz_layout layouts[] = {{8, 1, 1, 0}, {30, 4, -1, 0},
+                                 {14, 4, 1, -1}, {64, 8, 1, 1},
+                                 {64, 8, -1, 0}, {3, 1, 1, 0}};
+    const int bases[] = {10, 16, -36, 2, 7};
+
+    for (size_t i = 0; i < sizeof(bits)/sizeof(bits[0]); i++) {
+        zz_t u, v;
+
+        if (zz_init(&u) || zz_init(&v) || zz_set(!!bits[i], &u)
+            || zz_random(bits[i], false, &v)
+            || zz_mul_2exp(&u, bits[i], &u) || zz_add(&u, &v, &u))
+        {
+            abort();
+        }
+        for (size_t j = 0; j < sizeof(layouts)/sizeof(layouts[0]); j++) {
+            zz_layout lay = layouts[j];
+            mem_stream s = {NULL, 0, 0, -1};
+            size_t len = (zz_bitlen(&u) + lay.bits_per_digit
+                          - 1)/lay.bits_per_digit;
+            void *buf = malloc(len*lay.digit_size + 1);
+
+            if (!buf || zz_export(&u, lay, len, buf)
+                || zz_export_stream(&u, lay, mem_write, &s)
+                || s.len != len*lay.digit_size
+                || (len && memcmp(s.data, buf, s.len)))
+            {
+                abort();
+            }
+            if (zz_set(1, &v) || zz_import_stream(mem_read, &s, lay, &v)
+                || zz_cmp(&u, &v) != ZZ_EQ)
+            {
+                abort();
+            }
+            free(buf);
+            free(s.data);
+        }
+        for (size_t j = 0; j < sizeof(bases)/sizeof(bases[0]); j++) {
+            mem_stream s = {NULL, 0, 0, -1};
+            size_t len;
+
+            if (zz_neg(&u, &u) || zz_get_str_size(&u, bases[j], &len)) {
+                abort();
+            }
+
+            char *buf = malloc(len);
+
+            if (!buf || zz_get_str(&u, bases[j], buf)
+                || zz_get_str_stream(&u, bases[j], mem_write, &s)
+                || s.len != strlen(buf) || memcmp(s.data, buf, s.len))
+            {
+                abort();
+            }
+            if (zz_set_str_stream(mem_read, &s, abs(bases[j]), &v)
+                || zz_cmp(&u, &v) != ZZ_EQ)
+            {
+                abort();
+            }
+            free(buf);
+            free(s.data);
+        }
+        zz_clear(&u);
+        zz_clear(&v);
+    }
+
+    zz_t u;
+    mem_stream s = {NULL, 0, 0, 0};
+
+    if (zz_init(&u) || zz_set(123, &u)
+        || zz_get_str_stream(&u, 10, mem_write, &s) != ZZ_BUF
+        || zz_get_str_stream(&u, 37, mem_write, &s) != ZZ_VAL
+        || (s.fail_after = 0)
+        || zz_export_stream(&u, layouts[0], mem_write, &s) != ZZ_BUF)
+    {
+        abort();
+    }
+    s = (mem_stream){(unsigned char *)"12x", 3, 0, 0};
+    if (zz_set_str_stream(mem_read, &s, 10, &u) != ZZ_VAL) {
+        abort();
+    }
+    s = (mem_stream){(unsigned char *)"123", 3, 0, 0};
+    if (zz_import_stream(mem_read, &s, layouts[1], &u) != ZZ_VAL) {
+        abort();
+    }
+    zz_clear(&u);
+}
+
+void
+check_view_adopt(void)
+{
+    zz_digit_t buf[4] = {1, 2, 3, 0};
+    zz_t u, v;
+
+    if (zz_init(&u) || zz_init(&v) || zz_view(4, buf, &u) || u.size != 3
+        || zz_import(4, buf, *zz_get_layout(), &v)
+        || zz_cmp(&u, &v) != ZZ_EQ || zz_sizeof(&u) != sizeof(zz_t))
+    {
+        abort();
+    }
+    if (zz_add(&u, &u, &v) || zz_quo_2exp(&v, 1, &v)
+        || zz_cmp(&u, &v) != ZZ_EQ)
+    {
+        abort();
+    }
+    /* Writes detach the view. */
+    if (zz_add(&u, 1, &u) || buf[0] != 1 || zz_sub(&u, 1, &u)
+        || zz_cmp(&u, &v) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_view(2, buf, &u) || zz_neg(&u, &u) || zz_quo_2exp(&u, 64, &u)
+        || zz_cmp(&u, -3) != ZZ_EQ || buf[1] != 2)
+    {
+        abort();
+    }
+    /* Aliased operations detach the view without touching it. */
+    zz_t x;
+
+    if (zz_init(&x) || zz_view(3, buf, &x) || zz_view(3, buf, &u)
+        || zz_mul(&x, &x, &v) || zz_mul(&u, &u, &u)
+        || zz_cmp(&u, &v) != ZZ_EQ || zz_view(3, buf, &u)
+        || zz_mul(&v, &x, &v) || zz_pow(&u, 3, &u)
+        || zz_cmp(&u, &v) != ZZ_EQ || zz_view(3, buf, &u)
+        || zz_powm(&u, &x, &u, &u) || zz_cmp(&u, 0) != ZZ_EQ
+        || buf[0] != 1 || buf[1] != 2 || buf[2] != 3)
+    {
+        abort();
+    }
+    zz_clear(&x);
+    if (zz_view(1, (char *)buf + 1, &u) != ZZ_VAL) {
+        abort();
+    }
+    zz_clear(&u);
+
+    zz_digit_t *p = malloc(3*sizeof(zz_digit_t));
+
+    if (!p) {
+        abort();
+    }
+    p[0] = 5;
+    p[1] = 1;
+    if (zz_adopt(2, 1, p, &u) != ZZ_VAL || zz_adopt(2, 3, p, &u)
+        || zz_mul_2exp(&u, 300, &u) || zz_quo_2exp(&u, 364, &u)
+        || zz_cmp(&u, 1) != ZZ_EQ)
+    {
+        abort();
+    }
+    zz_clear(&u);
+
+    /* Unaligned data in native layout and with swapped words. */
+    unsigned char raw[8*4 + 1], ref[8*4];
+    zz_layout lay = *zz_get_layout();
+
+    if (zz_view(3, buf, &v)) {
+        abort();
+    }
+    for (int i = 0; i < 4; i++) {
+        lay.digits_order = i < 2 ? -1 : 1;
+        lay.digit_endianness = i % 2 ? 1 : -1;
+        if (zz_export(&v, lay, 3, ref) || zz_export(&v, lay, 3, raw + 1)
+            || memcmp(ref, raw + 1, 3*8) || zz_import(3, raw + 1, lay, &u)
+            || zz_cmp(&u, &v) != ZZ_EQ)
+        {
+            abort();
+        }
+    }
+    zz_clear(&u);
+    zz_clear(&v);
+}
+
+void
+check_stats(void)
+{
+    zz_stats st;
+
+    if (zz_set_stats(true)) {
+        /* Built without --enable-stats. */
+        zz_get_stats(&st);
+        if (st.calls[ZZ_OP_MUL] || st.resize_count || st.tmp_count) {
+            abort();
+        }
+        return;
+    }
+    zz_reset_stats();
+
+    zz_t u, v;
+
+    if (zz_init(&u) || zz_init(&v) || zz_set(3, &u)
+        || zz_mul_2exp(&u, 100*ZZ_DIGIT_T_BITS, &u)
+        || zz_mul(&u, &u, &v))
     {
         abort();
     }
+    zz_get_stats(&st);
+    if (st.calls[ZZ_OP_SHIFT] != 1 || st.sizes[ZZ_OP_SHIFT][1] != 1
+        || st.calls[ZZ_OP_MUL] != 1 || st.sizes[ZZ_OP_MUL][7] != 1
+        || st.resize_count < 2
+        || st.resize_bytes < (101 + 202)*sizeof(zz_digit_t)
+        || st.mem_errors)
+    {
+        abort();
+    }
+
+    /* GMP temporaries */
+    mpz_t z;
+
+    if (TMP_OVERFLOW) {
+        abort();
+    }
+    mpz_init_set_ui(z, 1);
+    mpz_mul_2exp(z, z, 10000);
+    mpz_clear(z);
+    zz_get_stats(&st);
+    if (!st.tmp_count || st.tmp_bytes < 10000/8 || !st.tmp_peak) {
+        abort();
+    }
+
+    /* memory failures */
+    zz_set_memory_funcs(my_malloc, my_realloc, my_free);
+    max_size = 1000;
+    if (zz_mul_2exp(&u, 1000*ZZ_DIGIT_T_BITS, &v) != ZZ_MEM) {
+        abort();
+    }
+    zz_set_memory_funcs(NULL, NULL, NULL);
+    total_size = 0;
+    zz_get_stats(&st);
+    if (st.mem_errors < 1) {
+        abort();
+    }
+
+    /* counters of worker threads */
+    size_t n = 64;
+    zz_t *w = malloc(n*sizeof(zz_t));
+    uint64_t calls[2] = {0, 0};
+
+    for (size_t i = 0; i < n; i++) {
+        if (!w || zz_init(&w[i])
+            || zz_random(64*ZZ_DIGIT_T_BITS, true, &w[i]))
+        {
+            abort();
+        }
+    }
+    for (int j = 0; j < 1 + HAVE_PTHREAD_H; j++) {
+        if (zz_set_mul_threads(j ? 4 : 1, 8192)) {
+            abort();
+        }
+        zz_reset_stats();
+        if (zz_prod(n, w, &u)) {
+            abort();
+        }
+        zz_get_stats(&st);
+        calls[j] = st.calls[ZZ_OP_MUL];
+    }
+    if (zz_set_mul_threads(1, 8192)) {
+        abort();
+    }
+    if (calls[0] < n - 1 || (HAVE_PTHREAD_H && calls[0] != calls[1])) {
+        abort();
+    }
+    for (size_t i = 0; i < n; i++) {
+        zz_clear(&w[i]);
+    }
+    free(w);
     zz_clear(&u);
+    zz_clear(&v);
+    zz_reset_stats();
+    zz_get_stats(&st);
+    if (st.calls[ZZ_OP_MUL] || zz_set_stats(false)) {
+        abort();
+    }
 }
 
 int main(void)
@@ -887,21 +2188,43 @@ int main(void)
     check_lsbpos_examples();
     check_bitcnt_bulk();
     check_bitcnt_examples();
+    check_bitlen_bulk();
+    check_tstbit_bulk();
+    check_chbit_bulk();
+    check_chbit_examples();
     check_sqrtrem_bulk();
     check_sqrtrem_examples();
+    check_rootrem_bulk();
+    check_is_square_bulk();
+    check_perfect_power_bulk();
+    check_rootrem_examples();
     check_bin();
+    check_comb();
     check_isodd_bulk();
     check_isneg();
     check_gcdext_bulk();
     check_gcdext_examples();
     check_invert_euclidext_bulk();
+    check_prodtree_bulk();
+    check_prodtree_pool();
     check_fromto_double();
     check_sizeinbase();
     check_fromto_i32();
     check_fromto_i64();
     check_exportimport_roundtrip();
     check_exportimport_examples();
+    check_exportimport_layouts();
+    check_stream();
+    check_view_adopt();
     check_sizeof();
+    check_reserve();
+    check_tracker();
+    check_tracker_reuse();
+    check_arena();
+    check_pool();
+    check_alloc_owner();
+    check_scratch();
+    check_stats();
 #ifdef HAVE_SYS_RESOURCE_H
     struct rlimit new, old;
 
@@ -227,6 +227,457 @@ zz_ref_pow(const zz_t *u, uint64_t v, zz_t *w)
     return ZZ_OK;
 }
 
+void
+check_powm_ctx(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs = (zz_bitcnt_t)(i % 5 ? 1 + rand() % 512
+                                       : 1 + rand() % 4096);
+        zz_t u, v, w, z, r;
+        zz_mod_ctx ctx;
+
+        if (zz_init(&u) || zz_random(bs + 64, true, &u)) {
+            abort();
+        }
+        if (zz_init(&v) || zz_random(128, false, &v)) {
+            abort();
+        }
+        if (zz_init(&w) || zz_random(bs, true, &w)) {
+            abort();
+        }
+        if (i % 3 == 0 && zz_mul_2exp(&w, (zz_bitcnt_t)(rand() % 200), &w)) {
+            abort();
+        }
+        if (zz_init(&z) || zz_init(&r)) {
+            abort();
+        }
+        if (zz_iszero(&w)) {
+            if (zz_mod_ctx_init(&w, &ctx) != ZZ_VAL) {
+                abort();
+            }
+            goto clear;
+        }
+        if (zz_mod_ctx_init(&w, &ctx)) {
+            abort();
+        }
+        /* Check both unreduced and reduced bases. */
+        for (int j = 0; j < 2; j++) {
+            if (zz_powm_ctx(&u, &v, &ctx, &z) || zz_powm(&u, &v, &w, &r)
+                || zz_cmp(&z, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+            if (zz_pos(&u, &z) || zz_powm_ctx(&z, &v, &ctx, &z)
+                || zz_cmp(&z, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+            if (zz_mulmod_ctx(&u, &v, &ctx, &z) || zz_mul(&u, &v, &r)
+                || zz_div(&r, &w, NULL, &r) || zz_cmp(&z, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+            if (zz_div(&u, &w, NULL, &u)) {
+                abort();
+            }
+        }
+        if (zz_set(1, &z) || zz_powm_ctx(&u, &z, &ctx, &z)
+            || zz_div(&u, &w, NULL, &r) || zz_cmp(&z, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+        if (zz_set(0, &z) || zz_powm(&u, &z, &w, &r)
+            || zz_powm_ctx(&u, &z, &ctx, &z) || zz_cmp(&z, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+        if (zz_mulmod_ctx(&u, &u, &ctx, &z) || zz_mul(&u, &u, &r)
+            || zz_div(&r, &w, NULL, &r) || zz_cmp(&z, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+        if (zz_mulmod_ctx(&u, &u, &ctx, &u) || zz_cmp(&u, &r) != ZZ_EQ) {
+            abort();
+        }
+        if (!zz_iszero(&v) && (zz_neg(&v, &z)
+                               || zz_powm_ctx(&u, &z, &ctx, &z) != ZZ_VAL))
+        {
+            abort();
+        }
+        if (zz_isodd(&w)) {
+            zz_bitcnt_t rb = 64*(zz_bitcnt_t)((zz_bitlen(&w) + 63)/64);
+
+            if (zz_random(2*rb, false, &u) || zz_redc(&u, &ctx, &z)) {
+                abort();
+            }
+            /* z*R = u mod w */
+            if (zz_mul_2exp(&z, rb, &r) || zz_sub(&r, &u, &r)
+                || zz_div(&r, &w, NULL, &r) || !zz_iszero(&r))
+            {
+                abort();
+            }
+            if (zz_set(1, &u) || zz_mul_2exp(&u, 2*rb, &u)
+                || zz_redc(&u, &ctx, &z) != ZZ_VAL)
+            {
+                abort();
+            }
+        }
+        else if (zz_redc(&v, &ctx, &z) != ZZ_VAL) {
+            abort();
+        }
+        zz_mod_ctx_clear(&ctx);
+clear:
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&w);
+        zz_clear(&z);
+        zz_clear(&r);
+    }
+}
+
+void
+check_powm_fixed(void)
+{
+    for (size_t i = 0; i < nsamples/10; i++) {
+        zz_bitcnt_t bs = (zz_bitcnt_t)(1 + rand() % 1024);
+        zz_bitcnt_t bits = (zz_bitcnt_t)(rand() % 600);
+        zz_t u, v, w, z, r;
+        zz_mod_ctx ctx;
+        zz_powm_table tab;
+
+        if (zz_init(&u) || zz_random(bs + 64, true, &u)) {
+            abort();
+        }
+        if (zz_init(&w) || zz_random(bs, true, &w) || zz_add(&w, 1, &w)) {
+            abort();
+        }
+        if (i % 3 == 0 && zz_mul_2exp(&w, (zz_bitcnt_t)(rand() % 100), &w)) {
+            abort();
+        }
+        if (zz_init(&v) || zz_init(&z) || zz_init(&r)) {
+            abort();
+        }
+        if (zz_iszero(&w)) {
+            goto clear;
+        }
+        if (zz_mod_ctx_init(&w, &ctx)
+            || zz_powm_table_init(&u, bits, &ctx, &tab))
+        {
+            abort();
+        }
+        for (size_t j = 0; j < 10; j++) {
+            zz_bitcnt_t eb = (zz_bitcnt_t)rand() % (bits + 1);
+
+            if (j == 9) {
+                eb = bits + 100;
+            }
+            if (zz_random(eb, false, &v) || zz_powm_fixed(&v, &tab, &z)
+                || zz_powm(&u, &v, &w, &r) || zz_cmp(&z, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+        if (zz_powm_fixed(&v, &tab, &v) || zz_cmp(&v, &r) != ZZ_EQ) {
+            abort();
+        }
+        if (zz_set(-5, &v) || zz_powm_fixed(&v, &tab, &z) != ZZ_VAL) {
+            abort();
+        }
+        zz_powm_table_clear(&tab);
+        zz_mod_ctx_clear(&ctx);
+clear:
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&w);
+        zz_clear(&z);
+        zz_clear(&r);
+    }
+}
+
+void
+check_powm_multi(void)
+{
+    for (size_t i = 0; i < nsamples/10; i++) {
+        zz_bitcnt_t bs = (zz_bitcnt_t)(1 + rand() % 1024);
+        size_t n = (size_t)(rand() % 6);
+        zz_t u[6], v[6], w, z, r, t;
+        zz_mod_ctx ctx;
+
+        for (size_t j = 0; j < 6; j++) {
+            zz_bitcnt_t eb = (zz_bitcnt_t)(rand() % 1200);
+
+            if (zz_init(&u[j]) || zz_random(bs + 64, true, &u[j])) {
+                abort();
+            }
+            if (zz_init(&v[j]) || zz_random(eb, false, &v[j])) {
+                abort();
+            }
+        }
+        if (zz_init(&w) || zz_random(bs, true, &w) || zz_add(&w, 1, &w)) {
+            abort();
+        }
+        if (i % 3 == 0 && zz_mul_2exp(&w, (zz_bitcnt_t)(rand() % 100), &w)) {
+            abort();
+        }
+        if (zz_init(&z) || zz_init(&r) || zz_init(&t)) {
+            abort();
+        }
+        if (zz_iszero(&w)) {
+            goto clear;
+        }
+        if (zz_mod_ctx_init(&w, &ctx) || zz_powm_multi(n, u, v, &ctx, &z)) {
+            abort();
+        }
+        if (zz_set(1, &r) || zz_div(&r, &w, NULL, &r)) {
+            abort();
+        }
+        for (size_t j = 0; j < n; j++) {
+            if (zz_powm(&u[j], &v[j], &w, &t) || zz_mul(&r, &t, &r)
+                || zz_div(&r, &w, NULL, &r))
+            {
+                abort();
+            }
+        }
+        if (zz_cmp(&z, &r) != ZZ_EQ) {
+            abort();
+        }
+        if (n && (zz_powm_multi(n, u, v, &ctx, &u[0])
+                  || zz_cmp(&u[0], &r) != ZZ_EQ))
+        {
+            abort();
+        }
+        if (n && (zz_set(-5, &v[n - 1])
+                  || zz_powm_multi(n, u, v, &ctx, &z) != ZZ_VAL))
+        {
+            abort();
+        }
+        zz_mod_ctx_clear(&ctx);
+clear:
+        for (size_t j = 0; j < 6; j++) {
+            zz_clear(&u[j]);
+            zz_clear(&v[j]);
+        }
+        zz_clear(&w);
+        zz_clear(&z);
+        zz_clear(&r);
+        zz_clear(&t);
+    }
+}
+
+void
+check_powm_sec(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs = (zz_bitcnt_t)(1 + rand() % 1024);
+        zz_t u, v, w, z, r;
+        zz_mod_ctx ctx;
+
+        if (zz_init(&u) || zz_random(bs + 64, true, &u)) {
+            abort();
+        }
+        if (zz_init(&v) || zz_random((zz_bitcnt_t)(rand() % 400), false, &v)) {
+            abort();
+        }
+        if (zz_init(&w) || zz_random(bs, true, &w) || zz_iszero(&w)) {
+            zz_clear(&u);
+            zz_clear(&v);
+            zz_clear(&w);
+            continue;
+        }
+        if (zz_init(&z) || zz_init(&r) || zz_mod_ctx_init(&w, &ctx)) {
+            abort();
+        }
+        if (!zz_isodd(&w)) {
+            if (zz_powm_sec(&u, &v, &ctx, &z) != ZZ_VAL
+                || zz_inverse_sec(&u, &ctx, &z) != ZZ_VAL)
+            {
+                abort();
+            }
+            goto clear;
+        }
+        if (zz_powm_sec(&u, &v, &ctx, &z) || zz_powm(&u, &v, &w, &r)
+            || zz_cmp(&z, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+        if (zz_div(&u, &w, NULL, &z) || zz_powm_sec(&z, &v, &ctx, &z)
+            || zz_cmp(&z, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+
+        zz_err ret = zz_inverse_sec(&u, &ctx, &z);
+
+        if (ret == ZZ_OK) {
+            if (zz_mul(&z, &u, &r) || zz_sub(&r, 1, &r)
+                || zz_div(&r, &w, NULL, &r) || !zz_iszero(&r))
+            {
+                abort();
+            }
+            /* Same as zz_inverse(), but with the sign of the modulus. */
+            if (zz_inverse(&u, &w, &r)
+                || (zz_isneg(&w) && !zz_iszero(&r) && zz_add(&r, &w, &r))
+                || zz_cmp(&z, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+        else if (ret != ZZ_VAL || zz_ref_gcd(&u, &w, &z)
+                 || zz_cmp(&z, 1) == ZZ_EQ)
+        {
+            abort();
+        }
+        if (zz_set(-1, &z) || zz_powm_sec(&u, &z, &ctx, &z) != ZZ_VAL) {
+            abort();
+        }
+clear:
+        zz_mod_ctx_clear(&ctx);
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&w);
+        zz_clear(&z);
+        zz_clear(&r);
+    }
+}
+
+zz_err
+zz_ref_inverse(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    mpz_t z;
+    TMP_MPZ(mu, u);
+    TMP_MPZ(mv, v);
+    if (TMP_OVERFLOW) {
+        return ZZ_MEM;
+    }
+    mpz_init(z);
+    if (!mpz_invert(z, mu, mv)) {
+        mpz_clear(z);
+        return ZZ_VAL;
+    }
+    if (zz_set_mpz_t(z, w)) {
+        mpz_clear(z);
+        return ZZ_MEM;
+    }
+    mpz_clear(z);
+    return ZZ_OK;
+}
+
+void
+check_inverse_bulk(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs = (zz_bitcnt_t)(1 + rand() % 1024);
+        zz_t u, v, z, r;
+
+        if (zz_init(&u) || zz_random(bs + (zz_bitcnt_t)(rand() % 128), true,
+                                     &u))
+        {
+            abort();
+        }
+        if (zz_init(&v) || zz_random(bs, true, &v)) {
+            abort();
+        }
+        if (zz_init(&z) || zz_init(&r)) {
+            abort();
+        }
+        if (zz_iszero(&v)) {
+            if (zz_inverse(&u, &v, &z) != ZZ_VAL) {
+                abort();
+            }
+            goto clear;
+        }
+
+        zz_err ret = zz_inverse(&u, &v, &z);
+
+        if (ret != zz_ref_inverse(&u, &v, &r)
+            || (ret == ZZ_OK && zz_cmp(&z, &r) != ZZ_EQ))
+        {
+            abort();
+        }
+        if (ret == ZZ_OK && (zz_pos(&u, &z) || zz_inverse(&z, &v, &z)
+                             || zz_cmp(&z, &r) != ZZ_EQ
+                             || zz_pos(&v, &z) || zz_inverse(&u, &z, &z)
+                             || zz_cmp(&z, &r) != ZZ_EQ))
+        {
+            abort();
+        }
+clear:
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&z);
+        zz_clear(&r);
+    }
+}
+
+void
+check_inverse_batch(void)
+{
+    for (size_t i = 0; i < nsamples/10; i++) {
+        zz_bitcnt_t bs = (zz_bitcnt_t)(1 + rand() % 512);
+        size_t n = (size_t)(rand() % 20);
+        zz_t u[20], w[20], m, r;
+        zz_mod_ctx ctx;
+        zz_err ret = ZZ_OK;
+
+        if (zz_init(&m) || zz_random(bs, true, &m) || zz_add(&m, 1, &m)
+            || zz_init(&r))
+        {
+            abort();
+        }
+        if (zz_iszero(&m)) {
+            zz_clear(&m);
+            zz_clear(&r);
+            continue;
+        }
+        for (size_t j = 0; j < n; j++) {
+            if (zz_init(&u[j]) || zz_random(bs + 64, true, &u[j])
+                || zz_init(&w[j]))
+            {
+                abort();
+            }
+            if (ret == ZZ_OK) {
+                ret = zz_inverse(&u[j], &m, &r);
+            }
+        }
+        if (zz_mod_ctx_init(&m, &ctx)
+            || zz_inverse_batch(n, u, &ctx, w) != ret)
+        {
+            abort();
+        }
+        for (size_t j = 0; ret == ZZ_OK && j < n; j++) {
+            if (zz_mulmod_ctx(&u[j], &w[j], &ctx, &r)
+                || zz_sub(&r, 1, &r) || zz_div(&r, &m, NULL, &r)
+                || !zz_iszero(&r))
+            {
+                abort();
+            }
+            if (zz_inverse(&u[j], &m, &r)
+                || (zz_isneg(&m) && !zz_iszero(&r) && zz_add(&r, &m, &r))
+                || zz_cmp(&w[j], &r) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+        if (ret == ZZ_OK) {
+            if (zz_inverse_batch(n, u, &ctx, u)) {
+                abort();
+            }
+            for (size_t j = 0; j < n; j++) {
+                if (zz_cmp(&u[j], &w[j]) != ZZ_EQ) {
+                    abort();
+                }
+            }
+        }
+        for (size_t j = 0; j < n; j++) {
+            zz_clear(&u[j]);
+            zz_clear(&w[j]);
+        }
+        zz_mod_ctx_clear(&ctx);
+        zz_clear(&m);
+        zz_clear(&r);
+    }
+}
+
 void
 check_pow_bulk(void)
 {
@@ -273,6 +724,44 @@ check_pow_bulk(void)
     }
 }
 
+void
+check_pow_shapes(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_t u, w, r;
+        uint64_t v = (uint64_t)rand() % (rand() % 10 > 7 ? 3000 : 70);
+
+        if (zz_init(&u) || zz_init(&w) || zz_init(&r)) {
+            abort();
+        }
+        /* Small, even and power of two bases. */
+        if (zz_random((zz_bitcnt_t)(1 + rand() % 130), true, &u)
+            || (rand() % 4 == 0 && zz_set(rand() % 2 ? 1 : -1, &u))
+            || zz_mul_2exp(&u, (zz_bitcnt_t)(rand() % 3 ? rand() % 70 : 0),
+                           &u))
+        {
+            abort();
+        }
+        if (zz_pow(&u, v, &w) || zz_ref_pow(&u, v, &r)
+            || zz_cmp(&w, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+        /* Memory is allocated for the result size. */
+        if (w.alloc > (zz_size_t)(zz_bitlen(&u)*v/ZZ_DIGIT_T_BITS) + 2
+            && w.alloc > ZZ_SMALL_DIGITS)
+        {
+            abort();
+        }
+        if (zz_pos(&u, &w) || zz_pow(&w, v, &w) || zz_cmp(&w, &r) != ZZ_EQ) {
+            abort();
+        }
+        zz_clear(&u);
+        zz_clear(&w);
+        zz_clear(&r);
+    }
+}
+
 void
 check_pow_examples(void)
 {
@@ -304,7 +793,14 @@ int main(void)
     zz_setup();
     check_powm_bulk();
     check_powm_examples();
+    check_powm_ctx();
+    check_powm_fixed();
+    check_powm_multi();
+    check_powm_sec();
+    check_inverse_bulk();
+    check_inverse_batch();
     check_pow_bulk();
+    check_pow_shapes();
     check_pow_examples();
     zz_finish();
     zz_testclear();
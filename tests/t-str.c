@@ -45,12 +45,145 @@ check_str_roundtrip(void)
         {
             abort();
         }
+
+        char *buf2;
+
+        if (zz_get_str_size(&v, base, &len) || !(buf2 = malloc(len))
+            || zz_get_str_destructive(&v, base, buf2) || strcmp(buf, buf2)
+            || zz_cmp(&v, 0) != ZZ_EQ)
+        {
+            abort();
+        }
+        free(buf2);
         free(buf);
         zz_clear(&u);
         zz_clear(&v);
     }
 }
 
+void
+check_str_big(void)
+{
+    /* Exercise divide-and-conquer and threaded conversion. */
+    const zz_size_t sizes[] = {65, 300, 5000, 40000};
+    const int bases[] = {10, 3, 10, 36, -7};
+
+    for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+#if HAVE_PTHREAD_H
+        if (zz_set_mul_threads(sizes[i] >= 16384 ? 4 : 1, 8192)) {
+            abort();
+        }
+#endif
+        for (size_t j = 0; j < sizeof(bases)/sizeof(bases[0]); j++) {
+            zz_t u, v;
+            mpz_t z;
+            int base = bases[j];
+
+            if (zz_init(&u) || zz_init(&v)
+                || zz_random((zz_bitcnt_t)sizes[i]*64, true, &u))
+            {
+                abort();
+            }
+
+            size_t len;
+
+            (void)zz_sizeinbase(&u, base, &len);
+
+            char *buf = malloc(len + 2), *ref = malloc(len + 2);
+
+            if (!buf || !ref || zz_get_str(&u, base, buf)) {
+                abort();
+            }
+
+            TMP_MPZ(mu, &u);
+            mpz_init(z);
+            mpz_get_str(ref, base, mu);
+            if (strcmp(buf, ref)) {
+                abort();
+            }
+            if (zz_set_str(buf, abs(base), &v) || zz_cmp(&u, &v) != ZZ_EQ) {
+                abort();
+            }
+            if (mpz_set_str(z, ref, abs(base))) {
+                abort();
+            }
+            mpz_clear(z);
+            free(buf);
+            free(ref);
+            zz_clear(&u);
+            zz_clear(&v);
+        }
+    }
+    if (zz_set_mul_threads(1, 8192)) {
+        abort();
+    }
+    zz_radix_cache_clear();
+}
+
+#if HAVE_PTHREAD_H
+static pthread_t main_thread;
+
+static void *
+main_malloc(size_t size)
+{
+    if (!pthread_equal(pthread_self(), main_thread)) {
+        abort();
+    }
+    return malloc(size);
+}
+
+static void *
+main_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+    (void)old_size;
+    if (!pthread_equal(pthread_self(), main_thread)) {
+        abort();
+    }
+    return realloc(ptr, new_size);
+}
+
+static void
+main_free(void *ptr, size_t size)
+{
+    (void)size;
+    if (!pthread_equal(pthread_self(), main_thread)) {
+        abort();
+    }
+    free(ptr);
+}
+
+void
+check_str_threads(void)
+{
+    /* Big conversions don't start threads with default settings. */
+    main_thread = pthread_self();
+    zz_set_memory_funcs(main_malloc, main_realloc, main_free);
+
+    zz_t u, v;
+    size_t len;
+
+    if (zz_init(&u) || zz_init(&v) || zz_random(40000*64, false, &u)
+        || zz_setbit(&u, 40000*64 - 1)
+        || zz_sizeinbase(&u, 10, &len))
+    {
+        abort();
+    }
+
+    char *buf = malloc(len + 2);
+
+    if (!buf || zz_get_str(&u, 10, buf) || zz_set_str(buf, 10, &v)
+        || zz_cmp(&u, &v) != ZZ_EQ)
+    {
+        abort();
+    }
+    free(buf);
+    zz_clear(&u);
+    zz_clear(&v);
+    zz_radix_cache_clear();
+    zz_set_memory_funcs(NULL, NULL, NULL);
+}
+#endif /* HAVE_PTHREAD_H */
+
 void
 check_str_examples(void)
 {
@@ -62,6 +195,14 @@ check_str_examples(void)
     if (zz_get_str(&u, 38, NULL) != ZZ_VAL) {
         abort();
     }
+    if (zz_get_str_destructive(&u, 38, NULL) != ZZ_VAL
+        || zz_cmp(&u, 0) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_get_str_size(&u, 1, NULL) != ZZ_VAL) {
+        abort();
+    }
     if (zz_set_str(" ", 2, &u) != ZZ_VAL) {
         abort();
     }
@@ -134,6 +275,39 @@ check_str_examples(void)
     if (zz_set_str("-123", 0, &u) || zz_cmp(&u, -123) != ZZ_EQ) {
         abort();
     }
+    if (zz_set_str("0 ", 0, &u) || zz_cmp(&u, 0) != ZZ_EQ) {
+        abort();
+    }
+    if (zz_set_str("- ", 10, &u) != ZZ_VAL) {
+        abort();
+    }
+    if (zz_set_str("0x0x1", 0, &u) != ZZ_VAL) {
+        abort();
+    }
+    if (zz_set_str("1_0_1_1", 2, &u) || zz_cmp(&u, 11) != ZZ_EQ) {
+        abort();
+    }
+    if (zz_set_strn("12345", 3, 10, &u) || zz_cmp(&u, 123) != ZZ_EQ) {
+        abort();
+    }
+    if (zz_set_strn("-0x1f!", 5, 0, &u) || zz_cmp(&u, -31) != ZZ_EQ) {
+        abort();
+    }
+    if (zz_set_strn("12_", 3, 10, &u) != ZZ_VAL) {
+        abort();
+    }
+    if (zz_set_str("12_", 10, &u) != ZZ_VAL) {
+        abort();
+    }
+    if (zz_set_str("12_ ", 10, &u) != ZZ_VAL) {
+        abort();
+    }
+    if (zz_set_str("12_-3", 10, &u) != ZZ_VAL) {
+        abort();
+    }
+    if (zz_set_strn("123", 0, 10, &u) != ZZ_VAL) {
+        abort();
+    }
 
     char buf[10];
 
@@ -141,6 +315,21 @@ check_str_examples(void)
         abort();
     }
     zz_clear(&u);
+
+    /* The read-only buffer of a view isn't used as scratch space. */
+    zz_digit_t digits[40], ref[40];
+    char str1[800], str2[800];
+
+    for (size_t i = 0; i < 40; i++) {
+        digits[i] = ref[i] = 0x123456789abcdef1ULL*(i + 1);
+    }
+    if (zz_view(40, digits, &u) || zz_get_str(&u, 10, str1)
+        || zz_get_str_destructive(&u, 10, str2) || strcmp(str1, str2)
+        || memcmp(digits, ref, sizeof(digits)) || !zz_iszero(&u))
+    {
+        abort();
+    }
+    zz_clear(&u);
 }
 
 int main(void)
@@ -149,6 +338,10 @@ int main(void)
     zz_testinit();
     zz_setup();
     check_str_roundtrip();
+    check_str_big();
+#if HAVE_PTHREAD_H
+    check_str_threads();
+#endif
     check_str_examples();
     zz_finish();
     zz_testclear();
@@ -52,6 +52,76 @@
 #  define ZZ_BITS_MAX (zz_bitcnt_t)ZZ_DIGITS_MAX*ZZ_DIGIT_T_BITS
 #endif
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#  include <intrin.h>
+#endif
+
+/* Count trailing and leading zero bits of a nonzero digit. */
+static inline unsigned int
+zz_digit_ctz(zz_digit_t d)
+{
+    assert(d);
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctzll(d);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long r;
+
+    _BitScanForward64(&r, d);
+    return (unsigned int)r;
+#else
+    unsigned int r = 0;
+
+    for (unsigned int s = ZZ_DIGIT_T_BITS/2; s; s /= 2) {
+        if (!(d & (ZZ_DIGIT_T_MAX >> (ZZ_DIGIT_T_BITS - s)))) {
+            d >>= s;
+            r += s;
+        }
+    }
+    return r;
+#endif
+}
+
+static inline unsigned int
+zz_digit_clz(zz_digit_t d)
+{
+    assert(d);
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_clzll(d);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long r;
+
+    _BitScanReverse64(&r, d);
+    return ZZ_DIGIT_T_BITS - 1 - (unsigned int)r;
+#else
+    unsigned int r = 0;
+
+    for (unsigned int s = ZZ_DIGIT_T_BITS/2; s; s /= 2) {
+        if (!(d >> (ZZ_DIGIT_T_BITS - s))) {
+            d <<= s;
+            r += s;
+        }
+    }
+    return r;
+#endif
+}
+
+/* Count set bits of a digit.  The popcnt instruction is not in the x86-64
+   baseline, MSVC emits it unconditionally: use it only if AVX is on. */
+static inline unsigned int
+zz_digit_popcount(zz_digit_t d)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_popcountll(d);
+#elif defined(_MSC_VER) && defined(_M_X64) && defined(__AVX__)
+    return (unsigned int)__popcnt64(d);
+#else
+    d -= (d >> 1) & 0x5555555555555555;
+    d = (d & 0x3333333333333333) + ((d >> 2) & 0x3333333333333333);
+    d = (d + (d >> 4)) & 0x0f0f0f0f0f0f0f0f;
+    return (unsigned int)((d * 0x0101010101010101) >> 56);
+#endif
+}
+
 #ifdef __GNUC__
 #  pragma GCC diagnostic push
 #  pragma GCC diagnostic ignored "-Wunused-variable"
@@ -68,6 +138,16 @@ static _Thread_local jmp_buf zz_env;
 #define GETALLOC(u) ((u)->alloc)
 #define SETALLOC(u, v) ((v)->alloc = (u))
 
+#define ISSMALL(u) ((u)->digits == (u)->small_digits)
+/* Integer is a read-only view of an external buffer, see zz_view(). */
+#define ISVIEW(u) ((u)->alloc < 0)
+/* Integer owns a buffer, passed to zz_adopt().  Unlike other storage, it
+   was allocated by functions of the zz_set_memory_funcs() without header of
+   our allocator.  The mark is kept in the inline storage, which is unused
+   for such integers. */
+#define ISADOPTED(u) (!ISSMALL(u) && !ISVIEW(u) && (u)->small_digits[0])
+#define SETADOPTED(b, u) ((u)->small_digits[0] = (b))
+
 #define TMP_MPZ(z, u)                                   \
     mpz_t z;                                            \
                                                         \
@@ -87,9 +167,6 @@ static _Thread_local jmp_buf zz_env;
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define ABS_CAST(T, x) ((x) >= 0 ? ((T) (x)) : ((T) (((T) -((x) + 1)) + 1U)))
 
-void zz_set_memory_funcs(void *(*malloc) (size_t),
-                         void *(*realloc) (void *, size_t, size_t),
-                         void (*free) (void *, size_t));
 size_t zz_get_alloc_state(void);
 zz_err zz_inverse_euclidext(const zz_t *u, const zz_t *v, zz_t *t);
 zz_err zz_set_mpz_t(mpz_t u, zz_t *v);
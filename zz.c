@@ -18,6 +18,10 @@
 
 #include "zz-impl.h"
 
+#if HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+
 #undef zz_set
 #undef zz_get
 #undef zz_cmp
@@ -25,6 +29,17 @@
 #undef zz_sub
 #undef zz_mul
 #undef zz_div
+#undef zz_addmul
+#undef zz_submul
+#undef zz_add_i64
+#undef zz_sub_i64
+#undef zz_mul_i64
+#undef zz_mul_u64
+#undef zz_cmp_i64
+#undef zz_iszero
+#undef zz_isneg
+#undef zz_isodd
+#undef zz_tstbit
 
 #if GMP_NAIL_BITS != 0
 #  error "GMP_NAIL_BITS expected to be 0"
@@ -52,25 +67,12 @@ zz_get_bitcnt_max(void)
 size_t
 zz_sizeof(const zz_t *u)
 {
+    if (ISSMALL(u) || ISVIEW(u)) {
+        return sizeof(zz_t);
+    }
     return sizeof(zz_t) + (size_t)GETALLOC(u)*sizeof(zz_digit_t);
 }
 
-static struct {
-    void *(*default_allocate_func)(size_t);
-    void *(*default_reallocate_func)(void *, size_t, size_t);
-    void (*default_free_func)(void *, size_t);
-    void *(*malloc)(size_t);
-    void *(*realloc)(void *, size_t, size_t);
-    void (*free)(void *, size_t);
-} zz_state;
-
-#define TRACKER_SIZE_INCR 64
-_Thread_local struct {
-    size_t size;
-    size_t alloc;
-    void **ptrs;
-} zz_tracker = {0, 0, NULL};
-
 /* Thin wrappers over system allocation routines to
    support GMP's argument convention. */
 
@@ -88,2549 +90,7298 @@ zz_free(void *ptr, size_t size)
     free(ptr);
 }
 
-/* Following functions are used to handle all *temporary* allocations in the
-   GMP, apart from temporary space from alloca() if that function is available
-   and GMP is configured to use it (bad idea).
+static struct {
+    void *(*default_allocate_func)(size_t);
+    void *(*default_reallocate_func)(void *, size_t, size_t);
+    void (*default_free_func)(void *, size_t);
+    void *(*malloc)(size_t);
+    void *(*realloc)(void *, size_t, size_t);
+    void (*free)(void *, size_t);
+} zz_state = {NULL, NULL, NULL, zz_malloc, zz_realloc, zz_free};
+
+
+/* The arena or the pool, that serves all allocations of the current
+   thread, if any. */
+static _Thread_local zz_arena *zz_cur_arena = NULL;
+static _Thread_local zz_pool *zz_cur_pool = NULL;
+/* The scratch for temporary allocations of the current thread, if any. */
+static _Thread_local zz_scratch *zz_cur_scratch = NULL;
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/* Tracker of GMP's temporary allocations.  Each allocation keeps its slot
+   index in the ptrs array in the header of our allocator (see MEM_TRACKER),
+   so insertion and removal take O(1) time.
+   Released slots are chained in a free list and reused, so allocations that
+   outlive others (e.g. digits of mpz_t, using our memory functions) don't
+   grow the array.  Once the tracker is empty, slots are taken from the
+   start again.  First TRACKER_SIZE_INCR slots are stored in the structure
+   itself, that covers all but very deep call chains - without memory
+   allocation for the tracker.  A bigger array is kept for the thread, until
+   zz_finish() or the thread exit. */
+#define TRACKER_SIZE_INCR 64
+#define TRACKER_NONE (SIZE_MAX >> 1)
+_Thread_local struct {
+    size_t size;
+    size_t used;
+    size_t free;
+    size_t alloc;
+    void **ptrs;
+    void *small_ptrs[TRACKER_SIZE_INCR];
+} zz_tracker = {0, 0, TRACKER_NONE, 0, NULL, {NULL}};
+
+/* Free slots keep the index of the next one, tagged with the lowest bit
+   (headers of allocations are aligned). */
+#define TRACKER_LINK(i) ((void *)(((uintptr_t)(i) << 1) | 1))
+#define TRACKER_NEXT(p) ((size_t)((uintptr_t)(p) >> 1))
+#define TRACKER_ISFREE(p) ((uintptr_t)(p) & 1)
+
+/* Usage statistics of the current thread.  They are collected only if
+   the library is configured with --enable-stats and the collection is
+   turned on by zz_set_stats(), otherwise macros below expand to nothing.
+   Counters of worker threads are added to the thread, that joins them. */
+#ifndef ENABLE_STATS
+#  define ENABLE_STATS 0
+#endif
 
-   Calls to GMP's functions, which do memory allocations, must be preceded by
-   *one* "if (TMP_OVERFLOW)" block (TMP_OVERFLOW macro calls setjmp), that will
-   handle memory failure *after* freeing *all* GMP's allocations in the
-   zz_reallocate_function().
+#if ENABLE_STATS
+static bool zz_stats_enabled = false;
+static _Thread_local zz_stats zz_stats_tls;
 
-   Basically, GMP's functions for integers fall into two camps.  First,
-   low-level functions, prefixed by "mpn_", which we prefer.  (See zz_mul() as
-   an example.)  Those will use only zz_allocate_function() and
-   zz_free_function() to allocate temporary storage (not for output variables).
-   This allocation happens essentially in LIFO way and we take that into
-   account for optimization of the memory tracking.
+static void
+zz_stats_call(zz_op op, zz_size_t size)
+{
+    int k = 0;
 
-   Not all mpn_*() functions do memory allocation.  Sometimes it's obvious
-   (e.g. mpn_cmp() or mpn_add/sub()), sometimes - not (e.g. mpn_get/set_str()
-   for power of 2 bases).  Though, these details aren't documented and if you
-   feel that in the given case things might be changed - please add the "if
-   (TMP_OVERFLOW)" block.
+    while (size && k < ZZ_STATS_BUCKETS - 1) {
+        size >>= 1;
+        k++;
+    }
+    zz_stats_tls.calls[op]++;
+    zz_stats_tls.sizes[op][k]++;
+}
 
-   Second, in few cases we use integer functions, working with objects of type
-   mpz_t, prefixed by "mpz_".  Input variables for them must be created by the
-   TMP_MPZ macro.  Output variables (allocated by the GMP) are considered
-   temporary and cleared automatically on memory failure.  Here is an example:
+static void
+zz_stats_merge(const zz_stats *s)
+{
+    for (int op = 0; op < ZZ_OPS; op++) {
+        zz_stats_tls.calls[op] += s->calls[op];
+        for (int k = 0; k < ZZ_STATS_BUCKETS; k++) {
+            zz_stats_tls.sizes[op][k] += s->sizes[op][k];
+        }
+    }
+    zz_stats_tls.resize_count += s->resize_count;
+    zz_stats_tls.resize_bytes += s->resize_bytes;
+    zz_stats_tls.tmp_count += s->tmp_count;
+    zz_stats_tls.tmp_bytes += s->tmp_bytes;
+    zz_stats_tls.tmp_peak = MAX(zz_stats_tls.tmp_peak, s->tmp_peak);
+    zz_stats_tls.mem_errors += s->mem_errors;
+}
 
-       zz_err
-       mul(const zz_t *u, const zz_t *v, zz_t *w)
-       {
-           mpz_t z;
-           TMP_MPZ(a, u);
-           TMP_MPZ(b, v);
-           if (TMP_OVERFLOW) {
-               // Memory allocation failure happened in mpz_mul.
-               // No need to call mpz_clear(z)!
-               return ZZ_MEM;
-           }
-           mpz_init(z);
-           mpz_mul(z, a, b);
-           // Success!  Resize w and copy z's content to it.
-           if (zz_set_mpz_t(z, w)) {
-               mpz_clear(z);
-               return ZZ_MEM;
-           }
-           mpz_clear(z); // That finally clear all temporary allocations.
-           return ZZ_OK;
-       }
+#  define ZZ_STAT_CALL(op, size)                                \
+    do {                                                        \
+        if (zz_stats_enabled) {                                 \
+            zz_stats_call((op), (size));                        \
+        }                                                       \
+    } while (0)
+#  define ZZ_STAT_ADD(field, n)                                 \
+    do {                                                        \
+        if (zz_stats_enabled) {                                 \
+            zz_stats_tls.field += (n);                          \
+        }                                                       \
+    } while (0)
+#  define ZZ_STAT_MAX(field, n)                                 \
+    do {                                                        \
+        if (zz_stats_enabled) {                                 \
+            zz_stats_tls.field = MAX(zz_stats_tls.field, (n));  \
+        }                                                       \
+    } while (0)
+#else
+#  define ZZ_STAT_CALL(op, size) ((void)0)
+#  define ZZ_STAT_ADD(field, n) ((void)0)
+#  define ZZ_STAT_MAX(field, n) ((void)0)
+#endif
 
-   Note that our memory allocation functions are generic enough to work also
-   for usual GMP usage, without above assumptions.  Of course, unless memory
-   allocation failure happens, which will lead to undefined behavior (calling
-   longjmp() without a prior call to setjmp()).
+zz_err
+zz_set_stats(bool enable)
+{
+#if ENABLE_STATS
+    zz_stats_enabled = enable;
+    return ZZ_OK;
+#else
+    return enable ? ZZ_VAL : ZZ_OK;
+#endif
+}
 
-   Don't forget known pitfails of working with setjmp/longjmp:
+void
+zz_get_stats(zz_stats *stats)
+{
+#if ENABLE_STATS
+    *stats = zz_stats_tls;
+#else
+    memset(stats, 0, sizeof(zz_stats));
+#endif
+}
 
-     * Don't use VLA (may introduce memory leaks).
+void
+zz_reset_stats(void)
+{
+#if ENABLE_STATS
+    memset(&zz_stats_tls, 0, sizeof(zz_stats));
+#endif
+}
 
-     * Declare variables you care about (e.g. to free memory in
-       case of failure) in the scope of the setjmp invocation - with
-       volatile type qualifier.  See zz_gcd() as an example. */
+#if HAVE_PTHREAD_H
+#  if ENABLE_STATS
+typedef struct {
+    void *(*run)(void *);
+    void *arg;
+    zz_stats stats;
+} zz_stats_thread;
 
 static void *
-zz_reallocate_function(void *ptr, size_t old_size, size_t new_size)
+zz_stats_worker(void *arg)
 {
-    if (zz_tracker.size >= zz_tracker.alloc) {
-        /* Reallocation shouldn't be required.  Unless...
-           you are using the mpz_t from the GNU GMP with
-           our memory functions. */
-        void **tmp = zz_tracker.ptrs;
-        size_t old_alloc = zz_tracker.alloc;
-
-        zz_tracker.alloc += TRACKER_SIZE_INCR;
-        zz_tracker.ptrs = zz_state.realloc(zz_tracker.ptrs,
-                                           old_alloc * sizeof(void *),
-                                           zz_tracker.alloc * sizeof(void *));
-        if (!zz_tracker.ptrs) {
-            /* LCOV_EXCL_START */
-            zz_tracker.alloc = old_alloc;
-            zz_tracker.ptrs = tmp;
-            goto err;
-            /* LCOV_EXCL_STOP */
-        }
-    }
-    if (!ptr) {
-        void *ret = zz_state.malloc(new_size);
+    zz_stats_thread *t = arg;
 
-        if (!ret) {
-            goto err;
-        }
-        zz_tracker.ptrs[zz_tracker.size] = ret;
-        zz_tracker.size++;
-        return ret;
-    }
+    (void)t->run(t->arg);
+    t->stats = zz_stats_tls;
+    return t;
+}
+#  endif
 
-    size_t i = zz_tracker.size - 1;
+/* Start a worker thread of the library, like pthread_create(). */
+static int
+zz_thread_create(pthread_t *tid, void *(*run)(void *), void *arg)
+{
+#  if ENABLE_STATS
+    zz_stats_thread *t = zz_state.malloc(sizeof(zz_stats_thread));
 
-    for (;; i--) {
-        if (zz_tracker.ptrs[i] == ptr) {
-            break;
-        }
+    if (!t) {
+        return -1; /* LCOV_EXCL_LINE */
     }
-
-    void *ret = zz_state.realloc(ptr, old_size, new_size);
-
-    if (!ret) {
-        goto err; /* LCOV_EXCL_LINE */
+    t->run = run;
+    t->arg = arg;
+    if (pthread_create(tid, NULL, zz_stats_worker, t)) {
+        /* LCOV_EXCL_START */
+        zz_state.free(t, sizeof(zz_stats_thread));
+        return -1;
+        /* LCOV_EXCL_STOP */
     }
-    zz_tracker.ptrs[i] = ret;
-    return ret;
-err:
-    i = zz_tracker.size - 1;
-    while (zz_tracker.size > 0) {
-        zz_state.free(zz_tracker.ptrs[i], 0);
-        zz_tracker.ptrs[i] = NULL;
-        zz_tracker.size--;
-        i--;
-    }
-    zz_state.free(zz_tracker.ptrs, zz_tracker.alloc * sizeof(void *));
-    zz_tracker.alloc = 0;
-    zz_tracker.ptrs = NULL;
-    longjmp(zz_env, 1);
-}
-
-static void *
-zz_allocate_function(size_t size)
-{
-    return zz_reallocate_function(NULL, 0, size);
+    return 0;
+#  else
+    return pthread_create(tid, NULL, run, arg);
+#  endif
 }
 
 static void
-zz_free_function(void *ptr, size_t size)
+zz_thread_join(pthread_t tid)
 {
-    for (size_t i = zz_tracker.size - 1; i >= 0; i--) {
-        if (zz_tracker.ptrs[i] == ptr) {
-            zz_tracker.ptrs[i] = NULL;
-            break;
-        }
-    }
-    zz_state.free(ptr, size);
+#  if ENABLE_STATS
+    void *res;
 
-    size_t i = zz_tracker.size - 1;
+    pthread_join(tid, &res);
 
-    while (zz_tracker.size > 0) {
-        if (zz_tracker.ptrs[i]) {
-            return;
-        }
-        zz_tracker.size--;
-        i--;
-    }
-    zz_state.free(zz_tracker.ptrs, zz_tracker.alloc * sizeof(void *));
-    zz_tracker.alloc = 0;
-    zz_tracker.ptrs = NULL;
-}
+    zz_stats_thread *t = res;
 
-zz_err
-zz_setup(void)
-{
-    mp_get_memory_functions(&zz_state.default_allocate_func,
-                            &zz_state.default_reallocate_func,
-                            &zz_state.default_free_func);
-    mp_set_memory_functions(zz_allocate_function,
-                            zz_reallocate_function,
-                            zz_free_function);
-    zz_state.malloc = &zz_malloc;
-    zz_state.realloc = &zz_realloc;
-    zz_state.free = &zz_free;
-    return ZZ_OK;
+    zz_stats_merge(&t->stats);
+    zz_state.free(t, sizeof(zz_stats_thread));
+#  else
+    pthread_join(tid, NULL);
+#  endif
 }
+#endif
 
-void
-zz_set_memory_funcs(void *(*malloc) (size_t),
-                    void *(*realloc) (void *, size_t, size_t),
-                    void (*free) (void *, size_t))
+struct zz_arena_block {
+    struct zz_arena_block *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+static struct zz_arena_block *
+zz_arena_block_new(size_t size)
 {
-    if (!malloc) {
-        malloc = zz_malloc;
-    }
-    if (!realloc) {
-        realloc = zz_realloc;
-    }
-    if (!free) {
-        free = zz_free;
+    struct zz_arena_block *b = zz_state.malloc(sizeof(struct zz_arena_block)
+                                               + size);
+
+    if (b) {
+        b->next = NULL;
+        b->size = size;
+        b->used = 0;
     }
-    zz_state.malloc = malloc;
-    zz_state.realloc = realloc;
-    zz_state.free = free;
+    return b;
 }
 
-size_t
-zz_get_alloc_state(void)
+static void
+zz_arena_block_free(struct zz_arena_block *b)
 {
-    return zz_tracker.alloc;
+    zz_state.free(b, sizeof(struct zz_arena_block) + b->size);
 }
 
-void
-zz_finish(void)
+zz_err
+zz_arena_init(size_t block_size, zz_arena *a)
 {
-    mp_set_memory_functions(zz_state.default_allocate_func,
-                            zz_state.default_reallocate_func,
-                            zz_state.default_free_func);
-    zz_state.malloc = &zz_malloc;
-    zz_state.realloc = &zz_realloc;
-    zz_state.free = &zz_free;
+    a->block_size = ARENA_ROUND(MAX(block_size, ARENA_ALIGN));
+    a->last = NULL;
+    a->head = zz_arena_block_new(a->block_size);
+    return a->head ? ZZ_OK : ZZ_MEM;
 }
 
-zz_err
-zz_init(zz_t *u)
+static void *
+zz_arena_malloc(zz_arena *a, size_t size)
 {
-    SETNEG(false, u);
-    SETALLOC(0, u);
-    u->size = 0;
-    u->digits = NULL;
-    return ZZ_OK;
+    struct zz_arena_block *b = a->head;
+
+    size = ARENA_ROUND(MAX(size, 1));
+    if (b && b->size - b->used >= size) {
+        void *ret = (char *)b->data + b->used;
+
+        b->used += size;
+        a->last = ret;
+        return ret;
+    }
+    if (size > a->block_size && b) {
+        /* Oversized request get a dedicated block, which is inserted after
+           the current one, so we can continue to fill the later. */
+        struct zz_arena_block *nb = zz_arena_block_new(size);
+
+        if (!nb) {
+            return NULL; /* LCOV_EXCL_LINE */
+        }
+        nb->used = size;
+        nb->next = b->next;
+        b->next = nb;
+        return nb->data;
+    }
+    b = zz_arena_block_new(MAX(size, a->block_size));
+    if (!b) {
+        return NULL; /* LCOV_EXCL_LINE */
+    }
+    b->next = a->head;
+    a->head = b;
+    b->used = size;
+    a->last = b->data;
+    return b->data;
 }
 
-static zz_err
-zz_resize(zz_size_t size, zz_t *u)
+static void *
+zz_arena_realloc(zz_arena *a, void *ptr, size_t old_size, size_t new_size)
 {
-    if (GETALLOC(u) >= size) {
-        u->size = size;
-        if (!u->size) {
-            SETNEG(false, u);
+    if (!ptr) {
+        return zz_arena_malloc(a, new_size);
+    }
+    if (ptr == a->last) {
+        /* Most recent allocation, try to resize inplace. */
+        struct zz_arena_block *b = a->head;
+        size_t offset = (size_t)((char *)ptr - (char *)b->data);
+
+        if (b->size - offset >= new_size) {
+            b->used = offset + ARENA_ROUND(MAX(new_size, 1));
+            return ptr;
         }
-        return ZZ_OK;
     }
 
-    zz_size_t alloc = size;
-    zz_digit_t *t = u->digits;
+    void *ret = zz_arena_malloc(a, new_size);
 
-    u->digits = realloc(u->digits, (size_t)alloc * ZZ_DIGIT_T_BYTES);
-    if (u->digits) {
-        SETALLOC(alloc, u);
-        u->size = alloc;
-        return ZZ_OK;
+    if (ret) {
+        memcpy(ret, ptr, MIN(old_size, new_size));
     }
-    /* LCOV_EXCL_START */
-    u->digits = t;
-    return ZZ_MEM;
-    /* LCOV_EXCL_STOP */
+    return ret;
 }
 
-void
-zz_clear(zz_t *u)
+static void
+zz_arena_free(zz_arena *a, void *ptr)
 {
-    free(u->digits);
-    SETNEG(false, u);
-    SETALLOC(0, u);
-    u->size = 0;
-    u->digits = NULL;
+    /* Only most recent allocation can be released. */
+    if (ptr && ptr == a->last) {
+        a->head->used = (size_t)((char *)ptr - (char *)a->head->data);
+        a->last = NULL;
+    }
 }
 
-inline static void
-zz_normalize(zz_t *u)
+void
+zz_arena_reset(zz_arena *a)
 {
-    while (u->size && u->digits[u->size - 1] == 0) {
-        u->size--;
+    struct zz_arena_block *b = a->head;
+
+    if (!b) {
+        return;
     }
-    if (!u->size) {
-        SETNEG(false, u);
+    /* Keep only the first block (tail of the list). */
+    while (b->next) {
+        struct zz_arena_block *next = b->next;
+
+        zz_arena_block_free(b);
+        b = next;
     }
+    b->used = 0;
+    a->head = b;
+    a->last = NULL;
 }
 
-zz_ord
-zz_cmp(const zz_t *u, const zz_t *v)
+void
+zz_arena_clear(zz_arena *a)
 {
-    if (u == v) {
-        return ZZ_EQ;
-    }
+    struct zz_arena_block *b = a->head;
 
-    bool u_negative = ISNEG(u);
-    zz_ord res = u_negative ? ZZ_LT : ZZ_GT;
+    while (b) {
+        struct zz_arena_block *next = b->next;
 
-    if (u_negative != ISNEG(v)) {
-        return res;
+        zz_arena_block_free(b);
+        b = next;
     }
-    else if (u->size != v->size) {
-        return (u->size < v->size) ? -res : res;
+    a->head = NULL;
+    a->last = NULL;
+    if (zz_cur_arena == a) {
+        zz_cur_arena = NULL;
     }
-    res = mpn_cmp(u->digits, v->digits, u->size);
-    return u_negative ? -res : res;
 }
 
-zz_ord
-zz_cmp_i64(const zz_t *u, int64_t v)
-{
-    bool u_negative = ISNEG(u);
-    zz_ord res = u_negative ? ZZ_LT : ZZ_GT;
+/* Each pool chunk has a header, with the size class in the last word.
+   Small chunks of size (POOL_MIN_CHUNK << class) are carved from the
+   arena and recycled on free lists.  Larger allocations are served by the
+   underlying allocator and linked in the list to be released by the
+   zz_pool_clear(). */
+#define POOL_MIN_CHUNK 32
+#define POOL_LARGE SIZE_MAX
+
+struct zz_pool_large {
+    struct zz_pool_large *prev;
+    struct zz_pool_large *next;
+    size_t size;
+};
 
-    if (u_negative != (v < 0) || u->size > 1) {
-        return res;
-    }
-    else if (!u->size) {
-        return v ? -res : ZZ_EQ;
+#define POOL_SMALL_HDR ARENA_ROUND(sizeof(size_t))
+#define POOL_LARGE_HDR ARENA_ROUND(sizeof(struct zz_pool_large) \
+                                   + sizeof(size_t))
+#define POOL_CLS(ptr) (((size_t *)(void *)(ptr))[-1])
+
+zz_err
+zz_pool_init(zz_pool *p)
+{
+    for (size_t i = 0; i < ZZ_POOL_CLASSES; i++) {
+        p->free_lists[i] = NULL;
     }
+    p->large = NULL;
+    return zz_arena_init((size_t)POOL_MIN_CHUNK << ZZ_POOL_CLASSES, &p->slabs);
+}
 
-    zz_digit_t uu = u->digits[0], uv = ABS_CAST(zz_digit_t, v);
-
-    if (uu == uv) {
-        return ZZ_EQ;
-    }
-    return uu > uv ? res : -res;
-}
-
-zz_err
-zz_set_mpz_t(mpz_t u, zz_t *v)
+static void *
+zz_pool_malloc(zz_pool *p, size_t size)
 {
-    if (zz_resize(abs(u->_mp_size), v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    size_t cls = 0;
+
+    while (cls < ZZ_POOL_CLASSES
+           && ((size_t)POOL_MIN_CHUNK << cls) - POOL_SMALL_HDR < size)
+    {
+        cls++;
     }
-    mpn_copyi(v->digits, u->_mp_d, v->size);
-    SETNEG(u->_mp_size < 0, v);
-    return ZZ_OK;
-}
+    if (cls < ZZ_POOL_CLASSES) {
+        char *chunk = p->free_lists[cls];
 
-zz_err
-zz_set_i32(int32_t u, zz_t *v)
-{
-    if (!u) {
-        v->size = 0;
-        SETNEG(false, v);
-        return ZZ_OK;
+        if (chunk) {
+            p->free_lists[cls] = *(void **)chunk;
+        }
+        else {
+            chunk = zz_arena_malloc(&p->slabs, (size_t)POOL_MIN_CHUNK << cls);
+            if (!chunk) {
+                return NULL; /* LCOV_EXCL_LINE */
+            }
+        }
+        POOL_CLS(chunk + POOL_SMALL_HDR) = cls;
+        return chunk + POOL_SMALL_HDR;
     }
-    if (zz_resize(1, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    if (size > SIZE_MAX - POOL_LARGE_HDR) {
+        return NULL; /* LCOV_EXCL_LINE */
     }
-    SETNEG(u < 0, v);
-    v->digits[0] = (zz_digit_t)abs(u);
-    return ZZ_OK;
-}
 
-zz_err
-zz_set_i64(int64_t u, zz_t *v)
-{
-    if (!u) {
-        v->size = 0;
-        SETNEG(false, v);
-        return ZZ_OK;
+    struct zz_pool_large *l = zz_state.malloc(POOL_LARGE_HDR + size);
+
+    if (!l) {
+        return NULL; /* LCOV_EXCL_LINE */
     }
-    if (zz_resize(1, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    l->prev = NULL;
+    l->next = p->large;
+    if (l->next) {
+        l->next->prev = l;
     }
-    SETNEG(u < 0, v);
-    v->digits[0] = ABS_CAST(zz_digit_t, u);
-    return ZZ_OK;
+    p->large = l;
+    l->size = size;
+    POOL_CLS((char *)l + POOL_LARGE_HDR) = POOL_LARGE;
+    return (char *)l + POOL_LARGE_HDR;
 }
 
-zz_err
-zz_set_u64(uint64_t u, zz_t *v)
+static void
+zz_pool_free(zz_pool *p, void *ptr)
 {
-    if (!u) {
-        v->size = 0;
-        SETNEG(false, v);
-        return ZZ_OK;
-    }
-    if (zz_resize(1, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    if (!ptr) {
+        return;
     }
-    SETNEG(false, v);
-    v->digits[0] = u;
-    return ZZ_OK;
-}
 
-#define DIGITS_PER_DOUBLE ((53 + ZZ_DIGIT_T_BITS - 2) / ZZ_DIGIT_T_BITS + 1)
+    size_t cls = POOL_CLS(ptr);
 
-zz_err
-zz_set_double(double u, zz_t *v)
-{
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic push
-#  pragma GCC diagnostic ignored "-Wfloat-conversion"
-#endif
-    if (isnan(u)) {
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic pop
-#endif
-        return ZZ_VAL;
-    }
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic push
-#  pragma GCC diagnostic ignored "-Wfloat-conversion"
-#endif
-    if (isinf(u)) {
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic pop
-#endif
-        return ZZ_BUF;
-    }
-    if (zz_resize(DIGITS_PER_DOUBLE, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    if (cls == POOL_LARGE) {
+        struct zz_pool_large *l = (void *)((char *)ptr - POOL_LARGE_HDR);
+
+        if (l->prev) {
+            l->prev->next = l->next;
+        }
+        else {
+            p->large = l->next;
+        }
+        if (l->next) {
+            l->next->prev = l->prev;
+        }
+        zz_state.free(l, POOL_LARGE_HDR + l->size);
+        return;
     }
 
-    /* v has enough space to prevent new allocation by GMP */
-    TMP_MPZ(z, v);
-    mpz_set_d(z, u);
-    SETNEG(u < 0, v);
-    v->size = abs(z->_mp_size);
-    return ZZ_OK;
+    char *chunk = (char *)ptr - POOL_SMALL_HDR;
+
+    *(void **)chunk = p->free_lists[cls];
+    p->free_lists[cls] = chunk;
 }
 
-zz_err
-zz_get_i32(const zz_t *u, int32_t *v)
+static void *
+zz_pool_realloc(zz_pool *p, void *ptr, size_t old_size, size_t new_size)
 {
-    zz_size_t n = u->size;
-
-    if (!n) {
-        *v = 0;
-        return ZZ_OK;
-    }
-    if (n > 1) {
-        return ZZ_BUF;
+    if (!ptr) {
+        return zz_pool_malloc(p, new_size);
     }
 
-    zz_digit_t uv = u->digits[0];
+    size_t cls = POOL_CLS(ptr);
 
-    if (ISNEG(u)) {
-        if (uv <= INT32_MAX + (zz_digit_t)1) {
-            *v = -1 - (int32_t)((uv - 1) & INT32_MAX);
-            return ZZ_OK;
+    if (cls == POOL_LARGE) {
+        if (new_size > ((size_t)POOL_MIN_CHUNK << (ZZ_POOL_CLASSES - 1))
+                       - POOL_SMALL_HDR
+            && new_size <= SIZE_MAX - POOL_LARGE_HDR)
+        {
+            struct zz_pool_large *l = (void *)((char *)ptr - POOL_LARGE_HDR);
+            struct zz_pool_large *nl = zz_state.realloc(l,
+                                                        POOL_LARGE_HDR
+                                                        + l->size,
+                                                        POOL_LARGE_HDR
+                                                        + new_size);
+
+            if (!nl) {
+                return NULL; /* LCOV_EXCL_LINE */
+            }
+            if (nl->prev) {
+                nl->prev->next = nl;
+            }
+            else {
+                p->large = nl;
+            }
+            if (nl->next) {
+                nl->next->prev = nl;
+            }
+            nl->size = new_size;
+            return (char *)nl + POOL_LARGE_HDR;
         }
+        old_size = ((struct zz_pool_large *)(void *)((char *)ptr
+                                                     - POOL_LARGE_HDR))->size;
     }
     else {
-        if (uv <= INT32_MAX) {
-            *v = (int32_t)uv;
-            return ZZ_OK;
+        old_size = ((size_t)POOL_MIN_CHUNK << cls) - POOL_SMALL_HDR;
+        if (new_size <= old_size) {
+            return ptr;
         }
     }
-    return ZZ_BUF;
+
+    void *ret = zz_pool_malloc(p, new_size);
+
+    if (ret) {
+        memcpy(ret, ptr, MIN(old_size, new_size));
+        zz_pool_free(p, ptr);
+    }
+    return ret;
 }
 
-zz_err
-zz_get_i64(const zz_t *u, int64_t *v)
+void
+zz_pool_clear(zz_pool *p)
 {
-    zz_size_t n = u->size;
+    struct zz_pool_large *l = p->large;
 
-    if (!n) {
-        *v = 0;
-        return ZZ_OK;
+    while (l) {
+        struct zz_pool_large *next = l->next;
+
+        zz_state.free(l, POOL_LARGE_HDR + l->size);
+        l = next;
     }
-    if (n > 1) {
-        return ZZ_BUF;
+    p->large = NULL;
+    for (size_t i = 0; i < ZZ_POOL_CLASSES; i++) {
+        p->free_lists[i] = NULL;
     }
+    zz_arena_clear(&p->slabs);
+    if (zz_cur_pool == p) {
+        zz_cur_pool = NULL;
+    }
+}
 
-    zz_digit_t uv = u->digits[0];
+void
+zz_set_arena(zz_arena *a)
+{
+    zz_cur_arena = a;
+    zz_cur_pool = NULL;
+}
 
-    if (ISNEG(u)) {
-        if (uv <= INT64_MAX + (zz_digit_t)1) {
-            *v = -1 - (int64_t)((uv - 1) & INT64_MAX);
-            return ZZ_OK;
-        }
-    }
-    else {
-        if (uv <= INT64_MAX) {
-            *v = (int64_t)uv;
-            return ZZ_OK;
-        }
-    }
-    return ZZ_BUF;
+void
+zz_set_pool(zz_pool *p)
+{
+    zz_cur_pool = p;
+    zz_cur_arena = NULL;
 }
 
+/* The scratch is a stack of blocks in one buffer, that serves temporary
+   allocations of the current thread: GMP's temporaries and scratch space of
+   the library functions.  Each block has a header with the offset of the
+   previous block header and flags.  Blocks can be released in any order: a
+   freed block is marked and then popped, once all blocks above it are freed.
+   Requests, that don't fit, are served by the heap, but the stack size they
+   need is remembered and the buffer grows to it, when the stack is empty. */
+#define SCRATCH_HDR ARENA_ROUND(2*sizeof(size_t))
+#define SCRATCH_PREV(hdr) (((size_t *)(void *)(hdr))[0])
+#define SCRATCH_FLAGS(hdr) (((size_t *)(void *)(hdr))[1])
+#define SCRATCH_FREED 1
+#define SCRATCH_GMP 2
+#define SCRATCH_NONE SIZE_MAX
+#define SCRATCH_OWNS(s, ptr) ((s) && ((uintptr_t)(void *)(ptr)           \
+                                      - (uintptr_t)(s)->base) < (s)->used)
+
 zz_err
-zz_get_u32(const zz_t *u, uint32_t *v)
+zz_scratch_init(size_t size, zz_scratch *s)
 {
-    if (ISNEG(u)) {
-        return ZZ_VAL;
-    }
-    if (!u->size) {
-        *v = 0;
-        return ZZ_OK;
-    }
-    if (u->size > 1 || u->digits[0] > UINT32_MAX) {
-        return ZZ_BUF;
+    s->size = ARENA_ROUND(MIN(size, SIZE_MAX/4));
+    s->used = 0;
+    s->last = SCRATCH_NONE;
+    s->want = 0;
+    s->base = s->size ? zz_state.malloc(s->size) : NULL;
+    if (s->size && !s->base) {
+        s->size = 0;
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    *v = (uint32_t)u->digits[0];
     return ZZ_OK;
 }
 
-zz_err
-zz_get_u64(const zz_t *u, uint64_t *v)
+void
+zz_scratch_clear(zz_scratch *s)
 {
-    if (ISNEG(u)) {
-        return ZZ_VAL;
+    assert(!s->used);
+    if (s->base) {
+        zz_state.free(s->base, s->size);
     }
-    if (u->size > 1) {
-        return ZZ_BUF;
+    s->base = NULL;
+    s->size = 0;
+    s->want = 0;
+    if (zz_cur_scratch == s) {
+        zz_cur_scratch = NULL;
     }
-    *v = u->size ? u->digits[0] : 0;
-    return ZZ_OK;
 }
 
-bool
-zz_iszero(const zz_t *u)
+void
+zz_set_scratch(zz_scratch *s)
 {
-    return u->size == 0;
+    assert(!zz_cur_scratch || !zz_cur_scratch->used);
+    zz_cur_scratch = s;
 }
 
-bool
-zz_isneg(const zz_t *u)
+static void *
+zz_scratch_malloc(zz_scratch *s, size_t size, size_t flags)
 {
-    return ISNEG(u);
-}
+    if (size > SIZE_MAX/4) {
+        return NULL; /* LCOV_EXCL_LINE */
+    }
 
-bool
-zz_isodd(const zz_t *u)
-{
-    return u->size && u->digits[0] & 1;
+    size_t need = SCRATCH_HDR + ARENA_ROUND(MAX(size, 1));
+
+    s->want = MAX(s->want, s->used + need);
+    if (!s->used && s->want > s->size) {
+        /* Grow the empty stack: old content can be dropped. */
+        size_t new_size = ARENA_ROUND(s->want);
+        void *base = zz_state.malloc(new_size);
+
+        if (base) {
+            if (s->base) {
+                zz_state.free(s->base, s->size);
+            }
+            s->base = base;
+            s->size = new_size;
+        }
+    }
+    if (s->size - s->used < need) {
+        return NULL;
+    }
+
+    char *hdr = (char *)s->base + s->used;
+
+    SCRATCH_PREV(hdr) = s->last;
+    SCRATCH_FLAGS(hdr) = flags;
+    s->last = s->used;
+    s->used += need;
+    return hdr + SCRATCH_HDR;
 }
 
-zz_err
-zz_pos(const zz_t *u, zz_t *v)
+/* Pop freed blocks from the top of the stack. */
+static void
+zz_scratch_pop(zz_scratch *s)
 {
-    if (u != v) {
-        if (!u->size) {
-            return zz_set_i64(0, v);
-        }
-        if (zz_resize(u->size, v)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
+    while (s->last != SCRATCH_NONE) {
+        char *hdr = (char *)s->base + s->last;
+
+        if (!(SCRATCH_FLAGS(hdr) & SCRATCH_FREED)) {
+            break;
         }
-        SETNEG(ISNEG(u), v);
-        mpn_copyi(v->digits, u->digits, u->size);
+        s->used = s->last;
+        s->last = SCRATCH_PREV(hdr);
     }
-    return ZZ_OK;
 }
 
-zz_err
-zz_abs(const zz_t *u, zz_t *v)
+static void
+zz_scratch_free(zz_scratch *s, void *ptr)
 {
-    if (u != v && zz_pos(u, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
-    }
-    SETNEG(false, v);
-    return ZZ_OK;
+    SCRATCH_FLAGS((char *)ptr - SCRATCH_HDR) |= SCRATCH_FREED;
+    zz_scratch_pop(s);
 }
 
-zz_err
-zz_neg(const zz_t *u, zz_t *v)
+/* Resize the block inplace, if it's on top of the stack and
+   there is a room. */
+static bool
+zz_scratch_resize(zz_scratch *s, void *ptr, size_t new_size)
 {
-    if (u != v && zz_pos(u, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    size_t offset = (size_t)((char *)ptr - SCRATCH_HDR - (char *)s->base);
+
+    if (offset != s->last || new_size > SIZE_MAX/4) {
+        return false;
     }
-    if (v->size) {
-        SETNEG(!ISNEG(u), v);
+
+    size_t need = SCRATCH_HDR + ARENA_ROUND(MAX(new_size, 1));
+
+    s->want = MAX(s->want, offset + need);
+    if (s->size - offset < need) {
+        return false;
     }
-    return ZZ_OK;
+    s->used = offset + need;
+    return true;
 }
 
-zz_err
-zz_sizeinbase(const zz_t *u, int base, size_t *len)
+/* Release all GMP's blocks on memory failure, see the
+   zz_reallocate_function(). */
+static void
+zz_scratch_unwind(zz_scratch *s)
 {
-    const int abase = abs(base);
+    for (size_t i = s->last; i != SCRATCH_NONE;) {
+        char *hdr = (char *)s->base + i;
 
-    if (abase < 2 || abase > 36) {
-        return ZZ_VAL;
+        if (SCRATCH_FLAGS(hdr) & SCRATCH_GMP) {
+            SCRATCH_FLAGS(hdr) |= SCRATCH_FREED;
+        }
+        i = SCRATCH_PREV(hdr);
     }
-    *len = mpn_sizeinbase(u->digits, u->size, abase);
-    return ZZ_OK;
+    zz_scratch_pop(s);
 }
 
-zz_err
-zz_get_str(const zz_t *u, int base, char *str)
+/* All memory of the library (digits of integers, scratch space and GMP's
+   temporaries) is allocated with following functions.  Each block has a
+   header with its owner: the arena, the pool (tagged with the lowest bit)
+   or NULL for the heap.  So blocks are resized and released by the
+   allocator, that served them, whatever is current for the thread.  The
+   second word of the header is the slot of GMP's temporaries in the
+   tracker, so they are plain blocks of the allocator and could be given
+   to integers as is. */
+#define MEM_HDR ARENA_ROUND(2*sizeof(uintptr_t))
+#define MEM_OWNER(raw) (((uintptr_t *)(void *)(raw))[0])
+#define MEM_TRACKER(ptr) \
+    (((uintptr_t *)(void *)((char *)(ptr) - MEM_HDR))[1])
+#define MEM_POOL 1
+
+static void *
+zz_mem_malloc(size_t size)
 {
-    /* Maps 1-byte integer to digit character for bases up to 36. */
-    const char *NUM_TO_TEXT = "0123456789abcdefghijklmnopqrstuvwxyz";
+    char *raw = NULL;
+    uintptr_t owner = 0;
 
-    if (base < 0) {
-        base = -base;
-        NUM_TO_TEXT = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    }
-    if (base < 2 || base > 36) {
-        return ZZ_VAL;
+    if (size <= SIZE_MAX - MEM_HDR) {
+        if (zz_cur_arena) {
+            raw = zz_arena_malloc(zz_cur_arena, MEM_HDR + size);
+            owner = (uintptr_t)zz_cur_arena;
+        }
+        else if (zz_cur_pool) {
+            raw = zz_pool_malloc(zz_cur_pool, MEM_HDR + size);
+            owner = (uintptr_t)zz_cur_pool | MEM_POOL;
+        }
+        else {
+            raw = zz_state.malloc(MEM_HDR + size);
+        }
+    }
+    if (!raw) {
+        ZZ_STAT_ADD(mem_errors, 1);
+        return NULL;
+    }
+    MEM_OWNER(raw) = owner;
+    return raw + MEM_HDR;
+}
+
+static void *
+zz_mem_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+    if (!ptr) {
+        return zz_mem_malloc(new_size);
+    }
+
+    char *raw = (char *)ptr - MEM_HDR, *new_raw = NULL;
+    uintptr_t owner = MEM_OWNER(raw);
+
+    if (new_size <= SIZE_MAX - MEM_HDR) {
+        old_size += MEM_HDR;
+        new_size += MEM_HDR;
+        if (!owner) {
+            new_raw = zz_state.realloc(raw, old_size, new_size);
+        }
+        else if (owner & MEM_POOL) {
+            new_raw = zz_pool_realloc((zz_pool *)(owner & ~(uintptr_t)MEM_POOL),
+                                      raw, old_size, new_size);
+        }
+        else {
+            new_raw = zz_arena_realloc((zz_arena *)owner, raw, old_size,
+                                       new_size);
+        }
+    }
+    if (!new_raw) {
+        ZZ_STAT_ADD(mem_errors, 1);
+        return NULL;
+    }
+    return new_raw + MEM_HDR;
+}
+
+static void
+zz_mem_free(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return;
+    }
+
+    char *raw = (char *)ptr - MEM_HDR;
+    uintptr_t owner = MEM_OWNER(raw);
+
+    if (!owner) {
+        zz_state.free(raw, MEM_HDR + size);
+    }
+    else if (owner & MEM_POOL) {
+        zz_pool_free((zz_pool *)(owner & ~(uintptr_t)MEM_POOL), raw);
+    }
+    else {
+        zz_arena_free((zz_arena *)owner, raw);
+    }
+}
+
+/* Scratch space of functions is taken from the scratch of the current
+   thread, if it's set and has a room, else from the heap. */
+static void *
+zz_tmp_malloc(size_t size)
+{
+    void *ptr = NULL;
+
+    if (zz_cur_scratch) {
+        ptr = zz_scratch_malloc(zz_cur_scratch, size, 0);
+    }
+    return ptr ? ptr : zz_mem_malloc(size);
+}
+
+static void
+zz_tmp_free(void *ptr, size_t size)
+{
+    if (SCRATCH_OWNS(zz_cur_scratch, ptr)) {
+        zz_scratch_free(zz_cur_scratch, ptr);
+    }
+    else {
+        zz_mem_free(ptr, size);
+    }
+}
+
+/* Following functions are used to handle all *temporary* allocations in the
+   GMP, apart from temporary space from alloca() if that function is available
+   and GMP is configured to use it (bad idea).
+
+   Calls to GMP's functions, which do memory allocations, must be preceded by
+   *one* "if (TMP_OVERFLOW)" block (TMP_OVERFLOW macro calls setjmp), that will
+   handle memory failure *after* freeing *all* GMP's allocations in the
+   zz_reallocate_function().
+
+   Basically, GMP's functions for integers fall into two camps.  First,
+   low-level functions, prefixed by "mpn_", which we prefer.  (See zz_mul() as
+   an example.)  Those will use only zz_allocate_function() and
+   zz_free_function() to allocate temporary storage (not for output variables).
+   This allocation happens essentially in LIFO way and we take that into
+   account for optimization of the memory tracking.
+
+   Not all mpn_*() functions do memory allocation.  Sometimes it's obvious
+   (e.g. mpn_cmp() or mpn_add/sub()), sometimes - not (e.g. mpn_get/set_str()
+   for power of 2 bases).  Though, these details aren't documented and if you
+   feel that in the given case things might be changed - please add the "if
+   (TMP_OVERFLOW)" block.
+
+   Second, in few cases we use integer functions, working with objects of type
+   mpz_t, prefixed by "mpz_".  Input variables for them must be created by the
+   TMP_MPZ macro.  Output variables (allocated by the GMP) are considered
+   temporary and cleared automatically on memory failure.  Here is an example:
+
+       zz_err
+       mul(const zz_t *u, const zz_t *v, zz_t *w)
+       {
+           mpz_t z;
+           TMP_MPZ(a, u);
+           TMP_MPZ(b, v);
+           if (TMP_OVERFLOW) {
+               // Memory allocation failure happened in mpz_mul.
+               // No need to call mpz_clear(z)!
+               return ZZ_MEM;
+           }
+           mpz_init(z);
+           mpz_mul(z, a, b);
+           // Success!  Resize w and copy z's content to it.
+           if (zz_set_mpz_t(z, w)) {
+               mpz_clear(z);
+               return ZZ_MEM;
+           }
+           mpz_clear(z); // That finally clear all temporary allocations.
+           return ZZ_OK;
+       }
+
+   Or the result could be moved to w without copying: the zz_move_mpz_t()
+   takes digits of z and clears it.
+
+   If the scratch is set by zz_set_scratch(), temporary allocations are
+   taken from its stack, while it has a room.  Those are not tracked, but
+   released on memory failure as well.
+
+   Note that our memory allocation functions are generic enough to work also
+   for usual GMP usage, without above assumptions.  Of course, unless memory
+   allocation failure happens, which will lead to undefined behavior (calling
+   longjmp() without a prior call to setjmp()).
+
+   Don't forget known pitfails of working with setjmp/longjmp:
+
+     * Don't use VLA (may introduce memory leaks).
+
+     * Declare variables you care about (e.g. to free memory in
+       case of failure) in the scope of the setjmp invocation - with
+       volatile type qualifier.  See zz_gcd() as an example. */
+
+/* Release heap storage of the tracker, if it's empty. */
+static void
+zz_tracker_release(void)
+{
+    if (!zz_tracker.size && zz_tracker.ptrs
+        && zz_tracker.ptrs != zz_tracker.small_ptrs)
+    {
+        zz_state.free(zz_tracker.ptrs, zz_tracker.alloc * sizeof(void *));
+        zz_tracker.ptrs = NULL;
+        zz_tracker.alloc = 0;
+    }
+}
+
+#if HAVE_PTHREAD_H
+/* The key is set for threads with heap storage of the tracker, to
+   release it on exit. */
+static pthread_key_t zz_tracker_key;
+static pthread_once_t zz_tracker_once = PTHREAD_ONCE_INIT;
+static bool zz_tracker_key_ok = false;
+
+static void
+zz_tracker_destructor(void *arg)
+{
+    (void)arg;
+    zz_tracker_release();
+}
+
+static void
+zz_tracker_key_init(void)
+{
+    zz_tracker_key_ok = !pthread_key_create(&zz_tracker_key,
+                                            zz_tracker_destructor);
+}
+#endif
+
+/* Remove the allocation from the slot i. */
+static void
+zz_tracker_remove(size_t i)
+{
+    assert(zz_tracker.size > 0);
+    zz_tracker.ptrs[i] = TRACKER_LINK(zz_tracker.free);
+    zz_tracker.free = i;
+    if (!--zz_tracker.size) {
+        zz_tracker.used = 0;
+        zz_tracker.free = TRACKER_NONE;
+    }
+}
+
+static void *
+zz_reallocate_function(void *ptr, size_t old_size, size_t new_size)
+{
+    if (ptr && SCRATCH_OWNS(zz_cur_scratch, ptr)) {
+        if (zz_scratch_resize(zz_cur_scratch, ptr, new_size)) {
+            ZZ_STAT_ADD(tmp_count, 1);
+            ZZ_STAT_ADD(tmp_bytes, new_size);
+            return ptr;
+        }
+
+        void *new_ptr = zz_reallocate_function(NULL, 0, new_size);
+
+        memcpy(new_ptr, ptr, MIN(old_size, new_size));
+        zz_scratch_free(zz_cur_scratch, ptr);
+        return new_ptr;
+    }
+    ZZ_STAT_ADD(tmp_count, 1);
+    ZZ_STAT_ADD(tmp_bytes, new_size);
+    if (!ptr) {
+        if (zz_cur_scratch) {
+            void *p = zz_scratch_malloc(zz_cur_scratch, new_size, SCRATCH_GMP);
+
+            if (p) {
+                return p;
+            }
+        }
+        if (!zz_tracker.ptrs) {
+            zz_tracker.ptrs = zz_tracker.small_ptrs;
+            zz_tracker.alloc = TRACKER_SIZE_INCR;
+        }
+        if (zz_tracker.free == TRACKER_NONE
+            && zz_tracker.used >= zz_tracker.alloc)
+        {
+            /* Happens only for deep recursion in the GMP or if
+               you are using the mpz_t from the GNU GMP with
+               our memory functions. */
+            void **tmp = zz_tracker.ptrs;
+            size_t old_alloc = zz_tracker.alloc;
+
+            zz_tracker.alloc *= 2;
+            if (tmp == zz_tracker.small_ptrs) {
+                zz_tracker.ptrs = zz_state.malloc(zz_tracker.alloc
+                                                  * sizeof(void *));
+                if (zz_tracker.ptrs) {
+                    memcpy(zz_tracker.ptrs, tmp, old_alloc * sizeof(void *));
+#if HAVE_PTHREAD_H
+                    (void)pthread_once(&zz_tracker_once, zz_tracker_key_init);
+                    if (zz_tracker_key_ok) {
+                        (void)pthread_setspecific(zz_tracker_key,
+                                                  &zz_tracker);
+                    }
+#endif
+                }
+            }
+            else {
+                zz_tracker.ptrs = zz_state.realloc(tmp,
+                                                   old_alloc * sizeof(void *),
+                                                   zz_tracker.alloc
+                                                   * sizeof(void *));
+            }
+            if (!zz_tracker.ptrs) {
+                /* LCOV_EXCL_START */
+                ZZ_STAT_ADD(mem_errors, 1);
+                zz_tracker.alloc = old_alloc;
+                zz_tracker.ptrs = tmp;
+                goto err;
+                /* LCOV_EXCL_STOP */
+            }
+        }
+
+        void *p = zz_mem_malloc(new_size);
+
+        if (!p) {
+            goto err;
+        }
+
+        size_t i = zz_tracker.free;
+
+        if (i != TRACKER_NONE) {
+            zz_tracker.free = TRACKER_NEXT(zz_tracker.ptrs[i]);
+        }
+        else {
+            i = zz_tracker.used++;
+        }
+        MEM_TRACKER(p) = i;
+        zz_tracker.ptrs[i] = p;
+        zz_tracker.size++;
+        ZZ_STAT_MAX(tmp_peak, zz_tracker.size);
+        return p;
+    }
+
+    size_t i = (size_t)MEM_TRACKER(ptr);
+
+    assert(i < zz_tracker.used && zz_tracker.ptrs[i] == ptr);
+    ptr = zz_mem_realloc(ptr, old_size, new_size);
+    if (!ptr) {
+        goto err; /* LCOV_EXCL_LINE */
+    }
+    zz_tracker.ptrs[i] = ptr;
+    return ptr;
+err:
+    for (size_t i = 0; i < zz_tracker.used; i++) {
+        if (!TRACKER_ISFREE(zz_tracker.ptrs[i])) {
+            zz_mem_free(zz_tracker.ptrs[i], 0);
+        }
+    }
+    zz_tracker.size = zz_tracker.used = 0;
+    zz_tracker.free = TRACKER_NONE;
+    if (zz_cur_scratch) {
+        zz_scratch_unwind(zz_cur_scratch);
+    }
+    longjmp(zz_env, 1);
+}
+
+static void *
+zz_allocate_function(size_t size)
+{
+    return zz_reallocate_function(NULL, 0, size);
+}
+
+static void
+zz_free_function(void *ptr, size_t size)
+{
+    if (SCRATCH_OWNS(zz_cur_scratch, ptr)) {
+        zz_scratch_free(zz_cur_scratch, ptr);
+        return;
+    }
+
+    size_t i = (size_t)MEM_TRACKER(ptr);
+
+    assert(i < zz_tracker.used && zz_tracker.ptrs[i] == ptr);
+    zz_tracker_remove(i);
+    zz_mem_free(ptr, size);
+}
+
+zz_err
+zz_setup(void)
+{
+    mp_get_memory_functions(&zz_state.default_allocate_func,
+                            &zz_state.default_reallocate_func,
+                            &zz_state.default_free_func);
+    mp_set_memory_functions(zz_allocate_function,
+                            zz_reallocate_function,
+                            zz_free_function);
+    zz_state.malloc = &zz_malloc;
+    zz_state.realloc = &zz_realloc;
+    zz_state.free = &zz_free;
+    return ZZ_OK;
+}
+
+void
+zz_set_memory_funcs(void *(*malloc_func) (size_t),
+                    void *(*realloc_func) (void *, size_t, size_t),
+                    void (*free_func) (void *, size_t))
+{
+    /* Parameters aren't named like the C library functions, as
+       zz_malloc is a macro for malloc. */
+    zz_state.malloc = malloc_func ? malloc_func : &zz_malloc;
+    zz_state.realloc = realloc_func ? realloc_func : &zz_realloc;
+    zz_state.free = free_func ? free_func : &zz_free;
+}
+
+size_t
+zz_get_alloc_state(void)
+{
+    return zz_tracker.size;
+}
+
+void
+zz_finish(void)
+{
+    zz_radix_cache_clear();
+    zz_comb_cache_clear();
+    zz_tracker_release();
+    mp_set_memory_functions(zz_state.default_allocate_func,
+                            zz_state.default_reallocate_func,
+                            zz_state.default_free_func);
+    zz_state.malloc = &zz_malloc;
+    zz_state.realloc = &zz_realloc;
+    zz_state.free = &zz_free;
+}
+
+zz_err
+zz_init(zz_t *u)
+{
+    SETNEG(false, u);
+    SETALLOC(ZZ_SMALL_DIGITS, u);
+    u->size = 0;
+    u->digits = u->small_digits;
+    return ZZ_OK;
+}
+
+/* Set digits storage of u to exactly alloc digits.  Content of u is
+   preserved, unless alloc is less than u->size.  Views get own storage
+   and are detached from the external buffer. */
+static zz_err
+_zz_realloc(zz_size_t alloc, zz_t *u)
+{
+    zz_digit_t *t = u->digits;
+    bool adopted = ISADOPTED(u);
+
+    if (alloc <= ZZ_SMALL_DIGITS) {
+        if (!ISSMALL(u)) {
+            /* Switch from the heap back to inline storage. */
+            u->size = MIN(u->size, alloc);
+            u->digits = u->small_digits;
+            mpn_copyi(u->digits, t, u->size);
+            if (adopted) {
+                zz_state.free(t, (size_t)GETALLOC(u) * ZZ_DIGIT_T_BYTES);
+            }
+            else if (!ISVIEW(u)) {
+                zz_mem_free(t, (size_t)GETALLOC(u) * ZZ_DIGIT_T_BYTES);
+            }
+            SETALLOC(ZZ_SMALL_DIGITS, u);
+        }
+        return ZZ_OK;
+    }
+    ZZ_STAT_ADD(resize_count, 1);
+    ZZ_STAT_ADD(resize_bytes, (size_t)alloc * ZZ_DIGIT_T_BYTES);
+    if (ISSMALL(u) || ISVIEW(u)) {
+        /* Switch from inline storage or a view to the heap. */
+        u->digits = zz_mem_malloc((size_t)alloc * ZZ_DIGIT_T_BYTES);
+        if (u->digits) {
+            mpn_copyi(u->digits, t, MIN(u->size, alloc));
+            SETADOPTED(0, u);
+        }
+    }
+    else if (adopted) {
+        u->digits = zz_state.realloc(u->digits,
+                                     (size_t)GETALLOC(u) * ZZ_DIGIT_T_BYTES,
+                                     (size_t)alloc * ZZ_DIGIT_T_BYTES);
+        if (!u->digits) {
+            ZZ_STAT_ADD(mem_errors, 1); /* LCOV_EXCL_LINE */
+        }
+    }
+    else {
+        u->digits = zz_mem_realloc(u->digits,
+                                   (size_t)GETALLOC(u) * ZZ_DIGIT_T_BYTES,
+                                   (size_t)alloc * ZZ_DIGIT_T_BYTES);
+    }
+    if (u->digits) {
+        SETALLOC(alloc, u);
+        u->size = MIN(u->size, alloc);
+        return ZZ_OK;
+    }
+    /* LCOV_EXCL_START */
+    u->digits = t;
+    return ZZ_MEM;
+    /* LCOV_EXCL_STOP */
+}
+
+static zz_err
+zz_resize(zz_size_t size, zz_t *u)
+{
+    /* Like own storage, the detached copy of the view keeps all digits:
+       in-place operations read them after resize. */
+    if (ISVIEW(u) && _zz_realloc(MAX(size, u->size), u)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (GETALLOC(u) < size) {
+        /* Grow geometrically, to amortize cost of reallocations in loops,
+           where the value increases slowly.  Fall back to the exact size,
+           if that fails. */
+        int64_t alloc = (int64_t)GETALLOC(u) + GETALLOC(u)/2;
+
+        alloc = MIN(alloc, ZZ_DIGITS_MAX);
+        if ((alloc <= size || _zz_realloc((zz_size_t)alloc, u))
+            && _zz_realloc(size, u))
+        {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+    }
+    u->size = size;
+    if (!u->size) {
+        SETNEG(false, u);
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_reserve(zz_t *u, zz_size_t size)
+{
+    if (size > ZZ_DIGITS_MAX) {
+        return ZZ_BUF;
+    }
+    if (GETALLOC(u) >= size) {
+        return ZZ_OK;
+    }
+    return _zz_realloc(size, u);
+}
+
+zz_err
+zz_shrink_to_fit(zz_t *u)
+{
+    if (GETALLOC(u) == u->size) {
+        return ZZ_OK;
+    }
+    return _zz_realloc(u->size, u);
+}
+
+void
+zz_clear(zz_t *u)
+{
+    if (ISADOPTED(u)) {
+        zz_state.free(u->digits, (size_t)GETALLOC(u) * ZZ_DIGIT_T_BYTES);
+    }
+    else if (!ISSMALL(u) && !ISVIEW(u)) {
+        zz_mem_free(u->digits, (size_t)GETALLOC(u) * ZZ_DIGIT_T_BYTES);
+    }
+    SETNEG(false, u);
+    SETALLOC(ZZ_SMALL_DIGITS, u);
+    u->size = 0;
+    u->digits = u->small_digits;
+}
+
+/* Exchange values (and storage) of u and v. */
+static void
+zz_swap(zz_t *u, zz_t *v)
+{
+    bool small_u = ISSMALL(u), small_v = ISSMALL(v);
+
+    SWAP(zz_t, *u, *v);
+    if (small_u) {
+        v->digits = v->small_digits;
+    }
+    if (small_v) {
+        u->digits = u->small_digits;
+    }
+}
+
+inline static void
+zz_normalize(zz_t *u)
+{
+    while (u->size && u->digits[u->size - 1] == 0) {
+        u->size--;
+    }
+    if (!u->size) {
+        SETNEG(false, u);
+    }
+}
+
+zz_ord
+zz_cmp(const zz_t *u, const zz_t *v)
+{
+    if (u == v) {
+        return ZZ_EQ;
+    }
+
+    bool u_negative = ISNEG(u);
+    zz_ord res = u_negative ? ZZ_LT : ZZ_GT;
+
+    if (u_negative != ISNEG(v)) {
+        return res;
+    }
+    else if (u->size != v->size) {
+        return (u->size < v->size) ? -res : res;
+    }
+    res = mpn_cmp(u->digits, v->digits, u->size);
+    return u_negative ? -res : res;
+}
+
+zz_ord
+zz_cmp_i64(const zz_t *u, int64_t v)
+{
+    bool u_negative = ISNEG(u);
+    zz_ord res = u_negative ? ZZ_LT : ZZ_GT;
+
+    if (u_negative != (v < 0) || u->size > 1) {
+        return res;
+    }
+    else if (!u->size) {
+        return v ? -res : ZZ_EQ;
+    }
+
+    zz_digit_t uu = u->digits[0], uv = ABS_CAST(zz_digit_t, v);
+
+    if (uu == uv) {
+        return ZZ_EQ;
+    }
+    return uu > uv ? res : -res;
+}
+
+zz_err
+zz_set_mpz_t(mpz_t u, zz_t *v)
+{
+    if (zz_resize(abs(u->_mp_size), v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_copyi(v->digits, u->_mp_d, v->size);
+    SETNEG(u->_mp_size < 0, v);
+    return ZZ_OK;
+}
+
+/* Like zz_set_mpz_t(), but take ownership of the digits of u instead of
+   copying, so the result doesn't exist twice in memory.  Digits were
+   allocated by the zz_allocate_function(), i.e. it's a block of our
+   allocator: it's removed from the tracker and taken by v as is.  The u is
+   cleared in any case. */
+static zz_err
+zz_move_mpz_t(mpz_t u, zz_t *v)
+{
+    zz_size_t size = abs(u->_mp_size), alloc = u->_mp_alloc;
+    bool negative = u->_mp_size < 0;
+
+    if (size <= ZZ_SMALL_DIGITS || SCRATCH_OWNS(zz_cur_scratch, u->_mp_d)) {
+        /* Digits on the scratch stack are copied. */
+        zz_err ret = zz_set_mpz_t(u, v);
+
+        mpz_clear(u);
+        return ret;
+    }
+
+    size_t i = (size_t)MEM_TRACKER(u->_mp_d);
+
+    assert(i < zz_tracker.used && zz_tracker.ptrs[i] == u->_mp_d);
+    zz_tracker_remove(i);
+    zz_clear(v);
+    v->digits = u->_mp_d;
+    SETADOPTED(0, v);
+    SETALLOC(alloc, v);
+    v->size = size;
+    SETNEG(negative, v);
+    return ZZ_OK;
+}
+
+zz_err
+zz_set_i32(int32_t u, zz_t *v)
+{
+    if (!u) {
+        v->size = 0;
+        SETNEG(false, v);
+        return ZZ_OK;
+    }
+    if (zz_resize(1, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(u < 0, v);
+    v->digits[0] = (zz_digit_t)abs(u);
+    return ZZ_OK;
+}
+
+zz_err
+zz_set_i64(int64_t u, zz_t *v)
+{
+    if (!u) {
+        v->size = 0;
+        SETNEG(false, v);
+        return ZZ_OK;
+    }
+    if (zz_resize(1, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(u < 0, v);
+    v->digits[0] = ABS_CAST(zz_digit_t, u);
+    return ZZ_OK;
+}
+
+zz_err
+zz_set_u64(uint64_t u, zz_t *v)
+{
+    if (!u) {
+        v->size = 0;
+        SETNEG(false, v);
+        return ZZ_OK;
+    }
+    if (zz_resize(1, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(false, v);
+    v->digits[0] = u;
+    return ZZ_OK;
+}
+
+#define DIGITS_PER_DOUBLE ((53 + ZZ_DIGIT_T_BITS - 2) / ZZ_DIGIT_T_BITS + 1)
+
+zz_err
+zz_set_double(double u, zz_t *v)
+{
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wfloat-conversion"
+#endif
+    if (isnan(u)) {
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic pop
+#endif
+        return ZZ_VAL;
+    }
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wfloat-conversion"
+#endif
+    if (isinf(u)) {
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic pop
+#endif
+        return ZZ_BUF;
+    }
+    if (zz_resize(DIGITS_PER_DOUBLE, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+
+    /* v has enough space to prevent new allocation by GMP */
+    TMP_MPZ(z, v);
+    mpz_set_d(z, u);
+    SETNEG(u < 0, v);
+    v->size = abs(z->_mp_size);
+    return ZZ_OK;
+}
+
+zz_err
+zz_get_i32(const zz_t *u, int32_t *v)
+{
+    zz_size_t n = u->size;
+
+    if (!n) {
+        *v = 0;
+        return ZZ_OK;
+    }
+    if (n > 1) {
+        return ZZ_BUF;
+    }
+
+    zz_digit_t uv = u->digits[0];
+
+    if (ISNEG(u)) {
+        if (uv <= INT32_MAX + (zz_digit_t)1) {
+            *v = -1 - (int32_t)((uv - 1) & INT32_MAX);
+            return ZZ_OK;
+        }
+    }
+    else {
+        if (uv <= INT32_MAX) {
+            *v = (int32_t)uv;
+            return ZZ_OK;
+        }
+    }
+    return ZZ_BUF;
+}
+
+zz_err
+zz_get_i64(const zz_t *u, int64_t *v)
+{
+    zz_size_t n = u->size;
+
+    if (!n) {
+        *v = 0;
+        return ZZ_OK;
+    }
+    if (n > 1) {
+        return ZZ_BUF;
+    }
+
+    zz_digit_t uv = u->digits[0];
+
+    if (ISNEG(u)) {
+        if (uv <= INT64_MAX + (zz_digit_t)1) {
+            *v = -1 - (int64_t)((uv - 1) & INT64_MAX);
+            return ZZ_OK;
+        }
+    }
+    else {
+        if (uv <= INT64_MAX) {
+            *v = (int64_t)uv;
+            return ZZ_OK;
+        }
+    }
+    return ZZ_BUF;
+}
+
+zz_err
+zz_get_u32(const zz_t *u, uint32_t *v)
+{
+    if (ISNEG(u)) {
+        return ZZ_VAL;
+    }
+    if (!u->size) {
+        *v = 0;
+        return ZZ_OK;
+    }
+    if (u->size > 1 || u->digits[0] > UINT32_MAX) {
+        return ZZ_BUF;
+    }
+    *v = (uint32_t)u->digits[0];
+    return ZZ_OK;
+}
+
+zz_err
+zz_get_u64(const zz_t *u, uint64_t *v)
+{
+    if (ISNEG(u)) {
+        return ZZ_VAL;
+    }
+    if (u->size > 1) {
+        return ZZ_BUF;
+    }
+    *v = u->size ? u->digits[0] : 0;
+    return ZZ_OK;
+}
+
+bool
+zz_iszero(const zz_t *u)
+{
+    return u->size == 0;
+}
+
+bool
+zz_isneg(const zz_t *u)
+{
+    return ISNEG(u);
+}
+
+bool
+zz_isodd(const zz_t *u)
+{
+    return u->size && u->digits[0] & 1;
+}
+
+zz_err
+zz_pos(const zz_t *u, zz_t *v)
+{
+    if (u != v) {
+        if (!u->size) {
+            return zz_set_i64(0, v);
+        }
+        if (zz_resize(u->size, v)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        SETNEG(ISNEG(u), v);
+        mpn_copyi(v->digits, u->digits, u->size);
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_abs(const zz_t *u, zz_t *v)
+{
+    if (u != v && zz_pos(u, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(false, v);
+    return ZZ_OK;
+}
+
+zz_err
+zz_neg(const zz_t *u, zz_t *v)
+{
+    if (u != v && zz_pos(u, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (v->size) {
+        SETNEG(!ISNEG(u), v);
+    }
+    return ZZ_OK;
+}
+
+/* Products of at least threshold digits (of the shorter operand) are
+   split to run on up to threads threads, see zz_set_mul_threads().
+   Balanced operands are split by one step of the Karatsuba method, in
+   three products of nearly half size, unbalanced - by chunks of the
+   longer operand.  Parts are split further, if they are big enough and
+   threads are left. */
+#define ZZ_MUL_THREAD_THRESHOLD 8192
+/* Products with the shorter operand of less than this number of digits
+   are computed by the mpn_mul_basecase() directly.  It's below the Karatsuba
+   threshold of the GNU GMP on common platforms. */
+#define ZZ_MUL_BASECASE_THRESHOLD 16
+
+static struct {
+    int threads;
+    zz_size_t threshold;
+} zz_mul_params = {1, ZZ_MUL_THREAD_THRESHOLD};
+
+zz_err
+zz_set_mul_threads(int threads, zz_size_t threshold)
+{
+    if (threads < 1 || threshold < 2 || (!HAVE_PTHREAD_H && threads > 1)) {
+        return ZZ_VAL;
+    }
+    zz_mul_params.threads = threads;
+    zz_mul_params.threshold = threshold;
+    return ZZ_OK;
+}
+
+#if HAVE_PTHREAD_H
+static zz_err zz_mul_split(zz_digit_t *rp, const zz_digit_t *up,
+                           zz_size_t un, const zz_digit_t *vp, zz_size_t vn,
+                           int threads);
+#endif
+
+/* Set {rp, un + vn} to {up, un} times {vp, vn}, like mpn_mul(), using
+   up to threads threads.  Output shouldn't overlap inputs.  Memory
+   failures of the GMP are handled by the guard of the caller, if this
+   doesn't split the product. */
+static zz_err
+zz_mul_digits(zz_digit_t *rp, const zz_digit_t *up, zz_size_t un,
+              const zz_digit_t *vp, zz_size_t vn, int threads)
+{
+    if (un < vn) {
+        SWAP(const zz_digit_t *, up, vp);
+        SWAP(zz_size_t, un, vn);
+    }
+#if HAVE_PTHREAD_H
+    if (threads > 1 && vn >= zz_mul_params.threshold) {
+        return zz_mul_split(rp, up, un, vp, vn, threads);
+    }
+#else
+    (void)threads;
+#endif
+    if (un != vn) {
+        mpn_mul(rp, up, un, vp, vn);
+    }
+    else if (up != vp) {
+        mpn_mul_n(rp, up, vp, un);
+    }
+    else {
+        mpn_sqr(rp, up, un);
+    }
+    return ZZ_OK;
+}
+
+#if HAVE_PTHREAD_H
+typedef struct {
+    zz_digit_t *rp;
+    const zz_digit_t *up;
+    zz_size_t un;
+    const zz_digit_t *vp;
+    zz_size_t vn;
+    int threads;
+    zz_err ret;
+} zz_mul_task;
+
+static void *
+zz_mul_worker(void *arg)
+{
+    zz_mul_task *t = arg;
+
+    if (TMP_OVERFLOW) {
+        t->ret = ZZ_MEM; /* LCOV_EXCL_LINE */
+        return NULL; /* LCOV_EXCL_LINE */
+    }
+    t->ret = zz_mul_digits(t->rp, t->up, t->un, t->vp, t->vn, t->threads);
+    return NULL;
+}
+
+/* Run the task in the calling thread, while workers might be running.
+   Memory failure is returned, the guard of the caller is restored. */
+static void
+zz_mul_inline(zz_mul_task *t)
+{
+    jmp_buf env;
+
+    memcpy(env, zz_env, sizeof(jmp_buf));
+    if (TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+        memcpy(zz_env, env, sizeof(jmp_buf));
+        t->ret = ZZ_MEM;
+        return;
+        /* LCOV_EXCL_STOP */
+    }
+    t->ret = zz_mul_digits(t->rp, t->up, t->un, t->vp, t->vn, t->threads);
+    memcpy(zz_env, env, sizeof(jmp_buf));
+}
+
+/* Set {rp, an} to |{ap, an} - {bp, bn}|, an >= bn.  Return true, if
+   the difference is negative. */
+static bool
+zz_absdiff(zz_digit_t *rp, const zz_digit_t *ap, zz_size_t an,
+           const zz_digit_t *bp, zz_size_t bn)
+{
+    if (an > bn && !mpn_zero_p(ap + bn, an - bn)) {
+        mpn_sub(rp, ap, an, bp, bn);
+        return false;
+    }
+    mpn_zero(rp + bn, an - bn);
+    if (mpn_cmp(ap, bp, bn) < 0) {
+        mpn_sub_n(rp, bp, ap, bn);
+        return true;
+    }
+    mpn_sub_n(rp, ap, bp, bn);
+    return false;
+}
+
+static zz_err
+zz_mul_split(zz_digit_t *rp, const zz_digit_t *up, zz_size_t un,
+             const zz_digit_t *vp, zz_size_t vn, int threads)
+{
+    zz_size_t h = (un + 1)/2;
+    bool karatsuba = vn > h;
+    size_t scratch_size = ZZ_DIGIT_T_BYTES*(size_t)(karatsuba ? 6*h + 1
+                                                    : un - h + vn);
+    zz_digit_t *scratch = zz_mem_malloc(scratch_size);
+
+    if (!scratch) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+
+    zz_mul_task t[3];
+    int ntasks;
+    bool neg = false;
+
+    if (karatsuba) {
+        /* u*v = z0 + (z0 + z2 - (u0 - u1)*(v0 - v1))*B^h + z2*B^(2*h),
+           where z0 = u0*v0 and z2 = u1*v1. */
+        zz_digit_t *ud = scratch, *vd = scratch + h;
+
+        if (up == vp && un == vn) {
+            zz_absdiff(ud, up, h, up + h, un - h);
+            vd = ud;
+        }
+        else {
+            neg = (zz_absdiff(ud, up, h, up + h, un - h)
+                   != zz_absdiff(vd, vp, h, vp + h, vn - h));
+        }
+        t[0] = (zz_mul_task){rp, up, h, vp, h, 0, ZZ_OK};
+        t[1] = (zz_mul_task){rp + 2*h, up + h, un - h, vp + h, vn - h, 0,
+                             ZZ_OK};
+        t[2] = (zz_mul_task){scratch + 2*h, ud, h, vd, h, 0, ZZ_OK};
+        ntasks = 3;
+    }
+    else {
+        t[0] = (zz_mul_task){rp, up, h, vp, vn, 0, ZZ_OK};
+        t[1] = (zz_mul_task){scratch, up + h, un - h, vp, vn, 0, ZZ_OK};
+        ntasks = 2;
+    }
+
+    pthread_t tid[3];
+    int started = 0;
+
+    for (int i = 0; i < ntasks; i++) {
+        t[i].threads = MAX(threads/ntasks, 1);
+    }
+    /* The last task is always done by the calling thread. */
+    while (started < MIN(ntasks, threads) - 1
+           && !zz_thread_create(&tid[started], zz_mul_worker, t + started))
+    {
+        started++;
+    }
+    for (int i = started; i < ntasks; i++) {
+        zz_mul_inline(t + i);
+    }
+    for (int i = 0; i < started; i++) {
+        zz_thread_join(tid[i]);
+    }
+
+    zz_err ret = ZZ_OK;
+
+    for (int i = 0; i < ntasks; i++) {
+        if (t[i].ret) {
+            ret = t[i].ret; /* LCOV_EXCL_LINE */
+        }
+    }
+    if (ret) {
+        zz_mem_free(scratch, scratch_size); /* LCOV_EXCL_LINE */
+        return ret; /* LCOV_EXCL_LINE */
+    }
+    if (karatsuba) {
+        zz_digit_t *d = scratch + 2*h, *w = scratch + 4*h;
+        zz_size_t size = un + vn - h, w_size = 2*h + 1;
+
+        w[2*h] = mpn_add(w, rp, 2*h, rp + 2*h, un + vn - 2*h);
+        if (neg) {
+            mpn_add(w, w, w_size, d, 2*h);
+        }
+        else {
+            mpn_sub(w, w, w_size, d, 2*h);
+        }
+        while (w_size > size) {
+            assert(!w[w_size - 1]);
+            w_size--;
+        }
+        mpn_add(rp + h, rp + h, size, w, w_size);
+    }
+    else {
+        zz_digit_t *hp = rp + h + vn;
+
+        mpn_copyi(hp, scratch + vn, un - h);
+        mpn_add_1(hp, hp, un - h, mpn_add_n(rp + h, rp + h, scratch, vn));
+    }
+    zz_mem_free(scratch, scratch_size);
+    return ZZ_OK;
+}
+#endif
+
+/* Radix conversion for bases, that are not a power of 2.  Values are
+   split by powers P_k = B^(m*2^k) of the base B, where B^m is the
+   largest power, that fits in a digit.  Powers are cached per thread
+   and reused across conversions in the same base.  Like GMP, we keep
+   them without low zero digits (shifts[k] of them), for even bases
+   that makes divisors and multipliers noticeably shorter. */
+
+#define ZZ_RADIX_LEVELS 48
+/* Use divide-and-conquer for values of more than ZZ_RADIX_DC_THRESHOLD
+   digits, converting halves in parallel above ZZ_RADIX_THREAD_THRESHOLD
+   with up to zz_mul_params.threads threads. */
+#define ZZ_RADIX_DC_THRESHOLD 64
+#define ZZ_RADIX_THREAD_THRESHOLD 16384
+
+typedef struct {
+    int base;
+    size_t nlevels;
+    void (*free)(void *, size_t);
+    zz_digit_t *mem[ZZ_RADIX_LEVELS];
+    size_t allocs[ZZ_RADIX_LEVELS];
+    zz_digit_t *pows[ZZ_RADIX_LEVELS];
+    zz_size_t sizes[ZZ_RADIX_LEVELS];
+    zz_size_t shifts[ZZ_RADIX_LEVELS];
+    size_t digits[ZZ_RADIX_LEVELS];
+} zz_radix_cache_t;
+
+/* Number of digits in P_k. */
+#define RADIX_SIZE(c, k) ((c)->sizes[k] + (c)->shifts[k])
+
+static _Thread_local zz_radix_cache_t zz_radix_cache;
+
+void
+zz_radix_cache_clear(void)
+{
+    zz_radix_cache_t *c = &zz_radix_cache;
+
+    for (size_t k = 0; k < ZZ_RADIX_LEVELS; k++) {
+        if (c->mem[k]) {
+            c->free(c->mem[k], c->allocs[k]);
+            c->mem[k] = NULL;
+        }
+    }
+    c->nlevels = 0;
+    c->base = 0;
+}
+
+/* Return cache with at least nlevels powers of the base or NULL on
+   failure.  GMP calls here are protected by the caller's TMP_OVERFLOW
+   guard.  A level, interrupted by longjmp(), is recomputed later. */
+static const zz_radix_cache_t *
+zz_radix_powers(int base, size_t nlevels)
+{
+    zz_radix_cache_t *c = &zz_radix_cache;
+
+    if (c->base != base || c->free != zz_state.free) {
+        zz_radix_cache_clear();
+        c->base = base;
+        c->free = zz_state.free;
+    }
+    while (c->nlevels < nlevels) {
+        size_t k = c->nlevels;
+
+        if (k == ZZ_RADIX_LEVELS) {
+            return NULL; /* LCOV_EXCL_LINE */
+        }
+
+        size_t size = k ? 2*(size_t)c->sizes[k - 1] : 1;
+
+        if (c->mem[k]) {
+            c->free(c->mem[k], c->allocs[k]); /* LCOV_EXCL_LINE */
+        }
+        c->allocs[k] = size*ZZ_DIGIT_T_BYTES;
+        c->mem[k] = zz_state.malloc(c->allocs[k]);
+        if (!c->mem[k]) {
+            return NULL; /* LCOV_EXCL_LINE */
+        }
+        c->pows[k] = c->mem[k];
+        if (k) {
+            zz_size_t n = (zz_size_t)size;
+
+            mpn_sqr(c->pows[k], c->pows[k - 1], c->sizes[k - 1]);
+            n -= (c->pows[k][n - 1] == 0);
+            c->shifts[k] = 2*c->shifts[k - 1];
+            while (!c->pows[k][0]) {
+                c->pows[k]++;
+                c->shifts[k]++;
+                n--;
+            }
+            c->sizes[k] = n;
+            c->digits[k] = 2*c->digits[k - 1];
+        }
+        else {
+            zz_digit_t p = (zz_digit_t)base;
+            size_t m = 1;
+
+            while (p <= ZZ_DIGIT_T_MAX/(zz_digit_t)base) {
+                p *= (zz_digit_t)base;
+                m++;
+            }
+            c->pows[0][0] = p;
+            c->sizes[0] = 1;
+            c->shifts[0] = 0;
+            c->digits[0] = m;
+        }
+        c->nlevels++;
+    }
+    return c;
+}
+
+/* Size of chunks for streaming I/O, in bytes. */
+#define ZZ_STREAM_CHUNK 65536
+
+/* Buffered text output of digit values for zz_get_str_stream().  Leading
+   zeros are skipped until started is set. */
+typedef struct {
+    zz_write_func write;
+    void *ctx;
+    const char *num_to_text;
+    unsigned char *buf;
+    size_t used;
+    bool started;
+    zz_err ret;
+} zz_radix_sink;
+
+/* Append n digit values (zeros, if digits is NULL) to the sink. */
+static zz_err
+zz_sink_put(zz_radix_sink *s, const unsigned char *digits, size_t n)
+{
+    for (size_t i = 0; i < n && !s->ret; i++) {
+        unsigned char d = digits ? digits[i] : 0;
+
+        if (!s->started) {
+            if (!d) {
+                continue;
+            }
+            s->started = true;
+        }
+        s->buf[s->used++] = (unsigned char)s->num_to_text[d];
+        if (s->used == ZZ_STREAM_CHUNK) {
+            s->ret = s->write(s->ctx, s->buf, s->used);
+            s->used = 0;
+        }
+    }
+    return s->ret;
+}
+
+/* A half of the conversion, that could be handed over to a thread. */
+typedef struct {
+    const zz_radix_cache_t *c;
+    bool get;
+    zz_digit_t *digits;
+    zz_size_t size;
+    const unsigned char *in;
+    unsigned char *out;
+    zz_radix_sink *sink;
+    size_t len;
+    size_t k;
+    int threads;
+    zz_err ret;
+} zz_radix_task;
+
+/* Number of scratch digits, needed for conversion of a value, that
+   is less than P_(k+1). */
+static size_t
+zz_radix_scratch(const zz_radix_cache_t *c, bool get, size_t k)
+{
+    size_t size = 1;
+
+    for (size_t j = get; j <= k; j++) {
+        size += 2*(size_t)RADIX_SIZE(c, j) + (get ? 1 : 2);
+    }
+    return size;
+}
+
+static zz_err zz_radix_run(zz_radix_task *t, zz_digit_t *scratch);
+
+#if HAVE_PTHREAD_H
+static void *
+zz_radix_worker(void *arg)
+{
+    zz_radix_task *t = arg;
+    size_t scratch_size = ZZ_DIGIT_T_BYTES*zz_radix_scratch(t->c, t->get,
+                                                            t->k);
+    zz_digit_t *volatile scratch = zz_mem_malloc(scratch_size);
+
+    if (!scratch || TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+        zz_mem_free(scratch, scratch_size);
+        t->ret = ZZ_MEM;
+        return NULL;
+        /* LCOV_EXCL_STOP */
+    }
+    t->ret = zz_radix_run(t, scratch);
+    zz_mem_free(scratch, scratch_size);
+    return NULL;
+}
+#endif
+
+/* Convert both halves, in parallel if they are big enough.  Workers
+   own their scratch space and TMP_OVERFLOW guard, the calling thread
+   only waits for them, so it can't longjmp() while they are running.
+   If a thread can't be created, that half is converted in place. */
+static zz_err
+zz_radix_split(zz_radix_task *t, zz_digit_t *scratch, zz_size_t size)
+{
+#if HAVE_PTHREAD_H
+    if (t[0].threads && size >= ZZ_RADIX_THREAD_THRESHOLD) {
+        pthread_t tid[2];
+        int started = 0;
+
+        while (started < 2 && !zz_thread_create(&tid[started],
+                                                zz_radix_worker, t + started))
+        {
+            started++;
+        }
+        for (int i = 0; i < started; i++) {
+            zz_thread_join(tid[i]);
+        }
+        for (int i = started; i < 2; i++) {
+            t[i].ret = zz_radix_run(t + i, scratch); /* LCOV_EXCL_LINE */
+        }
+        return t[0].ret ? t[0].ret : t[1].ret;
+    }
+#endif
+    for (int i = 0; i < 2; i++) {
+        t[i].ret = zz_radix_run(t + i, scratch);
+        if (t[i].ret) {
+            return t[i].ret; /* LCOV_EXCL_LINE */
+        }
+    }
+    return ZZ_OK;
+}
+
+/* Write {up, un} as exactly len digits (padded with leading zeros) to
+   str or, if it's NULL, to the sink.  Input must be less than P_k^2.
+   It's clobbered, unless un is bigger than ZZ_RADIX_DC_THRESHOLD. */
+static zz_err
+zz_get_str_dc(const zz_radix_cache_t *c, zz_digit_t *up, zz_size_t un,
+              size_t k, unsigned char *str, size_t len,
+              zz_digit_t *scratch, int threads, zz_radix_sink *sink)
+{
+    while (un && !up[un - 1]) {
+        un--;
+    }
+    if (un <= ZZ_RADIX_DC_THRESHOLD) {
+        unsigned char buf[ZZ_RADIX_DC_THRESHOLD*ZZ_DIGIT_T_BITS + 1];
+        size_t n = un ? mpn_get_str(buf, c->base, up, un) : 0, i = 0;
+
+        while (n - i > len) {
+            assert(!buf[i]);
+            i++;
+        }
+        if (!str) {
+            (void)zz_sink_put(sink, NULL, len - (n - i));
+            return zz_sink_put(sink, buf + i, n - i);
+        }
+        memset(str, 0, len - (n - i));
+        memcpy(str + len - (n - i), buf + i, n - i);
+        return ZZ_OK;
+    }
+    while (un < RADIX_SIZE(c, k)
+           || (un == RADIX_SIZE(c, k)
+               && mpn_cmp(up + c->shifts[k], c->pows[k], c->sizes[k]) < 0))
+    {
+        k--;
+    }
+    assert(k > 0);
+
+    size_t dk = c->digits[k];
+    zz_size_t sn = c->shifts[k], pn = RADIX_SIZE(c, k), qn = un - pn + 1;
+
+    /* Low digits of the remainder are those of the input. */
+    assert(len >= dk);
+    mpn_copyi(scratch + qn, up, sn);
+    mpn_tdiv_qr(scratch, scratch + qn + sn, 0, up + sn, un - sn,
+                c->pows[k], c->sizes[k]);
+
+    zz_radix_task t[2] = {
+        {c, true, scratch, qn, NULL, str, sink, len - dk, k - 1, threads/2,
+         ZZ_OK},
+        {c, true, scratch + qn, pn, NULL, str ? str + len - dk : NULL, sink,
+         dk, k - 1, threads/2, ZZ_OK}};
+
+    return zz_radix_split(t, scratch + un + 1, un);
+}
+
+/* Set {rp, *rn} from len digit values at str.  There should be space
+   at rp for the largest number of len digits plus one extra digit. */
+static zz_err
+zz_set_str_dc(const zz_radix_cache_t *c, const unsigned char *str,
+              size_t len, zz_digit_t *rp, zz_size_t *rn,
+              zz_digit_t *scratch, int threads)
+{
+    zz_size_t n;
+
+    if (len <= ZZ_RADIX_DC_THRESHOLD*c->digits[0]) {
+        n = (zz_size_t)mpn_set_str(rp, str, len, c->base);
+        while (n && !rp[n - 1]) {
+            n--;
+        }
+        *rn = n;
+        return ZZ_OK;
+    }
+
+    size_t k = 0;
+
+    while (k + 1 < c->nlevels && c->digits[k + 1] < len) {
+        k++;
+    }
+
+    size_t dk = c->digits[k];
+    zz_size_t sn = c->shifts[k], pn = RADIX_SIZE(c, k);
+
+    assert(dk < len && len - dk <= dk);
+
+    zz_radix_task t[2] = {
+        {c, false, scratch, 0, str, NULL, NULL, len - dk, k - 1, threads/2,
+         ZZ_OK},
+        {c, false, scratch + pn + 1, 0, str + len - dk, NULL, NULL, dk, k - 1,
+         threads/2, ZZ_OK}};
+    zz_err ret = zz_radix_split(t, scratch + 2*(pn + 1),
+                                (zz_size_t)(len/c->digits[0]));
+
+    if (ret) {
+        return ret; /* LCOV_EXCL_LINE */
+    }
+
+    zz_digit_t *hp = t[0].digits, *lp = t[1].digits;
+    zz_size_t hn = t[0].size, ln = t[1].size;
+
+    if (!hn) {
+        mpn_copyi(rp, lp, ln);
+        *rn = ln;
+        return ZZ_OK;
+    }
+    mpn_zero(rp, sn);
+    ret = zz_mul_digits(rp + sn, c->pows[k], c->sizes[k], hp, hn,
+                        zz_mul_params.threads);
+    if (ret) {
+        return ret; /* LCOV_EXCL_LINE */
+    }
+    n = pn + hn;
+    if (ln) {
+        mpn_add(rp, rp, n, lp, ln);
+    }
+    while (n && !rp[n - 1]) {
+        n--;
+    }
+    *rn = n;
+    return ZZ_OK;
+}
+
+static zz_err
+zz_radix_run(zz_radix_task *t, zz_digit_t *scratch)
+{
+    if (t->get) {
+        return zz_get_str_dc(t->c, t->digits, t->size, t->k, t->out,
+                             t->len, scratch, t->threads, t->sink);
+    }
+    return zz_set_str_dc(t->c, t->in, t->len, t->digits, &t->size,
+                         scratch, t->threads);
+}
+
+zz_err
+zz_sizeinbase(const zz_t *u, int base, size_t *len)
+{
+    const int abase = abs(base);
+
+    if (abase < 2 || abase > 36) {
+        return ZZ_VAL;
+    }
+    *len = mpn_sizeinbase(u->digits, u->size, abase);
+    return ZZ_OK;
+}
+
+zz_err
+zz_get_str_size(const zz_t *u, int base, size_t *size)
+{
+    if (zz_sizeinbase(u, base, size)) {
+        return ZZ_VAL;
+    }
+    *size += ISNEG(u) + 1;
+    return ZZ_OK;
+}
+
+/* If clobber is true, the digits of u can be used as scratch space. */
+static zz_err
+_zz_get_str(zz_t *u, int sbase, bool clobber, char *str)
+{
+    ZZ_STAT_CALL(ZZ_OP_GET_STR, u->size);
+    /* Maps 1-byte integer to digit character for bases up to 36.  Neither
+       it nor the base are changed after setjmp(). */
+    const char *NUM_TO_TEXT = (sbase < 0
+                               ? "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                               : "0123456789abcdefghijklmnopqrstuvwxyz");
+    const int base = abs(sbase);
+
+    if (base < 2 || base > 36) {
+        return ZZ_VAL;
+    }
+
+    unsigned char *p = (unsigned char *)str;
+    size_t len;
+
+    if (!u->size) {
+        *(p++) = '0';
+        goto end;
+    }
+    if (ISNEG(u)) {
+        *(p++) = '-';
+    }
+    if ((base & (base - 1)) == 0) {
+        len = mpn_get_str(p, base, u->digits, u->size);
+    }
+    else if (u->size <= ZZ_RADIX_DC_THRESHOLD && clobber && !ISVIEW(u)) {
+        if (TMP_OVERFLOW) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        len = mpn_get_str(p, base, u->digits, u->size);
+    }
+    else if (u->size <= ZZ_RADIX_DC_THRESHOLD) {
+        /* generic base, not power of 2, input might be clobbered */
+        size_t tmp_size = ZZ_DIGIT_T_BYTES * (size_t)u->size;
+        zz_digit_t *volatile tmp = zz_mem_malloc(tmp_size);
+
+        if (!tmp || TMP_OVERFLOW) {
+            /* LCOV_EXCL_START */
+            zz_mem_free(tmp, tmp_size);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+        mpn_copyi(tmp, u->digits, u->size);
+        len = mpn_get_str(p, base, tmp, u->size);
+        zz_mem_free(tmp, tmp_size);
+    }
+    else {
+        /* Convert to mpn_sizeinbase() digits, that might be one more
+           than needed and strip leading zeros.  Input isn't clobbered
+           here, only the scratch space. */
+        volatile size_t k = 0, tmp_size = 0;
+        zz_digit_t *volatile tmp = NULL;
+
+        len = mpn_sizeinbase(u->digits, u->size, base);
+        if (TMP_OVERFLOW) {
+            /* LCOV_EXCL_START */
+            zz_mem_free(tmp, tmp_size);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+
+        const zz_radix_cache_t *c = zz_radix_powers(base, 1);
+
+        while (c && 2*(size_t)RADIX_SIZE(c, k) < (size_t)u->size + 2) {
+            k++;
+            c = zz_radix_powers(base, k + 1);
+        }
+        if (c) {
+            tmp_size = ZZ_DIGIT_T_BYTES*zz_radix_scratch(c, true, k);
+            tmp = zz_mem_malloc(tmp_size);
+        }
+        if (!tmp || zz_get_str_dc(c, u->digits, u->size, k, p, len,
+                                  tmp, zz_mul_params.threads, NULL))
+        {
+            /* LCOV_EXCL_START */
+            zz_mem_free(tmp, tmp_size);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+        zz_mem_free(tmp, tmp_size);
+
+        size_t i = 0;
+
+        while (!p[i]) {
+            i++;
+        }
+        memmove(p, p + i, len - i);
+        len -= i;
+    }
+    for (size_t i = 0; i < len; i++) {
+        *p = (unsigned char)NUM_TO_TEXT[*p];
+        p++;
+    }
+end:
+    *p = '\0';
+    return ZZ_OK;
+}
+
+zz_err
+zz_get_str(const zz_t *u, int base, char *str)
+{
+    return _zz_get_str((zz_t *)u, base, false, str);
+}
+
+zz_err
+zz_get_str_destructive(zz_t *u, int base, char *str)
+{
+    zz_err ret = _zz_get_str(u, base, true, str);
+
+    (void)zz_resize(0, u);
+    return ret;
+}
+
+zz_err
+zz_get_str_stream(const zz_t *u, int sbase, zz_write_func write, void *ctx)
+{
+    /* Neither base nor digit characters are changed after setjmp(). */
+    const char *NUM_TO_TEXT = (sbase < 0
+                               ? "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                               : "0123456789abcdefghijklmnopqrstuvwxyz");
+    const int base = abs(sbase);
+
+    if (base < 2 || base > 36) {
+        return ZZ_VAL;
+    }
+
+    zz_radix_sink s = {write, ctx, NUM_TO_TEXT, NULL, 0, false, ZZ_OK};
+    size_t digits_size = ZZ_STREAM_CHUNK + 1;
+    volatile size_t tmp_size = 0;
+    unsigned char *volatile digits = zz_mem_malloc(digits_size);
+    zz_digit_t *volatile tmp = NULL;
+
+    s.buf = zz_mem_malloc(ZZ_STREAM_CHUNK);
+    if (!s.buf || !digits || TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+        zz_mem_free(s.buf, ZZ_STREAM_CHUNK);
+        zz_mem_free(digits, digits_size);
+        zz_mem_free(tmp, tmp_size);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    if (!u->size) {
+        s.started = true;
+        (void)zz_sink_put(&s, NULL, 1);
+    }
+    if (ISNEG(u)) {
+        s.buf[s.used++] = '-';
+    }
+    if (u->size && (base & (base - 1)) == 0) {
+        /* Chunks of ZZ_STREAM_CHUNK digits, from the most significant.
+           Each one is padded, leading zeros are skipped by the sink. */
+        int bits = 0;
+
+        while ((1 << bits) < base) {
+            bits++;
+        }
+
+        zz_size_t w = ZZ_STREAM_CHUNK/ZZ_DIGIT_T_BITS*bits;
+
+        for (zz_size_t lo = (u->size - 1)/w*w; lo >= 0 && !s.ret; lo -= w) {
+            zz_size_t n = MIN(w, u->size - lo);
+            size_t len = 0, i = 0;
+
+            while (n && !u->digits[lo + n - 1]) {
+                n--;
+            }
+            if (n) {
+                len = mpn_get_str(digits, base, u->digits + lo, n);
+            }
+            while (len - i > ZZ_STREAM_CHUNK) {
+                i++; /* LCOV_EXCL_LINE */
+            }
+            (void)zz_sink_put(&s, NULL, ZZ_STREAM_CHUNK - (len - i));
+            (void)zz_sink_put(&s, digits + i, len - i);
+        }
+    }
+    else if (u->size && u->size <= ZZ_RADIX_DC_THRESHOLD) {
+        zz_digit_t up[ZZ_RADIX_DC_THRESHOLD];
+
+        mpn_copyi(up, u->digits, u->size);
+        (void)zz_sink_put(&s, digits,
+                          mpn_get_str(digits, base, up, u->size));
+    }
+    else if (u->size) {
+        size_t k = 0;
+        const zz_radix_cache_t *c = zz_radix_powers(base, 1);
+
+        while (c && 2*(size_t)RADIX_SIZE(c, k) < (size_t)u->size + 2) {
+            k++;
+            c = zz_radix_powers(base, k + 1);
+        }
+        if (c) {
+            tmp_size = ZZ_DIGIT_T_BYTES*zz_radix_scratch(c, true, k);
+            tmp = zz_mem_malloc(tmp_size);
+        }
+        if (!tmp) {
+            s.ret = ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        else {
+            (void)zz_get_str_dc(c, u->digits, u->size, k, NULL,
+                                mpn_sizeinbase(u->digits, u->size, base),
+                                tmp, 1, &s);
+        }
+    }
+    if (!s.ret && s.used) {
+        s.ret = write(ctx, s.buf, s.used);
+    }
+    zz_mem_free(s.buf, ZZ_STREAM_CHUNK);
+    zz_mem_free(digits, digits_size);
+    zz_mem_free(tmp, tmp_size);
+    return s.ret;
+}
+
+/* Table of digit values for 8-bit string->mpz conversion.
+   Note that when converting a base B string, a char c is a legitimate
+   base B digit iff DIGIT_VALUE_TAB[c] < B. */
+const int DIGIT_VALUE_TAB[] =
+{
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1,-1,-1,-1,-1,-1,
+  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
+  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
+  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
+  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1,-1,-1,-1,-1,-1,
+  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
+  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
+  -1,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,
+  51,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+/* If inplace is true, str is writable and digit values are collected
+   there, instead of a separate buffer. */
+static zz_err
+_zz_set_strn(const char *str, size_t len, int base, bool inplace, zz_t *u)
+{
+    if (base && (base < 2 || base > 36)) {
+        return ZZ_VAL;
+    }
+
+    const unsigned char *p = (const unsigned char *)str;
+
+    while (len && isspace(*p)) {
+        p++;
+        len--;
+    }
+    if (!len) {
+        return ZZ_VAL;
+    }
+
+    bool negative = (p[0] == '-');
+
+    p += negative;
+    len -= negative;
+    if (!len) {
+        return ZZ_VAL;
+    }
+    if (!negative && p[0] == '+') {
+        p++;
+        len--;
+    }
+    if (!len || p[0] == '_') {
+        return ZZ_VAL;
+    }
+    if (p[0] == '0' && base == 0) {
+        if (len == 1) {
+            return zz_set_i64(0, u);
+        }
+        else if (tolower(p[1]) == 'b') {
+            base = 2;
+        }
+        else if (tolower(p[1]) == 'o') {
+            base = 8;
+        }
+        else if (tolower(p[1]) == 'x') {
+            base = 16;
+        }
+        else if (!isspace(p[1])) {
+            return ZZ_VAL;
+        }
+        if (base) {
+            p += 2;
+            len -= 2;
+            if (len && p[0] == '_') {
+                p++;
+                len--;
+            }
+        }
+    }
+    else if (p[0] == '0' && len >= 2
+             && ((base == 2 && tolower(p[1]) == 'b')
+                 || (base == 8 && tolower(p[1]) == 'o')
+                 || (base == 16 && tolower(p[1]) == 'x')))
+    {
+        p += 2;
+        len -= 2;
+    }
+    if (base == 0) {
+        base = 10;
+    }
+    if (!len || p[0] == '_') {
+        return ZZ_VAL;
+    }
+
+    /* Validate the input and collect digit values in one pass.  The
+       value buffer is the only copy made: mpn_set_str() wants an array
+       of digit values, not characters, and str is read-only, unless
+       it's inplace: then we write digit values over characters,
+       already seen. */
+    size_t buf_size = inplace ? 0 : len, ndigits = 0;
+    unsigned char *volatile alloc = inplace ? NULL : zz_mem_malloc(buf_size);
+    unsigned char *buf = inplace ? (unsigned char *)p : alloc;
+
+    if (!buf) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '_') {
+            /* Underscores are allowed only between digits. */
+            if (i == len - 1
+                || (unsigned char)DIGIT_VALUE_TAB[p[i + 1]] >= base)
+            {
+                goto err;
+            }
+            continue;
+        }
+
+        unsigned char c = (unsigned char)DIGIT_VALUE_TAB[p[i]];
+
+        if (c < base) {
+            buf[ndigits++] = c;
+        }
+        else {
+            if (!isspace(p[i])) {
+                goto err;
+            }
+            for (size_t j = i + 1; j < len; j++) {
+                if (!isspace(p[j])) {
+                    goto err;
+                }
+            }
+            break;
+        }
+    }
+    if (!ndigits) {
+        goto err;
+    }
+
+    /* Bound the number of digits from the bits per digit in base. */
+    size_t bits = 1;
+
+    while ((1 << bits) < base) {
+        bits++;
+    }
+    if (ndigits > (SIZE_MAX - ZZ_DIGIT_T_BITS)/bits) {
+        /* LCOV_EXCL_START */
+        zz_mem_free(alloc, buf_size);
+        return ZZ_BUF;
+        /* LCOV_EXCL_STOP */
+    }
+
+    /* Leave room for one extra digit, as required by mpn_set_str(). */
+    size_t new_len = (ndigits*bits + ZZ_DIGIT_T_BITS - 1)/ZZ_DIGIT_T_BITS + 1;
+
+    if (new_len > ZZ_DIGITS_MAX) {
+        /* LCOV_EXCL_START */
+        zz_mem_free(alloc, buf_size);
+        return ZZ_BUF;
+        /* LCOV_EXCL_STOP */
+    }
+
+    size_t tmp_size = 0;
+    zz_digit_t *volatile tmp = NULL;
+
+    if (zz_resize((zz_size_t)new_len, u) || TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+        zz_mem_free(alloc, buf_size);
+        zz_mem_free(tmp, tmp_size);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    SETNEG(negative, u);
+    if ((base & (base - 1)) == 0 || new_len <= ZZ_RADIX_DC_THRESHOLD) {
+        u->size = (zz_size_t)mpn_set_str(u->digits, buf, ndigits, base);
+    }
+    else {
+        size_t k = 0;
+        const zz_radix_cache_t *c = zz_radix_powers(base, 1);
+
+        while (c && 2*c->digits[k] < ndigits) {
+            k++;
+            c = zz_radix_powers(base, k + 1);
+        }
+        if (c) {
+            tmp_size = (2*(size_t)RADIX_SIZE(c, k) + 1
+                        + zz_radix_scratch(c, false, k));
+            tmp_size *= ZZ_DIGIT_T_BYTES;
+            tmp = zz_mem_malloc(tmp_size);
+        }
+        if (!tmp || zz_set_str_dc(c, buf, ndigits, tmp, &u->size,
+                                  tmp + 2*RADIX_SIZE(c, k) + 1,
+                                  zz_mul_params.threads))
+        {
+            /* LCOV_EXCL_START */
+            zz_mem_free(alloc, buf_size);
+            zz_mem_free(tmp, tmp_size);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+        mpn_copyi(u->digits, tmp, u->size);
+        zz_mem_free(tmp, tmp_size);
+    }
+    zz_mem_free(alloc, buf_size);
+    if (zz_resize(u->size, u)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    zz_normalize(u);
+    return ZZ_OK;
+err:
+    zz_mem_free(alloc, buf_size);
+    return ZZ_VAL;
+}
+
+zz_err
+zz_set_strn(const char *str, size_t len, int base, zz_t *u)
+{
+    zz_err ret = _zz_set_strn(str, len, base, false, u);
+
+    ZZ_STAT_CALL(ZZ_OP_SET_STR, u->size);
+    return ret;
+}
+
+zz_err
+zz_set_str(const char *str, int base, zz_t *u)
+{
+    return zz_set_strn(str, strlen(str), base, u);
+}
+
+zz_err
+zz_set_str_stream(zz_read_func read, void *ctx, int base, zz_t *u)
+{
+    /* The conversion needs all digits at once, but we can parse the
+       text in place. */
+    size_t size = ZZ_STREAM_CHUNK, len = 0;
+    char *buf = zz_mem_malloc(size);
+
+    if (!buf) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    while (1) {
+        if (len == size) {
+            size_t new_size = size + size/2;
+            char *tmp = NULL;
+
+            if (new_size > size) {
+                tmp = zz_mem_realloc(buf, size, new_size);
+            }
+            if (!tmp) {
+                /* LCOV_EXCL_START */
+                zz_mem_free(buf, size);
+                return ZZ_MEM;
+                /* LCOV_EXCL_STOP */
+            }
+            buf = tmp;
+            size = new_size;
+        }
+
+        size_t n = size - len;
+        zz_err ret = read(ctx, buf + len, &n);
+
+        if (ret) {
+            zz_mem_free(buf, size);
+            return ret;
+        }
+        if (!n) {
+            break;
+        }
+        len += n;
+    }
+
+    zz_err ret = _zz_set_strn(buf, len, base, true, u);
+
+    zz_mem_free(buf, size);
+    return ret;
+}
+
+/* Test bit of the magnitude. */
+static bool
+zz_tstbit_abs(const zz_t *u, zz_bitcnt_t idx)
+{
+    zz_size_t digit_idx = (zz_size_t)(idx / ZZ_DIGIT_T_BITS);
+
+    assert(u->size > digit_idx);
+    return (u->digits[digit_idx] >> (idx%ZZ_DIGIT_T_BITS)) & 1;
+}
+
+zz_err
+zz_get_double(const zz_t *u, double *d)
+{
+    if (u->size > DBL_MAX_EXP/ZZ_DIGIT_T_BITS + 1) {
+        *d = ISNEG(u) ? -INFINITY : INFINITY;
+        return ZZ_BUF;
+    }
+
+    zz_bitcnt_t bits = zz_bitlen(u);
+    TMP_MPZ(z, u);
+    *d = mpz_get_d(z); /* round towards zero */
+    if (DBL_MANT_DIG < bits && bits <= DBL_MAX_EXP) {
+        bits -= DBL_MANT_DIG + 1;
+        if (zz_tstbit_abs(u, bits)) {
+            zz_bitcnt_t tz = zz_lsbpos(u);
+
+            if (tz < bits || (tz == bits && zz_tstbit_abs(u, bits + 1))) {
+                *d = nextafter(*d, 2 * (*d)); /* round away from zero */
+            }
+        }
+    }
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wfloat-conversion"
+#endif
+    if (isinf(*d)) {
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic pop
+#endif
+        return ZZ_BUF;
+    }
+    return ZZ_OK;
+}
+
+zz_bitcnt_t
+zz_bitlen(const zz_t *u)
+{
+    zz_size_t size = u->size;
+
+    if (!size) {
+        return 0;
+    }
+    return ((zz_bitcnt_t)size*ZZ_DIGIT_T_BITS
+            - zz_digit_clz(u->digits[size - 1]));
+}
+
+zz_bitcnt_t
+zz_lsbpos(const zz_t *u)
+{
+    for (zz_size_t i = 0; i < u->size; i++) {
+        zz_digit_t digit = u->digits[i];
+
+        if (digit) {
+            return (zz_bitcnt_t)i*ZZ_DIGIT_T_BITS + zz_digit_ctz(digit);
+        }
+    }
+    return 0;
+}
+
+/* Operands of this size are passed to mpn_popcount(), which has vectorized
+   assembly kernels. */
+#define ZZ_POPCOUNT_THRESHOLD 8
+
+zz_bitcnt_t
+zz_bitcnt(const zz_t *u)
+{
+    const zz_digit_t *digits = u->digits;
+    zz_size_t size = u->size;
+    zz_bitcnt_t count = 0;
+
+    if (size < ZZ_POPCOUNT_THRESHOLD) {
+        for (zz_size_t i = 0; i < size; i++) {
+            count += zz_digit_popcount(digits[i]);
+        }
+        return count;
+    }
+    /* The mp_bitcnt_t type might be 32-bit, so count in chunks
+       that can't overflow it. */
+    while (size) {
+        zz_size_t n = (zz_size_t)MIN((uint64_t)size,
+                                     ULONG_MAX/ZZ_DIGIT_T_BITS);
+
+        count += mpn_popcount(digits, n);
+        digits += n;
+        size -= n;
+    }
+    return count;
+}
+
+static const zz_layout native_layout = {
+    .bits_per_digit = ZZ_DIGIT_T_BITS,
+    .digit_size = sizeof(zz_digit_t),
+    .digits_order = -1,
+    .digit_endianness = 0,
+};
+
+const zz_layout *
+zz_get_layout(void)
+{
+    return &native_layout;
+}
+
+zz_err
+zz_import(size_t len, const void *digits, zz_layout layout, zz_t *u)
+{
+    size_t size = (len*layout.bits_per_digit
+                   + (ZZ_DIGIT_T_BITS - 1))/ZZ_DIGIT_T_BITS;
+
+    if (len > SIZE_MAX / layout.bits_per_digit || size > INT_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    ZZ_STAT_CALL(ZZ_OP_IMPORT, (zz_size_t)size);
+    if (zz_resize((zz_size_t)size, u)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (layout.digit_size == 1 && layout.bits_per_digit == 8
+        && layout.digits_order == 1 && !layout.digit_endianness)
+    {
+        u->size = (zz_size_t)mpn_set_str(u->digits, digits, len, 256);
+        zz_normalize(u);
+        return ZZ_OK;
+    }
+
+    assert(layout.digit_size*8 >= layout.bits_per_digit);
+    mpn_import(u->digits, (mp_size_t *)&u->size, len, layout.digits_order,
+               layout.digit_size, layout.digit_endianness,
+               (size_t)(layout.digit_size*8 - layout.bits_per_digit),
+               digits);
+    return ZZ_OK;
+}
+
+zz_err
+zz_export(const zz_t *u, zz_layout layout, size_t len, void *digits)
+{
+    ZZ_STAT_CALL(ZZ_OP_EXPORT, u->size);
+    if (len < (zz_bitlen(u) + layout.bits_per_digit
+               - 1)/layout.bits_per_digit || u->size > INT_MAX)
+    {
+        return ZZ_BUF;
+    }
+    if (layout.digit_size == 1 && layout.bits_per_digit == 8
+        && layout.digits_order == 1 && !layout.digit_endianness)
+    {
+        if (!u->size) {
+            memset(digits, 0, 1);
+        }
+        else {
+            mpn_get_str(digits, 256, u->digits, u->size);
+        }
+        return ZZ_OK;
+    }
+
+    assert(layout.digit_size*8 >= layout.bits_per_digit);
+    mpn_export(digits, NULL, layout.digits_order, layout.digit_size,
+               layout.digit_endianness,
+               (size_t)(layout.digit_size*8 - layout.bits_per_digit),
+               u->digits, u->size);
+    return ZZ_OK;
+}
+
+static zz_err
+zz_wrap(size_t len, const void *data, zz_size_t alloc, zz_t *u)
+{
+    if (len > ZZ_DIGITS_MAX) {
+        return ZZ_BUF;
+    }
+    if ((uintptr_t)data % _Alignof(zz_digit_t)) {
+        return ZZ_VAL;
+    }
+    zz_clear(u);
+    SETALLOC(alloc, u);
+    u->size = (zz_size_t)len;
+    u->digits = (zz_digit_t *)data;
+    SETADOPTED(alloc >= 0, u);
+    zz_normalize(u);
+    return ZZ_OK;
+}
+
+zz_err
+zz_view(size_t len, const void *data, zz_t *u)
+{
+    return zz_wrap(len, data, -1, u);
+}
+
+zz_err
+zz_adopt(size_t len, size_t alloc, void *data, zz_t *u)
+{
+    if (alloc < len || alloc > ZZ_DIGITS_MAX) {
+        return ZZ_VAL;
+    }
+    return zz_wrap(len, data, (zz_size_t)alloc, u);
+}
+
+/* Streams are processed in chunks of D digits, spanning exactly w digits
+   of the integer: D*bits_per_digit is a multiple of ZZ_DIGIT_T_BITS and
+   the chunk takes about ZZ_STREAM_CHUNK bytes. */
+static void
+zz_stream_chunk(zz_layout layout, size_t *D, zz_size_t *w)
+{
+    size_t a = layout.bits_per_digit, b = ZZ_DIGIT_T_BITS;
+
+    while (b) {
+        size_t t = a % b;
+
+        a = b;
+        b = t;
+    }
+    *D = ZZ_DIGIT_T_BITS/a;
+    *D *= MAX(1, ZZ_STREAM_CHUNK/(*D*layout.digit_size));
+    *w = (zz_size_t)(*D*layout.bits_per_digit/ZZ_DIGIT_T_BITS);
+}
+
+zz_err
+zz_export_stream(const zz_t *u, zz_layout layout, zz_write_func write,
+                 void *ctx)
+{
+    if (u->size > INT_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    assert(layout.digit_size*8 >= layout.bits_per_digit);
+
+    size_t D, bpd = layout.bits_per_digit, dsize = layout.digit_size;
+    zz_size_t w;
+
+    zz_stream_chunk(layout, &D, &w);
+
+    size_t total = (zz_bitlen(u) + bpd - 1)/bpd;
+    size_t nchunks = (total + D - 1)/D, buf_size = D*dsize;
+    unsigned char *buf = zz_mem_malloc(buf_size);
+    zz_err ret = ZZ_OK;
+
+    if (!buf) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    for (size_t i = 0; i < nchunks && !ret; i++) {
+        size_t j = layout.digits_order == 1 ? nchunks - 1 - i : i;
+        size_t need = j == nchunks - 1 ? total - j*D : D, count = 0;
+        zz_size_t lo = (zz_size_t)j*w, n = MIN(w, u->size - lo);
+        unsigned char *p = buf;
+
+        while (n && !u->digits[lo + n - 1]) {
+            n--;
+        }
+        if (n) {
+            count = (mpn_sizeinbase(u->digits + lo, n, 2) + bpd - 1)/bpd;
+        }
+        if (layout.digits_order == 1) {
+            memset(buf, 0, (need - count)*dsize);
+            p += (need - count)*dsize;
+        }
+        else {
+            memset(buf + count*dsize, 0, (need - count)*dsize);
+        }
+        mpn_export(p, NULL, layout.digits_order, dsize,
+                   layout.digit_endianness, dsize*8 - bpd,
+                   u->digits + lo, n);
+        ret = write(ctx, buf, need*dsize);
+    }
+    zz_mem_free(buf, buf_size);
+    return ret;
+}
+
+zz_err
+zz_import_stream(zz_read_func read, void *ctx, zz_layout layout, zz_t *u)
+{
+    assert(layout.digit_size*8 >= layout.bits_per_digit);
+
+    size_t D, bpd = layout.bits_per_digit, dsize = layout.digit_size;
+    zz_size_t w, nchunks = 0;
+
+    zz_stream_chunk(layout, &D, &w);
+
+    size_t buf_size = D*dsize, last = D;
+    unsigned char *buf = zz_mem_malloc(buf_size);
+    zz_err ret = ZZ_OK;
+
+    if (!buf) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    u->size = 0;
+    while (1) {
+        size_t got = 0;
+
+        while (got < buf_size) {
+            size_t n = buf_size - got;
+
+            ret = read(ctx, buf + got, &n);
+            if (ret) {
+                goto end;
+            }
+            if (!n) {
+                break;
+            }
+            got += n;
+        }
+        if (got % dsize) {
+            ret = ZZ_VAL;
+            goto end;
+        }
+        if (!got) {
+            break;
+        }
+        if (nchunks >= ZZ_DIGITS_MAX/w) {
+            ret = ZZ_BUF; /* LCOV_EXCL_LINE */
+            goto end; /* LCOV_EXCL_LINE */
+        }
+        if (zz_resize((nchunks + 1)*w, u)) {
+            ret = ZZ_MEM; /* LCOV_EXCL_LINE */
+            goto end; /* LCOV_EXCL_LINE */
+        }
+
+        /* The chunk takes exactly zn digits, but the size is normalized. */
+        zz_digit_t *zp = u->digits + nchunks*w;
+        zz_size_t zn = (zz_size_t)((got/dsize*bpd + ZZ_DIGIT_T_BITS - 1)
+                                   /ZZ_DIGIT_T_BITS);
+        mp_size_t size;
+
+        mpn_import(zp, &size, got/dsize, layout.digits_order, dsize,
+                   layout.digit_endianness, dsize*8 - bpd, buf);
+        mpn_zero(zp + zn, w - zn);
+        u->size = (nchunks + 1)*w;
+        nchunks++;
+        last = got/dsize;
+        if (got < buf_size) {
+            break;
+        }
+    }
+    if (layout.digits_order == 1 && nchunks > 1) {
+        /* The first chunk is the most significant one.  Reverse order
+           of chunks, then shift all above the last chunk (now lowest)
+           down to the actual size of it. */
+        zz_digit_t *zp = u->digits, *tmp = (zz_digit_t *)buf;
+
+        for (zz_size_t i = 0, j = nchunks - 1; i < j; i++, j--) {
+            for (zz_size_t k = 0; k < w; k++) {
+                SWAP(zz_digit_t, zp[i*w + k], zp[j*w + k]);
+            }
+        }
+        if (last < D) {
+            zz_size_t hn = (nchunks - 1)*w, ls = (zz_size_t)(last*bpd
+                                                            /ZZ_DIGIT_T_BITS);
+            unsigned int sh = (unsigned int)(last*bpd%ZZ_DIGIT_T_BITS);
+
+            mpn_copyi(tmp, zp, w);
+            mpn_copyi(zp + ls, zp + w, hn);
+            u->size = ls + hn;
+            if (sh) {
+                zp[u->size] = mpn_lshift(zp + ls, zp + ls, hn, sh);
+                u->size++;
+            }
+            mpn_copyi(zp, tmp, ls);
+            if (sh) {
+                zp[ls] |= tmp[ls];
+            }
+        }
+    }
+    zz_normalize(u);
+end:
+    zz_mem_free(buf, buf_size);
+    return ret;
+}
+
+static zz_err
+zz_addsub(const zz_t *u, const zz_t *v, bool subtract, zz_t *w)
+{
+    bool negu = ISNEG(u), negv = subtract ? !ISNEG(v) : ISNEG(v);
+    bool same_sign = negu == negv;
+    zz_size_t u_size = u->size, v_size = v->size;
+
+    if (!v_size) {
+        return zz_pos(u, w);
+    }
+    if (!u_size) {
+        return subtract ? zz_neg(v, w) : zz_pos(v, w);
+    }
+    if (u_size < v_size) {
+        SWAP(const zz_t *, u, v);
+        SWAP(bool, negu, negv);
+        SWAP(zz_size_t, u_size, v_size);
+    }
+    if (same_sign && u_size == ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    if (zz_resize(u_size + same_sign, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(negu, w);
+    if (same_sign) {
+        if (!(w->digits[w->size - 1] = mpn_add(w->digits, u->digits, u_size,
+                                               v->digits, v_size)))
+        {
+            w->size--;
+        }
+        return ZZ_OK;
+    }
+    else if (u_size != v_size) {
+        mpn_sub(w->digits, u->digits, u_size, v->digits, v_size);
+    }
+    else {
+        int cmp = mpn_cmp(u->digits, v->digits, u_size);
+
+        if (cmp < 0) {
+            mpn_sub_n(w->digits, v->digits, u->digits, u_size);
+            SETNEG(negv, w);
+        }
+        else if (cmp > 0) {
+            mpn_sub_n(w->digits, u->digits, v->digits, u_size);
+        }
+        else {
+            SETNEG(false, w);
+            w->size = 0;
+            return ZZ_OK;
+        }
+    }
+    zz_normalize(w);
+    return ZZ_OK;
+}
+
+static zz_err
+zz_addsub_u64(const zz_t *u, uint64_t v, bool negv, zz_t *w)
+{
+    bool negu = ISNEG(u), same_sign = negu == negv, v_size = v != 0;
+    zz_size_t u_size = u->size;
+
+    if (!u_size) {
+        if (v_size) {
+            if (zz_resize(v_size, w)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+            w->digits[0] = v;
+            SETNEG(negv, w);
+        }
+        else {
+            w->size = 0;
+            SETNEG(false, w);
+        }
+        return ZZ_OK;
+    }
+    if (same_sign && u_size == ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    if (zz_resize(u_size + same_sign, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(negu, w);
+    if (same_sign) {
+        if (!(w->digits[u_size] = mpn_add_1(w->digits, u->digits, u_size, v))) {
+            w->size--;
+        }
+    }
+    else if (u_size > 1) {
+        mpn_sub_1(w->digits, u->digits, u_size, v);
+        w->size -= w->digits[w->size - 1] == 0;
+    }
+
+    else {
+        if (u->digits[0] < v) {
+            w->digits[0] = v - u->digits[0];
+            SETNEG(negv, w);
+        }
+        else {
+            w->digits[0] = u->digits[0] - v;
+            if (!w->digits[0]) {
+                w->size = 0;
+                SETNEG(false, w);
+            }
+        }
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_addsub_i64(const zz_t *u, int64_t v, bool subtract, zz_t *w)
+{
+    bool negv = v < 0;
+    uint64_t uv = ABS_CAST(uint64_t, v);
+
+    return zz_addsub_u64(u, uv, subtract ? !negv : negv, w);
+}
+
+zz_err
+zz_add(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    ZZ_STAT_CALL(ZZ_OP_ADD, MAX(u->size, v->size));
+    return zz_addsub(u, v, false, w);
+}
+
+zz_err
+zz_sub(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    ZZ_STAT_CALL(ZZ_OP_SUB, MAX(u->size, v->size));
+    return zz_addsub(u, v, true, w);
+}
+
+zz_err
+zz_add_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+    return zz_addsub_u64(u, v, false, w);
+}
+
+zz_err
+zz_sub_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+    return zz_addsub_u64(u, v, true, w);
+}
+
+zz_err
+zz_u64_sub(uint64_t u, const zz_t *v, zz_t *w)
+{
+    if (zz_neg(v, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    return zz_addsub_u64(w, u, false, w);
+}
+
+zz_err
+zz_add_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+    return zz_addsub_i64(u, v, false, w);
+}
+
+zz_err
+zz_sub_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+    return zz_addsub_i64(u, v, true, w);
+}
+
+zz_err
+zz_i64_sub(int64_t u, const zz_t *v, zz_t *w)
+{
+    if (zz_neg(v, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    return zz_addsub_i64(w, u, false, w);
+}
+
+zz_err
+zz_mul(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+    }
+    if (v->size <= 1) {
+        ZZ_STAT_CALL(ZZ_OP_MUL, u->size);
+
+        bool w_negative = ISNEG(u) != ISNEG(v); /* in case v == w */
+        zz_err ret = zz_mul_u64(u, v->size ? v->digits[0] : 0, w);
+
+        if (w->size) {
+            SETNEG(w_negative, w);
+        }
+        return ret;
+    }
+    if (u == w || v == w) {
+        /* Compute into a new integer and swap storage with w, instead
+           of copying the aliased input. */
+        zz_t tmp;
+
+        if (zz_init(&tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_mul(u, v, &tmp);
+
+        if (ret == ZZ_OK) {
+            zz_swap(&tmp, w);
+        }
+        zz_clear(&tmp);
+        return ret;
+    }
+    ZZ_STAT_CALL(ZZ_OP_MUL, u->size);
+
+    uint64_t w_size = (uint64_t)u->size + (uint64_t)v->size;
+
+    if (w_size > ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    if (zz_resize((zz_size_t)w_size, w)) {
+        return ZZ_MEM;
+    }
+    SETNEG(ISNEG(u) != ISNEG(v), w);
+    if (v->size < ZZ_MUL_BASECASE_THRESHOLD && u->digits != v->digits
+        && (zz_mul_params.threads == 1
+            || v->size < zz_mul_params.threshold))
+    {
+        /* Short products are computed by the schoolbook method, which does
+           no memory allocation: no need for the TMP_OVERFLOW. */
+        mpn_mul_basecase(w->digits, u->digits, u->size, v->digits, v->size);
+    }
+    else {
+        if (TMP_OVERFLOW) {
+            return ZZ_MEM;
+        }
+        if (zz_mul_digits(w->digits, u->digits, u->size, v->digits, v->size,
+                          zz_mul_params.threads))
+        {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+    }
+    w->size -= w->digits[w->size - 1] == 0;
+    assert(w->size >= 1);
+    return ZZ_OK;
+}
+
+zz_err
+zz_mul_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+    zz_size_t u_size = u->size;
+
+    if (!u_size || !v) {
+        return zz_set_i64(0, w);
+    }
+    if (u_size == ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    if (zz_resize(u_size + 1, w) || TMP_OVERFLOW) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(ISNEG(u), w);
+    w->digits[u_size] = mpn_mul_1(w->digits, u->digits, u_size, v);
+    w->size -= w->digits[u_size] == 0;
+    assert(w->size >= 1);
+    return ZZ_OK;
+}
+
+zz_err
+zz_mul_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+    zz_err ret = zz_mul_u64(u, ABS_CAST(zz_digit_t, v), w);
+
+    if (w->size) {
+        SETNEG(ISNEG(u) != (v < 0), w);
+    }
+    return ret;
+}
+
+/* Set w to w + u*v (or w - u*v, if negv), without temporaries unless u
+   and w are the same. */
+static zz_err
+zz_addmul_1(const zz_t *u, uint64_t v, bool negv, zz_t *w)
+{
+    zz_size_t u_size = u->size, w_size = w->size;
+
+    if (!u_size || !v) {
+        return ZZ_OK;
+    }
+    if (u == w) {
+        zz_t tmp;
+
+        if (zz_init(&tmp) || zz_mul_u64(u, v, &tmp)
+            || zz_addsub(w, &tmp, negv, w))
+        {
+            /* LCOV_EXCL_START */
+            zz_clear(&tmp);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+        zz_clear(&tmp);
+        return ZZ_OK;
+    }
+
+    bool negp = ISNEG(u) != negv;
+    zz_size_t size = MAX(u_size, w_size);
+
+    if (size == ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    size++;
+    if (zz_resize(size, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_zero(w->digits + w_size, size - w_size);
+    if (!w_size || ISNEG(w) == negp) {
+        mpn_add_1(w->digits + u_size, w->digits + u_size, size - u_size,
+                  mpn_addmul_1(w->digits, u->digits, u_size, v));
+        SETNEG(negp, w);
+    }
+    else if (mpn_sub_1(w->digits + u_size, w->digits + u_size,
+                       size - u_size,
+                       mpn_submul_1(w->digits, u->digits, u_size, v)))
+    {
+        /* |u*v| > |w|, the result is in two's complement. */
+        mpn_neg(w->digits, w->digits, size);
+        SETNEG(negp, w);
+    }
+    zz_normalize(w);
+    return ZZ_OK;
+}
+
+static zz_err
+zz_addsubmul(const zz_t *u, const zz_t *v, bool subtract, zz_t *w)
+{
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+    }
+    if (v->size <= 1) {
+        return zz_addmul_1(u, v->size ? v->digits[0] : 0,
+                           ISNEG(v) != subtract, w);
+    }
+
+    zz_t tmp;
+
+    if (zz_init(&tmp) || zz_mul(u, v, &tmp)) {
+        /* LCOV_EXCL_START */
+        zz_clear(&tmp);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+
+    zz_err ret = zz_addsub(w, &tmp, subtract, w);
+
+    zz_clear(&tmp);
+    return ret;
+}
+
+zz_err
+zz_addmul(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    return zz_addsubmul(u, v, false, w);
+}
+
+zz_err
+zz_submul(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    return zz_addsubmul(u, v, true, w);
+}
+
+zz_err
+zz_addmul_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+    return zz_addmul_1(u, v, false, w);
+}
+
+zz_err
+zz_submul_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+    return zz_addmul_1(u, v, true, w);
+}
+
+zz_err
+zz_addmul_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+    return zz_addmul_1(u, ABS_CAST(uint64_t, v), v < 0, w);
+}
+
+zz_err
+zz_submul_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+    return zz_addmul_1(u, ABS_CAST(uint64_t, v), v >= 0, w);
+}
+
+/* Batch operations handle elements with at most one digit inline, if the
+   output has space for two digits.  That's true for own storage, but not
+   for views or buffers, passed to zz_adopt(), with smaller alloc. */
+#define SMALL_OPERANDS(u, v, w) \
+    ((u)->size <= 1 && (v)->size <= 1 && GETALLOC(w) >= 2)
+#define DIGIT(u) ((u)->size ? (u)->digits[0] : 0)
+
+zz_err
+zz_add_batch(size_t n, const zz_t *u, const zz_t *v, zz_t *w)
+{
+    zz_err ret = ZZ_OK;
+
+    for (size_t i = 0; i < n; i++) {
+        if (SMALL_OPERANDS(u + i, v + i, w + i)) {
+            zz_digit_t x = DIGIT(u + i), y = DIGIT(v + i);
+            bool negu = ISNEG(u + i), negv = ISNEG(v + i), neg;
+
+            if (negu == negv) {
+                zz_digit_t s = x + y;
+
+                w[i].digits[0] = s;
+                w[i].digits[1] = s < x;
+                w[i].size = s < x ? 2 : s != 0;
+                neg = negu;
+            }
+            else {
+                w[i].digits[0] = x >= y ? x - y : y - x;
+                w[i].size = x != y;
+                neg = x >= y ? negu : negv;
+            }
+            SETNEG(neg && w[i].size, w + i);
+            continue;
+        }
+
+        zz_err r = zz_add(u + i, v + i, w + i);
+
+        if (r && !ret) {
+            ret = r;
+        }
+    }
+    return ret;
+}
+
+zz_err
+zz_mul_batch(size_t n, const zz_t *u, const zz_t *v, zz_t *w)
+{
+    zz_err ret = ZZ_OK;
+
+    for (size_t i = 0; i < n; i++) {
+        if (SMALL_OPERANDS(u + i, v + i, w + i)) {
+            zz_digit_t x = DIGIT(u + i), y = DIGIT(v + i);
+            bool neg = ISNEG(u + i) != ISNEG(v + i);
+
+            w[i].digits[1] = mpn_mul_1(w[i].digits, &x, 1, y);
+            w[i].size = w[i].digits[1] ? 2 : w[i].digits[0] != 0;
+            SETNEG(neg && w[i].size, w + i);
+            continue;
+        }
+
+        zz_err r = zz_mul(u + i, v + i, w + i);
+
+        if (r && !ret) {
+            ret = r;
+        }
+    }
+    return ret;
+}
+
+void
+zz_cmp_batch(size_t n, const zz_t *u, const zz_t *v, zz_ord *r)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (u[i].size <= 1 && v[i].size <= 1) {
+            zz_digit_t x = DIGIT(u + i), y = DIGIT(v + i);
+            bool negu = ISNEG(u + i);
+            int c = negu != ISNEG(v + i) ? 1 : (x > y) - (x < y);
+
+            r[i] = (zz_ord)(negu ? -c : c);
+            continue;
+        }
+        r[i] = zz_cmp(u + i, v + i);
+    }
+}
+
+#undef SMALL_OPERANDS
+#undef DIGIT
+
+zz_err
+zz_div(const zz_t *u, const zz_t *v, zz_t *q, zz_t *r)
+{
+    if (!v->size) {
+        return ZZ_VAL;
+    }
+    if (!q || !r) {
+        if (!q && !r) {
+            return ZZ_OK;
+        }
+        if (!q) {
+            zz_t tmp;
+
+            if (zz_init(&tmp)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+
+            zz_err ret = zz_div(u, v, &tmp, r);
+
+            zz_clear(&tmp);
+            return ret;
+        }
+        else {
+            zz_t tmp;
+
+            if (zz_init(&tmp)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+
+            zz_err ret = zz_div(u, v, q, &tmp);
+
+            zz_clear(&tmp);
+            return ret;
+        }
+    }
+    if (!u->size) {
+        ZZ_STAT_CALL(ZZ_OP_DIV, v->size);
+        if (zz_set_i64(0, q) || zz_set_i64(0, r)) {
+            goto err; /* LCOV_EXCL_LINE */
+        }
+    }
+    else if (u->size < v->size) {
+        ZZ_STAT_CALL(ZZ_OP_DIV, v->size);
+        /* The remainder is set first, in case u == q. */
+        if (ISNEG(u) != ISNEG(v)) {
+            if (zz_add(u, v, r) || zz_set_i64(-1, q)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+        }
+        else {
+            if (zz_pos(u, r) || zz_set_i64(0, q)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+        }
+    }
+    else {
+        if (u == q || u == r) {
+            zz_t tmp;
+
+            if (zz_init(&tmp) || zz_pos(u, &tmp)) {
+                /* LCOV_EXCL_START */
+                zz_clear(&tmp);
+                return ZZ_MEM;
+                /* LCOV_EXCL_STOP */
+            }
+
+            zz_err ret = zz_div(&tmp, v, q, r);
+
+            zz_clear(&tmp);
+            return ret;
+        }
+        if (v == q || v == r) {
+            zz_t tmp;
+
+            if (zz_init(&tmp) || zz_pos(v, &tmp)) {
+                /* LCOV_EXCL_START */
+                zz_clear(&tmp);
+                return ZZ_MEM;
+                /* LCOV_EXCL_STOP */
+            }
+
+            zz_err ret = zz_div(u, &tmp, q, r);
+
+            zz_clear(&tmp);
+            return ret;
+        }
+        ZZ_STAT_CALL(ZZ_OP_DIV, u->size);
+
+        zz_size_t u_size = u->size;
+
+        if (zz_resize(u_size - v->size + 1, q)
+            || zz_resize(v->size, r) || TMP_OVERFLOW)
+        {
+            goto err; /* LCOV_EXCL_LINE */
+        }
+        SETNEG(ISNEG(u) != ISNEG(v), q);
+        SETNEG(ISNEG(v), r);
+        mpn_tdiv_qr(q->digits, r->digits, 0, u->digits, u_size, v->digits,
+                    v->size);
+        q->size -= q->digits[q->size - 1] == 0;
+        zz_normalize(r);
+        if (ISNEG(q) && r->size) {
+            /* Note that we can't get carry here for q of maximal size,
+               as this would mean |v| == 1, thus: r == 0 */
+            assert(q->size < ZZ_DIGITS_MAX);
+            if (zz_sub_i64(q, 1, q)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            r->size = v->size;
+            mpn_sub_n(r->digits, v->digits, r->digits, v->size);
+            zz_normalize(r);
+        }
+    }
+    return ZZ_OK;
+    /* LCOV_EXCL_START */
+err:
+    zz_clear(q);
+    zz_clear(r);
+    return ZZ_MEM;
+    /* LCOV_EXCL_STOP */
+}
+
+zz_err
+zz_div_i64(const zz_t *u, int64_t v, zz_t *q, zz_t *r)
+{
+    if (!v) {
+        return ZZ_VAL;
+    }
+
+    zz_digit_t rl = 0, uv = ABS_CAST(zz_digit_t, v);
+    bool same_signs = ISNEG(u) == (v < 0), u_zero = !u->size;
+
+    if (q) {
+        if (u->size) {
+            if (zz_resize(u->size, q)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+            rl = mpn_divrem_1(q->digits, 0, u->digits, u->size, uv);
+            if (rl && !same_signs) {
+                mpn_add_1(q->digits, q->digits, q->size, 1);
+            }
+            q->size -= q->digits[q->size - 1] == 0;
+            SETNEG(q->size ? !same_signs : false, q);
+        }
+        else {
+            (void)zz_set_i32(0, q);
+        }
+    }
+    if (r) {
+        if (u_zero) {
+            return zz_set_i32(0, r);
+        }
+        /* The remainder is known, if the quotient was computed (then u
+           might be overwritten by it). */
+        if (!q) {
+            rl = mpn_mod_1(u->digits, u->size, uv);
+        }
+        if (zz_resize(1, r)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        if (!rl) {
+            (void)zz_set_i32(0, r);
+        }
+        else {
+            if (!same_signs) {
+                rl = uv - rl;
+            }
+            r->digits[0] = rl;
+            SETNEG(v < 0, r);
+        }
+        return ZZ_OK;
+    }
+    return ZZ_OK;
+}
+
+static int64_t
+fdiv_r(int64_t a, int64_t b)
+{
+    return a/b - (a%b != 0 && (a^b) < 0);
+}
+
+zz_err
+zz_i64_div(int64_t u, const zz_t *v, zz_t *q, zz_t *r)
+{
+    if (!v->size) {
+        return ZZ_VAL;
+    }
+
+    int64_t sv;
+
+    if (q) {
+        zz_err ret = ZZ_OK;
+
+        if (zz_get_i64(v, &sv)) {
+            ret = zz_set_i64((u < 0) == ISNEG(v) || !u ? 0 : -1, q);
+        }
+        else {
+            ret = zz_set_i64(fdiv_r(u, sv), q);
+        }
+        if (ret || !r) {
+            return ret; /* LCOV_EXCL_LINE */
+        }
+    }
+    if (r) {
+        if (zz_get_i64(v, &sv)) {
+            if ((u < 0) == ISNEG(v) || !u) {
+                return zz_set_i64(u, r);
+            }
+            return zz_add_i64(v, u, r);
+        }
+        return zz_set_i64(u - fdiv_r(u, sv)*sv, r);
+    }
+    return ZZ_OK;
+}
+
+/* Division by invariant integers.  The divisor is kept normalized
+   (shifted to set the most significant bit) along with the reciprocal
+   of one or two most significant digits, like in the mpn_tdiv_qr().
+   Divisors of one or two digits and schoolbook division (for divisors
+   less than ZZ_DIV_DC_THRESHOLD digits or small quotients, up to
+   ZZ_DIV_MU_THRESHOLD digits) use them.  Otherwise, the mpn_tdiv_qr() is
+   called to select the asymptotically faster method: it spends only O(n)
+   for the normalization and the reciprocal, which is negligible there.
+   Above needs internal functions of the GMP, if they aren't available -
+   the mpn_tdiv_qr() is always used. */
+#define ZZ_DIV_DC_THRESHOLD 50
+#define ZZ_DIV_MU_THRESHOLD 1000
+#if HAVE_MPN_DIV_PI1
+#  define ZZ_DIV_PI1(n, un)                                          \
+    ((n) <= 2 || ((n) < ZZ_DIV_MU_THRESHOLD                          \
+                  && ((n) < ZZ_DIV_DC_THRESHOLD                      \
+                      || (un) - (n) < ZZ_DIV_DC_THRESHOLD)))
+#else
+#  define ZZ_DIV_PI1(n, un) 0
+#endif
+
+zz_err
+zz_divisor_init(const zz_t *d, zz_divisor *dv)
+{
+    zz_size_t n = d->size;
+
+    dv->norm = NULL;
+    if (zz_init(&dv->d)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (!n) {
+        return ZZ_VAL;
+    }
+    dv->norm = zz_mem_malloc((size_t)n*ZZ_DIGIT_T_BYTES);
+    if (!dv->norm || zz_pos(d, &dv->d)) {
+        /* LCOV_EXCL_START */
+        zz_divisor_clear(dv);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    dv->shift = (int)(ZZ_DIGIT_T_BITS
+                      - mpn_sizeinbase(d->digits + n - 1, 1, 2));
+    if (dv->shift) {
+        mpn_lshift(dv->norm, d->digits, n, (unsigned int)dv->shift);
+    }
+    else {
+        mpn_copyi(dv->norm, d->digits, n);
+    }
+#if HAVE_MPN_DIV_PI1
+    if (n == 1) {
+        dv->inv = mpn_invert_limb(dv->norm[0]);
+        if (dv->shift >= 2) {
+            mpn_mod_1s_4p_cps(dv->cps, d->digits[0]);
+        }
+        else {
+            mpn_mod_1_1p_cps(dv->cps, d->digits[0]);
+        }
+    }
+    else {
+        dv->inv = mpn_invert_pi1(dv->norm[n - 1], dv->norm[n - 2]);
+    }
+#endif
+    return ZZ_OK;
+}
+
+void
+zz_divisor_clear(zz_divisor *dv)
+{
+    zz_mem_free(dv->norm, (size_t)dv->d.size*ZZ_DIGIT_T_BYTES);
+    dv->norm = NULL;
+    zz_clear(&dv->d);
+}
+
+zz_err
+zz_div_pre(const zz_t *u, const zz_divisor *dv, zz_t *q, zz_t *r)
+{
+    const zz_t *d = &dv->d;
+    zz_size_t un = u->size, n = d->size;
+
+    if ((!q && !r) || un < n) {
+        return zz_div(u, d, q, r);
+    }
+    if (u == q || u == r) {
+        zz_t tmp;
+
+        if (zz_init(&tmp) || zz_pos(u, &tmp)) {
+            /* LCOV_EXCL_START */
+            zz_clear(&tmp);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+
+        zz_err ret = zz_div_pre(&tmp, dv, q, r);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+    if (!r) {
+        /* The remainder space is used as a scratch. */
+        zz_t tmp;
+
+        if (zz_init(&tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_div_pre(u, dv, q, &tmp);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+
+    /* The quotient has un - n + 1 digits.  Unless it's requested, the
+       remainder space holds it, when divisor has more than one digit or
+       the mpn_tdiv_qr() is used.  For the schoolbook division the
+       remainder space holds also the normalized u. */
+    zz_size_t qn = un - n + 1, rn = n;
+    bool same_signs = ISNEG(u) == ISNEG(d);
+
+    if (!ZZ_DIV_PI1(n, un)) {
+        if (!q) {
+            rn += qn;
+        }
+    }
+    else if (n == 2 && !q) {
+        rn = MAX(qn, 2);
+    }
+    else if (n > 2) {
+        rn = un + 1;
+        if (!q) {
+            rn += qn;
+        }
+    }
+    if ((q && zz_resize(qn, q)) || zz_resize(rn, r) || TMP_OVERFLOW) {
+        goto err; /* LCOV_EXCL_LINE */
+    }
+
+    const zz_digit_t *up = u->digits;
+    zz_digit_t *rp = r->digits, *qp = q ? q->digits : NULL;
+
+    if (!ZZ_DIV_PI1(n, un)) {
+        mpn_tdiv_qr(qp ? qp : rp + n, rp, 0, up, un, d->digits, n);
+    }
+#if HAVE_MPN_DIV_PI1
+    else if (n == 1) {
+        int shift = dv->shift;
+        zz_digit_t dl = d->digits[0];
+
+        if (qp) {
+            rp[0] = mpn_preinv_divrem_1(qp, up, un, dl, dv->inv, shift);
+        }
+        else if (un == 1) {
+            rp[0] = up[0] % dl;
+        }
+        else if (shift >= 2) {
+            rp[0] = mpn_mod_1s_4p(up, un, dl << shift, dv->cps);
+        }
+        else {
+            rp[0] = mpn_mod_1_1p(up, un, dl << shift, dv->cps);
+        }
+    }
+    else if (n == 2) {
+        zz_digit_t tp[2], d1 = dv->norm[1], d0 = dv->norm[0];
+        int shift = dv->shift;
+
+        if (!qp) {
+            qp = rp;
+        }
+        if (shift) {
+            qp[un - 2] = mpn_div_qr_2u_pi1(qp, tp, up, un, d1, d0, shift,
+                                           dv->inv);
+        }
+        else {
+            qp[un - 2] = mpn_div_qr_2n_pi1(qp, tp, up, un, d1, d0,
+                                           dv->inv);
+        }
+        rp[0] = tp[0];
+        rp[1] = tp[1];
+    }
+    else {
+        zz_digit_t *np = rp;
+        int shift = dv->shift;
+
+        if (!qp) {
+            qp = rp + un + 1;
+        }
+        if (shift) {
+            np[un] = mpn_lshift(np, up, un, (unsigned int)shift);
+        }
+        else {
+            mpn_copyi(np, up, un);
+            np[un] = 0;
+        }
+        /* The most significant digit of np is less than of the divisor,
+           so the quotient fits in qn digits. */
+        (void)mpn_sbpi1_div_qr(qp, np, un + 1, dv->norm, n, dv->inv);
+        if (shift) {
+            mpn_rshift(rp, np, n, (unsigned int)shift);
+        }
+    }
+#endif /* HAVE_MPN_DIV_PI1 */
+    if (q) {
+        q->size = qn;
+        SETNEG(!same_signs, q);
+        zz_normalize(q);
+    }
+    r->size = n;
+    SETNEG(ISNEG(d), r);
+    zz_normalize(r);
+    if (!same_signs && r->size) {
+        if (q && zz_sub_i64(q, 1, q)) {
+            goto err; /* LCOV_EXCL_LINE */
+        }
+        r->size = n;
+        mpn_sub_n(r->digits, d->digits, r->digits, n);
+        zz_normalize(r);
+    }
+    return ZZ_OK;
+    /* LCOV_EXCL_START */
+err:
+    if (q) {
+        zz_clear(q);
+    }
+    zz_clear(r);
+    return ZZ_MEM;
+    /* LCOV_EXCL_STOP */
+}
+
+zz_err
+zz_div_batch(size_t n, const zz_t *u, const zz_divisor *dv, zz_t *q,
+             zz_t *r)
+{
+    zz_err ret = ZZ_OK;
+
+    for (size_t i = 0; i < n; i++) {
+        zz_err e = zz_div_pre(&u[i], dv, q ? &q[i] : NULL,
+                              r ? &r[i] : NULL);
+
+        if (e && !ret) {
+            ret = e; /* LCOV_EXCL_LINE */
+        }
+    }
+    return ret;
+}
+
+zz_err
+zz_mod_u64(const zz_t *u, uint64_t v, uint64_t *w)
+{
+    if (!v) {
+        return ZZ_VAL;
+    }
+
+    zz_digit_t rl = u->size ? mpn_mod_1(u->digits, u->size, v) : 0;
+
+    *w = rl && ISNEG(u) ? v - rl : rl;
+    return ZZ_OK;
+}
+
+zz_err
+zz_quo_2exp(const zz_t *u, zz_bitcnt_t shift, zz_t *v)
+{
+    ZZ_STAT_CALL(ZZ_OP_SHIFT, u->size);
+    if (!u->size) {
+        return zz_set_i32(0, v);
+    }
+    if (shift >= (zz_bitcnt_t)u->size*ZZ_DIGIT_T_BITS) {
+        return zz_set_i64(ISNEG(u) ? -1 : 0, v);
+    }
+
+    zz_size_t whole = (zz_size_t)(shift / ZZ_DIGIT_T_BITS);
+    zz_size_t size = u->size - whole;
+    bool carry = false, extra = ISNEG(u);
+
+    shift %= ZZ_DIGIT_T_BITS;
+    for (mp_size_t i = 0; i < whole; i++) {
+        if (u->digits[i]) {
+            carry = ISNEG(u);
+            break;
+        }
+    }
+    /* Only the rounding carry of negative u might need an extra digit,
+       so the nonnegative result always fits in place. */
+    for (mp_size_t i = whole; extra && i < u->size; i++) {
+        if (u->digits[i] != ZZ_DIGIT_T_MAX) {
+            extra = 0;
+        }
+    }
+    if (zz_resize(size + extra, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(ISNEG(u), v);
+    if (shift) {
+        if (mpn_rshift(v->digits, u->digits + whole, size,
+                       (unsigned int)shift))
+        {
+            carry = ISNEG(u);
+        }
+    }
+    else {
+        mpn_copyi(v->digits, u->digits + whole, size);
+    }
+    if (extra) {
+        v->digits[size] = 0;
+    }
+    if (carry) {
+        if (mpn_add_1(v->digits, v->digits, size, 1)) {
+            v->digits[size] = 1;
+        }
+    }
+    zz_normalize(v);
+    return ZZ_OK;
+}
+
+zz_err
+zz_mul_2exp(const zz_t *u, zz_bitcnt_t shift, zz_t *v)
+{
+    ZZ_STAT_CALL(ZZ_OP_SHIFT, u->size);
+    if (!u->size) {
+        return zz_set_i32(0, v);
+    }
+    if (shift > ZZ_BITS_MAX) {
+        return ZZ_BUF;
+    }
+
+    zz_size_t whole = (zz_size_t)(shift / ZZ_DIGIT_T_BITS);
+    zz_size_t u_size = u->size;
+    int64_t v_size = (int64_t)u_size + whole;
+
+    shift %= ZZ_DIGIT_T_BITS;
+    v_size += (bool)shift;
+    if (v_size > ZZ_DIGITS_MAX) {
+        return ZZ_BUF;
+    }
+    if (zz_resize((zz_size_t)v_size, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(ISNEG(u), v);
+    if (shift) {
+        v->size -= !(bool)(v->digits[v->size - 1]
+                           = mpn_lshift(v->digits + whole,
+                                        u->digits, u_size,
+                                        (unsigned int)shift));
+    }
+    else {
+        mpn_copyd(v->digits + whole, u->digits, u_size);
+    }
+    mpn_zero(v->digits, whole);
+    return ZZ_OK;
+}
+
+zz_err
+zz_invert(const zz_t *u, zz_t *v)
+{
+    zz_size_t u_size = u->size;
+
+    if (ISNEG(u)) {
+        if (zz_resize(u_size, v)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        mpn_sub_1(v->digits, u->digits, u_size, 1);
+        v->size -= v->digits[u_size - 1] == 0;
+    }
+    else if (!u_size) {
+        return zz_set_i64(-1, v);
+    }
+    else {
+        if (u_size == ZZ_DIGITS_MAX) {
+            return ZZ_BUF; /* LCOV_EXCL_LINE */
+        }
+        if (zz_resize(u_size + 1, v)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        v->digits[u_size] = mpn_add_1(v->digits, u->digits, u_size, 1);
+        v->size -= v->digits[u_size] == 0;
+    }
+    SETNEG(!ISNEG(u), v);
+    return ZZ_OK;
+}
+
+/* Bitwise operations on integers in the two's complement representation.
+   For negative x, its digits are ~(|x| - 1): the borrow propagates only
+   through low zero digits, after that digits are just complemented.  Same
+   for the negation of the negative result.  So, only few low digits are
+   processed with borrows and carry, the rest - in a single pass over
+   digits, complemented with masks.  Operands may alias the output. */
+typedef enum {
+    ZZ_BITOP_AND,
+    ZZ_BITOP_OR,
+    ZZ_BITOP_XOR,
+} zz_bitop;
+
+#define BITOP(op, a, b) ((op) == ZZ_BITOP_AND ? (a) & (b)             \
+                         : (op) == ZZ_BITOP_OR ? (a) | (b) : (a) ^ (b))
+
+/* Set {rp, n} to low digits of the magnitude of the result and return the
+   carry, that is the next digit.  Requires un >= MAX(vn, n) and nonzero
+   inputs. */
+static zz_digit_t
+zz_bitop_kernel(zz_bitop op, zz_digit_t *rp, zz_size_t n,
+                const zz_digit_t *up, bool uneg,
+                const zz_digit_t *vp, zz_size_t vn, bool vneg, bool rneg)
+{
+    zz_digit_t mu = uneg ? ZZ_DIGIT_T_MAX : 0, mv = vneg ? ZZ_DIGIT_T_MAX : 0;
+    zz_digit_t mr = rneg ? ZZ_DIGIT_T_MAX : 0;
+    bool bu = uneg, bv = vneg, cr = rneg;
+    zz_size_t i = 0, m = MIN(vn, n);
+
+    for (; i < n && (bu || bv || cr); i++) {
+        zz_digit_t a = up[i], b = i < vn ? vp[i] : 0, r;
+
+        if (bu) {
+            bu = !a;
+            a = -a;
+        }
+        else {
+            a ^= mu;
+        }
+        if (bv) {
+            bv = !b;
+            b = -b;
+        }
+        else {
+            b ^= mv;
+        }
+        r = BITOP(op, a, b);
+        if (cr) {
+            cr = !r;
+            rp[i] = -r;
+        }
+        else {
+            rp[i] = r ^ mr;
+        }
+    }
+    /* Separate loops for each operation.  Blocks of digits are loaded
+       before stores, so loops could be vectorized despite of aliasing. */
+#define BITOP_LOOP(OP)                                          \
+    for (; i + 4 <= m; i += 4) {                                \
+        zz_digit_t a[4], b[4];                                  \
+                                                                \
+        for (zz_size_t k = 0; k < 4; k++) {                     \
+            a[k] = up[i + k] ^ mu;                              \
+            b[k] = vp[i + k] ^ mv;                              \
+        }                                                       \
+        for (zz_size_t k = 0; k < 4; k++) {                     \
+            rp[i + k] = (a[k] OP b[k]) ^ mr;                    \
+        }                                                       \
+    }                                                           \
+    for (; i < m; i++) {                                        \
+        rp[i] = ((up[i] ^ mu) OP (vp[i] ^ mv)) ^ mr;            \
+    }                                                           \
+    for (; i + 4 <= n; i += 4) {                                \
+        zz_digit_t a[4];                                        \
+                                                                \
+        for (zz_size_t k = 0; k < 4; k++) {                     \
+            a[k] = up[i + k] ^ mu;                              \
+        }                                                       \
+        for (zz_size_t k = 0; k < 4; k++) {                     \
+            rp[i + k] = (a[k] OP mv) ^ mr;                      \
+        }                                                       \
+    }                                                           \
+    for (; i < n; i++) {                                        \
+        rp[i] = ((up[i] ^ mu) OP mv) ^ mr;                      \
+    }
+    switch (op) {
+    case ZZ_BITOP_AND:
+        BITOP_LOOP(&)
+        break;
+    case ZZ_BITOP_OR:
+        BITOP_LOOP(|)
+        break;
+    default:
+        BITOP_LOOP(^)
+    }
+#undef BITOP_LOOP
+    return cr;
+}
+
+/* Set w to the result of the operation on u and v, if one of them is
+   negative.  Requires u->size >= v->size > 0.  The magnitude of the
+   result fits in n digits, plus one more, if there might be carry.
+   Otherwise, the in-place operation doesn't reallocate, unless the
+   result is longer than u. */
+static zz_err
+zz_bitwise(zz_bitop op, const zz_t *u, const zz_t *v, zz_size_t n,
+         bool rneg, bool carry, zz_t *w)
+{
+    zz_size_t v_size = v->size;
+    bool uneg = ISNEG(u), vneg = ISNEG(v);
+
+    if (carry && n == ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    if (zz_resize(n + carry, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+
+    zz_digit_t cy = zz_bitop_kernel(op, w->digits, n, u->digits, uneg,
+                                    v->digits, v_size, vneg, rneg);
+
+    if (carry) {
+        w->digits[n] = cy;
+    }
+    assert(carry || !cy);
+    SETNEG(rneg, w);
+    zz_normalize(w);
+    return ZZ_OK;
+}
+
+zz_err
+zz_and(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    ZZ_STAT_CALL(ZZ_OP_BITWISE, MAX(u->size, v->size));
+    if (!u->size || !v->size) {
+        return zz_set_i64(0, w);
+    }
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+    }
+
+    zz_size_t u_size = u->size, v_size = v->size;
+
+    if (ISNEG(u) || ISNEG(v)) {
+        /* The result of both negative inputs is not greater than both,
+           else it's between zero and the nonnegative input. */
+        if (ISNEG(u) && ISNEG(v)) {
+            return zz_bitwise(ZZ_BITOP_AND, u, v, u_size, true, true, w);
+        }
+        return zz_bitwise(ZZ_BITOP_AND, u, v, ISNEG(u) ? v_size : u_size,
+                          false, false, w);
+    }
+    SETNEG(false, w);
+    for (zz_size_t i = v_size; --i >= 0;) {
+        if (u->digits[i] & v->digits[i]) {
+            v_size = i + 1;
+            if (zz_resize(v_size, w)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+            mpn_and_n(w->digits, u->digits, v->digits, v_size);
+            zz_normalize(w);
+            return ZZ_OK;
+        }
+    }
+    w->size = 0;
+    return ZZ_OK;
+}
+
+zz_err
+zz_or(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    ZZ_STAT_CALL(ZZ_OP_BITWISE, MAX(u->size, v->size));
+    if (!u->size) {
+        return zz_pos(v, w);
+    }
+    if (!v->size) {
+        return zz_pos(u, w);
+    }
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+    }
+
+    zz_size_t u_size = u->size, v_size = v->size;
+
+    if (ISNEG(u) || ISNEG(v)) {
+        /* The result is negative and not less than negative inputs. */
+        return zz_bitwise(ZZ_BITOP_OR, u, v, ISNEG(v) ? v_size : u_size,
+                          true, false, w);
+    }
+    if (zz_resize(u_size, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(false, w);
+    mpn_ior_n(w->digits, u->digits, v->digits, v_size);
+    if (u_size != v_size) {
+        mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_xor(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    ZZ_STAT_CALL(ZZ_OP_BITWISE, MAX(u->size, v->size));
+    if (!u->size) {
+        return zz_pos(v, w);
+    }
+    if (!v->size) {
+        return zz_pos(u, w);
+    }
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+    }
+
+    zz_size_t u_size = u->size, v_size = v->size;
+
+    if (ISNEG(u) || ISNEG(v)) {
+        bool rneg = ISNEG(u) != ISNEG(v);
+
+        return zz_bitwise(ZZ_BITOP_XOR, u, v, u_size, rneg, rneg, w);
+    }
+    if (zz_resize(u_size, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(false, w);
+    mpn_xor_n(w->digits, u->digits, v->digits, v_size);
+    if (u_size != v_size) {
+        mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+    }
+    else {
+        zz_normalize(w);
+    }
+    return ZZ_OK;
+}
+
+bool
+zz_tstbit(const zz_t *u, zz_bitcnt_t idx)
+{
+    zz_bitcnt_t digit_idx = idx / ZZ_DIGIT_T_BITS;
+
+    if (digit_idx >= (zz_bitcnt_t)u->size) {
+        return ISNEG(u);
+    }
+
+    zz_digit_t digit = u->digits[digit_idx];
+
+    if (ISNEG(u)) {
+        /* In twos complement, digits below the lowest nonzero one are
+           zeros, it's negated and all above are complemented. */
+        bool lower = false;
+
+        for (zz_size_t i = 0; i < (zz_size_t)digit_idx; i++) {
+            if (u->digits[i]) {
+                lower = true;
+                break;
+            }
+        }
+        digit = lower ? ~digit : -digit;
+    }
+    return (digit >> (idx%ZZ_DIGIT_T_BITS)) & 1;
+}
+
+/* Set (op > 0), clear (op < 0) or complement (!op) the bit of nonnegative
+   integer in place. */
+static zz_err
+zz_chbit_abs(zz_t *u, zz_bitcnt_t idx, int op)
+{
+    zz_size_t size = u->size;
+    zz_bitcnt_t digit_idx = idx / ZZ_DIGIT_T_BITS;
+    zz_digit_t mask = (zz_digit_t)1 << (idx%ZZ_DIGIT_T_BITS);
+
+    if (digit_idx >= (zz_bitcnt_t)size) {
+        if (op < 0) {
+            return ZZ_OK;
+        }
+        if (digit_idx >= (zz_bitcnt_t)ZZ_DIGITS_MAX) {
+            return ZZ_BUF;
+        }
+        if (zz_resize((zz_size_t)digit_idx + 1, u)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        mpn_zero(u->digits + size, u->size - size);
+    }
+    else if (ISVIEW(u) && zz_resize(size, u)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (op > 0) {
+        u->digits[digit_idx] |= mask;
+    }
+    else if (op < 0) {
+        u->digits[digit_idx] &= ~mask;
+    }
+    else {
+        u->digits[digit_idx] ^= mask;
+    }
+    zz_normalize(u);
+    return ZZ_OK;
+}
+
+static zz_err
+zz_chbit(zz_t *u, zz_bitcnt_t idx, int op)
+{
+    ZZ_STAT_CALL(ZZ_OP_BITWISE, u->size);
+    if (!ISNEG(u)) {
+        return zz_chbit_abs(u, idx, op);
+    }
+    /* For negative u, change the opposite bit of ~u = |u| - 1 and
+       complement back.  The magnitude doesn't grow in between, so
+       restoring u on failure doesn't reallocate. */
+    if (ISVIEW(u) && zz_resize(u->size, u)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_sub_1(u->digits, u->digits, u->size, 1);
+    SETNEG(false, u);
+    zz_normalize(u);
+
+    zz_err ret = zz_chbit_abs(u, idx, -op);
+    zz_size_t size = u->size;
+
+    if (!size || mpn_add_1(u->digits, u->digits, size, 1)) {
+        if (zz_resize(size + 1, u)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        u->digits[size] = 1;
+    }
+    SETNEG(true, u);
+    return ret;
+}
+
+zz_err
+zz_setbit(zz_t *u, zz_bitcnt_t idx)
+{
+    return zz_chbit(u, idx, 1);
+}
+
+zz_err
+zz_clrbit(zz_t *u, zz_bitcnt_t idx)
+{
+    return zz_chbit(u, idx, -1);
+}
+
+zz_err
+zz_combit(zz_t *u, zz_bitcnt_t idx)
+{
+    return zz_chbit(u, idx, 0);
+}
+
+zz_err
+zz_pow(const zz_t *u, uint64_t v, zz_t *w)
+{
+    if (u == w) {
+        zz_t tmp;
+
+        if (zz_init(&tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_pow(u, v, &tmp);
+
+        if (ret == ZZ_OK) {
+            zz_swap(&tmp, w);
+        }
+        zz_clear(&tmp);
+        return ret;
+    }
+    ZZ_STAT_CALL(ZZ_OP_POW, u->size);
+    if (!v) {
+        return zz_set_i64(1, w);
+    }
+    if (!u->size) {
+        return zz_set_i64(0, w);
+    }
+    if (zz_cmp_i64(u, 1) == ZZ_EQ) {
+        return zz_set_i64(1, w);
+    }
+
+    /* The result is less than 2**(v*bitlen(u)). */
+    zz_bitcnt_t u_bits = zz_bitlen(u), shift = zz_lsbpos(u);
+    bool negative = ISNEG(u) && v%2;
+
+    if (v > ZZ_BITS_MAX / u_bits) {
+        return ZZ_BUF;
+    }
+
+    zz_bitcnt_t w_bits = v * u_bits;
+
+    if (w_bits / ZZ_DIGIT_T_BITS >= (zz_bitcnt_t)ZZ_DIGITS_MAX - 2) {
+        return ZZ_BUF;
+    }
+
+    /* Squaring and multiplication in the mpn_pow_1() may write up to two
+       digits more, than the size of the result. */
+    zz_size_t w_size = (zz_size_t)(w_bits / ZZ_DIGIT_T_BITS) + 2;
+
+    if (w_bits <= ZZ_DIGIT_T_BITS) {
+        /* The result fits in a digit, compute it directly. */
+        zz_digit_t b = u->digits[0], r = 1;
+
+        for (;;) {
+            if (v & 1) {
+                r *= b;
+            }
+            v >>= 1;
+            if (!v) {
+                break;
+            }
+            b *= b;
+        }
+        if (zz_resize(1, w)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        SETNEG(negative, w);
+        w->digits[0] = r;
+        return ZZ_OK;
+    }
+    if (shift) {
+        /* Split the base to the odd part and the power of two, so the
+           result is shifted odd part power.  Powers of two are just
+           shifted one.  Memory for the result is allocated at once. */
+        zz_t o;
+
+        if (zz_init(&o) || zz_quo_2exp(u, shift, &o) || zz_abs(&o, &o)
+            || zz_resize(w_size, w) || zz_pow(&o, v, w)
+            || zz_mul_2exp(w, v * shift, w))
+        {
+            /* LCOV_EXCL_START */
+            zz_clear(&o);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+        zz_clear(&o);
+        SETNEG(negative, w);
+        return ZZ_OK;
+    }
+
+    if (zz_mul_params.threads > 1 && w_size/2 >= zz_mul_params.threshold) {
+        /* Binary powering, to get squarings on several threads. */
+        uint64_t mask = (uint64_t)1 << 63;
+        zz_t tmp;
+
+        while (!(v & mask)) {
+            mask >>= 1;
+        }
+        if (zz_init(&tmp) || zz_pos(u, &tmp)) {
+            /* LCOV_EXCL_START */
+            zz_clear(&tmp);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+        while (mask >>= 1) {
+            if (zz_mul(&tmp, &tmp, &tmp)
+                || ((v & mask) && zz_mul(&tmp, u, &tmp)))
+            {
+                /* LCOV_EXCL_START */
+                zz_clear(&tmp);
+                return ZZ_MEM;
+                /* LCOV_EXCL_STOP */
+            }
+        }
+        zz_swap(&tmp, w);
+        zz_clear(&tmp);
+        return ZZ_OK;
+    }
+
+    size_t tmp_size = (size_t)w_size * ZZ_DIGIT_T_BYTES;
+    zz_digit_t *tmp = zz_tmp_malloc(tmp_size);
+
+    if (!tmp || zz_resize(w_size, w)) {
+        /* LCOV_EXCL_START */
+        zz_tmp_free(tmp, tmp_size);
+        zz_clear(w);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    SETNEG(negative, w);
+    w->size = (zz_size_t)mpn_pow_1(w->digits, u->digits, u->size, v, tmp);
+    zz_tmp_free(tmp, tmp_size);
+    if (zz_resize(w->size, w)) {
+        /* LCOV_EXCL_START */
+        zz_clear(w);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    return ZZ_OK;
+}
+
+/* Set w to the gcd of {up, un} and {vp, vn}, un >= vn > 0.  Inputs are
+   destroyed.  The setjmp() is here, the caller changes locals before. */
+static zz_err
+zz_gcd_mpn(zz_digit_t *up, zz_size_t un, zz_digit_t *vp, zz_size_t vn,
+           zz_t *w)
+{
+    if (zz_resize(vn, w) || TMP_OVERFLOW) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
+    if (vn == 1) {
+        w->digits[0] = mpn_gcd_1(up, un, vp[0]);
+    }
+    else {
+        w->size = (zz_size_t)mpn_gcd(w->digits, up, un, vp, vn);
+    }
+    SETNEG(false, w);
+    return ZZ_OK;
+}
 
-    unsigned char *p = (unsigned char *)str;
-    size_t len;
+static zz_err
+zz_gcd(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+    }
+    if (!v->size) {
+        return zz_abs(u, w);
+    }
 
-    if (!u->size) {
-        *(p++) = '0';
-        goto end;
+    /* The mpn_gcd() destroys inputs: copy them, shifted by the common
+       power of two, to the scratch space. */
+    zz_bitcnt_t shift = MIN(zz_lsbpos(u), zz_lsbpos(v));
+    zz_size_t skip = (zz_size_t)(shift / ZZ_DIGIT_T_BITS);
+    unsigned int cnt = (unsigned int)(shift % ZZ_DIGIT_T_BITS);
+    zz_size_t un = u->size - skip, vn = v->size - skip;
+    size_t tp_size = (size_t)(un + vn) * ZZ_DIGIT_T_BYTES;
+    zz_digit_t *tp = zz_tmp_malloc(tp_size);
+
+    if (!tp) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    if (ISNEG(u)) {
-        *(p++) = '-';
+
+    zz_digit_t *up = tp, *vp = tp + un;
+
+    if (cnt) {
+        mpn_rshift(up, u->digits + skip, un, cnt);
+        mpn_rshift(vp, v->digits + skip, vn, cnt);
     }
-    if ((base & (base - 1)) == 0) {
-        len = mpn_get_str(p, base, u->digits, u->size);
+    else {
+        mpn_copyi(up, u->digits + skip, un);
+        mpn_copyi(vp, v->digits + skip, vn);
+    }
+    un -= up[un - 1] == 0;
+    vn -= vp[vn - 1] == 0;
+    if (un < vn) {
+        /* Possible, if sizes of inputs were equal. */
+        SWAP(zz_digit_t *, up, vp);
+        SWAP(zz_size_t, un, vn);
+    }
+    assert(vn >= 1);
+
+    zz_err ret = zz_gcd_mpn(up, un, vp, vn, w);
+
+    zz_tmp_free(tp, tp_size);
+    if (ret) {
+        return ret; /* LCOV_EXCL_LINE */
+    }
+    return zz_mul_2exp(w, shift, w);
+}
+
+zz_err
+zz_inverse_euclidext(const zz_t *u, const zz_t *v, zz_t *t)
+{
+    zz_t r, newt, newr, q, t1, t2;
+    bool u_neg = ISNEG(u);
+
+    if (zz_init(&r) || zz_init(&newt) || zz_init(&newr)
+        || zz_init(&q) || zz_init(&t1) || zz_init(&t2)
+        || zz_pos(v, &r) || zz_set_i32(1, &newt)
+        || zz_pos(u, &newr) || zz_set_i32(0, t))
+    {
+        /* LCOV_EXCL_START */
+clear2:
+        zz_clear(&r);
+        zz_clear(&newt);
+        zz_clear(&newr);
+        zz_clear(&q);
+        zz_clear(&t1);
+        zz_clear(&t2);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    while (zz_cmp_i64(&newr, 0) != ZZ_EQ) {
+        if (zz_div(&r, &newr, &q, NULL)) {
+            goto clear2; /* LCOV_EXCL_LINE */
+        }
+        if (zz_pos(&newt, &t1) || zz_mul(&q, &newt, &t2)
+            || zz_sub(t, &t2, &newt) || zz_pos(&t1, t))
+        {
+            goto clear2; /* LCOV_EXCL_LINE */
+        }
+        if (zz_pos(&newr, &t1) || zz_mul(&q, &newr, &t2)
+            || zz_sub(&r, &t2, &newr) || zz_pos(&t1, &r))
+        {
+            goto clear2; /* LCOV_EXCL_LINE */
+        }
+    }
+    zz_clear(&newt);
+    zz_clear(&newr);
+    zz_clear(&q);
+    zz_clear(&t1);
+    zz_clear(&t2);
+    if (t->size) {
+        SETNEG(ISNEG(t) != u_neg, t);
+    }
+    (void)zz_abs(&r, &r);
+    if (zz_cmp_i64(&r, 1) != ZZ_EQ) {
+        zz_clear(&r);
+        return ZZ_VAL;
+    }
+    zz_clear(&r);
+    return ZZ_OK;
+}
+
+/* Set {gp, *gn} to the gcd of u and v, u->size >= v->size > 0, and
+   {sp, |*ssize|} to the cofactor of u, like mpn_gcdext().  Inputs are
+   copied to {up, u->size + 1} and {vp, v->size + 1}.  The setjmp() is
+   here, the caller changes locals before. */
+static zz_err
+zz_gcdext_mpn(const zz_t *u, const zz_t *v, zz_digit_t *up, zz_digit_t *vp,
+              zz_digit_t *gp, zz_digit_t *sp, zz_size_t *gn,
+              mp_size_t *ssize)
+{
+    if (TMP_OVERFLOW) {
+        return ZZ_MEM;
+    }
+    mpn_copyi(up, u->digits, u->size);
+    mpn_copyi(vp, v->digits, v->size);
+    *gn = (zz_size_t)mpn_gcdext(gp, sp, ssize, up, u->size, vp, v->size);
+    return ZZ_OK;
+}
+
+zz_err
+zz_gcdext(const zz_t *u, const zz_t *v, zz_t *g, zz_t *s, zz_t *t)
+{
+    ZZ_STAT_CALL(ZZ_OP_GCDEXT, MAX(u->size, v->size));
+    if (!s && !t) {
+        if (!g) {
+            return ZZ_OK;
+        }
+        return zz_gcd(u, v, g);
+    }
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+        SWAP(zz_t *, s, t);
+    }
+    if (!v->size) {
+        if (g) {
+            if (zz_abs(u, g)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+        }
+        if (s) {
+            if (zz_set_i64(ISNEG(u) ? -1 : 1, s)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+            s->size = u->size > 0; /* make 0 if u == 0 */
+        }
+        if (t) {
+            t->size = 0;
+            SETNEG(false, t);
+        }
+        return ZZ_OK;
+    }
+
+    /* The mpn_gcdext() destroys inputs and one digit past the end of each:
+       copy them to the scratch space, along with room for the gcd and the
+       cofactor. */
+    zz_size_t un = u->size, vn = v->size;
+    size_t tp_size = ((size_t)un + 3*(size_t)vn + 3) * ZZ_DIGIT_T_BYTES;
+    zz_digit_t *tp = zz_tmp_malloc(tp_size);
+
+    if (!tp) {
+        return ZZ_MEM;
+    }
+
+    zz_digit_t *up = tp, *vp = up + un + 1, *gp = vp + vn + 1, *sp = gp + vn;
+    zz_size_t gn;
+    mp_size_t ssize;
+
+    if (zz_gcdext_mpn(u, v, up, vp, gp, sp, &gn, &ssize)) {
+        zz_tmp_free(tp, tp_size);
+        return ZZ_MEM;
+    }
+
+    zz_t tmp_g, tmp_s;
+
+    /* Results are used as views of the scratch space.  Now s either 1 or
+       |s| < v/(2g) */
+    if (zz_init(&tmp_g) || zz_init(&tmp_s)
+        || zz_view((size_t)gn, gp, &tmp_g)
+        || zz_view((size_t)labs(ssize), sp, &tmp_s))
+    {
+        goto free; /* LCOV_EXCL_LINE */
+    }
+    SETNEG((ISNEG(u) && ssize > 0) || (!ISNEG(u) && ssize < 0), &tmp_s);
+    if (t) {
+        /* Use t = (g - u*s)/v, if no integer overflow is possible,
+           else compute t by Extended Euclidean algorithm */
+        zz_t o1, o2;
+        bool fail;
+
+        if (zz_init(&o1) || zz_init(&o2)) {
+            goto free; /* LCOV_EXCL_LINE */
+        }
+        if (MAX(un + tmp_s.size, tmp_g.size) < ZZ_DIGITS_MAX) {
+            fail = (zz_mul(u, &tmp_s, &o2) || zz_sub(&tmp_g, &o2, &o2)
+                    || zz_div(&o2, v, t, NULL));
+        }
+        else {
+            /* LCOV_EXCL_START */
+            fail = (zz_div(u, &tmp_g, &o1, NULL)
+                    || zz_div(v, &tmp_g, &o2, NULL)
+                    || zz_inverse_euclidext(&o2, &o1, t));
+            /* LCOV_EXCL_STOP */
+        }
+        zz_clear(&o1);
+        zz_clear(&o2);
+        if (fail) {
+            goto free; /* LCOV_EXCL_LINE */
+        }
+    }
+    if ((s && zz_pos(&tmp_s, s)) || (g && zz_pos(&tmp_g, g))) {
+        goto free; /* LCOV_EXCL_LINE */
+    }
+    zz_tmp_free(tp, tp_size);
+    return ZZ_OK;
+    /* LCOV_EXCL_START */
+free:
+    zz_tmp_free(tp, tp_size);
+    return ZZ_MEM;
+    /* LCOV_EXCL_STOP */
+}
+
+zz_err
+zz_inverse(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    zz_size_t n = v->size, un = u->size;
+
+    if (!n) {
+        return ZZ_VAL;
+    }
+
+    /* Take the cofactor of a = u mod |v|: it's the inverse of a, if the
+       gcd is one.  If a is shorter than v, use a + |v| instead to satisfy
+       mpn_gcdext() input requirements, rather than swapping operands and
+       computing the second cofactor. */
+    zz_size_t qn = un >= n ? un - n + 1 : 0;
+    size_t tp_size = (size_t)(qn + 6*n + 7) * ZZ_DIGIT_T_BYTES;
+    zz_digit_t *volatile tp = zz_tmp_malloc(tp_size);
+
+    if (!tp || TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+        zz_tmp_free(tp, tp_size);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+
+    zz_digit_t *ap = tp + qn, *up = ap + n, *vp = up + n + 2;
+    zz_digit_t *gp = vp + n + 1, *sp = gp + n + 2;
+    zz_size_t an = MIN(un, n);
+
+    if (un >= n) {
+        mpn_tdiv_qr(tp, ap, 0, u->digits, un, v->digits, n);
+    }
+    else {
+        mpn_copyi(ap, u->digits, un);
+    }
+    while (an && !ap[an - 1]) {
+        an--;
+    }
+    if (an && ISNEG(u)) {
+        mpn_sub(ap, v->digits, n, ap, an);
+        an = n;
+        while (!ap[an - 1]) {
+            an--;
+        }
+    }
+    if (!an) {
+        zz_tmp_free(tp, tp_size);
+        if (n == 1 && v->digits[0] == 1) {
+            return zz_set_i64(0, w);
+        }
+        return ZZ_VAL;
+    }
+
+    zz_size_t upn = n;
+    mp_size_t sn;
+
+    if (an == n) {
+        mpn_copyi(up, ap, n);
+    }
+    else {
+        up[n] = mpn_add(up, v->digits, n, ap, an);
+        upn += up[n] != 0;
+    }
+    mpn_copyi(vp, v->digits, n);
+
+    zz_size_t gn = (zz_size_t)mpn_gcdext(gp, sp, &sn, up, upn, vp, n);
+
+    if (gn != 1 || gp[0] != 1) {
+        zz_tmp_free(tp, tp_size);
+        return ZZ_VAL;
+    }
+    if (zz_resize(n, w)) {
+        /* LCOV_EXCL_START */
+        zz_tmp_free(tp, tp_size);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    SETNEG(false, w);
+    if (sn < 0) {
+        /* w = |v| - |s| */
+        mpn_sub(w->digits, v->digits, n, sp, -sn);
+    }
+    else {
+        mpn_copyi(w->digits, sp, sn);
+        mpn_zero(w->digits + sn, n - sn);
+    }
+    zz_tmp_free(tp, tp_size);
+    zz_normalize(w);
+    return ZZ_OK;
+}
+
+zz_err
+zz_lcm(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    zz_t g;
+    zz_err ret = ZZ_MEM;
+
+    if (zz_init(&g) || zz_gcd(u, v, &g)) {
+        goto end; /* LCOV_EXCL_LINE */
+    }
+    if (zz_iszero(&g)) {
+        zz_clear(&g);
+        return zz_set_i64(0, w);
+    }
+    if (zz_div(u, &g, &g, NULL)) {
+        goto end; /* LCOV_EXCL_LINE */
+    }
+    ret = zz_mul(&g, v, w);
+end:
+    zz_clear(&g);
+    (void)zz_abs(w, w);
+    return ret;
+}
+
+/* Product and remainder trees.  The level 0 of the tree keeps moduli,
+   each node of the level k + 1 is the product of two adjacent nodes of
+   the level k (or a copy of the last one, if their number is odd), the
+   root is the product of all moduli.  Subtrees, that are big enough, are
+   processed in parallel, using up to threads of zz_set_mul_threads().
+   Tasks call only public functions, that have own TMP_OVERFLOW guards. */
+#define ZZ_TREE_THREAD_THRESHOLD 1024
+/* Products of at most that many factors are computed by a loop. */
+#define ZZ_PROD_LEAF 8
+
+typedef struct zz_tree_task {
+    zz_err (*run)(struct zz_tree_task *);
+    const zz_prodtree *tree;
+    size_t k;
+    size_t i;
+    size_t n;
+    const zz_t *u;
+    zz_t *w;
+    int threads;
+    zz_err ret;
+} zz_tree_task;
+
+/* Return an array of n integers, set to zero, or NULL on failure. */
+static zz_t *
+zz_tree_alloc(size_t n)
+{
+    zz_t *u = NULL;
+
+    if (n <= SIZE_MAX/sizeof(zz_t)) {
+        u = zz_mem_malloc(n*sizeof(zz_t));
+    }
+    for (size_t j = 0; u && j < n; j++) {
+        (void)zz_init(&u[j]);
+    }
+    return u;
+}
+
+static void
+zz_tree_free(zz_t *u, size_t n)
+{
+    for (size_t j = 0; j < n; j++) {
+        zz_clear(&u[j]);
+    }
+    zz_mem_free(u, n*sizeof(zz_t));
+}
+
+/* Return the first node of the level k and set len to the number of
+   nodes on it. */
+static zz_t *
+zz_tree_level(const zz_prodtree *tree, size_t k, size_t *len)
+{
+    zz_t *nodes = tree->nodes;
+    size_t m = tree->n;
+
+    while (k--) {
+        nodes += m;
+        m = (m + 1)/2;
     }
-    else { /* generic base, not power of 2, input might be clobbered */
-        zz_digit_t *volatile tmp = malloc(ZZ_DIGIT_T_BYTES * (size_t)u->size);
+    *len = m;
+    return nodes;
+}
 
-        if (!tmp || TMP_OVERFLOW) {
-            /* LCOV_EXCL_START */
-            free(tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+#if HAVE_PTHREAD_H
+static void *
+zz_tree_worker(void *arg)
+{
+    zz_tree_task *t = arg;
+
+    t->ret = t->run(t);
+    return NULL;
+}
+#endif
+
+/* Run both tasks, in parallel if threads are left and their work (size
+   digits, roughly) is big enough.  If a thread can't be created, tasks
+   are run in turn. */
+static zz_err
+zz_tree_fork(zz_tree_task *t, zz_size_t size)
+{
+#if HAVE_PTHREAD_H
+    int threads = t[0].threads;
+
+    if (threads > 1 && size >= ZZ_TREE_THREAD_THRESHOLD) {
+        pthread_t tid;
+
+        t[0].threads = threads - threads/2;
+        t[1].threads = threads/2;
+        if (!zz_thread_create(&tid, zz_tree_worker, t)) {
+            t[1].ret = t[1].run(t + 1);
+            zz_thread_join(tid);
+            return t[0].ret ? t[0].ret : t[1].ret;
         }
-        mpn_copyi(tmp, u->digits, u->size);
-        len = mpn_get_str(p, base, tmp, u->size);
-        free(tmp);
     }
-    for (size_t i = 0; i < len; i++) {
-        *p = (unsigned char)NUM_TO_TEXT[*p];
-        p++;
+#else
+    (void)size;
+#endif
+    for (int j = 0; j < 2; j++) {
+        if ((t[j].ret = t[j].run(t + j))) {
+            return t[j].ret;
+        }
     }
-end:
-    *p = '\0';
     return ZZ_OK;
 }
 
-/* Table of digit values for 8-bit string->mpz conversion.
-   Note that when converting a base B string, a char c is a legitimate
-   base B digit iff DIGIT_VALUE_TAB[c] < B. */
-const int DIGIT_VALUE_TAB[] =
+/* Set t->w to the product of n integers of the array t->u. */
+static zz_err
+zz_tree_prod(zz_tree_task *t)
 {
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1,-1,-1,-1,-1,-1,
-  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
-  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
-  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
-  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1,-1,-1,-1,-1,-1,
-  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
-  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
-  -1,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,
-  51,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-};
+    const zz_t *u = t->u;
+    size_t n = t->n;
 
-zz_err
-zz_set_str(const char *str, int base, zz_t *u)
-{
-    if (base && (base < 2 || base > 36)) {
-        return ZZ_VAL;
+    if (n <= ZZ_PROD_LEAF) {
+        if (zz_pos(&u[0], t->w)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        for (size_t j = 1; j < n; j++) {
+            if (zz_mul(t->w, &u[j], t->w)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+        }
+        return ZZ_OK;
     }
 
-    size_t len = strlen(str);
-    unsigned char *volatile buf = malloc(len), *p = (unsigned char *)buf;
+    zz_t y[2];
+    zz_tree_task c[2] = {*t, *t};
+    zz_size_t size = 0;
+    zz_err ret;
 
-    if (!buf) {
+    if (zz_init(&y[0]) || zz_init(&y[1])) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    memcpy(buf, str, len);
-    while (len && isspace(*p)) {
-        p++;
-        len--;
+    c[0].n = n/2;
+    c[1].u += n/2;
+    c[1].n -= n/2;
+    c[0].w = &y[0];
+    c[1].w = &y[1];
+    for (size_t j = 0; t->threads > 1 && j < n; j++) {
+        size += u[j].size;
     }
-    if (!len) {
-        goto err;
+    if ((ret = zz_tree_fork(c, size)) == ZZ_OK) {
+        ret = zz_mul(&y[0], &y[1], t->w);
     }
+    zz_clear(&y[0]);
+    zz_clear(&y[1]);
+    return ret;
+}
 
-    bool negative = (p[0] == '-');
-
-    p += negative;
-    len -= negative;
-    if (!len) {
-        goto err;
+zz_err
+zz_prod(size_t n, const zz_t *u, zz_t *w)
+{
+    if (!n) {
+        return zz_set_i64(1, w);
     }
-    if (!negative && p[0] == '+') {
-        p++;
-        len--;
+
+    zz_t y;
+    zz_tree_task t = {zz_tree_prod, NULL, 0, 0, n, u, &y,
+                      zz_mul_params.threads, ZZ_OK};
+
+    if (zz_init(&y)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    if (!len || p[0] == '_') {
-        goto err;
+
+    zz_err ret = zz_tree_prod(&t);
+
+    if (ret == ZZ_OK) {
+        zz_swap(&y, w);
     }
-    if (p[0] == '0' && base == 0) {
-        if (len == 1) {
-            free(buf);
-            return zz_set_i64(0, u);
-        }
-        else if (tolower(p[1]) == 'b') {
-            base = 2;
-        }
-        else if (tolower(p[1]) == 'o') {
-            base = 8;
-        }
-        else if (tolower(p[1]) == 'x') {
-            base = 16;
+    zz_clear(&y);
+    return ret;
+}
+
+/* Compute the node (k, i) from leaves. */
+static zz_err
+zz_tree_build(zz_tree_task *t)
+{
+    size_t len, k = t->k, i = t->i;
+    zz_t *node = zz_tree_level(t->tree, k, &len) + i;
+    zz_t *child = zz_tree_level(t->tree, k - 1, &len) + 2*i;
+    zz_tree_task c[2] = {*t, *t};
+    zz_err ret;
+
+    c[0].k = c[1].k = k - 1;
+    c[0].i = 2*i;
+    c[1].i = 2*i + 1;
+    if (2*i + 1 == len) {
+        if (k > 1 && (ret = zz_tree_build(c))) {
+            return ret;
         }
-        else if (!isspace(p[1])) {
-            goto err;
+        return zz_pos(child, node);
+    }
+    if (k > 1) {
+        const zz_t *leaf = t->tree->nodes + (i << k);
+        size_t nleaves = MIN(t->tree->n - (i << k), (size_t)1 << k);
+        zz_size_t size = 0;
+
+        for (size_t j = 0; t->threads > 1 && j < nleaves; j++) {
+            size += leaf[j].size;
         }
-        p += 2;
-        len -= 2;
-        if (len && p[0] == '_') {
-            p++;
-            len--;
+        if ((ret = zz_tree_fork(c, size))) {
+            return ret;
         }
     }
-    if (p[0] == '0' && len >= 2
-        && ((base == 2 && tolower(p[1]) == 'b')
-            || (base == 8 && tolower(p[1]) == 'o')
-            || (base == 16 && tolower(p[1]) == 'x')))
-    {
-        p += 2;
-        len -= 2;
-    }
-    if (base == 0) {
-        base = 10;
-    }
-    if (!len || (len && p[0] == '_')) {
-        goto err;
-    }
-
-    size_t new_len = len;
+    return zz_mul(child, child + 1, node);
+}
 
-    for (size_t i = 0; i < len; i++) {
-        if (p[i] == '_') {
-            if (i == len - 1 || p[i + 1] == '_') {
-                goto err;
-            }
-            new_len--;
-            memmove(p + i, p + i + 1, len - i - 1);
+zz_err
+zz_prodtree_init(size_t n, const zz_t *m, zz_prodtree *tree)
+{
+    tree->n = n;
+    tree->nlevels = 0;
+    tree->nodes = NULL;
+    tree->coeffs = NULL;
+    for (size_t j = 0; j < n; j++) {
+        if (!m[j].size || ISNEG(&m[j])) {
+            return ZZ_VAL;
         }
+    }
+    if (!n) {
+        return ZZ_VAL;
+    }
 
-        unsigned char c = (unsigned char)DIGIT_VALUE_TAB[p[i]];
+    size_t nnodes = 0;
 
-        if (c < base) {
-            p[i] = c;
-        }
-        else {
-            if (!isspace(p[i])) {
-                goto err;
-            }
-            new_len--;
-            for (size_t j = i + 1; j < len; j++) {
-                if (!isspace(p[j])) {
-                    goto err;
-                }
-                new_len--;
-            }
+    for (size_t len = n; ; len = (len + 1)/2) {
+        nnodes += len;
+        tree->nlevels++;
+        if (len == 1) {
             break;
         }
     }
-    len = new_len;
-    new_len = 1 + len/2;
-    if (new_len > ZZ_DIGITS_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    tree->nodes = zz_tree_alloc(nnodes);
+    if (!tree->nodes) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    if (zz_resize((zz_size_t)new_len, u) || TMP_OVERFLOW) {
-        /* LCOV_EXCL_START */
-        free(buf);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+    for (size_t j = 0; j < n; j++) {
+        if (zz_pos(&m[j], &tree->nodes[j])) {
+            goto err; /* LCOV_EXCL_LINE */
+        }
     }
-    SETNEG(negative, u);
-    u->size = (zz_size_t)mpn_set_str(u->digits, p, len, base);
-    free(buf);
-    if (zz_resize(u->size, u)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+
+    zz_tree_task t = {zz_tree_build, tree, tree->nlevels - 1, 0, 0, NULL,
+                      NULL, zz_mul_params.threads, ZZ_OK};
+
+    if (tree->nlevels > 1 && zz_tree_build(&t)) {
+        goto err; /* LCOV_EXCL_LINE */
     }
-    zz_normalize(u);
     return ZZ_OK;
+    /* LCOV_EXCL_START */
 err:
-    free(buf);
-    return ZZ_VAL;
+    zz_prodtree_clear(tree);
+    return ZZ_MEM;
+    /* LCOV_EXCL_STOP */
 }
 
-static bool
-zz_tstbit(const zz_t *u, zz_bitcnt_t idx)
+void
+zz_prodtree_clear(zz_prodtree *tree)
 {
-    zz_size_t digit_idx = (zz_size_t)(idx / ZZ_DIGIT_T_BITS);
+    size_t nnodes = 0;
 
-    assert(u->size > digit_idx);
-    return (u->digits[digit_idx] >> (idx%ZZ_DIGIT_T_BITS)) & 1;
+    for (size_t k = 0, len = tree->n; k < tree->nlevels; k++) {
+        nnodes += len;
+        len = (len + 1)/2;
+    }
+    if (tree->nodes) {
+        zz_tree_free(tree->nodes, nnodes);
+        tree->nodes = NULL;
+    }
+    if (tree->coeffs) {
+        zz_tree_free(tree->coeffs, tree->n);
+        tree->coeffs = NULL;
+    }
 }
 
-zz_err
-zz_get_double(const zz_t *u, double *d)
+/* Set t->w[j] for leaves j of the node (k, i) to t->u modulo them. */
+static zz_err
+zz_tree_rem(zz_tree_task *t)
 {
-    if (u->size > DBL_MAX_EXP/ZZ_DIGIT_T_BITS + 1) {
-        *d = ISNEG(u) ? -INFINITY : INFINITY;
-        return ZZ_BUF;
+    size_t len, k = t->k, i = t->i;
+    zz_t *node = zz_tree_level(t->tree, k, &len) + i;
+
+    if (!k) {
+        return zz_div(t->u, node, NULL, &t->w[i]);
     }
 
-    zz_bitcnt_t bits = zz_bitlen(u);
-    TMP_MPZ(z, u);
-    *d = mpz_get_d(z); /* round towards zero */
-    if (DBL_MANT_DIG < bits && bits <= DBL_MAX_EXP) {
-        bits -= DBL_MANT_DIG + 1;
-        if (zz_tstbit(u, bits)) {
-            zz_bitcnt_t tz = zz_lsbpos(u);
+    zz_t r;
+    zz_tree_task c[2] = {*t, *t};
+    zz_err ret;
 
-            if (tz < bits || (tz == bits && zz_tstbit(u, bits + 1))) {
-                *d = nextafter(*d, 2 * (*d)); /* round away from zero */
-            }
-        }
+    if (zz_init(&r) || zz_div(t->u, node, NULL, &r)) {
+        zz_clear(&r); /* LCOV_EXCL_LINE */
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic push
-#  pragma GCC diagnostic ignored "-Wfloat-conversion"
-#endif
-    if (isinf(*d)) {
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic pop
-#endif
-        return ZZ_BUF;
+    (void)zz_tree_level(t->tree, k - 1, &len);
+    c[0].k = c[1].k = k - 1;
+    c[0].i = 2*i;
+    c[1].i = 2*i + 1;
+    c[0].u = c[1].u = &r;
+    if (2*i + 1 == len) {
+        ret = zz_tree_rem(c);
     }
-    return ZZ_OK;
+    else {
+        ret = zz_tree_fork(c, node->size);
+    }
+    zz_clear(&r);
+    return ret;
 }
 
-zz_bitcnt_t
-zz_bitlen(const zz_t *u)
+zz_err
+zz_remtree(const zz_t *u, const zz_prodtree *tree, zz_t *w)
 {
-    return u->size ? (zz_bitcnt_t)mpn_sizeinbase(u->digits, u->size, 2) : 0;
+    zz_tree_task t = {zz_tree_rem, tree, tree->nlevels - 1, 0, 0, u, w,
+                      zz_mul_params.threads, ZZ_OK};
+
+    if (t.threads <= 1) {
+        return zz_tree_rem(&t);
+    }
+
+    /* Storage of outputs can come from an arena or a pool, which aren't
+       thread-safe.  So workers fill new integers (their digits are
+       allocated from the heap), that are moved to w by this thread. */
+    zz_t *r = zz_tree_alloc(tree->n);
+
+    if (!r) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    t.w = r;
+
+    zz_err ret = zz_tree_rem(&t);
+
+    for (size_t j = 0; ret == ZZ_OK && j < tree->n; j++) {
+        zz_swap(&r[j], &w[j]);
+    }
+    zz_tree_free(r, tree->n);
+    return ret;
 }
 
-zz_bitcnt_t
-zz_lsbpos(const zz_t *u)
+/* Set CRT coefficients s_j = (M/m_j)^(-1) mod m_j for leaves j of the
+   node (k, i), where M is the root.  The t->u is M/P mod P for the
+   parent P of the node. */
+static zz_err
+zz_tree_coeffs(zz_tree_task *t)
 {
-#if ULONG_MAX == ZZ_DIGIT_T_MAX
-    return u->size ? mpn_scan1(u->digits, 0) : 0;
-#else
-    zz_bitcnt_t lsb_pos = 0;
-
-    for (zz_size_t i = 0; i < u->size; i++) {
-        zz_digit_t digit = u->digits[i];
+    size_t len, k = t->k, i = t->i;
+    zz_t *node = zz_tree_level(t->tree, k, &len) + i;
+    zz_t c;
+    zz_err ret = ZZ_MEM;
 
-        if (digit) {
-            for (;;) {
-                if (digit & 1) {
-                    return lsb_pos;
-                }
-                lsb_pos += 1;
-                digit >>= 1;
-            }
-        }
-        else {
-            lsb_pos += 64;
+    if (zz_init(&c)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    /* M/node = (M/P)*sibling */
+    if (i % 2 || i + 1 < len) {
+        if (zz_mul(t->u, node + (i % 2 ? -1 : 1), &c)
+            || zz_div(&c, node, NULL, &c))
+        {
+            goto end; /* LCOV_EXCL_LINE */
         }
     }
-    return lsb_pos;
-#endif
+    else if (zz_pos(t->u, &c)) {
+        goto end; /* LCOV_EXCL_LINE */
+    }
+    if (!k) {
+        ret = zz_inverse(&c, node, &t->tree->coeffs[i]);
+        goto end;
+    }
+
+    zz_tree_task s[2] = {*t, *t};
+
+    (void)zz_tree_level(t->tree, k - 1, &len);
+    s[0].k = s[1].k = k - 1;
+    s[0].i = 2*i;
+    s[1].i = 2*i + 1;
+    s[0].u = s[1].u = &c;
+    if (2*i + 1 == len) {
+        ret = zz_tree_coeffs(s);
+    }
+    else {
+        ret = zz_tree_fork(s, node->size);
+    }
+end:
+    zz_clear(&c);
+    return ret;
 }
 
-zz_bitcnt_t
-zz_bitcnt(const zz_t *u)
+/* Set t->w to the sum of y_j*(P/m_j) for leaves j of the node P = (k, i),
+   where y_j = u_j*s_j mod m_j. */
+static zz_err
+zz_tree_crt(zz_tree_task *t)
 {
-#if ULONG_MAX == ZZ_DIGIT_T_MAX
-    return u->size ? mpn_popcount(u->digits, u->size) : 0;
-#else
-    zz_bitcnt_t count = 0;
-
-    for (zz_size_t i = 0; i < u->size; i++) {
-        zz_digit_t digit = u->digits[i];
+    size_t len, k = t->k, i = t->i;
+    zz_t *node = zz_tree_level(t->tree, k, &len) + i;
 
-        while (digit) {
-            count += digit & 1;
-            digit >>= 1;
+    if (!k) {
+        if (zz_div(&t->u[i], node, NULL, t->w)
+            || zz_mul(t->w, &t->tree->coeffs[i], t->w)
+            || zz_div(t->w, node, NULL, t->w))
+        {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
+        return ZZ_OK;
     }
-    return count;
-#endif
-}
 
-static const zz_layout native_layout = {
-    .bits_per_digit = ZZ_DIGIT_T_BITS,
-    .digit_size = sizeof(zz_digit_t),
-    .digits_order = -1,
-    .digit_endianness = 0,
-};
+    zz_t *child = zz_tree_level(t->tree, k - 1, &len) + 2*i;
+    zz_tree_task c[2] = {*t, *t};
 
-const zz_layout *
-zz_get_layout(void)
-{
-    return &native_layout;
-}
+    c[0].k = c[1].k = k - 1;
+    c[0].i = 2*i;
+    c[1].i = 2*i + 1;
+    if (2*i + 1 == len) {
+        return zz_tree_crt(c);
+    }
 
-zz_err
-zz_import(size_t len, const void *digits, zz_layout layout, zz_t *u)
-{
-    size_t size = (len*layout.bits_per_digit
-                   + (ZZ_DIGIT_T_BITS - 1))/ZZ_DIGIT_T_BITS;
+    zz_t y[2];
+    zz_err ret;
 
-    if (len > SIZE_MAX / layout.bits_per_digit || size > INT_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
-    }
-    if (zz_resize((zz_size_t)size, u)) {
+    if (zz_init(&y[0]) || zz_init(&y[1])) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    if (layout.digit_size == 1 && layout.bits_per_digit == 8
-        && layout.digits_order == 1 && !layout.digit_endianness)
+    c[0].w = &y[0];
+    c[1].w = &y[1];
+    if ((ret = zz_tree_fork(c, node->size)) == ZZ_OK
+        && (zz_mul(&y[0], child + 1, t->w) || zz_addmul(&y[1], child, t->w)))
     {
-        u->size = (zz_size_t)mpn_set_str(u->digits, digits, len, 256);
-        zz_normalize(u);
-        return ZZ_OK;
+        ret = ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-
-    assert(layout.digit_size*8 >= layout.bits_per_digit);
-    mpn_import(u->digits, (mp_size_t *)&u->size, len, layout.digits_order,
-               layout.digit_size, layout.digit_endianness,
-               (size_t)(layout.digit_size*8 - layout.bits_per_digit),
-               digits);
-    return ZZ_OK;
+    zz_clear(&y[0]);
+    zz_clear(&y[1]);
+    return ret;
 }
 
 zz_err
-zz_export(const zz_t *u, zz_layout layout, size_t len, void *digits)
+zz_crt(const zz_t *u, zz_prodtree *tree, zz_t *w)
 {
-    if (len < (zz_bitlen(u) + layout.bits_per_digit
-               - 1)/layout.bits_per_digit || u->size > INT_MAX)
-    {
-        return ZZ_BUF;
-    }
-    if (layout.digit_size == 1 && layout.bits_per_digit == 8
-        && layout.digits_order == 1 && !layout.digit_endianness)
-    {
-        if (!u->size) {
-            memset(digits, 0, 1);
+    zz_tree_task t = {zz_tree_coeffs, tree, tree->nlevels - 1, 0, 0, NULL,
+                      NULL, zz_mul_params.threads, ZZ_OK};
+    zz_err ret;
+
+    if (!tree->coeffs) {
+        zz_t one;
+
+        tree->coeffs = zz_tree_alloc(tree->n);
+        if (!tree->coeffs || zz_init(&one) || zz_set_i64(1, &one)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
-        else {
-            mpn_get_str(digits, 256, u->digits, u->size);
+        t.u = &one;
+        ret = zz_tree_coeffs(&t);
+        zz_clear(&one);
+        if (ret) {
+            zz_tree_free(tree->coeffs, tree->n);
+            tree->coeffs = NULL;
+            return ret;
         }
-        return ZZ_OK;
     }
 
-    assert(layout.digit_size*8 >= layout.bits_per_digit);
-    mpn_export(digits, NULL, layout.digits_order, layout.digit_size,
-               layout.digit_endianness,
-               (size_t)(layout.digit_size*8 - layout.bits_per_digit),
-               u->digits, u->size);
-    return ZZ_OK;
+    zz_t y;
+
+    if (zz_init(&y)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    t.run = zz_tree_crt;
+    t.u = u;
+    t.w = &y;
+    if ((ret = zz_tree_crt(&t)) == ZZ_OK) {
+        size_t len;
+
+        ret = zz_div(&y, zz_tree_level(tree, tree->nlevels - 1, &len),
+                     NULL, w);
+    }
+    zz_clear(&y);
+    return ret;
 }
 
 static zz_err
-zz_addsub(const zz_t *u, const zz_t *v, bool subtract, zz_t *w)
+_zz_powm(const zz_t *u, const zz_t *v, const zz_t *w, zz_t *res)
 {
-    bool negu = ISNEG(u), negv = subtract ? !ISNEG(v) : ISNEG(v);
-    bool same_sign = negu == negv;
-    zz_size_t u_size = u->size, v_size = v->size;
-
-    if (!v_size) {
-        return zz_pos(u, w);
-    }
-    if (!u_size) {
-        return subtract ? zz_neg(v, w) : zz_pos(v, w);
-    }
-    if (u_size < v_size) {
-        SWAP(const zz_t *, u, v);
-        SWAP(bool, negu, negv);
-        SWAP(zz_size_t, u_size, v_size);
-    }
-    if (same_sign && u_size == ZZ_DIGITS_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
-    }
-    if (zz_resize(u_size + same_sign, w)) {
+    if (zz_resize(w->size, res)) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    SETNEG(negu, w);
-    if (same_sign) {
-        if (!(w->digits[w->size - 1] = mpn_add(w->digits, u->digits, u_size,
-                                               v->digits, v_size)))
-        {
-            w->size--;
+    SETNEG(false, res);
+    /* Handle (u**1 mod w) early, since mpn_pow* can't */
+    if (zz_cmp_i64(v, 1) == ZZ_EQ) {
+        if (zz_div(u, w, NULL, res)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
         return ZZ_OK;
     }
-    else if (u_size != v_size) {
-        mpn_sub(w->digits, u->digits, u_size, v->digits, v_size);
-    }
-    else {
-        int cmp = mpn_cmp(u->digits, v->digits, u_size);
 
-        if (cmp < 0) {
-            mpn_sub_n(w->digits, v->digits, u->digits, u_size);
-            SETNEG(negv, w);
-        }
-        else if (cmp > 0) {
-            mpn_sub_n(w->digits, u->digits, v->digits, u_size);
-        }
-        else {
-            SETNEG(false, w);
-            w->size = 0;
-            return ZZ_OK;
+    zz_bitcnt_t lsbpos = zz_lsbpos(w);
+    zz_size_t n = w->size;
+    zz_t t1;
+
+    zz_init(&t1);
+    if (lsbpos) {
+        if (zz_quo_2exp(w, lsbpos, &t1)) {
+            /* LCOV_EXCL_START */
+            zz_clear(&t1);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
         }
+        w = &t1;
     }
-    zz_normalize(w);
-    return ZZ_OK;
-}
 
-static zz_err
-zz_addsub_u64(const zz_t *u, uint64_t v, bool negv, zz_t *w)
-{
-    bool negu = ISNEG(u), same_sign = negu == negv, v_size = v != 0;
-    zz_size_t u_size = u->size;
+    zz_size_t nodd = w->size;
+    zz_size_t neven = (zz_size_t)(lsbpos + ZZ_DIGIT_T_BITS - 1)/ZZ_DIGIT_T_BITS;
+    zz_size_t cnt = lsbpos % ZZ_DIGIT_T_BITS;
+    zz_size_t n_largest_binvert = MAX(neven, nodd);
+    zz_size_t itch_binvert = mpn_binvert_itch(n_largest_binvert);
+    zz_size_t itch = n + MAX(itch_binvert, 2*n);
 
-    if (!u_size) {
-        if (v_size) {
-            if (zz_resize(v_size, w)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
+    /* Now w factored as w * BASE**neven */
+    if (neven != 0) {
+        /* We will call both mpn_powm() and mpn_powlo() */
+        itch += 2*n;
+    }
+
+    size_t tp_size = (size_t)itch * ZZ_DIGIT_T_BYTES;
+    size_t neven_size = (size_t)neven * ZZ_DIGIT_T_BYTES;
+    zz_digit_t *volatile tp = zz_tmp_malloc(tp_size);
+    zz_digit_t *volatile newup = NULL;
+    zz_digit_t *volatile newwp = NULL;
+    zz_digit_t *volatile rp = tp;
+
+    if (!tp || TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+clear:
+        zz_tmp_free(rp, tp_size);
+        zz_tmp_free(newup, neven_size);
+        zz_tmp_free(newwp, neven_size);
+        zz_clear(&t1);
+        zz_clear(res);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    tp += n;
+    /* Compute r = u**v mod w */
+    mpn_powm (rp, u->digits, u->size, v->digits, v->size,
+              w->digits, nodd, tp);
+    if (neven != 0) {
+        zz_digit_t *r2, *xp, *yp, *odd_inv_2exp, *up, *wp;
+
+        if (u->size < neven) {
+            /* Padd u with zeros. */
+            newup = zz_tmp_malloc(neven_size);
+            if (!newup) {
+                goto clear; /* LCOV_EXCL_LINE */
             }
-            w->digits[0] = v;
-            SETNEG(negv, w);
+            mpn_copyi(newup, u->digits, u->size);
+            mpn_zero(newup + u->size, neven - u->size);
+            up = newup;
         }
         else {
-            w->size = 0;
-            SETNEG(false, w);
+            up = u->digits;
         }
-        return ZZ_OK;
-    }
-    if (same_sign && u_size == ZZ_DIGITS_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
-    }
-    if (zz_resize(u_size + same_sign, w)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
-    }
-    SETNEG(negu, w);
-    if (same_sign) {
-        if (!(w->digits[u_size] = mpn_add_1(w->digits, u->digits, u_size, v))) {
-            w->size--;
+        r2 = tp;
+        if (up[0] % 2 == 0) {
+            if (v->size > 1) {
+                mpn_zero(r2, neven);
+                goto zero;
+            }
         }
-    }
-    else if (u_size > 1) {
-        mpn_sub_1(w->digits, u->digits, u_size, v);
-        w->size -= w->digits[w->size - 1] == 0;
-    }
-
-    else {
-        if (u->digits[0] < v) {
-            w->digits[0] = v - u->digits[0];
-            SETNEG(negv, w);
+        /* Compute r2 = u**v mod BASE**neven */
+        mpn_powlo(r2, up, v->digits, v->size, neven, tp + neven);
+zero:
+        zz_tmp_free(newup, neven_size);
+        newup = NULL;
+        if (nodd < neven) {
+            /* Padd w with zeros */
+            newwp = zz_tmp_malloc(neven_size);
+            if (!newwp) {
+                goto clear; /* LCOV_EXCL_LINE */
+            }
+            mpn_copyi(newwp, w->digits, nodd);
+            mpn_zero(newwp + nodd, neven - nodd);
+            wp = newwp;
+            zz_clear(&t1);
+        }
+        else {
+            wp = w->digits;
+        }
+        odd_inv_2exp = tp + n;
+        /* odd_inv_2exp = w**(-1) mod BASE**neven */
+        mpn_binvert(odd_inv_2exp, wp, neven, tp + 2*n);
+        /* r2 = r2 - r */
+        mpn_sub(r2, r2, neven, rp, MIN(nodd, neven));
+        xp = tp + 2*n;
+        /* x = (odd_inv_2exp * r2) mod BASE**neven */
+        mpn_mullo_n(xp, odd_inv_2exp, r2, neven);
+        if (cnt) {
+            xp[neven - 1] &= ((mp_limb_t)1 << cnt) - 1;
+        }
+        yp = tp;
+        if (neven > nodd) {
+            mpn_mul(yp, xp, neven, wp, nodd);
         }
         else {
-            w->digits[0] = u->digits[0] - v;
-            if (!w->digits[0]) {
-                w->size = 0;
-                SETNEG(false, w);
-            }
+            mpn_mul(yp, wp, nodd, xp, neven);
         }
+        zz_tmp_free(newwp, neven_size);
+        newwp = NULL;
+        /* r += x * w */
+        mpn_add(rp, yp, n, rp, nodd);
     }
+    zz_clear(&t1);
+    if (zz_resize(n, res)) {
+        /* LCOV_EXCL_START */
+        zz_tmp_free(rp, tp_size);
+        zz_clear(res);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    mpn_copyi(res->digits, rp, n);
+    zz_tmp_free(rp, tp_size);
+    zz_normalize(res);
     return ZZ_OK;
 }
 
 zz_err
-zz_addsub_i64(const zz_t *u, int64_t v, bool subtract, zz_t *w)
-{
-    bool negv = v < 0;
-    uint64_t uv = ABS_CAST(uint64_t, v);
-
-    return zz_addsub_u64(u, uv, subtract ? !negv : negv, w);
-}
-
-zz_err
-zz_add(const zz_t *u, const zz_t *v, zz_t *w)
-{
-    return zz_addsub(u, v, false, w);
-}
-
-zz_err
-zz_sub(const zz_t *u, const zz_t *v, zz_t *w)
+zz_powm(const zz_t *u, const zz_t *v, const zz_t *w, zz_t *res)
 {
-    return zz_addsub(u, v, true, w);
-}
+    if (!w->size) {
+        return ZZ_VAL;
+    }
+    if (u == res || v == res || w == res) {
+        zz_t tmp;
 
-zz_err
-zz_add_u64(const zz_t *u, uint64_t v, zz_t *w)
-{
-    return zz_addsub_u64(u, v, false, w);
-}
+        if (zz_init(&tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
 
-zz_err
-zz_sub_u64(const zz_t *u, uint64_t v, zz_t *w)
-{
-    return zz_addsub_u64(u, v, true, w);
-}
+        zz_err ret = zz_powm(u, v, w, &tmp);
 
-zz_err
-zz_u64_sub(uint64_t u, const zz_t *v, zz_t *w)
-{
-    if (zz_neg(v, w)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+        if (ret == ZZ_OK) {
+            zz_swap(&tmp, res);
+        }
+        zz_clear(&tmp);
+        return ret;
     }
-    return zz_addsub_u64(w, u, false, w);
-}
-
-zz_err
-zz_add_i64(const zz_t *u, int64_t v, zz_t *w)
-{
-    return zz_addsub_i64(u, v, false, w);
-}
+    ZZ_STAT_CALL(ZZ_OP_POWM, MAX(MAX(u->size, v->size), w->size));
 
-zz_err
-zz_sub_i64(const zz_t *u, int64_t v, zz_t *w)
-{
-    return zz_addsub_i64(u, v, true, w);
-}
+    int negativeOutput = 0;
+    zz_t o1, o2, o3;
+    zz_err ret = ZZ_OK;
 
-zz_err
-zz_i64_sub(int64_t u, const zz_t *v, zz_t *w)
-{
-    if (zz_neg(v, w)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    if (zz_init(&o1) || zz_init(&o2) || zz_init(&o3)) {
+        /* LCOV_EXCL_START */
+        zz_clear(&o1);
+        zz_clear(&o2);
+        zz_clear(&o3);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
     }
-    return zz_addsub_i64(w, u, false, w);
-}
-
-zz_err
-zz_mul(const zz_t *u, const zz_t *v, zz_t *w)
-{
-    if (u->size < v->size) {
-        SWAP(const zz_t *, u, v);
+    if (ISNEG(w)) {
+        if (zz_pos(w, &o3)) {
+            goto end; /* LCOV_EXCL_LINE */
+        }
+        negativeOutput = 1;
+        SETNEG(false, &o3);
+        w = &o3;
     }
-    if (v->size <= 1) {
-        bool w_negative = ISNEG(u) != ISNEG(v); /* in case v == w */
-        zz_err ret = zz_mul_u64(u, v->size ? v->digits[0] : 0, w);
+    if (ISNEG(v)) {
+        if (zz_pos(v, &o2)) {
+            goto end; /* LCOV_EXCL_LINE */
+        }
+        SETNEG(false, &o2);
+        v = &o2;
 
-        if (w->size) {
-            SETNEG(w_negative, w);
+        if ((ret = zz_inverse(u, w, &o1)) == ZZ_MEM) {
+            goto end; /* LCOV_EXCL_LINE */
         }
-        return ret;
+        if (ret == ZZ_VAL) {
+end:
+            zz_clear(&o1);
+            zz_clear(&o2);
+            zz_clear(&o3);
+            return ZZ_VAL;
+        }
+        u = &o1;
     }
-    if (u == w) {
+    if (ISNEG(u) || u->size > w->size) {
         zz_t tmp;
 
-        if (zz_init(&tmp) || zz_pos(u, &tmp)) {
+        if (zz_init(&tmp) || zz_div(u, w, NULL, &tmp)
+            || zz_pos(&tmp, &o1))
+        {
             /* LCOV_EXCL_START */
             zz_clear(&tmp);
-            return ZZ_MEM;
+            goto end;
             /* LCOV_EXCL_STOP */
         }
-
-        zz_err ret = u == v ? zz_mul(&tmp, &tmp, w) : zz_mul(&tmp, v, w);
-
         zz_clear(&tmp);
-        return ret;
+        u = &o1;
     }
-    if (v == w) {
-        zz_t tmp;
-
-        if (zz_init(&tmp) || zz_pos(v, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+    if (zz_cmp_i64(w, 1) == ZZ_EQ) {
+        ret = zz_set_i64(0, res);
+    }
+    else if (!v->size) {
+        ret = zz_set_i64(1, res);
+    }
+    else if (!u->size) {
+        ret = zz_set_i64(0, res);
+    }
+    else if (zz_cmp_i64(u, 1) == ZZ_EQ) {
+        ret = zz_set_i64(1, res);
+    }
+    else {
+        if (_zz_powm(u, v, w, res)) {
+            goto end; /* LCOV_EXCL_LINE */
         }
+    }
+    if (negativeOutput && !ret && res->size && zz_sub(res, w, res)) {
+        goto end; /* LCOV_EXCL_LINE */
+    }
+    zz_clear(&o1);
+    zz_clear(&o2);
+    zz_clear(&o3);
+    return ret;
+}
 
-        zz_err ret = zz_mul(u, &tmp, w);
+/* Use mpn_redc_n() instead of mpn_redc_1() for odd moduli of at least
+   ZZ_REDC_N_THRESHOLD digits. */
+#define ZZ_REDC_N_THRESHOLD 48
+/* Largest window size in zz_mont_powm(), the context keeps a table of
+   ZZ_POWM_TABLE odd powers of the base. */
+#define ZZ_POWM_WINDOW 6
+#define ZZ_POWM_TABLE (1 << (ZZ_POWM_WINDOW - 1))
+/* Below this number of digits, the mpn_powm() is faster: it's table of
+   powers is small here. */
+#define ZZ_MONT_POWM_THRESHOLD 3
 
-        zz_clear(&tmp);
-        return ret;
+zz_err
+zz_mod_ctx_init(const zz_t *m, zz_mod_ctx *ctx)
+{
+    if (!m->size) {
+        return ZZ_VAL;
     }
 
-    uint64_t w_size = (uint64_t)u->size + (uint64_t)v->size;
+    zz_t odd;
 
-    if (w_size > ZZ_DIGITS_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    if (zz_init(&ctx->mod) || zz_abs(m, &ctx->mod) || zz_init(&odd)) {
+        /* LCOV_EXCL_START */
+        zz_clear(&ctx->mod);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
     }
-    if (zz_resize((zz_size_t)w_size, w) || TMP_OVERFLOW) {
+    ctx->negative = ISNEG(m);
+    ctx->shift = zz_lsbpos(m);
+    ctx->sec_scratch = NULL;
+    ctx->sec_alloc = 0;
+    if (zz_quo_2exp(&ctx->mod, ctx->shift, &odd)) {
+        /* LCOV_EXCL_START */
+        zz_clear(&odd);
+        zz_clear(&ctx->mod);
         return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
     }
-    SETNEG(ISNEG(u) != ISNEG(v), w);
-    if (u->size == v->size) {
-        if (u != v) {
-            mpn_mul_n(w->digits, u->digits, v->digits, u->size);
+
+    /* Now m factored as odd * 2**shift.  For the odd part we keep
+       inverse for Montgomery reduction and R**2 mod odd, R = BASE**n,
+       for the even part - odd**(-1) mod BASE**neven. */
+    zz_size_t mn = m->size;
+    zz_size_t n = zz_cmp_i64(&odd, 1) == ZZ_EQ ? 0 : odd.size;
+    zz_size_t neven = (zz_size_t)((ctx->shift + ZZ_DIGIT_T_BITS - 1)
+                                  / ZZ_DIGIT_T_BITS);
+    zz_size_t on = MAX(n, neven);
+    zz_size_t work = MAX(ZZ_POWM_TABLE*n + 3*n, 3*neven);
+
+    if (n && n < ZZ_MONT_POWM_THRESHOLD) {
+        work = MAX(work, MAX(mpn_binvert_itch(n), 2*n));
+    }
+    zz_size_t itch = MAX(3*n + mn + 1 + 4*neven + work, 4*mn + 1);
+
+    if (on) {
+        itch = MAX(itch, MAX(mpn_binvert_itch(on), 3*n + 3));
+    }
+    ctx->odd_size = n;
+    ctx->alloc = (size_t)(2*on + n + neven + itch) * ZZ_DIGIT_T_BYTES;
+    ctx->odd = zz_mem_malloc(ctx->alloc);
+    if (!ctx->odd) {
+        /* LCOV_EXCL_START */
+        zz_clear(&odd);
+        zz_clear(&ctx->mod);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    ctx->inv = ctx->odd + on;
+    ctx->r2 = ctx->inv + on;
+    ctx->inv_2exp = ctx->r2 + n;
+    ctx->scratch = ctx->inv_2exp + neven;
+    mpn_zero(ctx->odd, on);
+    mpn_copyi(ctx->odd, odd.digits, MIN(odd.size, on));
+    zz_clear(&odd);
+    if (TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+        zz_mod_ctx_clear(ctx);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    if (n) {
+        zz_digit_t *np = ctx->scratch, *qp = np + 2*n + 1;
+
+        if (n < ZZ_REDC_N_THRESHOLD) {
+            mpn_binvert(ctx->inv, ctx->odd, 1, ctx->scratch);
+            ctx->inv[0] = -ctx->inv[0];
         }
         else {
-            mpn_sqr(w->digits, u->digits, u->size);
+            mpn_binvert(ctx->inv, ctx->odd, n, ctx->scratch);
         }
+        /* r2 = BASE**(2*n) mod odd */
+        mpn_zero(np, 2*n);
+        np[2*n] = 1;
+        mpn_tdiv_qr(qp, ctx->r2, 0, np, 2*n + 1, ctx->odd, n);
     }
-    else {
-        mpn_mul(w->digits, u->digits, u->size, v->digits, v->size);
+    if (neven && n) {
+        mpn_binvert(ctx->inv_2exp, ctx->odd, neven, ctx->scratch);
     }
-    w->size -= w->digits[w->size - 1] == 0;
-    assert(w->size >= 1);
     return ZZ_OK;
 }
 
-zz_err
-zz_mul_u64(const zz_t *u, uint64_t v, zz_t *w)
+void
+zz_mod_ctx_clear(zz_mod_ctx *ctx)
 {
-    zz_size_t u_size = u->size;
-
-    if (!u_size || !v) {
-        return zz_set_i64(0, w);
-    }
-    if (u_size == ZZ_DIGITS_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
-    }
-    if (zz_resize(u_size + 1, w) || TMP_OVERFLOW) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
-    }
-    SETNEG(ISNEG(u), w);
-    w->digits[u_size] = mpn_mul_1(w->digits, u->digits, u_size, v);
-    w->size -= w->digits[u_size] == 0;
-    assert(w->size >= 1);
-    return ZZ_OK;
+    zz_mem_free(ctx->odd, ctx->alloc);
+    ctx->odd = NULL;
+    zz_mem_free(ctx->sec_scratch, ctx->sec_alloc);
+    ctx->sec_scratch = NULL;
+    ctx->sec_alloc = 0;
+    zz_clear(&ctx->mod);
 }
 
-zz_err
-zz_mul_i64(const zz_t *u, int64_t v, zz_t *w)
+/* Set {rp, n} = {tp, 2*n} / R mod odd, the result is less than BASE**n.
+   The {tp, 2*n} is clobbered. */
+static void
+zz_redc_digits(const zz_mod_ctx *ctx, zz_digit_t *rp, zz_digit_t *tp)
 {
-    zz_err ret = zz_mul_u64(u, ABS_CAST(zz_digit_t, v), w);
+    zz_size_t n = ctx->odd_size;
+    zz_digit_t cy;
 
-    if (w->size) {
-        SETNEG(ISNEG(u) != (v < 0), w);
+    if (n < ZZ_REDC_N_THRESHOLD) {
+        cy = mpn_redc_1(rp, tp, ctx->odd, n, ctx->inv[0]);
+    }
+    else {
+        cy = mpn_redc_n(rp, tp, ctx->odd, n, ctx->inv);
+    }
+    if (cy) {
+        mpn_sub_n(rp, rp, ctx->odd, n);
     }
-    return ret;
 }
 
-zz_err
-zz_div(const zz_t *u, const zz_t *v, zz_t *q, zz_t *r)
+/* Return len (at most ZZ_DIGIT_T_BITS) bits of {ep, en}, starting from
+   the bit pos.  Bits past the end of {ep, en} are zeros. */
+static zz_digit_t
+zz_getbits(const zz_digit_t *ep, zz_size_t en, zz_bitcnt_t pos,
+           zz_bitcnt_t len)
 {
-    if (!v->size) {
-        return ZZ_VAL;
-    }
-    if (!q || !r) {
-        if (!q && !r) {
-            return ZZ_OK;
-        }
-        if (!q) {
-            zz_t tmp;
-
-            if (zz_init(&tmp)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
-
-            zz_err ret = zz_div(u, v, &tmp, r);
-
-            zz_clear(&tmp);
-            return ret;
-        }
-        else {
-            zz_t tmp;
-
-            if (zz_init(&tmp)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
+    zz_size_t i = (zz_size_t)(pos / ZZ_DIGIT_T_BITS);
+    zz_bitcnt_t off = pos % ZZ_DIGIT_T_BITS;
 
-            zz_err ret = zz_div(u, v, q, &tmp);
+    if (i >= en) {
+        return 0;
+    }
 
-            zz_clear(&tmp);
-            return ret;
-        }
+    zz_digit_t r = ep[i] >> off;
+
+    if (off + len > ZZ_DIGIT_T_BITS && i + 1 < en) {
+        r |= ep[i + 1] << (ZZ_DIGIT_T_BITS - off);
     }
-    if (!u->size) {
-        if (zz_set_i64(0, q) || zz_set_i64(0, r)) {
-            goto err; /* LCOV_EXCL_LINE */
-        }
+    return r & (ZZ_DIGIT_T_MAX >> (ZZ_DIGIT_T_BITS - len));
+}
+
+/* Set {rp, 2*n} = {ap, n} * {bp, n}.  Single-digit products are most
+   common in loops of zz_mont_powm(), use mpn_mul_1() for them. */
+static inline void
+zz_mul_n(zz_digit_t *rp, const zz_digit_t *ap, const zz_digit_t *bp,
+         zz_size_t n)
+{
+    if (n == 1) {
+        rp[1] = mpn_mul_1(rp, ap, 1, bp[0]);
     }
-    else if (u->size < v->size) {
-        if (ISNEG(u) != ISNEG(v)) {
-            if (zz_set_i64(-1, q) || zz_add(u, v, r)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-        }
-        else {
-            if (zz_set_i64(0, q) || zz_pos(u, r)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-        }
+    else if (ap == bp) {
+        mpn_sqr(rp, ap, n);
     }
     else {
-        if (u == q || u == r) {
-            zz_t tmp;
+        mpn_mul_n(rp, ap, bp, n);
+    }
+}
 
-            if (zz_init(&tmp) || zz_pos(u, &tmp)) {
-                /* LCOV_EXCL_START */
-                zz_clear(&tmp);
-                return ZZ_MEM;
-                /* LCOV_EXCL_STOP */
-            }
+/* Set {rp, n} = {bp, n} * R mod odd (Montgomery form of b), uses 2*n
+   digits of scratch space at pp. */
+static void
+zz_mont_in(const zz_mod_ctx *ctx, zz_digit_t *rp, const zz_digit_t *bp,
+           zz_digit_t *pp)
+{
+    zz_mul_n(pp, bp, ctx->r2, ctx->odd_size);
+    zz_redc_digits(ctx, rp, pp);
+}
 
-            zz_err ret = zz_div(&tmp, v, q, r);
+/* Set {rp, n} = {xp, n} / R mod odd, the result is fully reduced.  Uses
+   2*n digits of scratch space at pp. */
+static void
+zz_mont_out(const zz_mod_ctx *ctx, zz_digit_t *rp, const zz_digit_t *xp,
+            zz_digit_t *pp)
+{
+    zz_size_t n = ctx->odd_size;
 
-            zz_clear(&tmp);
-            return ret;
+    mpn_copyi(pp, xp, n);
+    mpn_zero(pp + n, n);
+    zz_redc_digits(ctx, rp, pp);
+    if (mpn_cmp(rp, ctx->odd, n) >= 0) {
+        mpn_sub_n(rp, rp, ctx->odd, n);
+    }
+}
+
+/* Compute {rp, n} = {bp, n}**{ep, en} mod odd with sliding window
+   exponentiation in Montgomery form.  Requires normalized e > 0 and
+   {bp, n} less than odd.  Uses (ZZ_POWM_TABLE + 3)*n digits of scratch
+   space at tp. */
+static void
+zz_mont_powm(const zz_mod_ctx *ctx, zz_digit_t *rp, const zz_digit_t *bp,
+             const zz_digit_t *ep, zz_size_t en, zz_digit_t *tp)
+{
+    static const zz_bitcnt_t thresholds[ZZ_POWM_WINDOW - 1] = {7, 25, 81,
+                                                                241, 673};
+    zz_size_t n = ctx->odd_size;
+    zz_bitcnt_t i = (zz_bitcnt_t)mpn_sizeinbase(ep, en, 2);
+    zz_bitcnt_t k = 1;
+    zz_digit_t *tab = tp, *pp = tab + ZZ_POWM_TABLE*n, *xp = pp + 2*n;
+
+    while (k < ZZ_POWM_WINDOW && i > thresholds[k - 1]) {
+        k++;
+    }
+    /* tab[j] = b**(2*j + 1) * R mod odd */
+    zz_mont_in(ctx, tab, bp, pp);
+    if (k > 1) {
+        zz_mul_n(pp, tab, tab, n);
+        zz_redc_digits(ctx, xp, pp);
+        for (zz_size_t j = 1; j < (zz_size_t)1 << (k - 1); j++) {
+            zz_mul_n(pp, tab + (j - 1)*n, xp, n);
+            zz_redc_digits(ctx, tab + j*n, pp);
         }
-        if (v == q || v == r) {
-            zz_t tmp;
+    }
 
-            if (zz_init(&tmp) || zz_pos(v, &tmp)) {
-                /* LCOV_EXCL_START */
-                zz_clear(&tmp);
-                return ZZ_MEM;
-                /* LCOV_EXCL_STOP */
-            }
+    bool first = true;
 
-            zz_err ret = zz_div(u, &tmp, q, r);
+    while (i) {
+        if (!zz_getbits(ep, en, i - 1, 1)) {
+            zz_mul_n(pp, xp, xp, n);
+            zz_redc_digits(ctx, xp, pp);
+            i--;
+            continue;
+        }
 
-            zz_clear(&tmp);
-            return ret;
+        zz_bitcnt_t len = MIN(k, i);
+
+        while (!zz_getbits(ep, en, i - len, 1)) {
+            len--;
         }
 
-        zz_size_t u_size = u->size;
+        zz_digit_t d = zz_getbits(ep, en, i - len, len);
 
-        if (zz_resize(u_size - v->size + 1, q)
-            || zz_resize(v->size, r) || TMP_OVERFLOW)
-        {
-            goto err; /* LCOV_EXCL_LINE */
+        i -= len;
+        if (first) {
+            mpn_copyi(xp, tab + (zz_size_t)(d/2)*n, n);
+            first = false;
+            continue;
         }
-        SETNEG(ISNEG(u) != ISNEG(v), q);
-        SETNEG(ISNEG(v), r);
-        mpn_tdiv_qr(q->digits, r->digits, 0, u->digits, u_size, v->digits,
-                    v->size);
-        q->size -= q->digits[q->size - 1] == 0;
-        zz_normalize(r);
-        if (ISNEG(q) && r->size) {
-            /* Note that we can't get carry here for q of maximal size,
-               as this would mean |v| == 1, thus: r == 0 */
-            assert(q->size < ZZ_DIGITS_MAX);
-            if (zz_sub_i64(q, 1, q)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            r->size = v->size;
-            mpn_sub_n(r->digits, v->digits, r->digits, v->size);
-            zz_normalize(r);
+        while (len--) {
+            zz_mul_n(pp, xp, xp, n);
+            zz_redc_digits(ctx, xp, pp);
         }
+        zz_mul_n(pp, xp, tab + (zz_size_t)(d/2)*n, n);
+        zz_redc_digits(ctx, xp, pp);
     }
-    return ZZ_OK;
-    /* LCOV_EXCL_START */
-err:
-    zz_clear(q);
-    zz_clear(r);
-    return ZZ_MEM;
-    /* LCOV_EXCL_STOP */
+    zz_mont_out(ctx, rp, xp, pp);
 }
 
-zz_err
-zz_div_i64(const zz_t *u, int64_t v, zz_t *q, zz_t *r)
+/* Set the w to the canonical form of {rp, len} mod m: it has the sign of
+   the modulus. */
+static zz_err
+zz_mod_ctx_set(const zz_mod_ctx *ctx, const zz_digit_t *rp, zz_size_t len,
+               zz_t *w)
 {
-    if (!v) {
-        return ZZ_VAL;
-    }
+    zz_size_t mn = ctx->mod.size;
 
-    zz_digit_t rl, uv = ABS_CAST(zz_digit_t, v);
-    bool same_signs = ISNEG(u) == (v < 0);
+    if (zz_resize(mn, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(false, w);
+    mpn_copyi(w->digits, rp, len);
+    mpn_zero(w->digits + len, mn - len);
+    zz_normalize(w);
+    if (ctx->negative && w->size) {
+        return zz_sub(w, &ctx->mod, w);
+    }
+    return ZZ_OK;
+}
 
-    if (q) {
-        if (u->size) {
-            if (zz_resize(u->size, q)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
-            rl = mpn_divrem_1(q->digits, 0, u->digits, u->size, uv);
-            if (rl && !same_signs) {
-                mpn_add_1(q->digits, q->digits, q->size, 1);
-            }
-            q->size -= q->digits[q->size - 1] == 0;
-            SETNEG(q->size ? !same_signs : false, q);
-        }
-        else {
-            (void)zz_set_i32(0, q);
+/* Finish computation of w = u**v mod m, given {r1, n} = u**v mod odd at
+   the start of the context's scratch space: compute u**v mod 2**shift and
+   combine both residues.  Requires nonnegative u of at most m->size
+   digits and v > 0. */
+static zz_err
+zz_powm_ctx_crt(const zz_t *u, const zz_t *v, zz_mod_ctx *ctx, zz_t *w)
+{
+    zz_size_t mn = ctx->mod.size, n = ctx->odd_size;
+    zz_size_t neven = (zz_size_t)((ctx->shift + ZZ_DIGIT_T_BITS - 1)
+                                  / ZZ_DIGIT_T_BITS);
+    zz_bitcnt_t cnt = ctx->shift % ZZ_DIGIT_T_BITS;
+    zz_digit_t *r1 = ctx->scratch, *r2 = r1 + 2*n + mn + 1;
+    zz_digit_t *up = r2 + neven, *xp = up + neven, *yp = xp + neven;
+    zz_digit_t *tp = yp + n + neven, *rp = r1;
+    zz_size_t len = n;
+
+    if (neven) {
+        zz_size_t un = MIN(u->size, neven);
+
+        mpn_copyi(up, u->digits, un);
+        mpn_zero(up + un, neven - un);
+        /* Compute r2 = u**v mod BASE**neven */
+        if (up[0] % 2 == 0 && (v->size > 1 || v->digits[0] >= ctx->shift)) {
+            mpn_zero(r2, neven);
         }
-    }
-    if (r) {
-        if (!u->size) {
-            return zz_set_i32(0, r);
+        else if (v->size == 1 && v->digits[0] == 1) {
+            mpn_copyi(r2, up, neven);
         }
-
-        zz_size_t u_size = u->size;
-
-        if (zz_resize(1, r)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        else {
+            mpn_powlo(r2, up, v->digits, v->size, neven, tp);
         }
-        rl = mpn_mod_1(u->digits, u_size, uv);
-        if (!rl) {
-            (void)zz_set_i32(0, r);
+        if (n) {
+            /* r2 = r2 - r1 */
+            mpn_sub(r2, r2, neven, r1, MIN(n, neven));
+            /* x = (odd_inv_2exp * r2) mod BASE**neven */
+            mpn_mullo_n(xp, ctx->inv_2exp, r2, neven);
+            if (cnt) {
+                xp[neven - 1] &= ((zz_digit_t)1 << cnt) - 1;
+            }
+            if (neven > n) {
+                mpn_mul(yp, xp, neven, ctx->odd, n);
+            }
+            else {
+                mpn_mul(yp, ctx->odd, n, xp, neven);
+            }
+            /* r = r1 + x * odd */
+            mpn_add(yp, yp, mn, r1, n);
+            rp = yp;
+            len = mn;
         }
         else {
-            if (!same_signs) {
-                rl = uv - rl;
+            if (cnt) {
+                r2[neven - 1] &= ((zz_digit_t)1 << cnt) - 1;
             }
-            r->digits[0] = rl;
-            SETNEG(v < 0, r);
+            rp = r2;
+            len = neven;
         }
-        return ZZ_OK;
     }
-    return ZZ_OK;
+    return zz_mod_ctx_set(ctx, rp, len, w);
 }
 
-static int64_t
-fdiv_r(int64_t a, int64_t b)
+/* Set {ub, n} = u mod odd, u is nonnegative and has at most m->size
+   digits.  Uses m->size - n + 1 digits of scratch space at qp. */
+static void
+zz_mod_ctx_reduce(const zz_mod_ctx *ctx, const zz_t *u, zz_digit_t *ub,
+                  zz_digit_t *qp)
 {
-    return a/b - (a%b != 0 && (a^b) < 0);
+    zz_size_t n = ctx->odd_size;
+
+    if (u->size >= n) {
+        mpn_tdiv_qr(qp, ub, 0, u->digits, u->size, ctx->odd, n);
+    }
+    else {
+        mpn_copyi(ub, u->digits, u->size);
+        mpn_zero(ub + u->size, n - u->size);
+    }
 }
 
 zz_err
-zz_i64_div(int64_t u, const zz_t *v, zz_t *q, zz_t *r)
+zz_powm_ctx(const zz_t *u, const zz_t *v, zz_mod_ctx *ctx, zz_t *w)
 {
-    if (!v->size) {
+    const zz_t *m = &ctx->mod;
+
+    if (ISNEG(v)) {
         return ZZ_VAL;
     }
+    if (ISNEG(u) || u->size > m->size) {
+        zz_t tmp;
 
-    int64_t sv;
+        if (zz_init(&tmp) || zz_div(u, m, NULL, &tmp)) {
+            /* LCOV_EXCL_START */
+            zz_clear(&tmp);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
 
-    if (q) {
-        zz_err ret = ZZ_OK;
+        zz_err ret = zz_powm_ctx(&tmp, v, ctx, w);
 
-        if (zz_get_i64(v, &sv)) {
-            ret = zz_set_i64((u < 0) == ISNEG(v) || !u ? 0 : -1, q);
-        }
-        else {
-            ret = zz_set_i64(fdiv_r(u, sv), q);
-        }
-        if (ret || !r) {
-            return ret; /* LCOV_EXCL_LINE */
-        }
+        zz_clear(&tmp);
+        return ret;
     }
-    if (r) {
-        if (zz_get_i64(v, &sv)) {
-            if ((u < 0) == ISNEG(v) || !u) {
-                return zz_set_i64(u, r);
-            }
-            return zz_add_i64(v, u, r);
-        }
-        return zz_set_i64(u - fdiv_r(u, sv)*sv, r);
+    if (zz_cmp_i64(m, 1) == ZZ_EQ || (v->size && !u->size)) {
+        return zz_set_i64(0, w);
     }
-    return ZZ_OK;
-}
+    if (!v->size) {
+        zz_digit_t one = 1;
 
-zz_err
-zz_quo_2exp(const zz_t *u, zz_bitcnt_t shift, zz_t *v)
-{
-    if (!u->size) {
-        return zz_set_i32(0, v);
-    }
-    if (shift >= (zz_bitcnt_t)u->size*ZZ_DIGIT_T_BITS) {
-        return zz_set_i64(ISNEG(u) ? -1 : 0, v);
+        return zz_mod_ctx_set(ctx, &one, 1, w);
     }
 
-    zz_size_t whole = (zz_size_t)(shift / ZZ_DIGIT_T_BITS);
-    zz_size_t size = u->size - whole;
-    bool carry = false, extra = true;
+    zz_size_t mn = m->size, n = ctx->odd_size;
+    zz_size_t neven = (zz_size_t)((ctx->shift + ZZ_DIGIT_T_BITS - 1)
+                                  / ZZ_DIGIT_T_BITS);
+    zz_digit_t *r1 = ctx->scratch, *ub = r1 + n, *qp = ub + n;
+    zz_digit_t *tp = qp + mn + 1 + 4*neven + n;
 
-    shift %= ZZ_DIGIT_T_BITS;
-    for (mp_size_t i = 0; i < whole; i++) {
-        if (u->digits[i]) {
-            carry = ISNEG(u);
-            break;
-        }
-    }
-    for (mp_size_t i = whole; i < u->size; i++) {
-        if (u->digits[i] != ZZ_DIGIT_T_MAX) {
-            extra = 0;
-            break;
-        }
-    }
-    if (zz_resize(size + extra, v)) {
+    if (TMP_OVERFLOW) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    SETNEG(ISNEG(u), v);
-    if (shift) {
-        if (mpn_rshift(v->digits, u->digits + whole, size,
-                       (unsigned int)shift))
-        {
-            carry = ISNEG(u);
+    if (n) {
+        /* Compute r1 = u**v mod odd */
+        zz_mod_ctx_reduce(ctx, u, ub, qp);
+        if (v->size == 1 && v->digits[0] == 1) {
+            mpn_copyi(r1, ub, n);
         }
-    }
-    else {
-        mpn_copyi(v->digits, u->digits + whole, size);
-    }
-    if (extra) {
-        v->digits[size] = 0;
-    }
-    if (carry) {
-        if (mpn_add_1(v->digits, v->digits, size, 1)) {
-            v->digits[size] = 1;
+        else if (n < ZZ_MONT_POWM_THRESHOLD) {
+            mpn_powm(r1, ub, n, v->digits, v->size, ctx->odd, n, tp);
+        }
+        else {
+            zz_mont_powm(ctx, r1, ub, v->digits, v->size, tp);
         }
     }
-    zz_normalize(v);
-    return ZZ_OK;
+    return zz_powm_ctx_crt(u, v, ctx, w);
 }
 
-zz_err
-zz_mul_2exp(const zz_t *u, zz_bitcnt_t shift, zz_t *v)
+/* Set *rp to the remainder of u*v modulo the ctx->mod, u->size >= v->size,
+   and *len to its length.  The result is in the scratch of the ctx.  The
+   setjmp() is kept out of the caller, which changes locals later. */
+static zz_err
+zz_mulmod_ctx_mpn(const zz_t *u, const zz_t *v, zz_mod_ctx *ctx,
+                  zz_digit_t **rp, zz_size_t *len)
 {
-    if (!u->size) {
-        return zz_set_i32(0, v);
-    }
-    if (shift > ZZ_BITS_MAX) {
-        return ZZ_BUF;
-    }
-
-    zz_size_t whole = (zz_size_t)(shift / ZZ_DIGIT_T_BITS);
-    zz_size_t u_size = u->size;
-    int64_t v_size = (int64_t)u_size + whole;
+    zz_size_t mn = ctx->mod.size, pn = u->size + v->size;
+    zz_digit_t *pp = ctx->scratch, *qp = pp + 2*mn;
 
-    shift %= ZZ_DIGIT_T_BITS;
-    v_size += (bool)shift;
-    if (v_size > ZZ_DIGITS_MAX) {
-        return ZZ_BUF;
-    }
-    if (zz_resize((zz_size_t)v_size, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
-    }
-    SETNEG(ISNEG(u), v);
-    if (shift) {
-        v->size -= !(bool)(v->digits[v->size - 1]
-                           = mpn_lshift(v->digits + whole,
-                                        u->digits, u_size,
-                                        (unsigned int)shift));
+    if (TMP_OVERFLOW) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_mul(pp, u->digits, u->size, v->digits, v->size);
+    if (pn >= mn) {
+        *rp = qp + mn + 1;
+        *len = mn;
+        mpn_tdiv_qr(qp, *rp, 0, pp, pn, ctx->mod.digits, mn);
     }
     else {
-        mpn_copyd(v->digits + whole, u->digits, u_size);
+        *rp = pp;
+        *len = pn;
     }
-    mpn_zero(v->digits, whole);
     return ZZ_OK;
 }
 
 zz_err
-zz_invert(const zz_t *u, zz_t *v)
+zz_mulmod_ctx(const zz_t *u, const zz_t *v, zz_mod_ctx *ctx, zz_t *w)
 {
-    zz_size_t u_size = u->size;
+    const zz_t *m = &ctx->mod;
 
-    if (ISNEG(u)) {
-        if (zz_resize(u_size, v)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
+    if (u->size > m->size || v->size > m->size) {
+        zz_t tu, tv;
+
+        if (zz_init(&tu) || zz_init(&tv) || zz_div(u, m, NULL, &tu)
+            || zz_div(v, m, NULL, &tv))
+        {
+            /* LCOV_EXCL_START */
+            zz_clear(&tu);
+            zz_clear(&tv);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
         }
-        mpn_sub_1(v->digits, u->digits, u_size, 1);
-        v->size -= v->digits[u_size - 1] == 0;
+
+        zz_err ret = zz_mulmod_ctx(&tu, &tv, ctx, w);
+
+        zz_clear(&tu);
+        zz_clear(&tv);
+        return ret;
     }
-    else if (!u_size) {
-        return zz_set_i64(-1, v);
+    if (!u->size || !v->size) {
+        return zz_set_i64(0, w);
     }
-    else {
-        if (u_size == ZZ_DIGITS_MAX) {
-            return ZZ_BUF; /* LCOV_EXCL_LINE */
+
+    bool negative = ISNEG(u) != ISNEG(v);
+    zz_size_t mn = m->size, len;
+    zz_digit_t *rp;
+
+    if ((u->size < v->size ? zz_mulmod_ctx_mpn(v, u, ctx, &rp, &len)
+         : zz_mulmod_ctx_mpn(u, v, ctx, &rp, &len)))
+    {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (negative) {
+        while (len && !rp[len - 1]) {
+            len--;
         }
-        if (zz_resize(u_size + 1, v)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        if (len) {
+            /* r = m - r */
+            mpn_sub(rp, m->digits, mn, rp, len);
+            len = mn;
         }
-        v->digits[u_size] = mpn_add_1(v->digits, u->digits, u_size, 1);
-        v->size -= v->digits[u_size] == 0;
     }
-    SETNEG(!ISNEG(u), v);
-    return ZZ_OK;
+    return zz_mod_ctx_set(ctx, rp, len, w);
 }
 
 zz_err
-zz_and(const zz_t *u, const zz_t *v, zz_t *w)
+zz_redc(const zz_t *u, zz_mod_ctx *ctx, zz_t *w)
 {
-    if (!u->size || !v->size) {
+    zz_size_t n = ctx->odd_size;
+
+    if (ctx->shift || ISNEG(u)) {
+        return ZZ_VAL;
+    }
+    if (u->size > 2*MAX(n, 1)) {
+        return ZZ_VAL;
+    }
+    if (!n) {
         return zz_set_i64(0, w);
     }
 
-    zz_size_t u_size = u->size, v_size = v->size;
+    zz_digit_t *tp = ctx->scratch, *rp = tp + 2*n;
 
-    if (ISNEG(u) || ISNEG(v)) {
-        zz_t o1, o2;
-        zz_err ret = ZZ_MEM;
+    if (TMP_OVERFLOW) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_copyi(tp, u->digits, u->size);
+    mpn_zero(tp + u->size, 2*n - u->size);
+    zz_redc_digits(ctx, rp, tp);
+    if (mpn_cmp(rp, ctx->odd, n) >= 0) {
+        mpn_tdiv_qr(tp, rp, 0, rp, n, ctx->odd, n);
+    }
+    return zz_mod_ctx_set(ctx, rp, n, w);
+}
 
-        if (zz_init(&o1) || zz_init(&o2)) {
-            /* LCOV_EXCL_START */
-err:
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ret;
-            /* LCOV_EXCL_STOP */
-        }
-        if (ISNEG(u)) {
-            ret = zz_invert(u, &o1);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, &o1);
-            u = &o1;
-            u_size = u->size;
-        }
-        if (ISNEG(v)) {
-            ret = zz_invert(v, &o2);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, &o2);
-            v = &o2;
-            v_size = v->size;
-        }
-        if (u_size < v_size) {
-            SWAP(const zz_t *, u, v);
-            SWAP(zz_size_t, u_size, v_size);
-        }
-        if (ISNEG(u) && ISNEG(v)) {
-            if (!u_size) {
-                zz_clear(&o1);
-                zz_clear(&o2);
-                return zz_set_i64(-1, w);
-            }
-            if (u_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(u_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, w);
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            if (v_size) {
-                mpn_ior_n(w->digits, u->digits, v->digits, v_size);
-            }
-            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
-        }
-        else if (ISNEG(u)) {
-            assert(v_size > 0);
-            if (zz_resize(v_size, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(false, w);
-            mpn_andn_n(w->digits, v->digits, u->digits, v_size);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
-        }
-        else {
-            assert(u_size > 0);
-            if (zz_resize(u_size, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(false, w);
-            if (v_size) {
-                mpn_andn_n(w->digits, u->digits, v->digits, v_size);
-            }
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
-        }
+/* Largest number of teeth for zz_powm_table: the table has
+   2**teeth - 1 entries. */
+#define ZZ_POWM_COMB 8
+
+zz_err
+zz_powm_table_init(const zz_t *u, zz_bitcnt_t bits, zz_mod_ctx *ctx,
+                   zz_powm_table *tab)
+{
+    tab->ctx = ctx;
+    tab->bits = MAX(bits, 1);
+    tab->teeth = 0;
+    tab->table = NULL;
+    tab->alloc = 0;
+    if (zz_init(&tab->base) || zz_div(u, &ctx->mod, NULL, &tab->base)) {
+        /* LCOV_EXCL_START */
+        zz_clear(&tab->base);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
     }
-    if (u_size < v_size) {
-        SWAP(const zz_t *, u, v);
-        SWAP(zz_size_t, u_size, v_size);
+
+    zz_size_t n = ctx->odd_size;
+
+    if (!n) {
+        /* The modulus is a power of 2, nothing to precompute. */
+        return ZZ_OK;
     }
-    SETNEG(false, w);
-    for (zz_size_t i = v_size; --i >= 0;) {
-        if (u->digits[i] & v->digits[i]) {
-            v_size = i + 1;
-            if (zz_resize(v_size, w)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
-            mpn_and_n(w->digits, u->digits, v->digits, v_size);
-            zz_normalize(w);
-            return ZZ_OK;
+
+    zz_bitcnt_t h = 1;
+
+    while (h < ZZ_POWM_COMB && ((zz_bitcnt_t)1 << (h + 3)) <= tab->bits) {
+        h++;
+    }
+
+    zz_bitcnt_t a = (tab->bits + h - 1)/h;
+    zz_size_t entries = ((zz_size_t)1 << h) - 1;
+
+    tab->alloc = (size_t)(entries*n) * ZZ_DIGIT_T_BYTES;
+    tab->table = zz_mem_malloc(tab->alloc);
+    if (!tab->table) {
+        /* LCOV_EXCL_START */
+        zz_clear(&tab->base);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    tab->teeth = h;
+    if (TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+        zz_powm_table_clear(tab);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+
+    zz_digit_t *ub = ctx->scratch, *qp = ub + n;
+    zz_digit_t *pp = qp + ctx->mod.size + 1;
+
+    /* The entry j is the product of u**(2**(t*a)) * R mod odd for all bits
+       t of j, stored at table + (j - 1)*n. */
+    zz_mod_ctx_reduce(ctx, &tab->base, ub, qp);
+    zz_mont_in(ctx, tab->table, ub, pp);
+    for (zz_bitcnt_t t = 1; t < h; t++) {
+        zz_digit_t *gp = tab->table + (((zz_size_t)1 << t) - 1)*n;
+
+        mpn_copyi(gp, tab->table + (((zz_size_t)1 << (t - 1)) - 1)*n, n);
+        for (zz_bitcnt_t j = 0; j < a; j++) {
+            zz_mul_n(pp, gp, gp, n);
+            zz_redc_digits(ctx, gp, pp);
+        }
+    }
+    for (zz_size_t j = 3; j <= entries; j++) {
+        zz_size_t low = j & -j;
+
+        if (low != j) {
+            zz_mul_n(pp, tab->table + (j - low - 1)*n,
+                     tab->table + (low - 1)*n, n);
+            zz_redc_digits(ctx, tab->table + (j - 1)*n, pp);
         }
     }
-    w->size = 0;
     return ZZ_OK;
 }
 
+void
+zz_powm_table_clear(zz_powm_table *tab)
+{
+    zz_mem_free(tab->table, tab->alloc);
+    tab->table = NULL;
+    zz_clear(&tab->base);
+}
+
 zz_err
-zz_or(const zz_t *u, const zz_t *v, zz_t *w)
+zz_powm_fixed(const zz_t *v, zz_powm_table *tab, zz_t *w)
 {
-    if (!u->size) {
-        return zz_pos(v, w);
+    zz_mod_ctx *ctx = tab->ctx;
+    zz_bitcnt_t h = tab->teeth, a = (tab->bits + h - 1)/MAX(h, 1);
+
+    if (ISNEG(v)) {
+        return ZZ_VAL;
     }
-    if (!v->size) {
-        return zz_pos(u, w);
+    if (!tab->table || !v->size || !tab->base.size || zz_bitlen(v) > a*h) {
+        return zz_powm_ctx(&tab->base, v, ctx, w);
     }
 
-    zz_size_t u_size = u->size, v_size = v->size;
+    zz_size_t n = ctx->odd_size;
+    zz_digit_t *xp = ctx->scratch;
+    zz_digit_t *pp = xp + 3*n + ctx->mod.size + 1;
+    bool first = true;
 
-    if (ISNEG(u) || ISNEG(v)) {
-        zz_t o1, o2;
-        zz_err ret = ZZ_MEM;
+    if (TMP_OVERFLOW) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    for (zz_bitcnt_t i = a; i-- > 0;) {
+        zz_size_t j = 0;
 
-        if (zz_init(&o1) || zz_init(&o2)) {
-            /* LCOV_EXCL_START */
-err:
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ret;
-            /* LCOV_EXCL_STOP */
-        }
-        if (ISNEG(u)) {
-            ret = zz_invert(u, &o1);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, &o1);
-            u = &o1;
-            u_size = u->size;
+        if (!first) {
+            zz_mul_n(pp, xp, xp, n);
+            zz_redc_digits(ctx, xp, pp);
         }
-        if (ISNEG(v)) {
-            ret = zz_invert(v, &o2);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, &o2);
-            v = &o2;
-            v_size = v->size;
-        }
-        if (u_size < v_size) {
-            SWAP(const zz_t *, u, v);
-            SWAP(zz_size_t, u_size, v_size);
+        for (zz_bitcnt_t t = 0; t < h; t++) {
+            j |= (zz_size_t)zz_getbits(v->digits, v->size, t*a + i, 1) << t;
         }
-        if (ISNEG(u) && ISNEG(v)) {
-            if (!v_size) {
-                zz_clear(&o1);
-                zz_clear(&o2);
-                return zz_set_i64(-1, w);
-            }
-            if (v_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(v_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, w);
-            mpn_and_n(w->digits, u->digits, v->digits, v_size);
-            w->digits[v_size] = mpn_add_1(w->digits, w->digits, v_size, 1);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+        if (!j) {
+            continue;
         }
-        else if (ISNEG(u)) {
-            assert(v_size > 0);
-            if (u_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(u_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, w);
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            mpn_andn_n(w->digits, u->digits, v->digits, v_size);
-            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+        if (first) {
+            mpn_copyi(xp, tab->table + (j - 1)*n, n);
+            first = false;
         }
         else {
-            assert(u_size > 0);
-            if (v_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(v_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, w);
-            if (v_size) {
-                mpn_andn_n(w->digits, v->digits, u->digits, v_size);
-                w->digits[v_size] = mpn_add_1(w->digits, w->digits, v_size, 1);
-                zz_normalize(w);
-            }
-            else {
-                w->digits[0] = 1;
-            }
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+            zz_mul_n(pp, xp, tab->table + (j - 1)*n, n);
+            zz_redc_digits(ctx, xp, pp);
         }
     }
-    if (u_size < v_size) {
-        SWAP(const zz_t *, u, v);
-        SWAP(zz_size_t, u_size, v_size);
-    }
-    if (zz_resize(u_size, w)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
-    }
-    SETNEG(false, w);
-    mpn_ior_n(w->digits, u->digits, v->digits, v_size);
-    if (u_size != v_size) {
-        mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-    }
-    return ZZ_OK;
+    zz_mont_out(ctx, xp, xp, pp);
+    return zz_powm_ctx_crt(&tab->base, v, ctx, w);
 }
 
+/* Largest window size for zz_powm_multi(). */
+#define ZZ_POWM_MULTI_WINDOW 5
+
 zz_err
-zz_xor(const zz_t *u, const zz_t *v, zz_t *w)
+zz_powm_multi(size_t n, const zz_t *u, const zz_t *v, zz_mod_ctx *ctx,
+              zz_t *w)
 {
-    if (!u->size) {
-        return zz_pos(v, w);
+    const zz_t *m = &ctx->mod;
+    zz_bitcnt_t bits = 0;
+    bool reduce = false;
+
+    for (size_t i = 0; i < n; i++) {
+        if (ISNEG(&v[i])) {
+            return ZZ_VAL;
+        }
+        if (ISNEG(&u[i]) || u[i].size > m->size) {
+            reduce = true;
+        }
+        bits = MAX(bits, zz_bitlen(&v[i]));
     }
-    if (!v->size) {
-        return zz_pos(u, w);
+    if (reduce) {
+        size_t t_size = n * sizeof(zz_t);
+        zz_t *t = zz_mem_malloc(t_size);
+        zz_err ret = ZZ_MEM;
+        size_t i = 0;
+
+        if (!t) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        for (; i < n; i++) {
+            if (zz_init(&t[i]) || zz_div(&u[i], m, NULL, &t[i])) {
+                i++; /* LCOV_EXCL_LINE */
+                goto clear; /* LCOV_EXCL_LINE */
+            }
+        }
+        ret = zz_powm_multi(n, t, v, ctx, w);
+clear:
+        while (i--) {
+            zz_clear(&t[i]);
+        }
+        zz_mem_free(t, t_size);
+        return ret;
     }
 
-    zz_size_t u_size = u->size, v_size = v->size;
+    zz_size_t on = ctx->odd_size;
 
-    if (ISNEG(u) || ISNEG(v)) {
-        zz_t o1, o2;
-        zz_err ret = ZZ_MEM;
+    if (ctx->shift || !on || !bits) {
+        /* Multiply separate powers. */
+        zz_t r, t;
+        zz_err ret;
 
-        if (zz_init(&o1) || zz_init(&o2)) {
+        if (zz_init(&r) || zz_init(&t)) {
             /* LCOV_EXCL_START */
-err:
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ret;
+            zz_clear(&r);
+            return ZZ_MEM;
             /* LCOV_EXCL_STOP */
-        }
-        if (ISNEG(u)) {
-            ret = zz_invert(u, &o1);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, &o1);
-            u = &o1;
-            u_size = u->size;
-        }
-        if (ISNEG(v)) {
-            ret = zz_invert(v, &o2);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
+        }
+        /* r = 0**0 mod m */
+        ret = zz_powm_ctx(&t, &t, ctx, &r);
+        for (size_t i = 0; !ret && i < n; i++) {
+            if ((ret = zz_powm_ctx(&u[i], &v[i], ctx, &t)) == ZZ_OK) {
+                ret = zz_mulmod_ctx(&r, &t, ctx, &r);
             }
-            SETNEG(true, &o2);
-            v = &o2;
-            v_size = v->size;
         }
-        if (u_size < v_size) {
-            SWAP(const zz_t *, u, v);
-            SWAP(zz_size_t, u_size, v_size);
+        if (!ret) {
+            zz_swap(&r, w);
         }
-        if (ISNEG(u) && ISNEG(v)) {
-            if (!u_size) {
-                zz_clear(&o1);
-                zz_clear(&o2);
-                return zz_set_i64(0, w);
-            }
-            if (zz_resize(u_size, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(false, w);
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            if (v_size) {
-                mpn_xor_n(w->digits, u->digits, v->digits, v_size);
-            }
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+        zz_clear(&r);
+        zz_clear(&t);
+        return ret;
+    }
+
+    /* Straus' algorithm: the table has powers u[i]**j (in Montgomery form)
+       for 0 < j < 2**k, they are used for windows of k bits for all
+       exponents, while squarings are shared. */
+    static const zz_bitcnt_t thresholds[ZZ_POWM_MULTI_WINDOW - 1] = {16, 64,
+                                                                      256,
+                                                                      1024};
+    zz_bitcnt_t k = 1;
+
+    while (k < ZZ_POWM_MULTI_WINDOW && bits > thresholds[k - 1]) {
+        k++;
+    }
+
+    /* Number of windows of k bits. */
+    const zz_bitcnt_t windows = (bits + k - 1)/k;
+    zz_size_t entries = ((zz_size_t)1 << k) - 1;
+    size_t tab_size = n * (size_t)(entries*on) * ZZ_DIGIT_T_BYTES;
+    zz_digit_t *volatile tab = zz_mem_malloc(tab_size);
+
+    if (!tab || TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+        zz_mem_free(tab, tab_size);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+
+    zz_digit_t *xp = ctx->scratch, *ub = xp + on, *qp = ub + on;
+    zz_digit_t *pp = qp + m->size + 1;
+
+    for (size_t i = 0; i < n; i++) {
+        zz_digit_t *tp = tab + i*(size_t)(entries*on);
+
+        zz_mod_ctx_reduce(ctx, &u[i], ub, qp);
+        zz_mont_in(ctx, tp, ub, pp);
+        for (zz_size_t j = 1; j < entries; j++) {
+            zz_mul_n(pp, tp + (j - 1)*on, tp, on);
+            zz_redc_digits(ctx, tp + j*on, pp);
         }
-        else if (ISNEG(u)) {
-            assert(v_size > 0);
-            if (u_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(u_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, w);
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            mpn_xor_n(w->digits, v->digits, u->digits, v_size);
-            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+    }
+
+    bool first = true;
+
+    for (zz_bitcnt_t i = windows; i-- > 0;) {
+        for (zz_bitcnt_t j = 0; !first && j < k; j++) {
+            zz_mul_n(pp, xp, xp, on);
+            zz_redc_digits(ctx, xp, pp);
         }
-        else {
-            assert(u_size > 0);
-            if (u_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
+        for (size_t l = 0; l < n; l++) {
+            zz_size_t d = (zz_size_t)zz_getbits(v[l].digits, v[l].size,
+                                                i*k, k);
+
+            if (!d) {
+                continue;
             }
-            if (zz_resize(u_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
+
+            zz_digit_t *tp = tab + l*(size_t)(entries*on) + (d - 1)*on;
+
+            if (first) {
+                mpn_copyi(xp, tp, on);
+                first = false;
             }
-            SETNEG(true, w);
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            if (v_size) {
-                mpn_xor_n(w->digits, u->digits, v->digits, v_size);
+            else {
+                zz_mul_n(pp, xp, tp, on);
+                zz_redc_digits(ctx, xp, pp);
             }
-            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
         }
     }
-    if (u_size < v_size) {
-        SWAP(const zz_t *, u, v);
-        SWAP(zz_size_t, u_size, v_size);
-    }
-    if (zz_resize(u_size, w)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
-    }
-    SETNEG(false, w);
-    mpn_xor_n(w->digits, u->digits, v->digits, v_size);
-    if (u_size != v_size) {
-        mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-    }
-    else {
-        zz_normalize(w);
+    zz_mont_out(ctx, xp, xp, pp);
+    zz_mem_free(tab, tab_size);
+    return zz_mod_ctx_set(ctx, xp, on, w);
+}
+
+/* Make sure, that the context has at least itch digits of scratch space
+   for side-channel silent functions.  This depends only on sizes of
+   operands, the space is kept between calls. */
+static zz_err
+zz_mod_ctx_sec_reserve(zz_mod_ctx *ctx, zz_size_t itch)
+{
+    size_t size = (size_t)itch * ZZ_DIGIT_T_BYTES;
+
+    if (size > ctx->sec_alloc) {
+        zz_digit_t *tp = zz_mem_realloc(ctx->sec_scratch, ctx->sec_alloc,
+                                        size);
+
+        if (!tp) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        ctx->sec_scratch = tp;
+        ctx->sec_alloc = size;
     }
     return ZZ_OK;
 }
 
 zz_err
-zz_pow(const zz_t *u, uint64_t v, zz_t *w)
+zz_powm_sec(const zz_t *u, const zz_t *v, zz_mod_ctx *ctx, zz_t *w)
 {
-    if (u == w) {
+    const zz_t *m = &ctx->mod;
+
+    if (ctx->shift || ISNEG(v)) {
+        return ZZ_VAL;
+    }
+    if (ISNEG(u) || u->size > m->size) {
         zz_t tmp;
 
-        if (zz_init(&tmp) || zz_pos(u, &tmp)) {
+        if (zz_init(&tmp) || zz_div(u, m, NULL, &tmp)) {
             /* LCOV_EXCL_START */
             zz_clear(&tmp);
             return ZZ_MEM;
             /* LCOV_EXCL_STOP */
         }
 
-        zz_err ret = zz_pow(&tmp, v, w);
+        zz_err ret = zz_powm_sec(&tmp, v, ctx, w);
 
         zz_clear(&tmp);
         return ret;
     }
-    if (!v) {
-        return zz_set_i64(1, w);
-    }
-    if (!u->size) {
+    if (!ctx->odd_size) {
         return zz_set_i64(0, w);
     }
-    if (zz_cmp_i64(u, 1) == ZZ_EQ) {
-        return zz_set_i64(1, w);
-    }
-    if (v > ZZ_DIGITS_MAX / u->size) {
-        return ZZ_BUF;
+    if (!v->size) {
+        zz_digit_t one = 1;
+
+        return zz_mod_ctx_set(ctx, &one, 1, w);
     }
 
-    zz_size_t w_size = (zz_size_t)(v * (zz_digit_t)u->size);
-    zz_digit_t *tmp = malloc((size_t)w_size * ZZ_DIGIT_T_BYTES);
+    /* Only sizes of operands are used to select the exponent length and
+       the scratch space, the base is padded to the size of
+       the modulus. */
+    zz_size_t n = m->size;
+    zz_bitcnt_t enb = (zz_bitcnt_t)v->size * ZZ_DIGIT_T_BITS;
 
-    if (!tmp || zz_resize(w_size, w)) {
-        /* LCOV_EXCL_START */
-        free(tmp);
-        zz_clear(w);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
-    }
-    SETNEG(ISNEG(u) && v%2, w);
-    w->size = (zz_size_t)mpn_pow_1(w->digits, u->digits, u->size, v, tmp);
-    free(tmp);
-    if (zz_resize(w->size, w)) {
-        /* LCOV_EXCL_START */
-        zz_clear(w);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+    if (zz_mod_ctx_sec_reserve(ctx, 2*n + mpn_sec_powm_itch(n, enb, n))) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    return ZZ_OK;
+
+    zz_digit_t *bp = ctx->sec_scratch, *rp = bp + n, *tp = rp + n;
+
+    mpn_copyi(bp, u->digits, u->size);
+    mpn_zero(bp + u->size, n - u->size);
+    mpn_sec_powm(rp, bp, n, v->digits, enb, m->digits, n, tp);
+    return zz_mod_ctx_set(ctx, rp, n, w);
 }
 
-static zz_err
-zz_gcd(const zz_t *u, const zz_t *v, zz_t *w)
+zz_err
+zz_inverse_sec(const zz_t *u, zz_mod_ctx *ctx, zz_t *w)
 {
-    if (u->size < v->size) {
-        SWAP(const zz_t *, u, v);
-    }
-    if (!v->size) {
-        return zz_abs(u, w);
+    const zz_t *m = &ctx->mod;
+
+    if (ctx->shift) {
+        return ZZ_VAL;
     }
+    if (ISNEG(u) || u->size > m->size) {
+        zz_t tmp;
 
-    zz_bitcnt_t shift = MIN(zz_lsbpos(u), zz_lsbpos(v));
-    zz_t *volatile o1 = malloc(sizeof(zz_t));
-    zz_t *volatile o2 = malloc(sizeof(zz_t));
+        if (zz_init(&tmp) || zz_div(u, m, NULL, &tmp)) {
+            /* LCOV_EXCL_START */
+            zz_clear(&tmp);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
 
-    if (!o1 || !o2) {
-        goto free; /* LCOV_EXCL_LINE */
-    }
-    if (zz_init(o1) || zz_init(o2) || zz_abs(u, o1) || zz_abs(v, o2)) {
-        goto clear; /* LCOV_EXCL_LINE */
-    }
-    if (shift && (zz_quo_2exp(o1, shift, o1) || zz_quo_2exp(o2, shift, o2))) {
-        goto clear; /* LCOV_EXCL_LINE */
-    }
-    u = o1;
-    v = o2;
-    assert(v->size);
-    if (zz_resize(v->size, w) || TMP_OVERFLOW) {
-        goto clear; /* LCOV_EXCL_LINE */
+        zz_err ret = zz_inverse_sec(&tmp, ctx, w);
+
+        zz_clear(&tmp);
+        return ret;
     }
-    if (v->size == 1) {
-        w->digits[0] = mpn_gcd_1(u->digits, u->size, v->digits[0]);
+    if (!ctx->odd_size) {
+        return zz_set_i64(0, w);
     }
-    else {
-        w->size = (zz_size_t)mpn_gcd(w->digits, u->digits, u->size, v->digits,
-                                     v->size);
+
+    zz_size_t n = m->size;
+
+    if (zz_mod_ctx_sec_reserve(ctx, 2*n + mpn_sec_invert_itch(n))) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    SETNEG(false, w);
-    zz_clear(o1);
-    zz_clear(o2);
-    free(o1);
-    free(o2);
-    return zz_mul_2exp(w, shift, w);
-    /* LCOV_EXCL_START */
-clear:
-    zz_clear(o1);
-    zz_clear(o2);
-free:
-    free(o1);
-    free(o2);
-    return ZZ_MEM;
-    /* LCOV_EXCL_STOP */
-}
 
-zz_err
-zz_inverse_euclidext(const zz_t *u, const zz_t *v, zz_t *t)
-{
-    zz_t r, newt, newr, q, t1, t2;
-    bool u_neg = ISNEG(u);
+    zz_digit_t *ap = ctx->sec_scratch, *rp = ap + n, *tp = rp + n;
 
-    if (zz_init(&r) || zz_init(&newt) || zz_init(&newr)
-        || zz_init(&q) || zz_init(&t1) || zz_init(&t2)
-        || zz_pos(v, &r) || zz_set_i32(1, &newt)
-        || zz_pos(u, &newr) || zz_set_i32(0, t))
+    mpn_copyi(ap, u->digits, u->size);
+    mpn_zero(ap + u->size, n - u->size);
+    if (!mpn_sec_invert(rp, ap, m->digits, n,
+                        2*(zz_bitcnt_t)n*ZZ_DIGIT_T_BITS, tp))
     {
-        /* LCOV_EXCL_START */
-clear2:
-        zz_clear(&r);
-        zz_clear(&newt);
-        zz_clear(&newr);
-        zz_clear(&q);
-        zz_clear(&t1);
-        zz_clear(&t2);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
-    }
-    while (zz_cmp_i64(&newr, 0) != ZZ_EQ) {
-        if (zz_div(&r, &newr, &q, NULL)) {
-            goto clear2; /* LCOV_EXCL_LINE */
-        }
-        if (zz_pos(&newt, &t1) || zz_mul(&q, &newt, &t2)
-            || zz_sub(t, &t2, &newt) || zz_pos(&t1, t))
-        {
-            goto clear2; /* LCOV_EXCL_LINE */
-        }
-        if (zz_pos(&newr, &t1) || zz_mul(&q, &newr, &t2)
-            || zz_sub(&r, &t2, &newr) || zz_pos(&t1, &r))
-        {
-            goto clear2; /* LCOV_EXCL_LINE */
-        }
-    }
-    zz_clear(&newt);
-    zz_clear(&newr);
-    zz_clear(&q);
-    zz_clear(&t1);
-    zz_clear(&t2);
-    if (t->size) {
-        SETNEG(ISNEG(t) != u_neg, t);
-    }
-    (void)zz_abs(&r, &r);
-    if (zz_cmp_i64(&r, 1) != ZZ_EQ) {
-        zz_clear(&r);
         return ZZ_VAL;
     }
-    zz_clear(&r);
-    return ZZ_OK;
+    return zz_mod_ctx_set(ctx, rp, n, w);
 }
 
 zz_err
-zz_gcdext(const zz_t *u, const zz_t *v, zz_t *g, zz_t *s, zz_t *t)
+zz_inverse_batch(size_t n, const zz_t *u, zz_mod_ctx *ctx, zz_t *w)
 {
-    if (!s && !t) {
-        if (!g) {
-            return ZZ_OK;
-        }
-        return zz_gcd(u, v, g);
-    }
-    if (u->size < v->size) {
-        SWAP(const zz_t *, u, v);
-        SWAP(zz_t *, s, t);
+    if (!n) {
+        return ZZ_OK;
     }
-    if (!v->size) {
-        if (g) {
-            if (zz_abs(u, g)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
+    if (u == w) {
+        /* Prefix products are kept in w, save the input. */
+        size_t t_size = n * sizeof(zz_t);
+        zz_t *t = zz_mem_malloc(t_size);
+        zz_err ret = ZZ_MEM;
+        size_t i = 0;
+
+        if (!t) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
-        if (s) {
-            if (zz_set_i64(ISNEG(u) ? -1 : 1, s)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
+        for (; i < n; i++) {
+            if (zz_init(&t[i]) || zz_pos(&u[i], &t[i])) {
+                i++; /* LCOV_EXCL_LINE */
+                goto clear; /* LCOV_EXCL_LINE */
             }
-            s->size = u->size > 0; /* make 0 if u == 0 */
         }
-        if (t) {
-            t->size = 0;
-            SETNEG(false, t);
+        ret = zz_inverse_batch(n, t, ctx, w);
+clear:
+        while (i--) {
+            zz_clear(&t[i]);
         }
-        return ZZ_OK;
+        zz_mem_free(t, t_size);
+        return ret;
     }
 
-    zz_t *volatile o1 = malloc(sizeof(zz_t));
-    zz_t *volatile o2 = malloc(sizeof(zz_t));
-    zz_t *volatile tmp_g = malloc(sizeof(zz_t));
-    zz_t *volatile tmp_s = malloc(sizeof(zz_t));
-    /* v->size + 1 can be > ZZ_DIGITS_MAX, but it should
-       not overflow zz_size_t type */
-    zz_digit_t *volatile tmp_s_digits = malloc(ZZ_DIGIT_T_BYTES
-                                               * (size_t)(v->size + 1));
+    /* Montgomery's trick: one inversion of the product of all elements
+       and 3*(n - 1) multiplications. */
+    zz_t inv;
+    zz_err ret = ZZ_MEM;
 
-    if (!o1 || !o2 || !tmp_g || !tmp_s || !tmp_s_digits) {
-        goto free; /* LCOV_EXCL_LINE */
+    if (zz_init(&inv) || zz_div(&u[0], &ctx->mod, NULL, &w[0])) {
+        goto end; /* LCOV_EXCL_LINE */
+    }
+    for (size_t i = 1; i < n; i++) {
+        if (zz_mulmod_ctx(&w[i - 1], &u[i], ctx, &w[i])) {
+            goto end; /* LCOV_EXCL_LINE */
+        }
     }
-    if (zz_init(o1) || zz_init(o2)
-        || zz_init(tmp_g) || zz_init(tmp_s)
-        || zz_pos(u, o1) || zz_pos(v, o2)
-        || zz_resize(v->size, tmp_g)
-        || TMP_OVERFLOW)
+    if ((ret = zz_inverse(&w[n - 1], &ctx->mod, &inv))) {
+        goto end;
+    }
+    ret = ZZ_MEM;
+    for (size_t i = n - 1; i > 0; i--) {
+        if (zz_mulmod_ctx(&inv, &w[i - 1], ctx, &w[i])
+            || zz_mulmod_ctx(&inv, &u[i], ctx, &inv))
+        {
+            goto end; /* LCOV_EXCL_LINE */
+        }
+    }
+    /* Only the result of zz_inverse() (for n == 1) is nonnegative. */
+    if (ctx->negative && inv.size && !ISNEG(&inv)
+        && zz_sub(&inv, &ctx->mod, &inv))
     {
-        goto clear; /* LCOV_EXCL_LINE */
+        goto end; /* LCOV_EXCL_LINE */
     }
+    zz_swap(&inv, &w[0]);
+    ret = ZZ_OK;
+end:
+    zz_clear(&inv);
+    return ret;
+}
 
-    mp_size_t ssize;
-
-    tmp_g->size = (zz_size_t)mpn_gcdext(tmp_g->digits, tmp_s_digits, &ssize,
-                                        o1->digits, u->size, o2->digits,
-                                        v->size);
-    SETNEG(false, tmp_g);
-    /* Now s either 1 or |s| < v/(2g) */
-    if (zz_resize(labs(ssize), tmp_s)) {
-        goto clear; /* LCOV_EXCL_LINE */
-    }
-    mpn_copyi(tmp_s->digits, tmp_s_digits, tmp_s->size);
-    SETNEG((ISNEG(u) && ssize > 0) || (!ISNEG(u) && ssize < 0), tmp_s);
-    free(tmp_s_digits);
-    tmp_s_digits = NULL;
-    if (t) {
-        /* Use t = (g - u*s)/v, if no integer overflow is possible,
-           else compute t by Extended Euclidean algorithm */
-        if (MAX(u->size + tmp_s->size, tmp_g->size) < ZZ_DIGITS_MAX) {
-            if (zz_mul(u, tmp_s, o2) || zz_sub(tmp_g, o2, o2)
-                || zz_div(o2, v, t, NULL))
-            {
-                goto clear; /* LCOV_EXCL_LINE */
-            }
+zz_err
+zz_sqrtrem(const zz_t *u, zz_t *v, zz_t *w)
+{
+    if (ISNEG(u)) {
+        return ZZ_VAL;
+    }
+    SETNEG(false, v);
+    if (!u->size) {
+        ZZ_STAT_CALL(ZZ_OP_SQRTREM, 0);
+        v->size = 0;
+        if (w) {
+            w->size = 0;
+            SETNEG(false, w);
         }
-        else {
+        return ZZ_OK;
+    }
+    if (u == v) {
+        zz_t tmp;
+
+        if (zz_init(&tmp) || zz_pos(v, &tmp)) {
             /* LCOV_EXCL_START */
-            if (zz_div(u, tmp_g, o1, NULL) || zz_div(v, tmp_g, o2, NULL)
-                || zz_inverse_euclidext(o2, o1, t))
-            {
-                goto clear;
-            }
+            zz_clear(&tmp);
+            return ZZ_MEM;
             /* LCOV_EXCL_STOP */
         }
+
+        zz_err ret = zz_sqrtrem(&tmp, v, w);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+    ZZ_STAT_CALL(ZZ_OP_SQRTREM, u->size);
+    if (zz_resize((u->size + 1)/2, v) || TMP_OVERFLOW) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    zz_clear(o1);
-    zz_clear(o2);
-    free(o1);
-    free(o2);
-    o1 = NULL;
-    o2 = NULL;
-    if (s && zz_pos(tmp_s, s)) {
-        goto clear; /* LCOV_EXCL_LINE */
+    if (w) {
+        SETNEG(false, w);
+        if (zz_resize(u->size, w)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        w->size = (zz_size_t)mpn_sqrtrem(v->digits, w->digits, u->digits,
+                                         u->size);
     }
-    if (g && zz_pos(tmp_g, g)) {
-        goto clear; /* LCOV_EXCL_LINE */
+    else {
+        mpn_sqrtrem(v->digits, NULL, u->digits, u->size);
     }
-    zz_clear(tmp_s);
-    zz_clear(tmp_g);
-    free(tmp_g);
-    free(tmp_s);
     return ZZ_OK;
-    /* LCOV_EXCL_START */
-clear:
-    zz_clear(o1);
-    zz_clear(o2);
-    zz_clear(tmp_g);
-    zz_clear(tmp_s);
-free:
-    free(o1);
-    free(o2);
-    free(tmp_g);
-    free(tmp_s);
-    free(tmp_s_digits);
-    return ZZ_MEM;
-    /* LCOV_EXCL_STOP */
 }
 
+/* Return false, if the u > 0 is not a square by residues modulo 64 (of
+   the lowest digit) and modulo 63, 65, 17 and 97.  These moduli divide
+   2**48 - 1, so residues are taken from the mpn_mod_34lsub1() value, at
+   cost of one fast pass over digits.  About 0.4% of non-squares pass. */
+static bool
+zz_square_filter(const zz_t *u)
+{
+    /* Bits of quadratic residues. */
+    static const uint64_t qr64 = 0x0202021202030213, qr63 = 0x0402483012450293;
+    static const uint64_t qr17 = 0x000000000001a317;
+    static const uint64_t qr65[2] = {0x218a019866014613, 0x1};
+    static const uint64_t qr97[2] = {0x6067981b8b451b5f, 0x00000001eb628b47};
+
+    if (!((qr64 >> (u->digits[0] % 64)) & 1)) {
+        return false;
+    }
+
+    uint64_t r = mpn_mod_34lsub1(u->digits, u->size);
+
+    return (((qr63 >> (r % 63)) & 1) && ((qr17 >> (r % 17)) & 1)
+            && ((qr65[r % 65 / 64] >> (r % 65 % 64)) & 1)
+            && ((qr97[r % 97 / 64] >> (r % 97 % 64)) & 1));
+}
+
+/* Test the u > 0 by computing the square root. */
 static zz_err
-zz_inverse(const zz_t *u, const zz_t *v, zz_t *w)
+zz_square_test(const zz_t *u, bool *res)
 {
-    zz_t g;
+    size_t sp_size = (size_t)(u->size + 1)/2 * ZZ_DIGIT_T_BYTES;
+    zz_digit_t *volatile sp = zz_tmp_malloc(sp_size);
 
-    if (zz_init(&g) || zz_gcdext(u, v, &g, w, NULL)) {
-        /* LCOV_EXCL_START */
-        zz_clear(&g);
+    if (!sp || TMP_OVERFLOW) {
+        zz_tmp_free(sp, sp_size);
         return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
     }
-    if (zz_cmp_i64(&g, 1) == ZZ_EQ) {
-        zz_clear(&g);
+    *res = !mpn_sqrtrem(sp, NULL, u->digits, u->size);
+    zz_tmp_free(sp, sp_size);
+    return ZZ_OK;
+}
+
+zz_err
+zz_is_square(const zz_t *u, bool *res)
+{
+    if (ISNEG(u) || !u->size) {
+        *res = !u->size;
         return ZZ_OK;
     }
-    zz_clear(&g);
-    return ZZ_VAL;
+    if (!zz_square_filter(u)) {
+        *res = false;
+        return ZZ_OK;
+    }
+    return zz_square_test(u, res);
 }
 
 zz_err
-zz_lcm(const zz_t *u, const zz_t *v, zz_t *w)
+zz_rootrem(const zz_t *u, uint64_t k, zz_t *v, zz_t *w)
 {
-    zz_t g;
-    zz_err ret = ZZ_MEM;
+    if (!k || (ISNEG(u) && k % 2 == 0)) {
+        return ZZ_VAL;
+    }
+    if (k == 2) {
+        return zz_sqrtrem(u, v, w);
+    }
+    if (u == v || u == w) {
+        zz_t tmp;
 
-    if (zz_init(&g) || zz_gcd(u, v, &g)) {
-        goto end; /* LCOV_EXCL_LINE */
+        if (zz_init(&tmp) || zz_pos(u, &tmp)) {
+            /* LCOV_EXCL_START */
+            zz_clear(&tmp);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+
+        zz_err ret = zz_rootrem(&tmp, k, v, w);
+
+        zz_clear(&tmp);
+        return ret;
     }
-    if (zz_iszero(&g)) {
-        zz_clear(&g);
-        return zz_set_i64(0, w);
+    if (k == 1 || !u->size) {
+        if (w) {
+            w->size = 0;
+            SETNEG(false, w);
+        }
+        return zz_pos(u, v);
     }
-    if (zz_div(u, &g, &g, NULL)) {
-        goto end; /* LCOV_EXCL_LINE */
+    if (zz_resize((zz_size_t)((uint64_t)(u->size - 1)/k) + 1, v)
+        || (w && zz_resize(u->size, w)) || TMP_OVERFLOW)
+    {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    ret = zz_mul(&g, v, w);
-end:
-    zz_clear(&g);
-    (void)zz_abs(w, w);
-    return ret;
+
+    mp_size_t rn = mpn_rootrem(v->digits, w ? w->digits : NULL, u->digits,
+                               u->size, k);
+
+    zz_normalize(v);
+    SETNEG(ISNEG(u), v);
+    if (w) {
+        w->size = (zz_size_t)rn;
+        SETNEG(ISNEG(u) && rn, w);
+    }
+    return ZZ_OK;
 }
 
-static zz_err
-_zz_powm(const zz_t *u, const zz_t *v, const zz_t *w, zz_t *res)
+zz_err
+zz_is_perfect_power(const zz_t *u, bool *res)
 {
-    if (zz_resize(w->size, res)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    /* 0, 1 and -1 are powers.  Else the exponent must divide the
+       multiplicity of 2, so it can't be one. */
+    if (u->size <= 1 && (!u->size || u->digits[0] == 1)) {
+        *res = true;
+        return ZZ_OK;
     }
-    SETNEG(false, res);
-    /* Handle (u**1 mod w) early, since mpn_pow* can't */
-    if (zz_cmp_i64(v, 1) == ZZ_EQ) {
-        if (zz_div(u, w, NULL, res)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
-        }
+    if (zz_lsbpos(u) == 1) {
+        *res = false;
         return ZZ_OK;
     }
+    if (!ISNEG(u) && zz_square_filter(u)) {
+        zz_err ret = zz_square_test(u, res);
 
-    zz_bitcnt_t lsbpos = zz_lsbpos(w);
-    zz_size_t n = w->size;
-    zz_t t1;
-
-    zz_init(&t1);
-    if (lsbpos) {
-        if (zz_quo_2exp(w, lsbpos, &t1)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&t1);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+        if (ret || *res) {
+            return ret;
         }
-        w = &t1;
     }
+    if (TMP_OVERFLOW) {
+        return ZZ_MEM;
+    }
+    *res = mpn_perfect_power_p(u->digits, ISNEG(u) ? -(mp_size_t)u->size
+                                                   : (mp_size_t)u->size);
+    return ZZ_OK;
+}
 
-    zz_size_t nodd = w->size;
-    zz_size_t neven = (zz_size_t)(lsbpos + ZZ_DIGIT_T_BITS - 1)/ZZ_DIGIT_T_BITS;
-    zz_size_t cnt = lsbpos % ZZ_DIGIT_T_BITS;
-    zz_size_t n_largest_binvert = MAX(neven, nodd);
-    zz_size_t itch_binvert = mpn_binvert_itch(n_largest_binvert);
-    zz_size_t itch = n + MAX(itch_binvert, 2*n);
+/* Combinatorial functions.  For arguments of at least the threshold of
+   zz_set_comb_threshold(), if several threads are allowed by
+   zz_set_mul_threads(), results are computed from the prime
+   factorization.  The exponent e_p of every prime p is known (see the
+   zz_comb_exp()), so the odd part of the result is
+
+       ((L_m^2 L_{m-1})^2 ...)^2 L_0,
+
+   where L_j is the product of odd primes with the bit j of e_p set.
+   Primes are packed in digits and leaves of ZZ_COMB_LEAF digits, and
+   each L_j is evaluated by the product tree of the zz_prod(), with
+   subtrees and big multiplications on several threads.  Otherwise, the
+   GMP is called, which is well tuned for a single thread.  It's faster
+   than above for one thread and the parallel speedup depends on the
+   machine, so by default the GMP is always used. */
+static uint64_t zz_comb_threshold = UINT64_MAX;
+#define ZZ_COMB_LEAF 16
+/* Sieving up to n takes n/16 bytes, while the zz_bin() result might be
+   much smaller.  Use the sieve for k at least n/ZZ_COMB_BIN_RATIO. */
+#define ZZ_COMB_BIN_RATIO 64
+
+typedef enum {
+    ZZ_COMB_FAC,
+    ZZ_COMB_FAC2,
+    ZZ_COMB_BIN,
+    ZZ_COMB_PRIMORIAL,
+} zz_comb_kind;
+
+/* Recent results are cached per thread, up to ZZ_COMB_CACHE_MAX of
+   them, if enabled by the zz_set_comb_cache().  A result for nearby
+   arguments is reused, if it's within ZZ_COMB_NEAR factors for
+   (double) factorials or ZZ_COMB_NEAR/4 steps of n or k for binomial
+   coefficients.  Digits are allocated with functions of the
+   zz_set_memory_funcs(), not with the current arena or pool. */
+#define ZZ_COMB_CACHE_MAX 64
+#define ZZ_COMB_NEAR 64
+
+typedef struct {
+    zz_comb_kind kind;
+    uint64_t n;
+    uint64_t k;
+    uint64_t stamp;
+    zz_size_t size;
+    zz_digit_t *digits;
+} zz_comb_entry;
+
+typedef struct {
+    size_t size;
+    uint64_t clock;
+    void (*free)(void *, size_t);
+    zz_comb_entry entries[ZZ_COMB_CACHE_MAX];
+} zz_comb_cache_t;
 
-    /* Now w factored as w * BASE**neven */
-    if (neven != 0) {
-        /* We will call both mpn_powm() and mpn_powlo() */
-        itch += 2*n;
+static _Thread_local zz_comb_cache_t zz_comb_cache;
+
+static void
+zz_comb_entry_clear(zz_comb_entry *e)
+{
+    if (e->digits) {
+        zz_comb_cache.free(e->digits, (size_t)e->size * ZZ_DIGIT_T_BYTES);
+        e->digits = NULL;
     }
+}
 
-    zz_digit_t *volatile tp = malloc((size_t)itch * sizeof(zz_digit_t));
-    zz_digit_t *volatile newup = NULL;
-    zz_digit_t *volatile newwp = NULL;
-    zz_digit_t *volatile rp = tp;
+void
+zz_comb_cache_clear(void)
+{
+    for (size_t j = 0; j < ZZ_COMB_CACHE_MAX; j++) {
+        zz_comb_entry_clear(&zz_comb_cache.entries[j]);
+    }
+}
 
-    if (!tp || TMP_OVERFLOW) {
-        /* LCOV_EXCL_START */
-clear:
-        free(rp);
-        free(newup);
-        free(newwp);
-        zz_clear(&t1);
-        zz_clear(res);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+zz_err
+zz_set_comb_cache(size_t size)
+{
+    if (size > ZZ_COMB_CACHE_MAX) {
+        return ZZ_VAL;
     }
-    tp += n;
-    /* Compute r = u**v mod w */
-    mpn_powm (rp, u->digits, u->size, v->digits, v->size,
-              w->digits, nodd, tp);
-    if (neven != 0) {
-        zz_digit_t *r2, *xp, *yp, *odd_inv_2exp, *up, *wp;
+    for (size_t j = size; j < ZZ_COMB_CACHE_MAX; j++) {
+        zz_comb_entry_clear(&zz_comb_cache.entries[j]);
+    }
+    zz_comb_cache.size = size;
+    return ZZ_OK;
+}
 
-        if (u->size < neven) {
-            /* Padd u with zeros. */
-            newup = malloc((size_t)neven * sizeof(zz_digit_t));
-            if (!newup) {
-                goto clear; /* LCOV_EXCL_LINE */
-            }
-            mpn_copyi(newup, u->digits, u->size);
-            mpn_zero(newup + u->size, neven - u->size);
-            up = newup;
-        }
-        else {
-            up = u->digits;
-        }
-        r2 = tp;
-        if (up[0] % 2 == 0) {
-            if (v->size > 1) {
-                mpn_zero(r2, neven);
-                goto zero;
-            }
-        }
-        /* Compute r2 = u**v mod BASE**neven */
-        mpn_powlo(r2, up, v->digits, v->size, neven, tp + neven);
-zero:
-        free(newup);
-        if (nodd < neven) {
-            /* Padd w with zeros */
-            newwp = malloc((size_t)neven * sizeof(zz_digit_t));
-            if (!newwp) {
-                goto clear; /* LCOV_EXCL_LINE */
-            }
-            mpn_copyi(newwp, w->digits, nodd);
-            mpn_zero(newwp + nodd, neven - nodd);
-            wp = newwp;
-            zz_clear(&t1);
-        }
-        else {
-            wp = w->digits;
-        }
-        odd_inv_2exp = tp + n;
-        /* odd_inv_2exp = w**(-1) mod BASE**neven */
-        mpn_binvert(odd_inv_2exp, wp, neven, tp + 2*n);
-        /* r2 = r2 - r */
-        mpn_sub(r2, r2, neven, rp, MIN(nodd, neven));
-        xp = tp + 2*n;
-        /* x = (odd_inv_2exp * r2) mod BASE**neven */
-        mpn_mullo_n(xp, odd_inv_2exp, r2, neven);
-        if (cnt) {
-            xp[neven - 1] &= ((mp_limb_t)1 << cnt) - 1;
-        }
-        yp = tp;
-        if (neven > nodd) {
-            mpn_mul(yp, xp, neven, wp, nodd);
-        }
-        else {
-            mpn_mul(yp, wp, nodd, xp, neven);
-        }
-        free(newwp);
-        /* r += x * w */
-        mpn_add(rp, yp, n, rp, nodd);
+zz_err
+zz_set_comb_threshold(uint64_t threshold)
+{
+    if (!threshold) {
+        return ZZ_VAL;
     }
-    zz_clear(&t1);
-    if (zz_resize(n, res)) {
-        /* LCOV_EXCL_START */
-        free(rp);
-        zz_clear(res);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+    zz_comb_threshold = threshold;
+    return ZZ_OK;
+}
+
+/* Set u to u*d. */
+static zz_err
+zz_comb_mul_digit(zz_t *u, zz_digit_t d)
+{
+    zz_size_t u_size = u->size;
+
+    if (zz_resize(u_size + 1, u)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    mpn_copyi(res->digits, rp, n);
-    free(rp);
-    zz_normalize(res);
+    u->digits[u_size] = mpn_mul_1(u->digits, u->digits, u_size, d);
+    zz_normalize(u);
+    return ZZ_OK;
+}
+
+/* Set u to u*m/d, that must be an integer. */
+static zz_err
+zz_comb_step(zz_t *u, uint64_t m, uint64_t d)
+{
+    if (zz_comb_mul_digit(u, m)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_divexact_1(u->digits, u->digits, u->size, d);
+    zz_normalize(u);
     return ZZ_OK;
 }
 
-zz_err
-zz_powm(const zz_t *u, const zz_t *v, const zz_t *w, zz_t *res)
+/* Return the distance between arguments of the cached result and
+   (n, k) or UINT64_MAX, if the entry can't be reused. */
+static uint64_t
+zz_comb_dist(const zz_comb_entry *e, zz_comb_kind kind, uint64_t n,
+             uint64_t k)
+{
+    if (!e->digits || e->kind != kind) {
+        return UINT64_MAX;
+    }
+    switch (kind) {
+    case ZZ_COMB_FAC:
+        return e->n <= n && n - e->n <= ZZ_COMB_NEAR ? n - e->n : UINT64_MAX;
+    case ZZ_COMB_FAC2:
+        return (e->n <= n && (n - e->n)%2 == 0
+                && n - e->n <= 2*ZZ_COMB_NEAR) ? n - e->n : UINT64_MAX;
+    case ZZ_COMB_BIN:
+    {
+        uint64_t d = (e->n < n ? n - e->n : e->n - n)
+                     + (e->k < k ? k - e->k : e->k - k);
+
+        return d <= ZZ_COMB_NEAR/4 ? d : UINT64_MAX;
+    }
+    default:
+        return e->n == n ? 0 : UINT64_MAX;
+    }
+}
+
+/* Set v to the result from the cache, computed for (n, k) or nearby
+   arguments.  Return ZZ_VAL, if there is no such result. */
+static zz_err
+zz_comb_cache_get(zz_comb_kind kind, uint64_t n, uint64_t k, zz_t *v)
 {
-    if (!w->size) {
+    zz_comb_cache_t *c = &zz_comb_cache;
+    zz_comb_entry *e = NULL;
+    uint64_t dist = UINT64_MAX;
+
+    for (size_t j = 0; j < c->size; j++) {
+        uint64_t d = zz_comb_dist(&c->entries[j], kind, n, k);
+
+        if (d < dist) {
+            dist = d;
+            e = &c->entries[j];
+        }
+    }
+    if (!e) {
         return ZZ_VAL;
     }
-    if (u == res) {
-        zz_t tmp;
+    e->stamp = ++c->clock;
+    if (zz_resize(e->size, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_copyi(v->digits, e->digits, e->size);
+    SETNEG(false, v);
 
-        if (zz_init(&tmp) || zz_pos(u, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+    uint64_t m = e->n, j = e->k;
+
+    if (kind == ZZ_COMB_BIN) {
+        /* Steps keep j <= m and nonzero divisors. */
+        for (; m < n; m++) {
+            if (zz_comb_step(v, m + 1, m + 1 - j)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+        }
+        for (; j > k; j--) {
+            if (zz_comb_step(v, j, m - j + 1)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+        }
+        for (; j < k; j++) {
+            if (zz_comb_step(v, m - j, j + 1)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+        }
+        for (; m > n; m--) {
+            if (zz_comb_step(v, m - j, m)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+        }
+        return ZZ_OK;
+    }
+
+    uint64_t step = kind == ZZ_COMB_FAC2 ? 2 : 1;
+    zz_digit_t word = 1;
+
+    for (m += step; m <= n; m += step) {
+        if (word > ZZ_DIGIT_T_MAX/m) {
+            if (zz_comb_mul_digit(v, word)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+            word = 1;
         }
+        word *= m;
+    }
+    return word == 1 ? ZZ_OK : zz_comb_mul_digit(v, word);
+}
 
-        zz_err ret = zz_powm(&tmp, v, w, res);
+/* Save v in the cache, replacing the least recently used result.
+   Failures are ignored. */
+static void
+zz_comb_cache_put(zz_comb_kind kind, uint64_t n, uint64_t k, const zz_t *v)
+{
+    zz_comb_cache_t *c = &zz_comb_cache;
+    zz_comb_entry *e = NULL;
 
-        zz_clear(&tmp);
-        return ret;
+    if (!c->size || !v->size) {
+        return;
     }
-    if (v == res) {
-        zz_t tmp;
+    if (c->free != zz_state.free) {
+        zz_comb_cache_clear();
+        c->free = zz_state.free;
+    }
+    for (size_t j = 0; j < c->size; j++) {
+        zz_comb_entry *t = &c->entries[j];
 
-        if (zz_init(&tmp) || zz_pos(v, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+        if (!t->digits || (t->kind == kind && t->n == n && t->k == k)) {
+            e = t;
+            break;
         }
+        if (!e || t->stamp < e->stamp) {
+            e = t;
+        }
+    }
+    zz_comb_entry_clear(e);
+    e->digits = zz_state.malloc((size_t)v->size * ZZ_DIGIT_T_BYTES);
+    if (!e->digits) {
+        return; /* LCOV_EXCL_LINE */
+    }
+    mpn_copyi(e->digits, v->digits, v->size);
+    e->size = v->size;
+    e->kind = kind;
+    e->n = n;
+    e->k = k;
+    e->stamp = ++c->clock;
+}
 
-        zz_err ret = zz_powm(u, &tmp, w, res);
+/* Return the exponent of the prime p in n!. */
+static uint64_t
+zz_legendre(uint64_t n, uint64_t p)
+{
+    uint64_t e = 0;
 
-        zz_clear(&tmp);
-        return ret;
+    while (n >= p) {
+        n /= p;
+        e += n;
     }
-    if (w == res) {
-        zz_t tmp;
+    return e;
+}
 
-        if (zz_init(&tmp) || zz_pos(w, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+/* Return the exponent of the prime p in the result.  For the double
+   factorial n!! = n!/(2**m m!), if n = 2*m + 1, or 2**m m!, if
+   n = 2*m. */
+static uint64_t
+zz_comb_exp(zz_comb_kind kind, uint64_t n, uint64_t k, uint64_t p)
+{
+    switch (kind) {
+    case ZZ_COMB_FAC:
+        return zz_legendre(n, p);
+    case ZZ_COMB_FAC2:
+        if (n%2) {
+            return p == 2 ? 0 : zz_legendre(n, p) - zz_legendre(n/2, p);
         }
+        return zz_legendre(n/2, p) + (p == 2 ? n/2 : 0);
+    case ZZ_COMB_BIN:
+        return zz_legendre(n, p) - zz_legendre(k, p)
+               - zz_legendre(n - k, p);
+    default:
+        return 1;
+    }
+}
 
-        zz_err ret = zz_powm(u, v, &tmp, res);
+/* Product of primes with a bit of the exponent set. */
+typedef struct {
+    zz_t *u;
+    size_t n;
+    size_t alloc;
+    zz_digit_t word;
+} zz_comb_level;
 
-        zz_clear(&tmp);
-        return ret;
+static void
+zz_comb_level_clear(zz_comb_level *l)
+{
+    for (size_t j = 0; j < l->n; j++) {
+        zz_clear(&l->u[j]);
     }
+    zz_mem_free(l->u, l->alloc*sizeof(zz_t));
+    l->u = NULL;
+    l->n = l->alloc = 0;
+}
 
-    int negativeOutput = 0;
-    zz_t o1, o2, o3;
-    zz_err ret = ZZ_OK;
+/* Multiply the last leaf (or a new one) by the packed word of primes.
+   Leaves are on the heap, so the array could be reallocated. */
+static zz_err
+zz_comb_level_flush(zz_comb_level *l)
+{
+    zz_digit_t word = l->word;
 
-    if (zz_init(&o1) || zz_init(&o2) || zz_init(&o3)) {
-        /* LCOV_EXCL_START */
-        zz_clear(&o1);
-        zz_clear(&o2);
-        zz_clear(&o3);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+    l->word = 1;
+    if (word == 1) {
+        return ZZ_OK;
     }
-    if (ISNEG(w)) {
-        if (zz_pos(w, &o3)) {
-            goto end; /* LCOV_EXCL_LINE */
-        }
-        negativeOutput = 1;
-        SETNEG(false, &o3);
-        w = &o3;
+    if (l->n && l->u[l->n - 1].size < ZZ_COMB_LEAF) {
+        return zz_comb_mul_digit(&l->u[l->n - 1], word);
     }
-    if (ISNEG(v)) {
-        if (zz_pos(v, &o2)) {
-            goto end; /* LCOV_EXCL_LINE */
-        }
-        SETNEG(false, &o2);
-        v = &o2;
+    if (l->n == l->alloc) {
+        size_t alloc = l->alloc ? 2*l->alloc : 16;
+        zz_t *u = (l->u ? zz_mem_realloc(l->u, l->alloc*sizeof(zz_t),
+                                         alloc*sizeof(zz_t))
+                   : zz_mem_malloc(alloc*sizeof(zz_t)));
 
-        if ((ret = zz_inverse(u, w, &o1)) == ZZ_MEM) {
-            goto end; /* LCOV_EXCL_LINE */
-        }
-        if (ret == ZZ_VAL) {
-end:
-            zz_clear(&o1);
-            zz_clear(&o2);
-            zz_clear(&o3);
-            return ZZ_VAL;
+        if (!u) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
-        u = &o1;
+        l->u = u;
+        l->alloc = alloc;
     }
-    if (ISNEG(u) || u->size > w->size) {
-        zz_t tmp;
 
-        if (zz_init(&tmp) || zz_div(u, w, NULL, &tmp)
-            || zz_pos(&tmp, &o1))
-        {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            goto end;
-            /* LCOV_EXCL_STOP */
-        }
-        zz_clear(&tmp);
-        u = &o1;
-    }
-    if (zz_cmp_i64(w, 1) == ZZ_EQ) {
-        ret = zz_set_i64(0, res);
-    }
-    else if (!v->size) {
-        ret = zz_set_i64(1, res);
-    }
-    else if (!u->size) {
-        ret = zz_set_i64(0, res);
-    }
-    else if (zz_cmp_i64(u, 1) == ZZ_EQ) {
-        ret = zz_set_i64(1, res);
-    }
-    else {
-        if (_zz_powm(u, v, w, res)) {
-            goto end; /* LCOV_EXCL_LINE */
-        }
+    zz_t *leaf = &l->u[l->n];
+
+    if (zz_init(leaf) || zz_resize(ZZ_COMB_LEAF, leaf)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    if (negativeOutput && !ret && res->size && zz_sub(res, w, res)) {
-        goto end; /* LCOV_EXCL_LINE */
+    leaf->size = 1;
+    leaf->digits[0] = word;
+    l->n++;
+    return ZZ_OK;
+}
+
+static zz_err
+zz_comb_level_mul(zz_comb_level *l, zz_digit_t p)
+{
+    if (l->word > ZZ_DIGIT_T_MAX/p && zz_comb_level_flush(l)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    zz_clear(&o1);
-    zz_clear(&o2);
-    zz_clear(&o3);
-    return ret;
+    l->word *= p;
+    return ZZ_OK;
 }
 
-zz_err
-zz_sqrtrem(const zz_t *u, zz_t *v, zz_t *w)
+#define ZZ_COMB_LEVELS 64
+#define SIEVE_TST(s, i) (((s)[(i)/64] >> ((i)%64)) & 1)
+
+static zz_err
+zz_comb_primes(zz_comb_kind kind, uint64_t n, uint64_t k, zz_t *v)
 {
-    if (ISNEG(u)) {
-        return ZZ_VAL;
+    /* The bit i of the sieve is set for composites 2*i + 1. */
+    size_t nbits = (size_t)(n/2 + 1), sieve_size = (nbits/64 + 1)*8;
+    uint64_t *sieve = zz_mem_malloc(sieve_size);
+    zz_comb_level levels[ZZ_COMB_LEVELS];
+    size_t nlevels = 0;
+    zz_err ret = ZZ_MEM;
+    zz_t r, l;
+
+    for (size_t j = 0; j < ZZ_COMB_LEVELS; j++) {
+        levels[j] = (zz_comb_level){NULL, 0, 0, 1};
     }
-    SETNEG(false, v);
-    if (!u->size) {
-        v->size = 0;
-        if (w) {
-            w->size = 0;
-            SETNEG(false, w);
+    if (zz_init(&r) || zz_init(&l) || !sieve) {
+        goto end; /* LCOV_EXCL_LINE */
+    }
+    memset(sieve, 0, sieve_size);
+    for (uint64_t p = 3; p <= n/p; p += 2) {
+        if (!SIEVE_TST(sieve, p/2)) {
+            for (uint64_t i = p*p/2; i < nbits; i += p) {
+                sieve[i/64] |= (uint64_t)1 << (i%64);
+            }
         }
-        return ZZ_OK;
     }
-    if (u == v) {
-        zz_t tmp;
-
-        if (zz_init(&tmp) || zz_pos(v, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+    for (uint64_t p = 3; p <= n; p += 2) {
+        if (SIEVE_TST(sieve, p/2)) {
+            continue;
+        }
+        for (uint64_t e = zz_comb_exp(kind, n, k, p), j = 0; e; e >>= 1, j++) {
+            if ((e & 1) && zz_comb_level_mul(&levels[j], p)) {
+                goto end; /* LCOV_EXCL_LINE */
+            }
+            nlevels = MAX(nlevels, j + 1);
         }
-
-        zz_err ret = zz_sqrtrem(&tmp, v, w);
-
-        zz_clear(&tmp);
-        return ret;
     }
-    if (zz_resize((u->size + 1)/2, v) || TMP_OVERFLOW) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    zz_mem_free(sieve, sieve_size);
+    sieve = NULL;
+    if (zz_set_i64(1, &r)) {
+        goto end; /* LCOV_EXCL_LINE */
     }
-    if (w) {
-        SETNEG(false, w);
-        if (zz_resize(u->size, w)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
+    while (nlevels--) {
+        zz_comb_level *lv = &levels[nlevels];
+
+        if (zz_comb_level_flush(lv) || zz_prod(lv->n, lv->u, &l)) {
+            goto end; /* LCOV_EXCL_LINE */
+        }
+        zz_comb_level_clear(lv);
+        if (zz_mul(&r, &r, &r) || zz_mul(&r, &l, &r)) {
+            goto end; /* LCOV_EXCL_LINE */
         }
-        w->size = (zz_size_t)mpn_sqrtrem(v->digits, w->digits, u->digits,
-                                         u->size);
     }
-    else {
-        mpn_sqrtrem(v->digits, NULL, u->digits, u->size);
+    ret = zz_mul_2exp(&r, zz_comb_exp(kind, n, k, 2), v);
+end:
+    for (size_t j = 0; j < ZZ_COMB_LEVELS; j++) {
+        zz_comb_level_clear(&levels[j]);
     }
-    return ZZ_OK;
+    zz_mem_free(sieve, sieve_size);
+    zz_clear(&r);
+    zz_clear(&l);
+    return ret;
 }
 
-zz_err
-zz_fac(uint64_t u, zz_t *v)
+static zz_err
+zz_comb_gmp(zz_comb_kind kind, uint64_t n, uint64_t k, zz_t *v)
 {
-#if ULONG_MAX < ZZ_DIGIT_T_MAX
-    if (u > ULONG_MAX) {
-        return ZZ_BUF;
-    }
-#endif
     if (TMP_OVERFLOW) {
         return ZZ_MEM;
     }
@@ -2638,39 +7389,76 @@ zz_fac(uint64_t u, zz_t *v)
     mpz_t z;
 
     mpz_init(z);
-    mpz_fac_ui(z, (unsigned long)u);
-    if (zz_set_mpz_t(z, v)) {
-        /* LCOV_EXCL_START */
-        mpz_clear(z);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
-    }
-    mpz_clear(z);
-    return ZZ_OK;
+    switch (kind) {
+    case ZZ_COMB_FAC:
+        mpz_fac_ui(z, (unsigned long)n);
+        break;
+    case ZZ_COMB_FAC2:
+        mpz_2fac_ui(z, (unsigned long)n);
+        break;
+    case ZZ_COMB_BIN:
+        mpz_bin_uiui(z, (unsigned long)n, (unsigned long)k);
+        break;
+    default:
+        mpz_primorial_ui(z, (unsigned long)n);
+    }
+    return zz_move_mpz_t(z, v);
 }
 
-zz_err
-zz_bin(uint64_t n, uint64_t k, zz_t *v)
+static zz_err
+zz_comb(zz_comb_kind kind, uint64_t n, uint64_t k, zz_t *v)
 {
 #if ULONG_MAX < ZZ_DIGIT_T_MAX
     if (n > ULONG_MAX || k > ULONG_MAX) {
         return ZZ_BUF;
     }
 #endif
-    if (TMP_OVERFLOW) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    if (kind == ZZ_COMB_BIN) {
+        if (k > n) {
+            return zz_set_i64(0, v);
+        }
+        k = MIN(k, n - k);
     }
 
-    mpz_t z;
+    zz_err ret = zz_comb_cache_get(kind, n, k, v);
 
-    mpz_init(z);
-    mpz_bin_uiui(z, (unsigned long)n, (unsigned long)k);
-    if (zz_set_mpz_t(z, v)) {
-        /* LCOV_EXCL_START */
-        mpz_clear(z);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+    if (ret != ZZ_VAL) {
+        return ret;
     }
-    mpz_clear(z);
-    return ZZ_OK;
+    if (zz_mul_params.threads > 1 && n >= zz_comb_threshold
+        && (kind != ZZ_COMB_BIN || k >= n/ZZ_COMB_BIN_RATIO))
+    {
+        ret = zz_comb_primes(kind, n, k, v);
+    }
+    else {
+        ret = zz_comb_gmp(kind, n, k, v);
+    }
+    if (ret == ZZ_OK) {
+        zz_comb_cache_put(kind, n, k, v);
+    }
+    return ret;
+}
+
+zz_err
+zz_fac(uint64_t u, zz_t *v)
+{
+    return zz_comb(ZZ_COMB_FAC, u, 0, v);
+}
+
+zz_err
+zz_fac2(uint64_t u, zz_t *v)
+{
+    return zz_comb(ZZ_COMB_FAC2, u, 0, v);
+}
+
+zz_err
+zz_bin(uint64_t n, uint64_t k, zz_t *v)
+{
+    return zz_comb(ZZ_COMB_BIN, n, k, v);
+}
+
+zz_err
+zz_primorial(uint64_t u, zz_t *v)
+{
+    return zz_comb(ZZ_COMB_PRIMORIAL, u, 0, v);
 }
@@ -29,11 +29,16 @@ typedef int64_t zz_size_t;
 typedef int32_t zz_size_t;
 #endif
 
+/* Number of digits, stored inside of the zz_t structure itself.  Values of
+   this size (or less) don't require heap allocation. */
+#define ZZ_SMALL_DIGITS 2
+
 typedef struct {
     bool negative;
     zz_size_t alloc;
     zz_size_t size;
     zz_digit_t *digits;
+    zz_digit_t small_digits[ZZ_SMALL_DIGITS];
 } zz_t;
 
 typedef enum {
@@ -43,11 +48,102 @@ typedef enum {
     ZZ_BUF = -3,
 } zz_err;
 
+/* Callbacks for streaming I/O.  The read function gets in *len space
+   available at data and sets it to the number of bytes read, 0 at the
+   end of input.  Errors are returned to the caller of the stream function
+   as is. */
+typedef zz_err (*zz_write_func)(void *ctx, const void *data, size_t len);
+typedef zz_err (*zz_read_func)(void *ctx, void *data, size_t *len);
+
 zz_err zz_setup(void);
 void zz_finish(void);
 
+void zz_set_memory_funcs(void *(*malloc) (size_t),
+                         void *(*realloc) (void *, size_t, size_t),
+                         void (*free) (void *, size_t));
+void zz_radix_cache_clear(void);
+zz_err zz_set_comb_cache(size_t size);
+void zz_comb_cache_clear(void);
+zz_err zz_set_comb_threshold(uint64_t threshold);
+zz_err zz_set_mul_threads(int threads, zz_size_t threshold);
+
+typedef enum {
+    ZZ_OP_ADD,
+    ZZ_OP_SUB,
+    ZZ_OP_MUL,
+    ZZ_OP_DIV,
+    ZZ_OP_POW,
+    ZZ_OP_POWM,
+    ZZ_OP_SQRTREM,
+    ZZ_OP_GCDEXT,
+    ZZ_OP_BITWISE,
+    ZZ_OP_SHIFT,
+    ZZ_OP_GET_STR,
+    ZZ_OP_SET_STR,
+    ZZ_OP_IMPORT,
+    ZZ_OP_EXPORT,
+    ZZ_OPS
+} zz_op;
+
+#define ZZ_STATS_BUCKETS 32
+
+typedef struct {
+    uint64_t calls[ZZ_OPS];
+    /* Calls by the size of the largest operand: the bucket k > 0 counts
+       sizes from 2**(k - 1) to 2**k - 1 digits (the last one - all
+       above), the bucket 0 - zero operands. */
+    uint64_t sizes[ZZ_OPS][ZZ_STATS_BUCKETS];
+    uint64_t resize_count;
+    uint64_t resize_bytes;
+    uint64_t tmp_count;
+    uint64_t tmp_bytes;
+    size_t tmp_peak;
+    uint64_t mem_errors;
+} zz_stats;
+
+zz_err zz_set_stats(bool enable);
+void zz_get_stats(zz_stats *stats);
+void zz_reset_stats(void);
+
+typedef struct {
+    struct zz_arena_block *head;
+    size_t block_size;
+    void *last;
+} zz_arena;
+
+zz_err zz_arena_init(size_t block_size, zz_arena *a);
+void zz_arena_reset(zz_arena *a);
+void zz_arena_clear(zz_arena *a);
+void zz_set_arena(zz_arena *a);
+
+#define ZZ_POOL_CLASSES 12
+
+typedef struct {
+    void *free_lists[ZZ_POOL_CLASSES];
+    void *large;
+    zz_arena slabs;
+} zz_pool;
+
+zz_err zz_pool_init(zz_pool *p);
+void zz_pool_clear(zz_pool *p);
+void zz_set_pool(zz_pool *p);
+
+typedef struct {
+    void *base;
+    size_t size;
+    size_t used;
+    size_t last;
+    size_t want;
+} zz_scratch;
+
+zz_err zz_scratch_init(size_t size, zz_scratch *s);
+void zz_scratch_clear(zz_scratch *s);
+void zz_set_scratch(zz_scratch *s);
+
 zz_err zz_init(zz_t *u);
 void zz_clear(zz_t *u);
+zz_err zz_reserve(zz_t *u, zz_size_t size);
+zz_err zz_shrink_to_fit(zz_t *u);
 
 zz_err zz_set_i32(int32_t u, zz_t *v);
 zz_err zz_set_i64(int64_t u, zz_t *v);
@@ -66,6 +162,7 @@ zz_err zz_set_double(double u, zz_t *v);
              double: zz_set_double)(U, V)
 
 zz_err zz_set_str(const char *str, int base, zz_t *u);
+zz_err zz_set_strn(const char *str, size_t len, int base, zz_t *u);
 
 zz_err zz_get_i32(const zz_t *u, int32_t *v);
 zz_err zz_get_i64(const zz_t *u, int64_t *v);
@@ -83,6 +180,11 @@ zz_err zz_get_double(const zz_t *u, double *d);
                                double *: zz_get_double))(U, V)
 
 zz_err zz_get_str(const zz_t *u, int base, char *str);
+zz_err zz_get_str_destructive(zz_t *u, int base, char *str);
+zz_err zz_get_str_size(const zz_t *u, int base, size_t *size);
+zz_err zz_set_str_stream(zz_read_func read, void *ctx, int base, zz_t *u);
+zz_err zz_get_str_stream(const zz_t *u, int base, zz_write_func write,
+                         void *ctx);
 
 zz_err zz_add(const zz_t *u, const zz_t *v, zz_t *w);
 zz_err zz_add_i64(const zz_t *u, int64_t v, zz_t *w);
@@ -98,10 +200,114 @@ zz_err zz_abs(const zz_t *u, zz_t *v);
 zz_err zz_mul(const zz_t *u, const zz_t *v, zz_t *w);
 zz_err zz_mul_i64(const zz_t *u, int64_t v, zz_t *w);
 zz_err zz_mul_u64(const zz_t *u, uint64_t v, zz_t *w);
+zz_err zz_addmul(const zz_t *u, const zz_t *v, zz_t *w);
+zz_err zz_addmul_i64(const zz_t *u, int64_t v, zz_t *w);
+zz_err zz_addmul_u64(const zz_t *u, uint64_t v, zz_t *w);
+zz_err zz_submul(const zz_t *u, const zz_t *v, zz_t *w);
+zz_err zz_submul_i64(const zz_t *u, int64_t v, zz_t *w);
+zz_err zz_submul_u64(const zz_t *u, uint64_t v, zz_t *w);
+zz_err zz_add_batch(size_t n, const zz_t *u, const zz_t *v, zz_t *w);
+zz_err zz_mul_batch(size_t n, const zz_t *u, const zz_t *v, zz_t *w);
 zz_err zz_div(const zz_t *u, const zz_t *v, zz_t *q, zz_t *r);
 zz_err zz_div_i64(const zz_t *u, int64_t v, zz_t *q, zz_t *r);
 zz_err zz_i64_div(int64_t u, const zz_t *v, zz_t *q, zz_t *r);
 
+/* Inline fast paths for integers of one digit, falling back to above
+   functions for bigger values, for overflow and for views as outputs.
+   Macros below and the dispatch for integer arguments use them. */
+static inline bool
+zz_inline_get_i64(const zz_t *u, int64_t *v)
+{
+    if (u->size > 1 || (u->size && u->digits[0] > INT64_MAX)) {
+        return false;
+    }
+    *v = u->size ? (int64_t)u->digits[0] : 0;
+    if (u->negative) {
+        *v = -*v;
+    }
+    return true;
+}
+
+static inline bool
+zz_inline_set_i64(int64_t u, zz_t *v)
+{
+    if (v->alloc <= 0) {
+        return false;
+    }
+    v->negative = u < 0;
+    v->digits[0] = u < 0 ? -(zz_digit_t)u : (zz_digit_t)u;
+    v->size = u != 0;
+    return true;
+}
+
+static inline zz_err
+zz_inline_add_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+#if defined(__GNUC__)
+    int64_t r;
+
+    if (zz_inline_get_i64(u, &r) && !__builtin_add_overflow(r, v, &r)
+        && zz_inline_set_i64(r, w))
+    {
+        return ZZ_OK;
+    }
+#endif
+    return zz_add_i64(u, v, w);
+}
+
+static inline zz_err
+zz_inline_sub_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+#if defined(__GNUC__)
+    int64_t r;
+
+    if (zz_inline_get_i64(u, &r) && !__builtin_sub_overflow(r, v, &r)
+        && zz_inline_set_i64(r, w))
+    {
+        return ZZ_OK;
+    }
+#endif
+    return zz_sub_i64(u, v, w);
+}
+
+static inline zz_err
+zz_inline_mul_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+#if defined(__GNUC__)
+    int64_t r;
+
+    if (zz_inline_get_i64(u, &r) && !__builtin_mul_overflow(r, v, &r)
+        && zz_inline_set_i64(r, w))
+    {
+        return ZZ_OK;
+    }
+#endif
+    return zz_mul_i64(u, v, w);
+}
+
+static inline zz_err
+zz_inline_mul_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+#if defined(__GNUC__)
+    uint64_t r;
+
+    if (u->size <= 1 && w->alloc > 0
+        && !__builtin_mul_overflow(u->size ? u->digits[0] : 0, v, &r))
+    {
+        w->negative = u->negative && r;
+        w->digits[0] = r;
+        w->size = r != 0;
+        return ZZ_OK;
+    }
+#endif
+    return zz_mul_u64(u, v, w);
+}
+
+#define zz_add_i64(U, V, W) zz_inline_add_i64(U, V, W)
+#define zz_sub_i64(U, V, W) zz_inline_sub_i64(U, V, W)
+#define zz_mul_i64(U, V, W) zz_inline_mul_i64(U, V, W)
+#define zz_mul_u64(U, V, W) zz_inline_mul_u64(U, V, W)
+
 static inline zz_err
 zz_i64_add(int64_t u, const zz_t *v, zz_t *w)
 {
@@ -141,9 +347,9 @@ zz_u64_mul(uint64_t u, const zz_t *v, zz_t *w)
              unsigned long long: _Generic((V),                  \
                                           default: zz_u64_add), \
              default: _Generic((V),                             \
-                               int: zz_add_i64,                 \
-                               long: zz_add_i64,                \
-                               long long: zz_add_i64,           \
+                               int: zz_inline_add_i64,          \
+                               long: zz_inline_add_i64,         \
+                               long long: zz_inline_add_i64,    \
                                unsigned int: zz_add_u64,        \
                                unsigned long: zz_add_u64,       \
                                unsigned long long: zz_add_u64,  \
@@ -163,35 +369,55 @@ zz_u64_mul(uint64_t u, const zz_t *v, zz_t *w)
              unsigned long long: _Generic((V),                  \
                                           default: zz_u64_sub), \
              default: _Generic((V),                             \
-                               int: zz_sub_i64,                 \
-                               long: zz_sub_i64,                \
-                               long long: zz_sub_i64,           \
+                               int: zz_inline_sub_i64,          \
+                               long: zz_inline_sub_i64,         \
+                               long long: zz_inline_sub_i64,    \
                                unsigned int: zz_sub_u64,        \
                                unsigned long: zz_sub_u64,       \
                                unsigned long long: zz_sub_u64,  \
                                default: zz_sub))(U, V, W)
-#define zz_mul(U, V, W)                                         \
-    _Generic((U),                                               \
-             int: _Generic((V),                                 \
-                           default: zz_i64_mul),                \
-             long: _Generic((V),                                \
-                            default: zz_i64_mul),               \
-             long long: _Generic((V),                           \
-                                 default: zz_i64_mul),          \
-             unsigned int: _Generic((V),                        \
-                                    default: zz_u64_mul),       \
-             unsigned long: _Generic((V),                       \
-                                     default: zz_u64_mul),      \
-             unsigned long long: _Generic((V),                  \
-                                          default: zz_u64_mul), \
-             default: _Generic((V),                             \
-                               int: zz_mul_i64,                 \
-                               long: zz_mul_i64,                \
-                               long long: zz_mul_i64,           \
-                               unsigned int: zz_mul_u64,        \
-                               unsigned long: zz_mul_u64,       \
-                               unsigned long long: zz_mul_u64,  \
+#define zz_mul(U, V, W)                                               \
+    _Generic((U),                                                     \
+             int: _Generic((V),                                       \
+                           default: zz_i64_mul),                      \
+             long: _Generic((V),                                      \
+                            default: zz_i64_mul),                     \
+             long long: _Generic((V),                                 \
+                                 default: zz_i64_mul),                \
+             unsigned int: _Generic((V),                              \
+                                    default: zz_u64_mul),             \
+             unsigned long: _Generic((V),                             \
+                                     default: zz_u64_mul),            \
+             unsigned long long: _Generic((V),                        \
+                                          default: zz_u64_mul),       \
+             default: _Generic((V),                                   \
+                               int: zz_inline_mul_i64,                \
+                               long: zz_inline_mul_i64,               \
+                               long long: zz_inline_mul_i64,          \
+                               unsigned int: zz_inline_mul_u64,       \
+                               unsigned long: zz_inline_mul_u64,      \
+                               unsigned long long: zz_inline_mul_u64, \
                                default: zz_mul))(U, V, W)
+#define zz_addmul(U, V, W)                                        \
+    _Generic((U),                                                 \
+             default: _Generic((V),                               \
+                               int: zz_addmul_i64,                \
+                               long: zz_addmul_i64,               \
+                               long long: zz_addmul_i64,          \
+                               unsigned int: zz_addmul_u64,       \
+                               unsigned long: zz_addmul_u64,      \
+                               unsigned long long: zz_addmul_u64, \
+                               default: zz_addmul))(U, V, W)
+#define zz_submul(U, V, W)                                        \
+    _Generic((U),                                                 \
+             default: _Generic((V),                               \
+                               int: zz_submul_i64,                \
+                               long: zz_submul_i64,               \
+                               long long: zz_submul_i64,          \
+                               unsigned int: zz_submul_u64,       \
+                               unsigned long: zz_submul_u64,      \
+                               unsigned long long: zz_submul_u64, \
+                               default: zz_submul))(U, V, W)
 #define zz_div(U, V, Q, R)                                   \
     _Generic((U),                                            \
              int: _Generic((V),                              \
@@ -206,9 +432,65 @@ zz_u64_mul(uint64_t u, const zz_t *v, zz_t *w)
                                long long: zz_div_i64,        \
                                default: zz_div))(U, V, Q, R)
 
+typedef struct {
+    zz_t d;
+    int shift;
+    zz_digit_t inv;
+    zz_digit_t cps[7];
+    zz_digit_t *norm;
+} zz_divisor;
+
+zz_err zz_divisor_init(const zz_t *d, zz_divisor *dv);
+void zz_divisor_clear(zz_divisor *dv);
+zz_err zz_div_pre(const zz_t *u, const zz_divisor *dv, zz_t *q, zz_t *r);
+zz_err zz_div_batch(size_t n, const zz_t *u, const zz_divisor *dv, zz_t *q,
+                    zz_t *r);
+zz_err zz_mod_u64(const zz_t *u, uint64_t v, uint64_t *w);
+
 zz_err zz_pow(const zz_t *u, uint64_t v, zz_t *w);
 zz_err zz_powm(const zz_t *u, const zz_t *v, const zz_t *w, zz_t *x);
 
+typedef struct {
+    zz_t mod;
+    bool negative;
+    zz_bitcnt_t shift;
+    zz_size_t odd_size;
+    zz_digit_t *odd;
+    zz_digit_t *inv;
+    zz_digit_t *r2;
+    zz_digit_t *inv_2exp;
+    zz_digit_t *scratch;
+    size_t alloc;
+    zz_digit_t *sec_scratch;
+    size_t sec_alloc;
+} zz_mod_ctx;
+
+zz_err zz_mod_ctx_init(const zz_t *m, zz_mod_ctx *ctx);
+void zz_mod_ctx_clear(zz_mod_ctx *ctx);
+zz_err zz_powm_ctx(const zz_t *u, const zz_t *v, zz_mod_ctx *ctx, zz_t *w);
+zz_err zz_mulmod_ctx(const zz_t *u, const zz_t *v, zz_mod_ctx *ctx,
+                     zz_t *w);
+zz_err zz_redc(const zz_t *u, zz_mod_ctx *ctx, zz_t *w);
+
+typedef struct {
+    zz_mod_ctx *ctx;
+    zz_t base;
+    zz_bitcnt_t bits;
+    zz_bitcnt_t teeth;
+    zz_digit_t *table;
+    size_t alloc;
+} zz_powm_table;
+
+zz_err zz_powm_table_init(const zz_t *u, zz_bitcnt_t bits, zz_mod_ctx *ctx,
+                          zz_powm_table *tab);
+void zz_powm_table_clear(zz_powm_table *tab);
+zz_err zz_powm_fixed(const zz_t *v, zz_powm_table *tab, zz_t *w);
+zz_err zz_powm_multi(size_t n, const zz_t *u, const zz_t *v, zz_mod_ctx *ctx,
+                     zz_t *w);
+zz_err zz_powm_sec(const zz_t *u, const zz_t *v, zz_mod_ctx *ctx, zz_t *w);
+zz_err zz_inverse_sec(const zz_t *u, zz_mod_ctx *ctx, zz_t *w);
+zz_err zz_inverse_batch(size_t n, const zz_t *u, zz_mod_ctx *ctx, zz_t *w);
+
 typedef enum {
     ZZ_GT = +1,
     ZZ_EQ = 0,
@@ -217,28 +499,87 @@ typedef enum {
 
 zz_ord zz_cmp(const zz_t *u, const zz_t *v);
 zz_ord zz_cmp_i64(const zz_t *u, int64_t v);
+void zz_cmp_batch(size_t n, const zz_t *u, const zz_t *v, zz_ord *r);
+
+static inline zz_ord
+zz_inline_cmp_i64(const zz_t *u, int64_t v)
+{
+    zz_ord res = u->negative ? ZZ_LT : ZZ_GT;
+
+    if (u->negative != (v < 0) || u->size > 1) {
+        return res;
+    }
+    if (!u->size) {
+        return v ? -res : ZZ_EQ;
+    }
+
+    zz_digit_t uu = u->digits[0], uv = v < 0 ? -(zz_digit_t)v : (zz_digit_t)v;
+
+    if (uu == uv) {
+        return ZZ_EQ;
+    }
+    return uu > uv ? res : -res;
+}
 
-#define zz_cmp(U, V)                                   \
-    _Generic((U),                                      \
-             default: _Generic((V),                    \
-                               int: zz_cmp_i64,        \
-                               long: zz_cmp_i64,       \
-                               long long: zz_cmp_i64,  \
+#define zz_cmp_i64(U, V) zz_inline_cmp_i64(U, V)
+
+#define zz_cmp(U, V)                                         \
+    _Generic((U),                                            \
+             default: _Generic((V),                          \
+                               int: zz_inline_cmp_i64,       \
+                               long: zz_inline_cmp_i64,      \
+                               long long: zz_inline_cmp_i64, \
                                default: zz_cmp))(U, V)
 
 zz_err zz_invert(const zz_t *u, zz_t *v);
 zz_err zz_and(const zz_t *u, const zz_t *v, zz_t *w);
 zz_err zz_or(const zz_t *u, const zz_t *v, zz_t *w);
 zz_err zz_xor(const zz_t *u, const zz_t *v, zz_t *w);
+bool zz_tstbit(const zz_t *u, zz_bitcnt_t idx);
+zz_err zz_setbit(zz_t *u, zz_bitcnt_t idx);
+zz_err zz_clrbit(zz_t *u, zz_bitcnt_t idx);
+zz_err zz_combit(zz_t *u, zz_bitcnt_t idx);
+
+static inline bool
+zz_inline_tstbit(const zz_t *u, zz_bitcnt_t idx)
+{
+    if (u->negative) {
+        return (zz_tstbit)(u, idx);
+    }
+    return (idx/64 < (zz_bitcnt_t)u->size
+            && (u->digits[idx/64] >> idx%64) & 1);
+}
+
+#define zz_tstbit(U, IDX) zz_inline_tstbit(U, IDX)
+
 zz_err zz_mul_2exp(const zz_t *u, zz_bitcnt_t v, zz_t *w);
 zz_err zz_quo_2exp(const zz_t *u, zz_bitcnt_t v, zz_t *w);
 
 zz_err zz_sqrtrem(const zz_t *u, zz_t *v, zz_t *w);
+zz_err zz_rootrem(const zz_t *u, uint64_t k, zz_t *v, zz_t *w);
+zz_err zz_is_square(const zz_t *u, bool *res);
+zz_err zz_is_perfect_power(const zz_t *u, bool *res);
 zz_err zz_gcdext(const zz_t *u, const zz_t *v, zz_t *g, zz_t *s, zz_t *t);
+zz_err zz_inverse(const zz_t *u, const zz_t *v, zz_t *w);
 zz_err zz_lcm(const zz_t *u, const zz_t *v, zz_t *w);
 
+typedef struct {
+    size_t n;
+    size_t nlevels;
+    zz_t *nodes;
+    zz_t *coeffs;
+} zz_prodtree;
+
+zz_err zz_prod(size_t n, const zz_t *u, zz_t *w);
+zz_err zz_prodtree_init(size_t n, const zz_t *m, zz_prodtree *tree);
+void zz_prodtree_clear(zz_prodtree *tree);
+zz_err zz_remtree(const zz_t *u, const zz_prodtree *tree, zz_t *w);
+zz_err zz_crt(const zz_t *u, zz_prodtree *tree, zz_t *w);
+
 zz_err zz_fac(uint64_t u, zz_t *v);
+zz_err zz_fac2(uint64_t u, zz_t *v);
 zz_err zz_bin(uint64_t n, uint64_t k, zz_t *v);
+zz_err zz_primorial(uint64_t u, zz_t *v);
 
 typedef struct {
     uint8_t bits_per_digit;
@@ -251,6 +592,13 @@ const zz_layout * zz_get_layout(void);
 
 zz_err zz_import(size_t len, const void *data, zz_layout layout, zz_t *u);
 zz_err zz_export(const zz_t *u, zz_layout layout, size_t len, void *data);
+zz_err zz_view(size_t len, const void *data, zz_t *u);
+zz_err zz_adopt(size_t len, size_t alloc, void *data, zz_t *u);
+
+zz_err zz_import_stream(zz_read_func read, void *ctx, zz_layout layout,
+                        zz_t *u);
+zz_err zz_export_stream(const zz_t *u, zz_layout layout, zz_write_func write,
+                        void *ctx);
 
 zz_err zz_sizeinbase(const zz_t *u, int base, size_t *size);
 zz_bitcnt_t zz_bitlen(const zz_t *u);
@@ -260,6 +608,28 @@ bool zz_iszero(const zz_t *u);
 bool zz_isneg(const zz_t *u);
 bool zz_isodd(const zz_t *u);
 
+static inline bool
+zz_inline_iszero(const zz_t *u)
+{
+    return u->size == 0;
+}
+
+static inline bool
+zz_inline_isneg(const zz_t *u)
+{
+    return u->negative;
+}
+
+static inline bool
+zz_inline_isodd(const zz_t *u)
+{
+    return u->size && u->digits[0] & 1;
+}
+
+#define zz_iszero(U) zz_inline_iszero(U)
+#define zz_isneg(U) zz_inline_isneg(U)
+#define zz_isodd(U) zz_inline_isodd(U)
+
 size_t zz_sizeof(const zz_t *u);
 
 const char * zz_get_version(void);